@@ -667,7 +667,9 @@
 enum analyzer_state{
         ANALYZER_IDLE = 0,
         ANALYZER_ACQUIRING = 1,
-        ANALYZER_ACQUISITION_DONE = 2
+        ANALYZER_ACQUISITION_DONE = 2,
+        ANALYZER_STREAMING = 3,             //  States from ANALYZER_STREAMING up store samples in LA_Stream_Ring[]
+        ANALYZER_DEEP_ACQUIRING = 4
         };
 
 
@@ -776,6 +778,30 @@ enum machine_numbers{
 #define HP86_87_CRTDAT  (0177703)       //  CRT DATA            HP86/87
 #define HEYEBTKS        (0177740)       //  Mailbox alert for AUXROM Functions. ()
 
+//
+//  CRTSTS Read bit functions, HP86 and HP87. The CRT library is in EBTKS_CRT.cpp
+//
+#define CRTSTS87_GRAPH      (1 << 7)        //  1 = graphics mode, 0 = alpha mode
+#define CRTSTS87_MODE       (1 << 6)        //  0 = normal graphics 400 pixels/line/ 1 = graph all 544 pixels/line
+#define CRTSTS87_INV        (1 << 5)        //  1 = inverse, 0 = normal
+#define CRTSTS87_ALPHA      (1 << 3)        //  1 = 24 lines of alpha (10 pixels per char height), 0 = 16 lines (15 pixels height)
+#define CRTSTS87_PWRD       (1 << 2)        //  1 = powerdown,0 = normal operation
+#define CRTSTS87_BLANK      (1 << 1)        //  1 = screen blanked. when blanked, you get higher speed memory access
+#define CRTSTS87_BUSY       (1 << 0)        //  1 = CRT controller is busy
+
+//
+//  CRTSTS Read bit functions, HP83, HP85A/B, and 9915A/B. See HP85 Assembler manual, PDF page 273
+//
+#define CRTSTS85_GRAPH        (error)       //  Can't read this status
+#define CRTSTS85_MODE         (error)       //  There is no mode bit
+#define CRTSTS85_INV          (error)       //  There is no invert bit
+#define CRTSTS85_ALPHA        (error)       //  Only 1 character height
+#define CRTSTS85_PWRD         (error)       //  Can't read this status
+#define CRTSTS85_BLANK        (error)       //  There is no blank bit
+#define CRTSTS85_BUSY         (1 << 7)      //  1 = CRT controller is busy
+#define CRTSTS85_DISPLAY_TIME (1 << 1)      //  1 = CRT Controller is sending pixels to CRT (not retrace time)
+#define CRTSTS85_DATA_READY   (1 << 0)      //  Requested data to be read from CRT RAM is now available.  (we could super duper speed this up by just reading our local copy, if we trust it)
+
 //
 //  HP-85 RAM Mirrors for some Standard I/O registers
 //
@@ -104,25 +104,40 @@
 //    Extended Memory Controller
 //
 #define ENABLE_EMC_SUPPORT                (1)
-#define EMC_MAX_BANKS                     (8)             //  Pre allocate 256kB for EMC Memory
-#define EMC_RAM_SIZE                      (EMC_MAX_BANKS * 32768)
+#define EMC_BANK_SIZE                     (32768)
+#define EMC_MAX_BANKS                     (32)            //  1 MB of EMC Memory, in PSRAM (EXTMEM)
+#define EMC_RAM_SIZE                      (EMC_MAX_BANKS * EMC_BANK_SIZE)
 
-#define ENABLE_TRACE_EMC                  (0)
-#if ENABLE_TRACE_EMC
-#define EMC_DIAG_BUF_SIZE                 (2048)
-#endif
+//
+//    The EMC backing store is in PSRAM, which is much slower than the on chip RAM when the data cache
+//    misses, so the ISR never touches it. EMC_CACHE_BANKS banks are copied into DMAMEM, and the ISR
+//    accesses them there. When an EMC pointer gets within EMC_HOLD_MARGIN bytes of a bank that is not
+//    cached, the ISR holds the HP-85 with HALT until loop() has brought it in, replacing the least
+//    recently used bank. See EBTKS_EMC_Cache.cpp. "PSRAM": false in the EMC section of CONFIG.TXT (or no
+//    PSRAM) limits EMC to EMC_CACHE_BANKS banks, all held in the cache.
+//
+#define EMC_CACHE_BANKS                   (8)             //  256 kB of DMAMEM, as before the PSRAM store
+#define EMC_CACHE_POLL_MS                 (10)            //  How often the cache notes which banks were used
+#define EMC_HOLD_MARGIN                   (16)            //  Bytes. More than one instruction can move a pointer (8)
 
-//      At most one of ENABLE_TRACE_EMC and ENABLE_TRACE_PTR2 can be enabled, or both can be disabled. See commit #120
-#define ENABLE_TRACE_PTR2                 (0)
+//
+//    EMC snapshots ("emc save", "emc load", AUXCMD usage 31 and 32, and "Restore" in the EMC section
+//    of CONFIG.TXT). See EBTKS_EMC_Snapshot.cpp
+//
+#define ENABLE_EMC_SNAPSHOT               (1)             //  Requires ENABLE_EMC_SUPPORT
+#define EMC_SNAPSHOT_FILENAME             "/EMC_Snapshot.bin"
+#define EMC_SNAPSHOT_BLOCK                (256)           //  Zero runs are skipped in blocks of this many bytes
+#define EMC_SNAPSHOT_RETRIES              (3)             //  "emc save" retries if the HP-85 writes to EMC while saving
 
-#if ENABLE_TRACE_PTR2
-#if ENABLE_TRACE_EMC
-#error "ENABLE_TRACE_EMC and ENABLE_TRACE_PTR2 can not both be enabled"
-#endif
-#define EMC_PTR2_BUF_SIZE                 (512)
-#define EMC_PTR2_TRACE_WINDOW_LOW         (47800)
-#define EMC_PTR2_TRACE_WINDOW_HIGH        (48200)
-#endif
+//
+//    EMC tracing ("emc trace ..."), switched on and off at run time. See EBTKS_EMC_Trace.cpp.
+//    The ring is EMC_TRACE_RING_SIZE events of 16 bytes, in DMAMEM. Must be a power of 2. 512 events is 8 kB,
+//    which RAM2 can spare (88,384 bytes free without it, 80,192 with it). While tracing is off, each EMC
+//    access costs one predictable branch
+//
+#define ENABLE_EMC_TRACE                  (1)             //  Requires ENABLE_EMC_SUPPORT
+#define EMC_TRACE_RING_SIZE               (512)
+#define EMC_TRACE_FILENAME                "/EMC_Trace.bin"
 
 //
 //    Tracking the CRT activity. Can be used to dump to a remote file or printer, and
@@ -131,6 +146,73 @@
 
 #define DUMP_HEIGHT (16)
 
+//
+//    Largest compressed screen export from dumpCrtAlphaAsBase64(). The Base64 of this many bytes fits the 4096 byte
+//    reply buffer of EBTKS_ESP.h. A graphics screen that doesn't compress to this size is not sent, the remote
+//    display gets it from "get_delta" instead (see EBTKS_CRT_Stream.cpp)
+//
+#define CRT_EXPORT_MAX_BYTES              (3072)
+
+//
+//    Dirty tracking for the mirrored CRT memory, see CRT_Dirty_Take() in EBTKS_CRT.cpp. One bit per block of
+//    current_screen.vram. A block is an alpha row, which is also a graphics scan line, on the HP83/85/9915
+//    (32 bytes), and an alpha row, a bit more than one graphics scan line, on the HP86/87 (80 bytes)
+//
+#define CRT_DIRTY_BLOCK_85                (32)
+#define CRT_DIRTY_BLOCK_8687              (80)
+#define CRT_DIRTY_BLOCKS                  (256)           //  Enough for 8 kB / 32, and 16 kB / 80
+#define CRT_DIRTY_WORDS                   (CRT_DIRTY_BLOCKS / 32)
+
+//
+//    CRT block writes, see CRT_Write_Span_with_DMA_Active() in EBTKS_CRT.cpp, and "crt bench". A write to CRTDAT
+//    while the controller is busy is lost, so the status is still read before every write, but the reads are
+//    spaced so that most writes need only one. CRT_restore_screen() only writes the bytes that differ from
+//    the mirror in current_screen, unless CRT_RESTORE_CHANGED_ONLY is 0
+//
+#define CRT_SPAN_SETTLE_NS                (1500)          //  The controller is busy for at least this long after a write
+#define CRT_SPAN_BUSY_POLL_NS             (1000)          //  Status poll interval while busy
+#define CRT_SPAN_DISPLAY_POLL_NS          (20000)         //  HP83/85/9915 poll interval while busy in display time (12.85 ms)
+#define CRT_SPAN_MERGE_GAP                (4)             //  Rewrite unchanged runs shorter than this, rather than write CRTBAD again
+#define CRT_SPAN_BLANK_8687_MIN           (0)             //  HP86/87 restores of at least this many bytes blank the screen while
+                                                          //  they run, for faster access (1024 is a good start). 0 to never
+                                                          //  blank, the default, as the screen flashes on every big restore
+#define CRT_RESTORE_CHANGED_ONLY          (1)
+
+//
+//    Incremental screen stream for the remote display ("get_delta" from the ESP32), see EBTKS_CRT_Stream.cpp.
+//    A frame carries the changed blocks of current_screen.vram, LZS compressed in runs of up to
+//    CRT_STREAM_RUN_BYTES. Frames are at most CRT_STREAM_FRAME_MAX bytes, so the Base64 fits in the
+//    4096 byte reply buffer of EBTKS_ESP.h. Whatever doesn't fit goes in the next frame
+//
+#define ENABLE_CRT_STREAM                 (1)
+#define CRT_STREAM_FRAME_MAX              (3000)
+#define CRT_STREAM_RUN_BYTES              (1024)
+
+//
+//    Screenshots ("screenshot [FILE]", AUXCMD usage 33). The screen is rendered straight from current_screen
+//    to a PBM file SCREENSHOT_ROWS_PER_POLL pixel rows per call of Screenshot_Poll() from loop(), so tape
+//    and disk polling are never held up for long. See EBTKS_Screenshot.cpp and EBTKS_CRT_Render.cpp
+//
+#define ENABLE_SCREENSHOT                 (1)
+#define SCREENSHOT_FILENAME               "/Screenshot.pbm"
+#define SCREENSHOT_ROWS_PER_POLL          (8)             //  At most 8 x 80 bytes rendered and written per call
+
+//
+//    CRT recorder ("crt record start [FILE]", "crt record stop", "crt record"). While it is on, every write to the
+//    CRT registers goes into a DTCM ring of CRT_RECORD_ISR_RING_SIZE 12 byte events (3 kB), with a cycle count time
+//    stamp. CRT_Record_Poll() in loop() moves them on to a ring of CRT_RECORD_RING_SIZE events (24 kB of EXTMEM),
+//    and writes them to the SD Card, about 4 bytes each. Both sizes must be a power of 2
+//    tools/crt_stream/crt_replay turns a recording back into screens. See EBTKS_CRT_Record.cpp
+//    Recording needs PSRAM
+//
+#ifndef ENABLE_CRT_RECORD
+#define ENABLE_CRT_RECORD                 (1)
+#endif
+#define CRT_RECORD_ISR_RING_SIZE          (256)
+#define CRT_RECORD_RING_SIZE              (2048)
+#define CRT_RECORD_FILENAME               "/CRT_Record.bin"
+#define CRT_RECORD_SYNC_MS                (2000)          //  Write and flush the file at least this often, so a recording survives a power off
+
 //
 //    Support for DMA transfers.
 //    While this hardware could do continuous DMA cycles, this would impact the
@@ -144,9 +226,40 @@
 //    times 1/1.6 us . i.e. 15/(15+3) gives 520 K Bytes per second, approximately
 //
 
+//    These are the defaults. The "DMA" section of CONFIG.TXT can set a different burst length and
+//    break for each machine type, "dma bench" measures what works. See EBTKS_DMA_Bench.cpp
+//
+
 #define MAX_DMA_TRANSFER_LENGTH           (256)
 #define MAX_DMA_BURST_LENGTH              (15)
 #define DMA_BURST_BREAK_CYCLES            (3)
+#define DMA_BURST_LENGTH_LIMIT            (64)            //  Longest burst that "dma bench long" tries
+#define DMA_BURST_REFRESH_LIMIT           (18)            //  Two refresh periods. Longer bursts can drop a refresh. CONFIG.TXT and "dma bench" stop here
+
+#define ENABLE_DMA_BENCH                  (1)
+#define DMA_BENCH_SCRATCH_SIZE            (256)           //  Bytes of free HP-85 RAM that "dma bench" writes patterns to, 64 per bus acquisition
+#define DMA_BENCH_PASSES                  (64)            //  Read back passes per burst length. Long bursts that starve refresh show up as errors
+#define DMA_SESSION_MAX_SEGMENTS          (16)            //  A DMA session runs early if more segments are added, see EBTKS_DMA.cpp
+
+//
+//    Queued DMA, serviced from loop(), so background code doesn't wait for the bus. See EBTKS_DMA_Queue.cpp
+//
+#define ENABLE_DMA_QUEUE                  (1)
+#define DMA_QUEUE_LENGTH                  (32)            //  Jobs. Enough for the boot messages to be queued without waiting
+#define DMA_QUEUE_BUDGET                  (MAX_DMA_TRANSFER_LENGTH)   //  Bytes per bus acquisition
+#define DMA_JOB_DATA_SIZE                 (80)            //  Short writes and CRT text are copied into the job
+
+//
+//    Shadow copy of HP-85 main RAM. The bus ISR queues every RAM write cycle in a DTCM FIFO, loop() applies
+//    them to the shadow, and it is seeded by DMA once the HP-85 is idle after boot. hp85_read(), DMA_Peek8()
+//    and DMA_Peek16() then read RAM from the shadow, with no bus cycles. See EBTKS_HP85_Shadow.cpp
+//    The 32 kB shadow is in EXTMEM, as RAM2 has no room for it, and is only used if PSRAM is fitted. The ISR
+//    never touches the PSRAM. If the FIFO overflows, the shadow is invalidated and seeded again
+//
+#define ENABLE_HP85_RAM_SHADOW            (1)
+#define HP85_SHADOW_BASE                  (0100000)
+#define HP85_SHADOW_SIZE                  (0077400)       //  0100000 to 0177377, up to the I/O page
+#define HP85_SHADOW_FIFO_SIZE             (2048)          //  4 byte writes, 8 kB of DTCM. Over 3 ms, even if every bus cycle wrote RAM. Power of 2
 
 #define SERIAL_STRING_MAX_LENGTH          (81)
 #define SERIAL_COMMAND_MAX_LENGTH         (81)
@@ -163,6 +276,106 @@
 // #define LOGIC_ANALYZER_BUFFER_SIZE     (8192)
 // #define LOGIC_ANALYZER_INDEX_MASK      (0x00001FFFU)
 
+//
+//  Logic Analyzer binary dump ("la dump", "la save" and "la output"). See EBTKS_LA_Dump.cpp
+//  and tools/la_decode
+//
+
+#define ENABLE_LA_DUMP                    (1)
+#define LA_DUMP_FILENAME                  "/LA_Dump.bin"
+
+//
+//  Logic Analyzer streaming to SD Card ("la stream" and "la stop")
+//
+//  Every bus cycle is stored in a ring buffer of LA_STREAM_RING_SIZE samples (8 bytes each, in DTCM),
+//  and Logic_Analyzer_Poll() drains it in chunks of LA_STREAM_CHUNK_SAMPLES, delta compressed, to
+//  LA_STREAM_FILENAME. The file is preallocated to LA_STREAM_FILE_SIZE bytes so that writes don't
+//  have to search for free clusters, and is truncated to the captured length when streaming stops.
+//  At about 2 bytes per bus cycle, 512 MB is about 7 minutes of bus activity.
+//  LA_STREAM_RING_SIZE must be a power of two, and a multiple of LA_STREAM_CHUNK_SAMPLES
+//
+//  The ring (32 kB) and the output buffer in EBTKS_LA_Stream.cpp (LA_STREAM_SD_WRITE_SIZE plus one worst case
+//  chunk, 7.6 kB) are in DTCM, about 40 kB together. The ring holds about 6.7 ms of bus cycles, so an SD Card
+//  write that stalls for longer than that loses samples, which are marked with LA_STREAM_GAP_BIT
+//
+
+#define ENABLE_LA_STREAM                  (1)
+#define LA_STREAM_RING_SIZE               (4096)
+#define LA_STREAM_CHUNK_SAMPLES           (512)
+#define LA_STREAM_SD_WRITE_SIZE           (4096)
+#define LA_STREAM_FILE_SIZE               (512ULL*1024*1024)
+#define LA_STREAM_FILENAME                "/LA_Stream.bin"
+#define LA_STREAM_GAP_BIT                 (0x08000000U)         //  Bit 27 of the main sample, set on the first sample stored after samples were lost
+
+//
+//  Logic Analyzer deep capture into PSRAM ("la deep")
+//
+//  Uses the same ring buffer as "la stream" to stage samples in DTCM, which Logic_Analyzer_Poll()
+//  copies to a store in EXTMEM, so the ISR never waits for the PSRAM. Samples are packed into
+//  6 bytes, so the 6 MB store holds 1M samples (1.7 seconds of bus activity), and leaves 2 MB of
+//  an 8 MB PSRAM for other uses. The store can be split into up to LA_DEEP_MAX_SEGMENTS segments,
+//  each capturing a window around one trigger event. Needs ENABLE_LA_STREAM
+//
+
+#define ENABLE_LA_DEEP                    (1)
+#define LA_DEEP_STORE_SAMPLES             (1024*1024)
+#define LA_DEEP_MAX_SEGMENTS              (64)
+
+//
+//  PSRAM (EXTMEM) budget
+//
+//  The EMC store (EMC_RAM_SIZE, 1 MB, see EBTKS_EMC_Cache.cpp), the deep capture store (6 bytes per
+//  sample, 6 MB, see EBTKS_LA_Deep.cpp), the HP-85 RAM shadow (32 kB, see EBTKS_HP85_Shadow.cpp) and the CRT
+//  recorder ring (24 kB, see EBTKS_CRT_Record.cpp) are static EXTMEM arrays, so the linker puts them one after the other. EBTKS_LA_Deep.cpp checks at compile
+//  time that together they fit in PSRAM_BUDGET. At run time each feature calls PSRAM_Holds_EXTMEM(), which
+//  checks the end of everything in EXTMEM against the PSRAM that is fitted, and does without PSRAM if it
+//  doesn't fit
+//
+
+#define PSRAM_BUDGET                      (8*1024*1024)         //  One PSRAM chip
+
+//
+//  Logic Analyzer trigger sequencer ("la trig <file>")
+//
+//  A JSON file describes a trigger as a small state machine, which is compiled into
+//  Logic_Analyzer_Sequence[]. Each cycle only the current state is evaluated: at most two
+//  comparators and a cycle count, so the cost in the ISR doesn't depend on the number of states.
+//  See EBTKS_LA_Trigger.cpp for the file format
+//
+
+#define ENABLE_LA_SEQUENCER               (1)
+#define LA_SEQUENCER_MAX_STATES           (8)
+#define LA_SEQUENCER_FIRE                 (0xFF)                //  goto value that triggers the Logic Analyzer
+#define LA_SEQUENCER_UNUSED               (0xFE)                //  goto value for a comparator that isn't used
+
+//
+//  Sampling profiler ("prof start", "prof show", "prof save")
+//
+//  Every PROFILER period'th instruction fetch seen by onPhi_1_Rise() adds one to a counter for its
+//  2^PROFILER_BUCKET_SHIFT byte bucket of the address space. The bank switched ROM window (060000 to
+//  077777) has its own buckets for each RSELEC value, up to PROFILER_ROM_SLOTS different ROMs.
+//  Only the HP85B, HP86 and HP87 have IFETCH on the backplane. See EBTKS_Profiler.cpp
+//
+
+#define ENABLE_PROFILER                   (1)
+#define PROFILER_BUCKET_SHIFT             (6)                   //  64 byte buckets
+#define PROFILER_ROM_SLOTS                (16)
+#define PROFILER_DEFAULT_PERIOD           (16)
+#define PROFILER_FILENAME                 "/Profile.csv"
+#define PROFILER_TOP_N                    (64)                  //  "prof show" ranks at most this many buckets
+
+//
+//  ISR timing statistics, reported with "show isrstats"
+//
+//  When enabled, the DWT cycle counter is read around the three phases of pinChange_isr()
+//  and around every ioReadFuncs[] / ioWriteFuncs[] dispatch. Each adds about 10 ns to the
+//  ISR, so leave this disabled for normal use. Histogram bin n counts times from 2^n to
+//  2^(n+1)-1 CPU cycles, with the last bin collecting everything longer
+//
+
+#define ENABLE_ISR_STATS                  (0)
+#define ISR_STATS_HISTOGRAM_BINS          (12)
+
 #define DIRECTORY_LISTING_BUFFER_SIZE     (65536)
 #define CRT_LOG_BUFFER_SIZE               ( 1024)
 #define SERIAL_LOG_BUFFER_SIZE            ( 2048)
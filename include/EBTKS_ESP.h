@@ -23,7 +23,7 @@ struct s_Dir_Entry dirent;
 #define MAX_STR_LEN 4096
 
 
-extern void dumpCrtAlphaAsBase64(char *buff, bool comp_graph);
+extern bool dumpCrtAlphaAsBase64(char *buff, bool comp_graph);
 
 //
 //  simple circular buffer class
@@ -409,33 +409,59 @@ public:
 
     //
     //  video screen request
-    //  need to determine the machine 85/86/87
-    //  and the video mode to encode the corrent length of framebuffer
-    //  and to tag the data with the correct screen dimensions
-    //  for the webpage to render
+    //  the machine 85/86/87 and the video mode set the length of the framebuffer
+    //  and the screen dimensions the webpage renders, see CRT_Get_Geometry()
     //
     else if (jdoc["get_alpha"])
     {
+      struct S_CRT_Geometry geometry;
+
+      CRT_Get_Geometry(&current_screen, &geometry);
       dumpCrtAlphaAsBase64(_strBuff, false);
       JsonObject reply = jreply["hpText"].to<JsonObject>();
 
-      reply["isHP87"] = false; //only HP85 for the moment
+      reply["isHP87"] = geometry.is8687;
       reply["image"] = _strBuff;
-      reply["width"] = 32;
-      reply["lines"] = 16;
-      reply["machine"] = "HP85";
+      reply["width"] = geometry.columns;
+      reply["lines"] = geometry.lines;
+      reply["machine"] = get_machineType();
     }
     else if (jdoc["get_graph"])
     {
-      dumpCrtAlphaAsBase64(_strBuff, true);
+      struct S_CRT_Geometry geometry;
+
+      CRT_Get_Geometry(&current_screen, &geometry);
+      bool ok = dumpCrtAlphaAsBase64(_strBuff, true);
       Serial.printf("vbuff size:%d\r\n", strlen(_strBuff));
       JsonObject reply = jreply["hpGraph"].to<JsonObject>();
-      reply["isHP87"] = false; //only HP85 for the moment
+      reply["isHP87"] = geometry.is8687;
+      reply["ok"] = ok;                                         //  false if it didn't fit, use get_delta
       reply["image"] = _strBuff;
-      reply["width"] = 32;
-      reply["lines"] = 16;
-      reply["machine"] = "HP85";
+      reply["width"] = geometry.columns;
+      reply["lines"] = geometry.lines;
+      reply["graphWidth"] = geometry.width;
+      reply["graphHeight"] = geometry.height;
+      reply["bytesPerLine"] = geometry.bytes_per_line;
+      reply["graphOffset"] = geometry.is8687 ? 0 : geometry.graph_base;   //  HP85 image is all of vram
+      reply["machine"] = get_machineType();
+    }
+#if ENABLE_CRT_STREAM
+    //
+    //  incremental video, see EBTKS_CRT_Stream.cpp. ack is the seq of the last frame applied,
+    //  0 for a keyframe. If more is true, ask again right away
+    //
+    else if (jdoc["get_delta"])
+    {
+      uint32_t ack = jdoc["get_delta"]["ack"] | 0;
+      int frameLen = CRT_Stream_Frame(ack, _frame, sizeof(_frame));
+      ourBase64.encode(_strBuff, (char *)_frame, frameLen);
+      JsonObject reply = jreply["hpDelta"].to<JsonObject>();
+      reply["seq"] = CRT_Stream_Seq();
+      reply["more"] = CRT_Stream_More();
+      reply["frame"] = _strBuff;
+      reply["machine"] = get_machineType();
     }
+#endif
     //
     //  get sdcard directory
     //
@@ -488,6 +514,9 @@ private:
                                   //
                                   //  Yep, no more error message. I think the issues is that it could result in a string in _strBuff without a trailing 0x00
   CircBuff kbuff;
+#if ENABLE_CRT_STREAM
+  uint8_t _frame[CRT_STREAM_FRAME_MAX];     //  Base64 of CRT_STREAM_FRAME_MAX bytes fits in _strBuff
+#endif
 };
 
 
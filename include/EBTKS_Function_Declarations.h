@@ -37,6 +37,40 @@ uint16_t DMA_Peek16(uint32_t address);
 void    DMA_Poke8 (uint32_t address, uint8_t  val);
 void    DMA_Poke16(uint32_t address, uint16_t val);
 
+void    DMA_Session_Begin(struct S_DMA_Session *session);
+void    DMA_Session_Read (struct S_DMA_Session *session, uint32_t address, uint8_t *buffer, uint32_t length);
+void    DMA_Session_Write(struct S_DMA_Session *session, uint32_t address, const uint8_t *buffer, uint32_t length);
+uint32_t DMA_Session_Run (struct S_DMA_Session *session);
+
+bool    hp85_read (uint32_t addr, uint8_t *buf, uint32_t n);
+bool    hp85_write(uint32_t addr, const uint8_t *buf, uint32_t n);
+
+#if ENABLE_HP85_RAM_SHADOW
+uint8_t *HP85_Shadow_Ptr(uint32_t addr, uint32_t n);
+void    HP85_Shadow_Update(uint32_t addr, const uint8_t *buf, uint32_t n);
+void    HP85_Shadow_Seed(void);
+void    HP85_Shadow_Poll(void);
+void    HP85_Shadow_Command(void);
+bool    is_hp85_idle(void);
+#endif
+
+#if ENABLE_DMA_QUEUE
+void    DMA_Queue_Read (uint32_t address, uint8_t *buffer, uint32_t length, volatile bool *done,
+                        void (*callback)(void *context), void *context);
+void    DMA_Queue_Write(uint32_t address, const uint8_t *buffer, uint32_t length, volatile bool *done,
+                        void (*callback)(void *context), void *context);
+void    DMA_Queue_CRT_Write(uint32_t address, const uint8_t *data, uint32_t length);
+void    DMA_Queue_CRT_Text(uint16_t row, uint16_t column, const char *text);
+void    DMA_Queue_Delay(uint32_t ms);
+void    DMA_Queue_Service(void);
+void    DMA_Queue_Flush(void);
+uint32_t DMA_Queue_Pending(void);
+#endif
+
+#if ENABLE_DMA_BENCH
+void    DMA_Bench_Command(void);
+#endif
+
 
 //
 //  CRT Functions
@@ -44,19 +78,44 @@ void    DMA_Poke16(uint32_t address, uint16_t val);
 void initCrtEmu();
 void dumpCrtAlpha(void);
 void Write_on_CRT_Alpha(uint16_t row, uint16_t column, const char *  text);
-void dumpCrtAlphaAsBase64(char *buff, bool comp_graph);
+void Write_on_CRT_Alpha_with_DMA_Active(uint16_t row, uint16_t column, const char *  text);
+bool Safe_CRT_is_Busy_with_DMA_Active(void);
+void CRT_Get_Geometry(const video_capt_t *screen, struct S_CRT_Geometry *geometry);
+void CRT_Render_Size(const struct S_CRT_Geometry *geometry, uint32_t *width, uint32_t *height);
+void CRT_Render_Rows(const video_capt_t *screen, const struct S_CRT_Geometry *geometry, uint32_t first, uint32_t count,
+                     uint8_t *out);
+bool dumpCrtAlphaAsBase64(char *buff, bool comp_graph);
 void writePixel(int x, int y, int color);
 void writeLine(int x0, int y0, int x1, int y1, int color);
 void CRT_capture_screen(void);
+bool CRT_Dirty_Take(uint8_t consumer, struct S_CRT_Dirty *dirty);
+void CRT_Dirty_Mark_Range(uint32_t first, uint32_t length);
+#if ENABLE_CRT_STREAM
+uint32_t CRT_Stream_Frame(uint32_t ack, uint8_t *frame, uint32_t size);
+uint32_t CRT_Stream_Seq(void);
+bool CRT_Stream_More(void);
+void CRT_Stream_Command(void);
+bool Screenshot_Start(const char *filename);
+void Screenshot_Poll(void);
+void Screenshot_Command(void);
+void AUXROM_SCREENSHOT(void);
+void CRT_Record_Write(uint8_t reg, uint8_t val);
+uint32_t CRT_Record_Begin(uint8_t *header);
+uint32_t CRT_Record_Encode(uint8_t *out, uint32_t size);
+void CRT_Record_Poll(void);
+void CRT_Record_Command(void);
+#endif
 void CRT_restore_screen(void);
+void CRT_Write_Span_with_DMA_Active(uint32_t index, const uint8_t *data, uint32_t length);
+void CRT_Bench(void);
 void Send_Visible_CRT_to_Serial(void);
 void Send_All_CRT_to_Serial(void);
 
 //
 //  Bank Switched ROM support
 //
-bool      readBankRom(uint16_t addr);
 uint8_t * getROMEntry(uint8_t romId);
+void      mapRomPages(void);
 
 //
 //  HP-85 Bus interface and ISR functions
@@ -77,6 +136,11 @@ void release_DMA_request(void);
 #pragma GCC diagnostic ignored "-Wattributes"
 FASTRUN void pinChange_isr(void) __attribute__ ((interrupt ("IRQ")));     //  This fixed the keyboard random errors, which was caused by unsaved registers on interrupt
                                                                           //  not being saved by normal function entry          #####
+FASTRUN void pinChange_isr_no_emc(void) __attribute__ ((interrupt ("IRQ")));
+#if ENABLE_EMC_SUPPORT
+FASTRUN void pinChange_isr_emc(void) __attribute__ ((interrupt ("IRQ")));
+#endif
+void select_pinChange_isr(void);
 void setupPinChange(void);
 void mySystick_isr(void);
 void initIOfuncTable(void);
@@ -84,6 +148,7 @@ void setIOReadFunc(uint8_t addr,ioReadFuncPtr_t readFuncP);
 void setIOWriteFunc(uint8_t addr,ioWriteFuncPtr_t writeFuncP);
 void removeIOReadFunc(uint8_t addr);
 void removeIOWriteFunc(uint8_t addr);
+void rebuildBusPages(void);
 
 
 
@@ -190,10 +255,12 @@ void serial_string_used(void);
 void Serial_Command_Poll(void);
 
 void str_tolower(char *p);
+uint32_t crc32_update(uint32_t crc, const void *data, uint32_t length);
 bool MatchesPattern(char *pT, char *pP);
 void HexDump_T41_mem (uint32_t start_address, uint32_t count, bool show_addr, bool final_nl);
 void HexDump_HP85_mem(uint32_t start_address, uint32_t count, bool show_addr, bool final_nl);
 void show_mailboxes_and_usage(void);
+bool PSRAM_Holds_EXTMEM(void);
 
 time_t getTeensy3Time(void);
 void show_RTC(void);
@@ -206,6 +273,30 @@ void ESP_Reset(void);
 void Setup_Logic_Analyzer(void);
 void Logic_analyzer_go(void);
 void Logic_Analyzer_Poll(void);
+#if ENABLE_LA_STREAM
+void Logic_Analyzer_Stream_Start(void);
+void Logic_Analyzer_Stream_Stop(void);
+void Logic_Analyzer_Stream_Poll(void);
+#endif
+#if ENABLE_LA_DEEP
+void Logic_Analyzer_Deep_Command(void);
+void Logic_Analyzer_Deep_Poll(void);
+#endif
+#if ENABLE_LA_SEQUENCER
+void Logic_Analyzer_Trigger_Command(void);
+void Logic_Analyzer_Sequencer_Reset(void);
+bool Logic_Analyzer_Sequencer_Step(uint32_t main_sample, uint32_t aux_sample);
+#endif
+#if ENABLE_LA_DUMP
+bool Logic_Analyzer_Dump_Results(uint32_t start_index, uint32_t count);
+void Logic_Analyzer_Dump_Command(void);
+#endif
+void Logic_Analyzer_Print_Heading(void);
+void Logic_Analyzer_Print_Sample(int32_t sample_number_relative_to_trigger, uint32_t temp, uint32_t aux, bool is_trigger);
+#if ENABLE_PROFILER
+void Profiler_Command(void);
+void Profiler_Record(uint32_t address, uint32_t rselec);
+#endif
 
 void Simple_Graphics_Test(void);
 
@@ -237,6 +328,24 @@ int  get_EMC_StartBank(void);
 int  get_EMC_StartAddress(void);
 int  get_EMC_EndAddress(void);
 bool get_EMC_master(void);
+void emc_cache_init(void);
+void emc_cache_poll(void);
+void emc_cache_rebalance(void);
+uint8_t *emc_cache_bank_data(uint32_t bank);
+void EMC_Cache_Info(void);
+const char * get_EMC_Restore(void);
+bool get_EMC_PSRAM(void);
+#endif
+#if ENABLE_EMC_SNAPSHOT
+bool EMC_Snapshot_Save(const char *filename);
+bool EMC_Snapshot_Load(const char *filename);
+void EMC_Snapshot_Command(void);
+void AUXROM_EMCSAVE(void);
+void AUXROM_EMCLOAD(void);
+#endif
+#if ENABLE_EMC_TRACE
+void EMC_Trace_Record(uint8_t op, uint32_t ptr, uint8_t data);
+void EMC_Trace_Command(void);
 #endif
 
 uint32_t getFlags(void);
@@ -127,9 +127,38 @@ EXTERN  uint8_t   Mailbox_to_be_processed;
 
 EXTERN  uint8_t HP85A_16K_RAM_module[EXP_RAM_SIZE]; //map this into the HP85 address space @ 0xc000..0xfeff
 
+//
+//  Bus page tables, indexed by addReg >> 8. Each entry points to the 256 bytes of EBTKS memory that
+//  back that page of the HP85 address space, or NULL if EBTKS does not respond there. The I/O page
+//  (0177400..0177777) is always NULL, and is handled by ioReadFuncs[] and ioWriteFuncs[].
+//  See rebuildBusPages() and mapRomPages()
+//
+EXTERN  uint8_t * busReadPages[256];
+EXTERN  uint8_t * busWritePages[256];
+
 EXTERN  uint8_t Shared_DMA_Buffer_1[MAX_DMA_TRANSFER_LENGTH + 8];    // + 8 for a tiny bit of off by error safety
 EXTERN  uint8_t Shared_DMA_Buffer_2[MAX_DMA_TRANSFER_LENGTH + 8];    // + 8 for a tiny bit of off by error safety
 
+//
+//  A DMA session is a list of reads and writes (segments) that are all done in one bus acquisition.
+//  See DMA_Session_Begin() in EBTKS_DMA.cpp
+//
+struct S_DMA_Segment
+{
+  uint32_t      address;                                  //  HP-85 address
+  uint8_t       *buffer;
+  uint32_t      length;
+  bool          write;
+};
+
+struct S_DMA_Session
+{
+  uint32_t              count;                            //  Segments in use
+  uint32_t              pending;                          //  Bytes in those segments
+  uint32_t              bytes;                            //  Bytes transferred by DMA_Session_Run(), including any early runs
+  struct S_DMA_Segment  segment[DMA_SESSION_MAX_SEGMENTS];
+};
+
 
 EXTERN  bool haltReq; //set true to request the HP85 to halt/DMA request
 
@@ -216,6 +245,258 @@ EXTERN  uint32_t  Logic_Analyzer_Valid_Samples_1_second_ago;
 EXTERN  volatile uint32_t  Logic_Analyzer_main_sample;
 EXTERN  volatile uint32_t  Logic_Analyzer_aux_sample;
 
+#if ENABLE_LA_STREAM
+//
+//  Logic Analyzer streaming ring buffer. The ISR (and DMA) advance LA_Stream_Head, Logic_Analyzer_Poll()
+//  advances LA_Stream_Tail as it writes samples to the SD Card. Both count samples and are only masked
+//  when indexing, so (Head - Tail) is the number of samples waiting. See EBTKS_LA_Stream.cpp
+//
+
+struct S_LA_Stream_Sample
+{
+  uint32_t  main;                                 //  Logic_Analyzer_main_sample
+  uint32_t  aux;                                  //  Logic_Analyzer_aux_sample
+};
+
+EXTERN  struct S_LA_Stream_Sample LA_Stream_Ring[LA_STREAM_RING_SIZE];
+EXTERN  volatile uint32_t  LA_Stream_Head;
+EXTERN  volatile uint32_t  LA_Stream_Tail;
+EXTERN  volatile uint32_t  LA_Stream_Dropped;     //  Samples lost because the ring was full
+EXTERN  uint32_t  LA_Stream_Gap_Flag;             //  LA_STREAM_GAP_BIT if samples were lost since the last one stored, else 0
+#endif
+
+#if ENABLE_LA_SEQUENCER
+//
+//  Compiled trigger sequence. See EBTKS_LA_Trigger.cpp
+//
+
+struct S_LA_Trigger_Comparator
+{
+  uint32_t  main_mask;                            //  Control, flag and data bits of Logic_Analyzer_main_sample. Address is not included
+  uint32_t  main_value;
+  uint32_t  aux_mask;                             //  RSELEC and DRP bits of Logic_Analyzer_aux_sample
+  uint32_t  aux_value;
+  uint16_t  addr_low;                             //  Address must be in addr_low .. addr_low + addr_span
+  uint16_t  addr_span;
+};
+
+struct S_LA_Trigger_State
+{
+  struct S_LA_Trigger_Comparator  cmp[2];
+  uint8_t   goto_state[2];                        //  Next state when cmp[n] matches, LA_SEQUENCER_FIRE, or LA_SEQUENCER_UNUSED (cmp[1] only)
+  uint8_t   timeout_state;                        //  Next state if neither matches within the 'within' limit
+  uint32_t  count;                                //  cmp[0] must match this many times
+  uint32_t  within;                               //  Cycles allowed in this state, 0 for no limit
+};
+
+EXTERN  struct S_LA_Trigger_State Logic_Analyzer_Sequence[LA_SEQUENCER_MAX_STATES];
+EXTERN  bool      Logic_Analyzer_Sequencer_Active;      //  If false, the "la setup" mask and pattern are used
+EXTERN  uint8_t   Logic_Analyzer_Sequencer_State;
+EXTERN  uint32_t  Logic_Analyzer_Sequencer_Cycles;
+EXTERN  uint32_t  Logic_Analyzer_Sequencer_Count;
+#endif
+
+#if ENABLE_PROFILER
+//
+//  Sampling profiler counters. Updated by Profiler_Record() in the ISR, see EBTKS_Profiler.cpp.
+//  Profiler_ROM_Slot[rselec] is 0 until that ROM is first seen, then its slot + 1
+//
+
+#define PROFILER_BUCKETS                  (0x10000U >> PROFILER_BUCKET_SHIFT)
+#define PROFILER_ROM_BUCKETS              (0x2000U  >> PROFILER_BUCKET_SHIFT)
+
+EXTERN  volatile bool      Profiler_Active;
+EXTERN  uint32_t  Profiler_Period;                        //  Record every Profiler_Period'th instruction fetch
+EXTERN  uint32_t  Profiler_Countdown;
+EXTERN  uint32_t  Profiler_Samples;
+EXTERN  uint32_t  Profiler_ROM_Overflow;                  //  Samples from ROMs that didn't get a slot
+EXTERN  uint32_t  Profiler_Buckets[PROFILER_BUCKETS];
+EXTERN  uint32_t  Profiler_ROM_Buckets[PROFILER_ROM_SLOTS][PROFILER_ROM_BUCKETS];
+EXTERN  uint8_t   Profiler_ROM_Slot[256];
+EXTERN  uint8_t   Profiler_ROM_Rselec[PROFILER_ROM_SLOTS];
+EXTERN  uint8_t   Profiler_ROM_Slots_Used;
+#endif
+
+#if ENABLE_EMC_SUPPORT
+//
+//  EMC bank map, maintained by EBTKS_EMC_Cache.cpp. EMC_Bank_Ptr[bank] points at the bank's 32 kB in the
+//  DMAMEM cache, or is NULL if it is only in the PSRAM store (use emc_cache_bank_data() from loop()). The ISR
+//  counts every access in EMC_Bank_Accesses[], and every write in EMC_Bank_Generation[], so that emc_cache_poll()
+//  can tell if a bank changed while it was being copied. The ISR sets a bit in EMC_Bank_Wanted for each bank a
+//  pointer is about to reach that is not cached, and holds the HP-85 with HALT until emc_cache_poll() clears it
+//
+
+EXTERN  uint8_t * volatile  EMC_Bank_Ptr[EMC_MAX_BANKS];
+EXTERN  volatile uint32_t   EMC_Bank_Generation[EMC_MAX_BANKS];
+EXTERN  volatile uint32_t   EMC_Bank_Accesses[EMC_MAX_BANKS];
+EXTERN  volatile uint32_t   EMC_Bank_Wanted;
+EXTERN  volatile uint32_t   EMC_Bank_Misses;            //  Accesses to a bank that was not cached. Should stay 0
+#endif
+
+#if ENABLE_EMC_TRACE
+//
+//  EMC trace ring, see EBTKS_EMC_Trace.cpp. While EMC_Trace_Active, EMC_Trace_Record() in the ISR adds an
+//  event for every EMC operation whose pointer is in EMC_Trace_Low .. EMC_Trace_Low + EMC_Trace_Span.
+//  EMC_Trace_Count is the number of events since "emc trace on", the newest is at (EMC_Trace_Count - 1) & mask
+//
+
+enum emc_trace_ops {  EMC_TRACE_READ = 1,                 //  Indirect read through PTR1 or PTR2
+                      EMC_TRACE_WRITE,                    //  Indirect write
+                      EMC_TRACE_DEC,                      //  Pre-decrement, data is the amount
+                      EMC_TRACE_PTR_READ,                 //  Read of a pointer register
+                      EMC_TRACE_PTR_WRITE                 //  Write to a pointer register, ptr is the new value
+                   };
+
+struct S_EMC_Trace_Event
+{
+  uint32_t      ptr;
+  uint32_t      cycle;                                    //  pin_isr_count
+  uint8_t       op;
+  uint8_t       data;
+  uint8_t       drp;
+  uint8_t       cycle_ndx;                                //  Byte of a multi-byte transfer
+  uint8_t       mode;                                     //  m_emc_mode, bit 2 selects PTR2
+  uint8_t       spare[3];
+};
+
+extern  struct S_EMC_Trace_Event EMC_Trace_Ring[EMC_TRACE_RING_SIZE];
+EXTERN  volatile bool       EMC_Trace_Active;
+EXTERN  uint32_t            EMC_Trace_Low;
+EXTERN  uint32_t            EMC_Trace_Span;
+EXTERN  volatile uint32_t   EMC_Trace_Count;
+#endif
+
+//
+//  Changes to the mirrored CRT memory, see CRT_Dirty_Take() in EBTKS_CRT.cpp. Each consumer gets its own copy,
+//  so taking the changes for one doesn't hide them from another. The remote display is the only one so far
+//
+
+enum crt_dirty_consumers {  CRT_DIRTY_REMOTE = 0,           //  Remote display, through the ESP32
+                            CRT_DIRTY_CONSUMERS
+                         };
+
+struct S_CRT_Dirty
+{
+  uint32_t      blocks[CRT_DIRTY_WORDS];                  //  Bit n of word w is block 32 * w + n
+  uint32_t      block_size;                               //  Bytes of current_screen.vram per block, for this machine
+  bool          view;                                     //  The start address or control register was written
+};
+
+//
+//  The mirrored CRT state, kept by the ioWriteCrt*() handlers in EBTKS_CRT.cpp. On the HP83/85/9915 vram[] holds
+//  the 16K nibble CRT memory as 8 KB, on the HP86/87 the full 16 KB
+//
+
+typedef struct
+{
+  uint8_t vram[16384];
+  uint16_t sadAddr;
+  uint16_t badAddr;
+  uint8_t  ctrl;
+} video_capt_t;
+
+extern  video_capt_t        current_screen;
+extern  video_capt_t        captured_screen;
+extern  bool                Is8687;
+
+//
+//  What part of vram a screen shows, from CRT_Get_Geometry() in EBTKS_CRT_Render.cpp. vram indexes wrap at vram_size
+//
+
+struct S_CRT_Geometry
+{
+  bool          is8687;
+  bool          graphics;                                 //  The screen is in graphics mode
+  bool          all;                                      //  HP86/87 ALPHALL or GRAPHALL
+  uint16_t      columns, lines;                           //  Alpha characters per line, and visible lines
+  uint16_t      char_height;                              //  Alpha, in pixels. Characters are 8 pixels wide
+  uint32_t      alpha_start;                              //  vram index of the top left character
+  uint32_t      alpha_wrap;                               //  Alpha memory wraps from here to 0
+  uint16_t      width, height;                            //  Graphics, in pixels
+  uint16_t      bytes_per_line;                           //  Graphics
+  uint32_t      graph_base;                               //  vram index of the top left graphics byte
+  uint32_t      vram_size;
+};
+
+#if ENABLE_CRT_RECORD
+//
+//  CRT recorder, see EBTKS_CRT_Record.cpp. While CRT_Record_Active, the CRT register write handlers in EBTKS_CRT.cpp
+//  call CRT_Record_Write() with one of these, and the byte written
+//
+
+enum crt_record_regs {  CRT_RECORD_SAD = 0,
+                        CRT_RECORD_BAD,
+                        CRT_RECORD_CTRL,
+                        CRT_RECORD_DAT
+                     };
+
+extern  volatile bool       CRT_Record_Active;
+#endif
+
+#if ENABLE_HP85_RAM_SHADOW
+//
+//  Shadow of HP-85 RAM, see EBTKS_HP85_Shadow.cpp. HP85_Shadow[addr - HP85_SHADOW_BASE] follows every write
+//  cycle. It is only used while HP85_Shadow_Valid, and only below HP85_Shadow_Top. The ISR clears
+//  HP85_Shadow_Valid (and counts it) if a write could have changed RAM without a write cycle it can see.
+//  HP85_Shadow[] is in EXTMEM, and nothing touches it while HP85_Shadow_Span is 0, as it is without PSRAM.
+//  The ISR only adds writes to HP85_Shadow_FIFO[] (DTCM) and advances HP85_Shadow_FIFO_Head, loop() applies
+//  them and advances HP85_Shadow_FIFO_Tail. Both count writes, and are only masked to index the FIFO
+//
+
+struct S_HP85_Shadow_Write
+{
+  uint16_t      addr;
+  uint8_t       data;
+  uint8_t       spare;
+};
+
+extern  uint8_t             HP85_Shadow[HP85_SHADOW_SIZE];
+EXTERN  uint32_t            HP85_Shadow_Span;
+EXTERN  struct S_HP85_Shadow_Write HP85_Shadow_FIFO[HP85_SHADOW_FIFO_SIZE];
+EXTERN  volatile uint32_t   HP85_Shadow_FIFO_Head;
+EXTERN  volatile uint32_t   HP85_Shadow_FIFO_Tail;
+EXTERN  volatile bool       HP85_Shadow_Valid;
+EXTERN  volatile uint32_t   HP85_Shadow_Invalidations;
+EXTERN  uint32_t            HP85_Shadow_Top;
+#endif
+
+#if ENABLE_ISR_STATS
+//
+//  ISR timing statistics, all times in CPU cycles from ARM_DWT_CYCCNT. Updated in pinChange_isr(),
+//  reported and cleared by "show isrstats"
+//
+
+struct S_ISR_Timing
+{
+  uint32_t  count;
+  uint32_t  min;
+  uint32_t  max;
+  uint64_t  total;                                        //  For the mean
+  uint32_t  histogram[ISR_STATS_HISTOGRAM_BINS];          //  Bin n is 2^n to 2^(n+1)-1 cycles
+};
+
+enum isr_phases {
+                  ISR_PHASE_RISE = 0,                     //  onPhi_1_Rise()
+                  ISR_PHASE_FALL,                         //  onPhi_1_Fall()
+                  ISR_PHASE_MID,                          //  mid_cycle_processing()
+                  ISR_PHASE_TO_FALL,                      //  ISR entry to start of onPhi_1_Fall(), includes waiting for Phi 1 to fall
+                  ISR_PHASE_TOTAL,                        //  Whole ISR, including the fixed EBTKS_delay_ns(222)
+                  ISR_PHASE_COUNT
+                };
+
+EXTERN  struct S_ISR_Timing   ISR_Stats_Phase[ISR_PHASE_COUNT];
+EXTERN  struct S_ISR_Timing   ISR_Stats_IO_Read[256];     //  Indexed by I/O address & 0xFF
+EXTERN  struct S_ISR_Timing   ISR_Stats_IO_Write[256];
+
+enum isr_emc_accesses {
+                  ISR_EMC_CACHE_READ = 0,                 //  Just the EMC_Bank_Ptr[] access in emc_r() and emc_w(),
+                  ISR_EMC_CACHE_WRITE,                    //  always the DMAMEM cache. See EBTKS_EMC_Cache.cpp
+                  ISR_EMC_COUNT
+                };
+
+EXTERN  struct S_ISR_Timing   ISR_Stats_EMC[ISR_EMC_COUNT];
+#endif
+
 EXTERN  Tape tape;
 
 EXTERN  SdFs SD;               //   Changed for 1.57
@@ -252,6 +533,9 @@ EXTERN  uint32_t      pin_isr_count;
         volatile bool DMA_Active = false;
         volatile bool DMA_has_been_Requested = false;
 
+        uint32_t      DMA_Burst_Length       = MAX_DMA_BURST_LENGTH;       //  From the "DMA" section of CONFIG.TXT, see "dma bench"
+        uint32_t      DMA_Burst_Break_Cycles = DMA_BURST_BREAK_CYCLES;
+
         const char b64_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
                                     "abcdefghijklmnopqrstuvwxyz"
                                     "0123456789+/";
@@ -279,6 +563,9 @@ EXTERN  uint32_t      pin_isr_count;
         extern  volatile bool DMA_Active;
         extern  volatile bool DMA_has_been_Requested;
 
+        extern  uint32_t      DMA_Burst_Length;
+        extern  uint32_t      DMA_Burst_Break_Cycles;
+
         extern  const char b64_alphabet[];
 
 				extern  bool           serial_string_available;
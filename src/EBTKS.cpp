@@ -323,7 +323,7 @@ GPIO9   33         7           CORE_PIN33_PORTREG
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //                                Main Uses of DMAMEM
 //
-//    256 KB      EMC for the HP85B, HP86/87                EMC_MAX_BANKS * 32kB EBTKS_Bus_Interface_ISR.cpp
+//    256 KB      EMC bank cache for the HP85B, HP86/87     EMC_CACHE_BANKS * 32kB EBTKS_EMC_Cache.cpp
 //
 //    144 KB      roms[][]                                  MAX_ROMS            EBTKS_Config.h (assumes MAX_ROMS is 18)
 //                                                          ROM_PAGE_SIZE       EBTKS_Config.h
@@ -331,6 +331,7 @@ GPIO9   33         7           CORE_PIN33_PORTREG
 //      1 KB      sprintf_result                            SCRATCHLENGTH       EBTKS_AUXROM_SD_Services.cpp
 //      1 KB      string_arg                                SCRATCHLENGTH       EBTKS_AUXROM_SD_Services.cpp
 //      0.1 KB    format_segment                                                EBTKS_AUXROM_SD_Services.cpp
+//     24 KB      profiler_ranked[]                         PROFILER_ROM_SLOTS  EBTKS_Profiler.cpp
 //
 //    436,324 B   Total.  Actual total from linker on 12/15/2020 is 473,312
 //    412,160 B   Total.  Actual total from linker on  3/28/2021 is 424,672
@@ -897,6 +898,12 @@ void setup()
   if (config_success && get_EMC_Enable())
   {
     emc_init();
+#if ENABLE_EMC_SNAPSHOT
+    if (*get_EMC_Restore())
+    {
+      EMC_Snapshot_Load(get_EMC_Restore());     //  Before PWO is released, so the HP-85 finds EMC as it was saved
+    }
+#endif
   }
 #endif
 
@@ -1120,6 +1127,21 @@ void loop()
   tape.poll();              //  72 ns when idle, but 800 ns ish if Phi 1 interrupt occurs while running
   AUXROM_Poll();            //  32 ns when idle, but 760 ns ish if Phi 1 interrupt occurs while running
   Logic_Analyzer_Poll();    //  54 ns when idle, but 780 ns ish if Phi 1 interrupt occurs while running
+#if ENABLE_EMC_SUPPORT
+  emc_cache_poll();         //  Brings in the EMC banks the ISR is holding the HP-85 for
+#endif
+#if ENABLE_DMA_QUEUE
+  DMA_Queue_Service();      //  Queued DMA jobs, up to DMA_QUEUE_BUDGET bytes in one bus acquisition
+#endif
+#if ENABLE_HP85_RAM_SHADOW
+  HP85_Shadow_Poll();       //  Seeds the HP-85 RAM shadow after boot, MAX_DMA_TRANSFER_LENGTH bytes per call
+#endif
+#if ENABLE_SCREENSHOT
+  Screenshot_Poll();        //  Renders and writes SCREENSHOT_ROWS_PER_POLL rows of a screenshot, if one is under way
+#endif
+#if ENABLE_CRT_RECORD
+  CRT_Record_Poll();        //  Moves CRT recorder events from the ring to the SD Card
+#endif
 
 #if TRACE_LOOPTRANSLATOR_TIMING
   loopTranslator_entry_time = systick_millis_count;
@@ -1250,11 +1272,15 @@ bool is_hp85_idle(void)
 //  During boot the CRT is unavailable. So we store all the boot status info in
 //  CRT_Log_Buffer.
 //  Once the CRT is available (detected by seeing the HP85 making references
-//  to 000072, which is part of the EXEC loop), we dump the array to the CRT
+//  to 000072, which is part of the EXEC loop), we dump the array to the CRT.
+//  With ENABLE_DMA_QUEUE, the lines are queued 40 ms apart, and written by DMA_Queue_Service()
+//  from loop(), so tape and disk emulation keep running while they are displayed
 //
 
+#if !ENABLE_DMA_QUEUE
 extern void Safe_Write_CRTBAD(uint16_t badAddr);
 extern void Safe_Write_CRTSAD(uint16_t sadAddr);
+#endif
 
 void Boot_Messages_to_CRT(void)
 {
@@ -1262,6 +1288,9 @@ void Boot_Messages_to_CRT(void)
   int row, column;
   int seg_length;
   char segment[100];
+#if ENABLE_DMA_QUEUE
+  uint16_t zero = 0;
+#endif
 
   log_to_CRT_ptr    = &CRT_Log_Buffer[0];
   if ((strlen(log_to_CRT_ptr) == 0) || (!get_CRTVerbose()))
@@ -1277,25 +1306,43 @@ void Boot_Messages_to_CRT(void)
     seg_length = strcspn(log_to_CRT_ptr,"\n");        //  Number of chars not in second string, so does not count the '\n'
     strlcpy(segment, log_to_CRT_ptr, seg_length+1);   //  Copies the segment, and appends a 0x00
     log_to_CRT_ptr += seg_length+1;                   //  Skip over the segment and the trailing '\n'
+#if ENABLE_DMA_QUEUE
+    DMA_Queue_CRT_Text(row++, column, segment);
+    if (row < 16)                                     // While on screen, add some delay between lines. After line 16, no need for delays, since it isn't seen
+      {
+        DMA_Queue_Delay(40);                          //  A little delay so they see it happening. Applies to the next line queued
+      }
+#else
     Write_on_CRT_Alpha(row++, column, segment);
     if (row < 16)                                     // While on screen, add some delay between lines. After line 16, no need for delays, since it isn't seen
       {
         delay(40);                                    //  A little delay so they see it happening
       }
+#endif
     if (row > 63)                                     //  ##########  These constants for line number are specific to HP85A/B.
     {                                                 //  ##########  If we have a HP86/87, there are multiple ALPHA modes each with different max lines
       row = 63;                                       //  Just over-write the last line. Note we start on line 1, so max lines is 63. We leave line 0 alone.
     }
     if (row == 15)
     {
+#if ENABLE_DMA_QUEUE
+      DMA_Queue_CRT_Text(row++, column, "Scroll up for more");
+#else
       Write_on_CRT_Alpha(row++, column, "Scroll up for more");
+#endif
     }
   }
   //
   // Write_on_CRT_Alpha(0,0, first_char);
   //
+#if ENABLE_DMA_QUEUE
+  DMA_Queue_Delay(0);                                 //  Nothing to see in these, no need to wait
+  DMA_Queue_CRT_Write(Is8687 ? HP86_87_CRTBAD : CRTBAD, (const uint8_t *)&zero, 2);
+  DMA_Queue_CRT_Write(Is8687 ? HP86_87_CRTSAD : CRTSAD, (const uint8_t *)&zero, 2);
+#else
   Safe_Write_CRTBAD(0);
   Safe_Write_CRTSAD(0);
+#endif
 }
 int get_wifi_key()
 {
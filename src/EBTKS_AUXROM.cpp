@@ -48,6 +48,9 @@
 #define  AUX_USAGE_RMIDLE        ( 28)      //  none                                              Called from the RMIDLE loop on the HP85. EBTKS can return a KeyCode in AR_Opts[0], and set usage to 1
 #define  AUX_USAGE_SDBATCH       ( 29)      //  SDBATCH
 #define  AUX_USAGE_BOOT          ( 30)      //  BOOT
+#define  AUX_USAGE_EMCSAVE       ( 31)      //  AUXCMD 0, 31, file$, ""                           Save an EMC snapshot, see EBTKS_EMC_Snapshot.cpp
+#define  AUX_USAGE_EMCLOAD       ( 32)      //  AUXCMD 0, 32, file$, ""                           Restore an EMC snapshot
+#define  AUX_USAGE_SCREENSHOT    ( 33)      //  AUXCMD 0, 33, file$, ""                           Save a screenshot (PBM), see EBTKS_Screenshot.cpp
 
 
 
@@ -252,6 +255,19 @@ void AUXROM_Poll(void)
     case AUX_USAGE_BOOT:
       AUXROM_BOOT();
       break;
+#if ENABLE_EMC_SNAPSHOT
+    case AUX_USAGE_EMCSAVE:
+      AUXROM_EMCSAVE();
+      break;
+    case AUX_USAGE_EMCLOAD:
+      AUXROM_EMCLOAD();
+      break;
+#endif
+#if ENABLE_SCREENSHOT
+    case AUX_USAGE_SCREENSHOT:
+      AUXROM_SCREENSHOT();
+      break;
+#endif
     default:
       *p_usage = 1;               //  Failure, unrecognized Usage code
   }
@@ -263,92 +279,29 @@ void AUXROM_Poll(void)
 }
 
 //
-//  Fetch num_bytes for HP-85 memory. Made difficult because they might be in
-//  the built-in DRAM (access via DMA) or they might be in RAM that EBTKS
-//  supplies (but only for HP85A)
-//
-//  The efficient solution would be identify the three scenarios:
-//    all in built-in DRAM
-//    all in EBTKS memory
-//    mixed
-//  and then write block transfer for each.
-//
-//  The expediant (and slower and less bug prone) is just transfer 1 byte at
-//  a time and do a test for each. Doing this for now.
-//  Actually, probably not that slow, since the overhead here is totally masked by the slow HP85 bus data rate
+//  Fetch num_bytes for HP-85 memory. They might be in the built-in DRAM (access via DMA),
+//  or in memory that EBTKS supplies (RAM, ROMs, the AUXROM RAM window), so this is done
+//  by hp85_read(), which handles each region with a block transfer
 //
-//  #################  does not handle ROMs that EBTKS provides
-//  #################  does not handle RAM window in EBTKS ROMs
+//  src_addr is an HP-85 bus address, and wraps at 0x10000, as it always has with DMA. The only caller
+//  that can pass more is AUXROM_Fetch_Parameters(), where R12 - num_bytes goes negative if the stack
+//  is corrupt, and that must not turn into a read of EMC memory. Use hp85_read() directly for EMC
 //
 
 void AUXROM_Fetch_Memory(uint8_t *dest, uint32_t src_addr, uint16_t num_bytes)
 {
-  while (num_bytes--)
-  {
-    if (getHP85RamExp())
-    {
-      //
-      //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-      //
-      if ((src_addr >= HP85A_16K_RAM_module_base_addr) && (src_addr < IO_ADDR))
-      {
-        *dest++ = HP85A_16K_RAM_module[src_addr++ & 0x3FFFU]; //  Got 85A EBTKS RAM, and address match
-        continue;
-      }
-      //  If we get here, got 85A EBTKS RAM, and address does not match, so must be built-in DRAM,
-      //  so just fall into that code
-    }
-    //
-    //  built-in DRAM
-    //
-    *dest++ = DMA_Peek8(src_addr++);
-  }
+  hp85_read(src_addr & 0xFFFFU, dest, num_bytes);
 }
 
 //
-//  Store num_bytes into HP-85 memory. Made difficult because they might be in
-//  the built-in DRAM (access via DMA) or they might be in RAM that EBTKS
-//  supplies (but only for HP85A)
-//
-//  The efficient solution would be identify the three scenarios:
-//    all in built-in DRAM
-//    all in EBTKS memory
-//    mixed
-//  and then write block transfer for each
-//
-//  The expediant (and slower and less bug prone) is just transfer 1 byte at
-//  a time and do a test for each. Doing this for now.
-//  Actually, probably not that slow, since the overhead here is totally masked by the slow HP85 bus data rate
-//
-//  #################  does not handle ROMs that EBTKS provides
-//  #################  does not handle RAM window in EBTKS ROMs
+//  Store num_bytes into HP-85 memory, with hp85_write(). See AUXROM_Fetch_Memory()
 //
 //  dest_addr is an HP85 memory address. source is a pointer into EBTKS memory
 //
 
 void AUXROM_Store_Memory(uint16_t dest_addr, char *source, uint16_t num_bytes)
 {
-  while (num_bytes--)
-  {
-    if (getHP85RamExp())
-    {
-      //
-      //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-      //
-      if ((dest_addr >= HP85A_16K_RAM_module_base_addr) && (dest_addr < IO_ADDR))
-      {
-        HP85A_16K_RAM_module[dest_addr++ - HP85A_16K_RAM_module_base_addr] = *source++; //  Got 85A EBTKS RAM, and address match
-        continue;
-      }
-      //  If we get here, got 85A EBTKS RAM, and address does not match, so must be built-in DRAM,
-      //  so just fall into that code
-    }
-    //
-    //  built-in DRAM
-    //
-    //Serial.printf("DestAddr %08X  SrcAddr %08X  byte %02X\n", dest_addr, source, *source);
-    DMA_Poke8((dest_addr++) & 0x0000FFFF, *source++);
-  }
+  hp85_write(dest_addr, (const uint8_t *)source, num_bytes);
 }
 
 //
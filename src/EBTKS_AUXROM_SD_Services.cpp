@@ -146,6 +146,12 @@
 //                                          530       SDEOF file isn't open
 //        540..549      AUXROM_SDEXISTS
 //        550..559      AUXROM_SDBATCH      550       Can't open Batch file
+//        560..569      AUXROM_SCREENSHOT   560       Can't resolve path
+//                                          561       Screenshot failed
+//        570..579      AUXROM_EMC_Snapshot
+//                                                    Shares use of 330
+//                                          570       EMC save failed
+//                                          571       EMC load failed
 //
 
 
@@ -3777,6 +3783,76 @@ void AUXROM_BOOT(void)
   pulse_PWO();
 }
 
+#if ENABLE_EMC_SNAPSHOT
+//
+//  AUXCMD 0, 31, file$, ""  and  AUXCMD 0, 32, file$, ""
+//  Save and restore EMC snapshots. While we are here, the HP-85 is waiting in the AUXROM, so EMC
+//  memory and the EMC pointers are not changing. See EBTKS_EMC_Snapshot.cpp
+//
+
+static void AUXROM_EMC_Snapshot(bool save)
+{
+#if VERBOSE_KEYWORDS
+  Serial.printf("Call to EMC%s, file [%s]\n", save ? "SAVE" : "LOAD", p_buffer);
+#endif
+
+  if (!Resolve_Path(p_buffer) || Resolved_Path_ends_with_slash)
+  {
+    post_custom_error_message("Can't resolve path", 330);
+    *p_mailbox = 0;      //  Indicate we are done
+    return;
+  }
+  if (!(save ? EMC_Snapshot_Save(Resolved_Path) : EMC_Snapshot_Load(Resolved_Path)))
+  {
+    post_custom_error_message(save ? "EMC save failed" : "EMC load failed", save ? 570 : 571);
+    *p_mailbox = 0;      //  Indicate we are done
+    return;
+  }
+  *p_usage   = 0;                                                             //  Success
+  *p_mailbox = 0;                                                             //  Indicate we are done
+}
+
+void AUXROM_EMCSAVE(void)
+{
+  AUXROM_EMC_Snapshot(true);
+}
+
+void AUXROM_EMCLOAD(void)
+{
+  AUXROM_EMC_Snapshot(false);
+}
+#endif
+
+#if ENABLE_SCREENSHOT
+//
+//  AUXCMD 0, 33, file$, ""
+//  Save a screenshot. The screen is copied now, and the file is written from loop() after we return,
+//  so file$ is complete a moment after the AUXCMD. See EBTKS_Screenshot.cpp
+//
+
+void AUXROM_SCREENSHOT(void)
+{
+#if VERBOSE_KEYWORDS
+  Serial.printf("Call to SCREENSHOT, file [%s]\n", p_buffer);
+#endif
+
+  if (!Resolve_Path(p_buffer) || Resolved_Path_ends_with_slash)
+  {
+    post_custom_error_message("Can't resolve path", 560);
+    *p_mailbox = 0;      //  Indicate we are done
+    return;
+  }
+  if (!Screenshot_Start(Resolved_Path))
+  {
+    post_custom_error_message("Screenshot failed", 561);
+    *p_mailbox = 0;      //  Indicate we are done
+    return;
+  }
+  *p_usage   = 0;                                                             //  Success
+  *p_mailbox = 0;                                                             //  Indicate we are done
+}
+#endif
+
 
 
 //
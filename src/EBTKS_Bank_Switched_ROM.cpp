@@ -10,7 +10,21 @@
 #include "Inc_Common_Headers.h"
 
 volatile uint8_t rselec = 0;                    //holds rom ID currently selected
-uint8_t *currRom;                               //pointer to the currently selected rom data. NULL if not selected
+
+//
+//  Everything the bus code needs to know about the selected ROM bank, worked out once when RSELEC is written.
+//  mapRomPages() builds the ROM window pages of busReadPages[] and busWritePages[] from it, which is how
+//  onReadData() and onWriteData() see the bank. For ROMs without a RAM window, window_length is 0
+//
+
+struct S_Rom_Bank
+{
+  uint8_t   *rom;                               //  Image of the selected ROM. NULL if no ROM with this ID is loaded
+  uint8_t   *window;                            //  AUXROM shared RAM window, NULL if the selected ROM is not an AUXROM
+  uint16_t  window_length;                      //  AUXROM_RAM_WINDOW_SIZE for AUXROMs, otherwise 0
+};
+
+struct S_Rom_Bank currBank;
 
 //
 //  Array to store the ROM images loaded from SD card, into DMAMEM memory
@@ -23,16 +37,50 @@ DMAMEM uint8_t roms[MAX_ROMS][ROM_PAGE_SIZE]   __attribute__ ((aligned(32)));
 uint8_t *romMap[256];                           //  Hold the pointers to the rom data based on ID as the index
 
 
+//
+//  Point the 32 pages of the ROM window (060000..077777) in busReadPages[] and busWritePages[] at the
+//  currently selected ROM. If an AUXROM is selected, its RAM window (070000..075777) is mapped for both
+//  read and write, so onReadData() and onWriteData() don't need to know about it
+//
+
+void mapRomPages(void)                          //  Called from ioWriteRSELEC(), so this is running within an ISR
+{
+  int       page;
+
+  for (page = 0 ; page < (ROM_PAGE_SIZE >> 8) ; page++)
+  {
+    busReadPages[(ROM_PAGE >> 8) + page]  = currBank.rom ? currBank.rom + (page << 8) : NULL;
+    busWritePages[(ROM_PAGE >> 8) + page] = NULL;
+  }
+  for (page = 0 ; page < (currBank.window_length >> 8) ; page++)
+  {
+    busReadPages[((ROM_PAGE + AUXROM_RAM_WINDOW_START) >> 8) + page]  = currBank.window + (page << 8);
+    busWritePages[((ROM_PAGE + AUXROM_RAM_WINDOW_START) >> 8) + page] = currBank.window + (page << 8);
+  }
+}
+
 void ioWriteRSELEC(uint8_t val)                  //  This function is running within an ISR, keep it short and fast.
 {
   rselec = val;
-  currRom = romMap[val];
+  currBank.rom = romMap[val];
+  if ((val >= AUXROM_PRIMARY_ID) && (val <= AUXROM_SECONDARY_ID_END))        //  Primary AUXROM and all secondaries have the RAM window
+  {
+    currBank.window        = AUXROM_RAM_Window.as_bytes;
+    currBank.window_length = AUXROM_RAM_WINDOW_SIZE;
+  }
+  else
+  {
+    currBank.window        = NULL;
+    currBank.window_length = 0;
+  }
+  mapRomPages();
 }
 
 void initRoms(void)
 {
   memset(roms,0,sizeof(roms));
   setIOWriteFunc(RSELEC & 0xff,&ioWriteRSELEC);      // rom select register for banked roms
+  mapRomPages();
 }
 
 uint8_t getRselec(void)
@@ -56,32 +104,3 @@ uint8_t *getRomSlotPtr(int slotNum)
   return &roms[slotNum][0];
 }
 
-
-bool readBankRom(uint16_t addr)            //  This function is running within an ISR, keep it short and fast.
-{                                                 //  addr is in the range 000000 .. 017777
-  //
-  //  Check for the special RAM window in the AUXROMs
-  //
-
-  if ((rselec >= AUXROM_PRIMARY_ID) && (rselec <= AUXROM_SECONDARY_ID_END))      //  Testing for Primary AUXROM and all secondaries
-  {
-    if ((addr >= AUXROM_RAM_WINDOW_START) && (addr <= AUXROM_RAM_WINDOW_LAST))   //  Read AUXROM shared RAM window
-    {
-      readData = AUXROM_RAM_Window.as_bytes[addr - AUXROM_RAM_WINDOW_START];
-      return true;
-    }
-  }
-
-  //
-  //  Normal ROM read for all normal ROMs, and the remainder of the AUXROM(s)
-  //
-
-  if (currRom)
-  {
-    readData = currRom[addr];
-    return true;
-  }
-  return false;
-}
-
-
@@ -49,20 +49,47 @@
 #include "Inc_Common_Headers.h"
 
 inline bool onReadData(void);
-inline void mid_cycle_processing(void);
-inline void onPhi_1_Rise(void);
+template <bool EMC>          inline void mid_cycle_processing(void) __attribute__((always_inline));
+template <bool LA>           inline void onPhi_1_Rise(void) __attribute__((always_inline));
 inline void onWriteData(uint16_t addr, uint8_t data) __attribute__((always_inline, unused));
-inline void onPhi_1_Fall(void);
+template <bool EMC>          inline void onPhi_1_Fall(void) __attribute__((always_inline));
 
 ioReadFuncPtr_t ioReadFuncs[256];      //ensure the setup() code initialises this!
 ioWriteFuncPtr_t ioWriteFuncs[256];
 
+#if ENABLE_ISR_STATS
+//
+//  Add one timing measurement (in CPU cycles) to a set of ISR statistics. See "show isrstats"
+//
+inline void isr_stats_record(struct S_ISR_Timing *stat, uint32_t cycles) __attribute__((always_inline));
+inline void isr_stats_record(struct S_ISR_Timing *stat, uint32_t cycles)
+{
+  uint32_t  bin;
+
+  if ((stat->count == 0) || (cycles < stat->min))
+  {
+    stat->min = cycles;
+  }
+  if (cycles > stat->max)
+  {
+    stat->max = cycles;
+  }
+  stat->count++;
+  stat->total += cycles;
+  bin = 31 - __builtin_clz(cycles | 1);           //  log2, rounded down
+  if (bin >= ISR_STATS_HISTOGRAM_BINS)
+  {
+    bin = ISR_STATS_HISTOGRAM_BINS - 1;
+  }
+  stat->histogram[bin]++;
+}
+#endif
+
 //
 //  Variables for the EMC (Extended Memory Controller)
 //
 
 #if ENABLE_EMC_SUPPORT
-DMAMEM uint8_t      emcram[EMC_RAM_SIZE];
 volatile bool       ifetch , m_emc_mult;
 volatile uint8_t    m_emc_drp;
 volatile uint8_t    disp;
@@ -75,6 +102,8 @@ volatile uint32_t   m_emc_read, m_emc_write;
 volatile uint32_t   m_emc_start_addr;
 volatile uint32_t   m_emc_end_addr;
 volatile bool       m_emc_master;
+static bool         emc_holding;                    //  HALT is asserted for EMC_Bank_Wanted
+bool                m_emc_active;                   //  Set by emc_init(), selects the ISR variant with EMC tracking
 
 enum {
 		  EMC_IDLE,
@@ -87,39 +116,15 @@ void lma_cycle(bool state);
 
 bool on_Diag_Read_PTR2(void);
 
-#if ENABLE_TRACE_EMC
-struct EMC_Trace_1_Struct {
-          uint32_t  ptr_1_contents;
-          uint32_t  ptr_2_contents;
-          uint32_t  Trace_mask;
-          uint32_t  Cycle_count;
-          uint8_t   Trace_val;
-          uint8_t   Trace_cycleNdx;
-} EMC_Trace_1[EMC_DIAG_BUF_SIZE];
-uint32_t  Trace_index = 0;
-#endif
-
-#if ENABLE_TRACE_PTR2
-struct EMC_Trace_2_struct {
-          uint32_t  ptr_2_contents_pre;
-          uint32_t  ptr_2_contents_post;
-          uint32_t  Cycle_count;
-          uint8_t   Trace_cycleNdx;
-          uint8_t   Trace_op;        ##### Trace_op consts should be enums
-          uint8_t   Dec_disp;
-          uint8_t   EMC_DRP;
-          uint8_t   EMC_DRP_Loaded;
-}  EMC_Trace_2[EMC_PTR2_BUF_SIZE];
-uint32_t  Trace_index = 0;
-bool      DRP_has_been_Loaded;
-uint8_t   New_DRP;
-#endif
-
 #endif
 
 volatile bool intEn_1MB5 = false;
 int intrState = 0;
 
+#if ENABLE_HP85_RAM_SHADOW
+EXTMEM uint8_t HP85_Shadow[HP85_SHADOW_SIZE];     //  Written from HP85_Shadow_FIFO[] by loop(), see EBTKS_HP85_Shadow.cpp
+#endif
+
 bool ioReadNullFunc(void) //  This function is running within an ISR, keep it short and fast.
 {
   return false;
@@ -187,6 +192,40 @@ bool enRam16k = false;
 void enHP85RamExp(bool en)
 {
   enRam16k = en;
+  rebuildBusPages();
+}
+
+//
+//  Rebuild the RAM pages of busReadPages[] and busWritePages[]. Needed whenever the 16K RAM expansion is
+//  enabled or disabled, which depends on the machine type in CONFIG.TXT. The ROM window (060000..077777)
+//  belongs to mapRomPages(), which is called on every write to RSELEC.
+//
+//  This may run while the bus ISR is active, so each entry goes straight to its final value, without
+//  disabling interrupts. The bus ISR never writes these entries
+//
+
+void rebuildBusPages(void)
+{
+  int       page;
+  uint8_t   *ram;
+
+  for (page = 0 ; page < 256 ; page++)
+  {
+    if ((page >= (ROM_PAGE >> 8)) && (page < ((ROM_PAGE + ROM_PAGE_SIZE) >> 8)))
+    {
+      continue;
+    }
+    ram = NULL;
+    if (enRam16k && (page >= (HP85A_16K_RAM_module_base_addr >> 8)) && (page < (IO_ADDR >> 8)))
+    {
+      //
+      //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
+      //
+      ram = &HP85A_16K_RAM_module[(page << 8) - HP85A_16K_RAM_module_base_addr];
+    }
+    busReadPages[page]  = ram;
+    busWritePages[page] = ram;
+  }
 }
 
 bool getHP85RamExp(void)      //  Report true if HP85A RAM expansion is enabled
@@ -453,16 +492,24 @@ bool getHP85RamExp(void)      //  Report true if HP85A RAM expansion is enabled
 //
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 //
-//  The declaration for this function (in EBTKS_Function_Declarations.h)
-//  must explicitly indicate that this is an ISR. It looks like this
+//  The declaration for this function, and its variants that are built from
+//  pinChange_cycle() (in EBTKS_Function_Declarations.h) must explicitly
+//  indicate that this is an ISR. It looks like this
 //    FASTRUN void pinChange_isr(void) __attribute__ ((interrupt ("IRQ")));
 //
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
-FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short and fast.
+template <bool EMC, bool LA>
+inline void pinChange_cycle(void) __attribute__((always_inline));
+template <bool EMC, bool LA>
+inline void pinChange_cycle(void)     //  This function is an ISR, keep it short and fast.
 {
 
   uint32_t interrupts;
+#if ENABLE_ISR_STATS
+  uint32_t isr_start = ARM_DWT_CYCCNT;
+  uint32_t phase_start;
+#endif
 
   SET_SCOPE_1;        //  Time point A
   interrupts = PHI_1_and_2_ISR;         //  This is a GPIO ISR Register
@@ -470,7 +517,13 @@ FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short
   //CLEAR_SCOPE_1;    //  Time point B
 
   //SET_SCOPE_2;      //  Time point C
-  onPhi_1_Rise();
+#if ENABLE_ISR_STATS
+  phase_start = ARM_DWT_CYCCNT;
+  onPhi_1_Rise<LA>();
+  isr_stats_record(&ISR_Stats_Phase[ISR_PHASE_RISE], ARM_DWT_CYCCNT - phase_start);
+#else
+  onPhi_1_Rise<LA>();
+#endif
   //CLEAR_SCOPE_2;    //  Time point D
   WAIT_WHILE_PHI_1_HIGH;          //  While Phi_1 is high, just hang around, not worth doing a return from interrupt
                                   //  and then having an interrupt on the falling edge.
@@ -479,7 +532,14 @@ FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short
                                   //  after the edge by that excess time. This does occur.
 
   //SET_SCOPE_1;      //  Time point E
-  onPhi_1_Fall();
+#if ENABLE_ISR_STATS
+  phase_start = ARM_DWT_CYCCNT;
+  isr_stats_record(&ISR_Stats_Phase[ISR_PHASE_TO_FALL], phase_start - isr_start);
+  onPhi_1_Fall<EMC>();
+  isr_stats_record(&ISR_Stats_Phase[ISR_PHASE_FALL], ARM_DWT_CYCCNT - phase_start);
+#else
+  onPhi_1_Fall<EMC>();
+#endif
   pin_isr_count++;    //  Used to detect that HP85 power is off
   //CLEAR_SCOPE_1;    //  Time point F
 
@@ -488,11 +548,121 @@ FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short
   //CLEAR_SCOPE_2;    //  Time point H
 
   //SET_SCOPE_1;      //  Time point I
-  mid_cycle_processing();
+#if ENABLE_ISR_STATS
+  phase_start = ARM_DWT_CYCCNT;
+  mid_cycle_processing<EMC>();
+  isr_stats_record(&ISR_Stats_Phase[ISR_PHASE_MID], ARM_DWT_CYCCNT - phase_start);
+  isr_stats_record(&ISR_Stats_Phase[ISR_PHASE_TOTAL], ARM_DWT_CYCCNT - isr_start);
+#else
+  mid_cycle_processing<EMC>();
+#endif
   CLEAR_SCOPE_1;      //  Time point J
 
 }
 
+//
+//  The ISR variants. See select_pinChange_isr()
+//
+
+FASTRUN void pinChange_isr(void)
+{
+  pinChange_cycle<(ENABLE_EMC_SUPPORT != 0), true>();
+}
+
+FASTRUN void pinChange_isr_no_emc(void)
+{
+  pinChange_cycle<false, false>();
+}
+
+#if ENABLE_EMC_SUPPORT
+FASTRUN void pinChange_isr_emc(void)
+{
+  pinChange_cycle<true, false>();
+}
+#endif
+
+#if ENABLE_LA_SEQUENCER
+//
+//  Advance the trigger sequencer by one bus cycle. Returns true when the trigger fires. Only the current
+//  state is looked at, so this is at most two comparisons and a cycle count, however many states there are.
+//  Called by onPhi_1_Rise() for "la go", and from the background for "la deep". See EBTKS_LA_Trigger.cpp
+//
+
+static inline bool la_comparator_match(const struct S_LA_Trigger_Comparator *cmp, uint32_t main_sample, uint32_t aux_sample)
+{
+  return ((main_sample & cmp->main_mask) == cmp->main_value)                    &&
+         ((aux_sample  & cmp->aux_mask)  == cmp->aux_value)                     &&
+         ((uint16_t)((uint16_t)(main_sample >> 8) - cmp->addr_low) <= cmp->addr_span);
+}
+
+FASTRUN bool Logic_Analyzer_Sequencer_Step(uint32_t main_sample, uint32_t aux_sample)
+{
+  const struct S_LA_Trigger_State   *state = &Logic_Analyzer_Sequence[Logic_Analyzer_Sequencer_State];
+  uint8_t                           next;
+
+  Logic_Analyzer_Sequencer_Cycles++;
+  if (la_comparator_match(&state->cmp[0], main_sample, aux_sample))
+  {
+    if (--Logic_Analyzer_Sequencer_Count > 0)
+    {
+      return false;                                                             //  Need more matches in this state
+    }
+    next = state->goto_state[0];
+  }
+  else if ((state->goto_state[1] != LA_SEQUENCER_UNUSED) && la_comparator_match(&state->cmp[1], main_sample, aux_sample))
+  {
+    next = state->goto_state[1];
+  }
+  else if (state->within && (Logic_Analyzer_Sequencer_Cycles > state->within))
+  {
+    next = state->timeout_state;
+  }
+  else
+  {
+    return false;
+  }
+
+  if (next == LA_SEQUENCER_FIRE)
+  {
+    return true;
+  }
+  Logic_Analyzer_Sequencer_State  = next;
+  Logic_Analyzer_Sequencer_Cycles = 0;
+  Logic_Analyzer_Sequencer_Count  = Logic_Analyzer_Sequence[next].count;
+  return false;
+}
+#endif
+
+#if ENABLE_PROFILER
+//
+//  Count one sampled instruction fetch. The bank switched ROM window is counted per ROM, with a slot
+//  given to each RSELEC value the first time it is seen. See EBTKS_Profiler.cpp
+//
+
+FASTRUN void Profiler_Record(uint32_t address, uint32_t rselec)
+{
+  uint32_t    slot;
+
+  Profiler_Samples++;
+  if ((address & 0xE000U) != 0x6000U)                                           //  Not 060000 to 077777
+  {
+    Profiler_Buckets[address >> PROFILER_BUCKET_SHIFT]++;
+    return;
+  }
+  if ((slot = Profiler_ROM_Slot[rselec]) == 0)
+  {
+    if (Profiler_ROM_Slots_Used >= PROFILER_ROM_SLOTS)
+    {
+      Profiler_ROM_Overflow++;
+      return;
+    }
+    Profiler_ROM_Rselec[Profiler_ROM_Slots_Used] = rselec;
+    slot = Profiler_ROM_Slot[rselec] = ++Profiler_ROM_Slots_Used;
+  }
+  Profiler_ROM_Buckets[slot - 1][(address & 0x1FFFU) >> PROFILER_BUCKET_SHIFT]++;
+}
+#endif
+
 //
 //  Data is valid during the Phi 1, possible drivers are:
 //      Capricorn
@@ -523,6 +693,7 @@ FASTRUN void pinChange_isr(void)      //  This function is an ISR, keep it short
 //      If Phi 1 is still high, wait
 //
 
+template <bool LA>
 inline void onPhi_1_Rise(void)                  //  This function is running within an ISR, keep it short and fast.             This needs to be timed.
 {
   uint32_t data_from_IO_bus;
@@ -555,7 +726,7 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
 //  30            Instruction Fetch Flag                                                            IF   CORE_PIN32_BIT     12       GPIO7       IOMUXC_SW_MUX_CTL_PAD_GPIO_B0_12
 //  29            /IRLX    Interrupt Request Signal from Bus (Might be us or some other module)     T04  CORE_PIN4_BIT       6       GPIO9       IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_06
 //  28            /HALTX   DMA Request Signal from Bus       (Might be us or some other module)     T05  CORE_PIN5_BIT       8       GPIO9       IOMUXC_SW_MUX_CTL_PAD_GPIO_EMC_08
-//  27            currently unused
+//  27            currently unused by the ISR. In "la stream" captures, set on the first sample after samples were lost (LA_STREAM_GAP_BIT)
 //  26            /WRX    recorded at the prior Phi 2
 //  25            /RDX    recorded at the prior Phi 2
 //  24            /LMA    recorded at the prior Phi 2
@@ -578,14 +749,17 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
                                 (addReg << 8)    |                            //  because we are very fast, it is ok to take
                                 Logic_Analyzer_current_bus_cycle_state_LA;    //  data on Phi 1 Rising edge, unlike HP-85 that    Logic_Analyzer_current_bus_cycle_state_LA is setup in the Phi 2 code
                                                                               //  uses the falling edge.
-  Logic_Analyzer_aux_sample  =  getRselec() & 0x000000FF;                     //  Get the Bank switched ROM select code
-  Logic_Analyzer_aux_sample  |= ((uint32_t)m_emc_drp << 8);                   //  Track our local copy of DRP.
+  if (LA)                                                                     //  Only the Logic Analyzer uses the aux sample
+  {
+    Logic_Analyzer_aux_sample  =  getRselec() & 0x000000FF;                   //  Get the Bank switched ROM select code
+    Logic_Analyzer_aux_sample  |= ((uint32_t)m_emc_drp << 8);                 //  Track our local copy of DRP.
                                                                               //     This does not work on HP85A because IFETCH is not connected to the backplane
+  }
 
   //CLEAR_SCOPE_2;      //  Time point AD
 
   //SET_SCOPE_2;        //  Time point AD
-  if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
+  if (LA && (Logic_Analyzer_State == ANALYZER_ACQUIRING))
   {
     //
     //  Check for trigger pattern
@@ -605,6 +779,17 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
         //   TOGGLE_SCOPE_2;
         // }
 
+#if ENABLE_LA_SEQUENCER
+        if (Logic_Analyzer_Sequencer_Active)
+        {
+          if (Logic_Analyzer_Sequencer_Step(Logic_Analyzer_main_sample, Logic_Analyzer_aux_sample))
+          {
+            Logic_Analyzer_Triggered = true;
+            Logic_Analyzer_Index_of_Trigger = Logic_Analyzer_Data_index;    //  Record the buffer index at time of trigger
+          }
+        }
+        else
+#endif
         if ( ((Logic_Analyzer_main_sample & Logic_Analyzer_Trigger_Mask_1) == Logic_Analyzer_Trigger_Value_1) &&
              ((Logic_Analyzer_aux_sample  & Logic_Analyzer_Trigger_Mask_2) == Logic_Analyzer_Trigger_Value_2)    )
         {   //  Trigger pattern has been matched
@@ -632,10 +817,46 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
       if (--Logic_Analyzer_Samples_Till_Done == 0)
       {
         Logic_Analyzer_State = ANALYZER_ACQUISITION_DONE;
+        select_pinChange_isr();                                             //  Takes effect from the next bus cycle
         //  CLEAR_SCOPE_2;                                                    //  End of Trigger of an external logic analyzer
       }
     }
   }
+#if ENABLE_LA_STREAM
+  else if (LA && (Logic_Analyzer_State >= ANALYZER_STREAMING))
+  {
+    //
+    //  "la stream" and "la deep". No trigger here, just store every sample in the stream ring buffer, and
+    //  the background does the rest. If the background hasn't kept up, count the lost sample and mark the
+    //  next one that is stored
+    //
+    if ((LA_Stream_Head - LA_Stream_Tail) < LA_STREAM_RING_SIZE)
+    {
+      LA_Stream_Ring[LA_Stream_Head & (LA_STREAM_RING_SIZE - 1)].main = Logic_Analyzer_main_sample | LA_Stream_Gap_Flag;
+      LA_Stream_Ring[LA_Stream_Head & (LA_STREAM_RING_SIZE - 1)].aux  = Logic_Analyzer_aux_sample;
+      LA_Stream_Head++;
+      LA_Stream_Gap_Flag = 0;
+    }
+    else
+    {
+      LA_Stream_Dropped++;
+      LA_Stream_Gap_Flag = LA_STREAM_GAP_BIT;
+    }
+  }
+#endif
+#if ENABLE_PROFILER
+  //
+  //  Sampling profiler. An instruction fetch is a read cycle with IFETCH (bit 30) set
+  //
+  if (LA && Profiler_Active && ((Logic_Analyzer_main_sample & (0x40000000 | BIT_MASK_RD)) == 0x40000000))
+  {
+    if (--Profiler_Countdown == 0)
+    {
+      Profiler_Countdown = Profiler_Period;
+      Profiler_Record((Logic_Analyzer_main_sample >> 8) & 0x0000FFFFU, Logic_Analyzer_aux_sample & 0x000000FFU);
+    }
+  }
+#endif
   //CLEAR_SCOPE_2;      //  Time point AE
 
 //
@@ -665,6 +886,7 @@ inline void onPhi_1_Rise(void)                  //  This function is running wit
 //  Thus ?? ns margin until precharge during Phi 12
 //
 
+template <bool EMC>
 inline void onPhi_1_Fall(void)
 {
   uint32_t data_from_IO_bus;
@@ -690,29 +912,28 @@ inline void onPhi_1_Fall(void)
   //CLEAR_SCOPE_2;      //  Time point BC
 
 #if ENABLE_EMC_SUPPORT
-  //SET_SCOPE_2;      //  Time point BC
-  if (schedule_read || schedule_write)
+  if (EMC)
   {
-    cycleNdx++;                         //  Keep track of the bus cycle count
-  }
-  //
-  //  Capture DRP instructions for the extended memory controller
-  //  and if the instruction is a multiple byte transfer
-  //
-  if (ifetch == true)
-  {
-    if ((data_from_IO_bus & 0xc0u) == 0x40u)    //  DRP instruction 0x40..0x7f?
-    //if (1)    //  DRP instruction 0x40..0x7f?
+    //SET_SCOPE_2;      //  Time point BC
+    if (schedule_read || schedule_write)
     {
-      m_emc_drp = data_from_IO_bus;
-#if ENABLE_TRACE_PTR2
-      DRP_has_been_Loaded = true;
-      New_DRP = data_from_IO_bus;
-#endif
+      cycleNdx++;                         //  Keep track of the bus cycle count
     }
-    m_emc_mult = data_from_IO_bus & 1u;         //  Set if multiple byte instruction
+    //
+    //  Capture DRP instructions for the extended memory controller
+    //  and if the instruction is a multiple byte transfer
+    //
+    if (ifetch == true)
+    {
+      if ((data_from_IO_bus & 0xc0u) == 0x40u)    //  DRP instruction 0x40..0x7f?
+      //if (1)    //  DRP instruction 0x40..0x7f?
+      {
+        m_emc_drp = data_from_IO_bus;
+      }
+      m_emc_mult = data_from_IO_bus & 1u;         //  Set if multiple byte instruction
+    }
+    //CLEAR_SCOPE_2;      //  Time point BD
   }
-  //CLEAR_SCOPE_2;      //  Time point BD
 #endif
 
   //SET_SCOPE_2;      //  Time point BD
@@ -769,6 +990,7 @@ inline void onPhi_1_Fall(void)
 //                Over a week of bug tracking indicates that this is not true.
 //
 
+template <bool EMC>
 inline void mid_cycle_processing(void)                             //  This function is running within an ISR, keep it short and fast.
 {
   bool       lma;
@@ -792,24 +1014,27 @@ inline void mid_cycle_processing(void)                             //  This func
   //CLEAR_SCOPE_2;      //  Time point CB
 
 #if ENABLE_EMC_SUPPORT
-  //SET_SCOPE_2;        //  Time point CB
-  ifetch = (GPIO_PAD_STATUS_REG_IFETCH & BIT_MASK_IFETCH);    //  Grab the instruction fetch bit. Only exists on HP85B, 86 and 87
-                                                              //  Used for tracking instructions for the extended memory controller
-  //if ((rd != schedule_read) || (wr != schedule_write))      //  Reset on any change of read or write
-  if (lma != delayed_lma)                                     //  Reset count on change of lma
-  {
-    cycleNdx = 0;
-  }
-  if (lma == true)
+  if (EMC)
   {
-    lma_cycle(rd);                                            //  For emc support
-    cycleNdx &= 1;                                            //  Ensure cycleNdx is only 0 or 1 in an lma cycle
-  }
-  else
-  {
-    m_emc_lmard = false;
+    //SET_SCOPE_2;        //  Time point CB
+    ifetch = (GPIO_PAD_STATUS_REG_IFETCH & BIT_MASK_IFETCH);    //  Grab the instruction fetch bit. Only exists on HP85B, 86 and 87
+                                                                //  Used for tracking instructions for the extended memory controller
+    //if ((rd != schedule_read) || (wr != schedule_write))      //  Reset on any change of read or write
+    if (lma != delayed_lma)                                     //  Reset count on change of lma
+    {
+      cycleNdx = 0;
+    }
+    if (lma == true)
+    {
+      lma_cycle(rd);                                            //  For emc support
+      cycleNdx &= 1;                                            //  Ensure cycleNdx is only 0 or 1 in an lma cycle
+    }
+    else
+    {
+      m_emc_lmard = false;
+    }
+    //CLEAR_SCOPE_2;      //  Time point CC
   }
-  //CLEAR_SCOPE_2;      //  Time point CC
 #endif
 
   //SET_SCOPE_2;        //  Time point CC
@@ -951,6 +1176,25 @@ inline void mid_cycle_processing(void)                             //  This func
     DMA_Request = false;                  //  Only request once
     DMA_has_been_Requested = true;        //  Record that a request has occured on the bus, but has not yet been acknowledged
   }
+#if ENABLE_EMC_SUPPORT
+  //
+  //  Hold the HP-85 while an EMC pointer is close to a bank that is not in the cache, until emc_cache_poll()
+  //  has brought it in. Same timing as a DMA request. There is no DMA acknowledge to handle, the CPU just waits
+  //
+  if (EMC)
+  {
+    if (EMC_Bank_Wanted)
+    {
+      ASSERT_HALT;
+      emc_holding = true;
+    }
+    else if (emc_holding && !DMA_has_been_Requested)
+    {
+      RELEASE_HALT;
+      emc_holding = false;
+    }
+  }
+#endif
   //CLEAR_SCOPE_2;      //  Time point CI
 
 //
@@ -1067,6 +1311,8 @@ inline void mid_cycle_processing(void)                             //  This func
 
 inline bool onReadData(void)                  //  This function is running within an ISR, keep it short and fast.
 {
+  uint8_t   *page;
+
   //
   //  If any of these tests indicate that we need to supply data
   //    Put the data in readData
@@ -1074,41 +1320,31 @@ inline bool onReadData(void)                  //  This function is running withi
   //  else
   //    return false
   //
+  //  ROMs, the AUXROM RAM window and the 16K RAM expansion are all found with one lookup
+  //  in busReadPages[], which is kept up to date by rebuildBusPages() and mapRomPages()
+  //
 
   //SET_SCOPE_2;        //  Time point DA
-  if ((addReg & 0xE000) == ROM_PAGE) // ROM page 0x6000..0x7FFF   (8 KB)
+  if ((page = busReadPages[addReg >> 8]) != NULL)
   {
-    //
-    //  Knock off some MSBs so we address the ROM from addReg 0
-    //  This function knows about the AUXROM RAM Window, and handles these reads as well
-    //
-    return readBankRom(addReg & (ROM_PAGE_SIZE - 1));
-  }
-  //CLEAR_SCOPE_2;      //  Time point DB, if test false
-
-  //SET_SCOPE_2;        //  Time point DC
-  if (enRam16k)
-  {
-    //
-    //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
-    //
-    if ((addReg >= HP85A_16K_RAM_module_base_addr) && (addReg < IO_ADDR))
-    {
-      readData = HP85A_16K_RAM_module[addReg & 0x3FFF];
-      //CLEAR_SCOPE_2;      //  Time point DD, if test true, true
-      return true;
-    }
-    //CLEAR_SCOPE_2;      //  Time point DD, if test true, false
+    readData = page[addReg & 0x00FFU];
+    //CLEAR_SCOPE_2;      //  Time point DB, if memory read
+    return true;
   }
-  //CLEAR_SCOPE_2;      //  Time point DD, if test false
 
   //
   //  Process I/O reads (data from I/O bus to the CPU)
   //
-  //SET_SCOPE_2;        //  Time point DE
   if ((addReg & 0xFF00U) == 0xFF00U)
   {
+#if ENABLE_ISR_STATS
+    uint32_t  start = ARM_DWT_CYCCNT;
+    bool      result = (ioReadFuncs[addReg & 0x00FFU])();
+    isr_stats_record(&ISR_Stats_IO_Read[addReg & 0x00FFU], ARM_DWT_CYCCNT - start);
+    return result;
+#else
     return (ioReadFuncs[addReg & 0x00FFU])();  // Call I/O read handler
+#endif
   }
 
   //
@@ -1123,7 +1359,6 @@ inline bool onReadData(void)                  //  This function is running withi
 //
 //    Note: By the time we get to this routine, the bus has already been captured.
 //
-//    Any ROM that we are emulating
 //    Any RAM that we are emulating
 //    Any Special RAM that we are implementing within the AUXROMs
 //    Any I/O registers that we are implementing
@@ -1134,39 +1369,91 @@ inline bool onReadData(void)                  //  This function is running withi
 
 inline void onWriteData(uint16_t addr, uint8_t data)
 {
+  uint8_t   *page;
+
   //
-  //  Process I/O writes
+  //  RAM expansion and the AUXROM RAM window, via busWritePages[]
   //
-  if ((addr & 0xFF00U) == 0xFF00U)
+  if ((page = busWritePages[addr >> 8]) != NULL)
   {
-    (ioWriteFuncs[addr & 0xFFU])(data);  //  Call an I/O write handler
+    page[addr & 0x00FFU] = data;
     return;
   }
 
+#if ENABLE_HP85_RAM_SHADOW
   //
-  //  For HP-85 A, implement 16384 - 256 bytes of RAM, mapped at 0xC000 to 0xFEFF (if enabled)
+  //  HP-85 RAM, see EBTKS_HP85_Shadow.cpp
   //
-  if (enRam16k)
+  if ((uint32_t)(addr - HP85_SHADOW_BASE) < HP85_Shadow_Span)      //  0 until PSRAM is known to be fitted
   {
-    if ((addr >= HP85A_16K_RAM_module_base_addr) && (addr < IO_ADDR))
+    uint32_t  head = HP85_Shadow_FIFO_Head;
+
+    if (head - HP85_Shadow_FIFO_Tail < HP85_SHADOW_FIFO_SIZE)     //  Never the PSRAM here, loop() applies the FIFO
     {
-      HP85A_16K_RAM_module[addr & 0x3FFFU] = data;
-      return;
+      HP85_Shadow_FIFO[head & (HP85_SHADOW_FIFO_SIZE - 1)].addr = addr;
+      HP85_Shadow_FIFO[head & (HP85_SHADOW_FIFO_SIZE - 1)].data = data;
+      HP85_Shadow_FIFO_Head = head + 1;                           //  Only after the entry is complete
     }
+    else
+    {                                                             //  Full, so this write is lost and the shadow is stale
+      HP85_Shadow_Valid = false;
+      HP85_Shadow_Invalidations++;
+    }
+    return;
   }
+#endif
 
   //
-  //  Handle special RAM window in the AUXROM(s)
+  //  Process I/O writes
   //
+  if ((addr & 0xFF00U) == 0xFF00U)
+  {
+#if ENABLE_ISR_STATS
+    uint32_t  start = ARM_DWT_CYCCNT;
+    (ioWriteFuncs[addr & 0xFFU])(data);
+    isr_stats_record(&ISR_Stats_IO_Write[addr & 0xFFU], ARM_DWT_CYCCNT - start);
+#else
+    (ioWriteFuncs[addr & 0xFFU])(data);  //  Call an I/O write handler
+#endif
+  }
+}
+
+//
+//  pinChange_isr() comes in several variants, specialized at compile time (see pinChange_cycle() ) so that
+//  the ISR does not spend time testing for features that can't change while it is running:
+//
+//    pinChange_isr()         Everything, including the Logic Analyzer. Used while the Logic Analyzer is acquiring,
+//                            and while the profiler is running
+//    pinChange_isr_emc()     EMC / IFETCH tracking, no Logic Analyzer. HP85AEMC, HP85B, HP86, HP87 with EMC enabled
+//    pinChange_isr_no_emc()  Neither. HP83, HP85A, 9915, and any machine with EMC disabled in CONFIG.TXT
+//
+//  The 16K RAM expansion, ROMs and AUXROM window need no variant, as they are found through busReadPages[]
+//  and busWritePages[]. Interrupt state (intrState) changes from cycle to cycle, so it is still tested at run time.
+//  This must be called again on every change of Logic_Analyzer_State, including the end of an acquisition in the
+//  ISR, and when the profiler starts or stops. Otherwise the slower full variant stays installed
+//
+
+FASTRUN void select_pinChange_isr(void)
+{
+  void (*isr)(void) = &pinChange_isr_no_emc;
 
-  if ((getRselec() >= AUXROM_PRIMARY_ID) && (getRselec() <= AUXROM_SECONDARY_ID_END))      //  Testing for Primary AUXROM and all secondaries
+  if ((Logic_Analyzer_State == ANALYZER_ACQUIRING) || (Logic_Analyzer_State >= ANALYZER_STREAMING))
   {
-    if ((addr >= (AUXROM_RAM_WINDOW_START + 060000)) && (addr <= (AUXROM_RAM_WINDOW_LAST + 060000)))     //  Write AUXROM shared RAM window
-    {
-      AUXROM_RAM_Window.as_bytes[addr - AUXROM_RAM_WINDOW_START - 060000] = data;
-      return;
-    }
+    isr = &pinChange_isr;
+  }
+#if ENABLE_PROFILER
+  else if (Profiler_Active)
+  {
+    isr = &pinChange_isr;                               //  The profiler needs the aux sample (RSELEC)
+  }
+#endif
+#if ENABLE_EMC_SUPPORT
+  else if (m_emc_active)
+  {
+    isr = &pinChange_isr_emc;
   }
+#endif
+  attachInterruptVector(IRQ_GPIO6789, isr);             //  Just updates the RAM vector table, so safe while interrupts are enabled
 }
 
 void setupPinChange(void)
@@ -1182,7 +1469,7 @@ void setupPinChange(void)
   //
   //  And then use our ISR to bypass the longwinded Teensy core one
   //
-  attachInterruptVector(IRQ_GPIO6789, &pinChange_isr);
+  select_pinChange_isr();
   NVIC_SET_PRIORITY(IRQ_GPIO6789, 16);  //  irqnum, priority. lower num = higher priority
   // NVIC_ENABLE_IRQ(IRQ_GPIO6789);     //  Disabled by PMF 5/25/2020   Don't do interrupts until PWO goes high
   __enable_irq();
@@ -1258,6 +1545,8 @@ void emc_init(void)
   m_emc_start_addr = get_EMC_StartAddress();
   m_emc_end_addr   = get_EMC_EndAddress();
   m_emc_master     = get_EMC_master();           //  When true - we are the only or master EMC in the system. Only on HP85AEMC with IF modification
+  m_emc_active     = true;                       //  setupPinChange() will install the ISR variant that tracks IFETCH and DRP
+  emc_cache_init();                              //  Map the banks before the ISR can use them
 
   setIOReadFunc( 0xc8 , &emc_r );
   setIOReadFunc( 0xc9 , &emc_r );
@@ -1281,8 +1570,8 @@ void emc_init(void)
 }
 
 uint8_t   Diag_Read_PTR2_ctr = 0;
-uint32_t  diag_snap_PTR2 = 0;                 //  Looks like this is only needed when ENABLE_TRACE_EMC is enabled
-bool      diag_snap_lock = false;             //  Looks like this is only needed when ENABLE_TRACE_EMC is enabled
+uint32_t  diag_snap_PTR2 = 0;                 //  PTR2 at the first diagnostic read, for debugging
+bool      diag_snap_lock = false;
 
 //
 //  note ! uses C++ 'reference', so it returns either a pointer to m_emc_ptr1 or m_emc_ptr2
@@ -1300,14 +1589,58 @@ inline uint32_t &get_ptr()
   }
 }
 
-#if ENABLE_TRACE_EMC
-struct EMC_Trace_1_Struct *trace_ptr;
-#endif
+#if ENABLE_EMC_TRACE
+DMAMEM struct S_EMC_Trace_Event EMC_Trace_Ring[EMC_TRACE_RING_SIZE];
+
+//
+//  Only called if EMC_Trace_Active, so with tracing off it costs each EMC operation one predictable
+//  branch. The window test also rejects ptr < EMC_Trace_Low, as the subtraction wraps
+//
+
+FASTRUN void EMC_Trace_Record(uint8_t op, uint32_t ptr, uint8_t data)
+{
+  struct S_EMC_Trace_Event  *event;
 
-#if ENABLE_TRACE_PTR2
-struct EMC_Trace_2_struct *trace_ptr;
+  if ((ptr - EMC_Trace_Low) > EMC_Trace_Span)
+  {
+    return;
+  }
+  event = &EMC_Trace_Ring[EMC_Trace_Count++ & (EMC_TRACE_RING_SIZE - 1)];
+  event->ptr       = ptr;
+  event->cycle     = pin_isr_count;
+  event->op        = op;
+  event->data      = data;
+  event->drp       = m_emc_drp;
+  event->cycle_ndx = (uint8_t)cycleNdx;
+  event->mode      = m_emc_mode;
+}
+
+#define EMC_TRACE(op, ptr, data)      do { if (EMC_Trace_Active) EMC_Trace_Record(op, ptr, data); } while (0)
+#else
+#define EMC_TRACE(op, ptr, data)      do { } while (0)
 #endif
 
+//
+//  Ask for the banks within EMC_HOLD_MARGIN bytes of ptr that are not in the cache, see EBTKS_EMC_Cache.cpp.
+//  Called whenever a pointer is written or moves. One of the two is always in ptr's own bank
+//
+
+inline void emc_want(uint32_t ptr)
+{
+  uint32_t  span = m_emc_end_addr - m_emc_start_addr;
+  uint32_t  offset;
+
+  offset = ptr - m_emc_start_addr + EMC_HOLD_MARGIN;
+  if ((offset <= span) && (EMC_Bank_Ptr[offset / EMC_BANK_SIZE] == NULL))
+  {
+    EMC_Bank_Wanted |= 1U << (offset / EMC_BANK_SIZE);
+  }
+  offset = ptr - m_emc_start_addr - EMC_HOLD_MARGIN;
+  if ((offset <= span) && (EMC_Bank_Ptr[offset / EMC_BANK_SIZE] == NULL))
+  {
+    EMC_Bank_Wanted |= 1U << (offset / EMC_BANK_SIZE);
+  }
+}
 
 inline void emc_ptr12_decrement(void)
 {
@@ -1319,40 +1652,7 @@ inline void emc_ptr12_decrement(void)
   {
     disp = 2u - (m_emc_drp & 1u);       //  For example DRP==12 results in disp == 2, DRP==13 results in disp == 1
   }
-
-#if ENABLE_TRACE_PTR2
-  if (get_ptr() == m_emc_ptr2)
-  {
-    if ((m_emc_ptr2 > EMC_PTR2_TRACE_WINDOW_LOW) && (m_emc_ptr2 < EMC_PTR2_TRACE_WINDOW_HIGH) && (Trace_index < EMC_PTR2_BUF_SIZE))
-    {
-      trace_ptr                         = &EMC_Trace_2[Trace_index];
-      trace_ptr->Dec_disp               = disp;
-      trace_ptr->EMC_DRP                = m_emc_drp;
-      trace_ptr->ptr_2_contents_pre     = m_emc_ptr2;
-      trace_ptr->Trace_cycleNdx         = cycleNdx;
-      trace_ptr->Cycle_count            = pin_isr_count;
-      if (m_emc_mult)
-      {
-        trace_ptr->Trace_op             = 1;                  //  Op 1 is emc_ptr12_decrement() , multiple   ##### Trace_op consts should be enums
-      }
-      else
-      {
-        trace_ptr->Trace_op             = 2;                  //  Op 2 is emc_ptr12_decrement() , by 1
-      }
-      trace_ptr->ptr_2_contents_post    = (m_emc_mult ? m_emc_ptr2 - disp : m_emc_ptr2 - 1);
-      if (DRP_has_been_Loaded)
-      {
-        trace_ptr->EMC_DRP_Loaded       = New_DRP;
-        DRP_has_been_Loaded = false;
-      }
-      else
-      {
-        trace_ptr->EMC_DRP_Loaded       = 0xff;
-      }
-      Trace_index++;
-    }
-  }
-#endif
+  EMC_TRACE(EMC_TRACE_DEC, get_ptr(), m_emc_mult ? disp : 1);
 
   if (m_emc_mult)
   {
@@ -1397,35 +1697,31 @@ bool emc_r(void)
     //
     if ((ptr >= m_emc_start_addr) && (ptr <= m_emc_end_addr))
     {
-      readData = emcram[ptr - m_emc_start_addr];
-      didRead = true;
-    }
+      uint32_t offset = ptr - m_emc_start_addr;
+#if ENABLE_ISR_STATS
+      uint32_t start = ARM_DWT_CYCCNT;
+#endif
 
-#if ENABLE_TRACE_PTR2
-    if (get_ptr() == m_emc_ptr2)
-    {
-      if ((m_emc_ptr2 > EMC_PTR2_TRACE_WINDOW_LOW) && (m_emc_ptr2 < EMC_PTR2_TRACE_WINDOW_HIGH) && (Trace_index < EMC_PTR2_BUF_SIZE))
+      uint8_t  *bank = EMC_Bank_Ptr[offset / EMC_BANK_SIZE];
+
+      if (bank != NULL)
       {
-        trace_ptr                       = &EMC_Trace_2[Trace_index];
-        trace_ptr->ptr_2_contents_pre   = m_emc_ptr2;
-        trace_ptr->Trace_cycleNdx       = cycleNdx;
-        trace_ptr->Cycle_count          = pin_isr_count;
-        trace_ptr->Trace_op             = 3;                  //  Op 3 is read indirect, with inc by 1
-        trace_ptr->ptr_2_contents_post  = ptr + 1;
-        if (DRP_has_been_Loaded)
-        {
-          trace_ptr->EMC_DRP_Loaded     = New_DRP;
-        }
-        else
-        {
-          trace_ptr->EMC_DRP_Loaded     = 0xff;
-        }
-        Trace_index++;
+        readData = bank[offset % EMC_BANK_SIZE];
+#if ENABLE_ISR_STATS
+        isr_stats_record(&ISR_Stats_EMC[ISR_EMC_CACHE_READ], ARM_DWT_CYCCNT - start);
+#endif
+      }
+      else
+      {                                                           //  Only in PSRAM, and the HP-85 wasn't held in time
+        EMC_Bank_Misses++;
+        EMC_Bank_Wanted |= 1U << (offset / EMC_BANK_SIZE);
       }
+      EMC_Bank_Accesses[offset / EMC_BANK_SIZE]++;
+      didRead = true;
     }
-#endif
-
+    EMC_TRACE(EMC_TRACE_READ, ptr, readData);
     ptr++;
+    emc_want(ptr);
   }
   else if (m_emc_lmard)
   {
@@ -1454,6 +1750,7 @@ bool emc_r(void)
     {
       readData = uint8_t(get_ptr() >> (8 * cycleNdx));
       didRead = m_emc_master;     //only one EMC controller should respond
+      EMC_TRACE(EMC_TRACE_PTR_READ, get_ptr(), readData);
     }
   }
   return didRead;
@@ -1466,36 +1763,40 @@ void emc_w(uint8_t val)
   {
     uint32_t &ptr = get_ptr();
 
-    if ((ptr >= m_emc_start_addr) && ((ptr - m_emc_start_addr) < EMC_RAM_SIZE))
-    {
-      emcram[ptr - m_emc_start_addr] = val;
-    }
-#if ENABLE_TRACE_PTR2
-    if (get_ptr() == m_emc_ptr2)
+    if ((ptr >= m_emc_start_addr) && (ptr <= m_emc_end_addr))
     {
-      if ((m_emc_ptr2 > EMC_PTR2_TRACE_WINDOW_LOW) && (m_emc_ptr2 < EMC_PTR2_TRACE_WINDOW_HIGH) && (Trace_index < EMC_PTR2_BUF_SIZE))
+      uint32_t offset = ptr - m_emc_start_addr;
+#if ENABLE_ISR_STATS
+      uint32_t start = ARM_DWT_CYCCNT;
+#endif
+
+      uint8_t  *bank = EMC_Bank_Ptr[offset / EMC_BANK_SIZE];
+
+      if (bank != NULL)
       {
-        trace_ptr                       = &EMC_Trace_2[Trace_index];
-        trace_ptr->ptr_2_contents_pre   = m_emc_ptr2;
-        trace_ptr->Trace_cycleNdx       = cycleNdx;
-        trace_ptr->Cycle_count          = pin_isr_count;
-        trace_ptr->Trace_op             = 4;                  //  Op 4 is write indirect, with inc by 1
-        trace_ptr->ptr_2_contents_post  = ptr + 1;
-        trace_ptr->Dec_disp             = disp;
-        trace_ptr->EMC_DRP              = m_emc_drp;
-        if (DRP_has_been_Loaded)
-        {
-          trace_ptr->EMC_DRP_Loaded     = New_DRP;
-        }
-        else
-        {
-          trace_ptr->EMC_DRP_Loaded     = 0xff;
-        }
-        Trace_index++;
+        bank[offset % EMC_BANK_SIZE] = val;
+#if ENABLE_ISR_STATS
+        isr_stats_record(&ISR_Stats_EMC[ISR_EMC_CACHE_WRITE], ARM_DWT_CYCCNT - start);
+#endif
+      }
+      else
+      {                                                           //  Only in PSRAM, and the HP-85 wasn't held in time. Lost
+        EMC_Bank_Misses++;
+        EMC_Bank_Wanted |= 1U << (offset / EMC_BANK_SIZE);
       }
+      EMC_Bank_Generation[offset / EMC_BANK_SIZE]++;              //  After the write, see emc_cache_poll()
+      EMC_Bank_Accesses[offset / EMC_BANK_SIZE]++;
+    }
+#if ENABLE_HP85_RAM_SHADOW
+    else if (ptr < 0200000)
+    {                                                             //  May be main RAM, without a write cycle we can see
+      HP85_Shadow_Valid = false;
+      HP85_Shadow_Invalidations++;
     }
 #endif
+    EMC_TRACE(EMC_TRACE_WRITE, ptr, val);
     ptr++;
+    emc_want(ptr);
   }
   else
   {
@@ -1507,6 +1808,8 @@ void emc_w(uint8_t val)
       uint32_t &ptr = get_ptr();
       mask = (uint32_t)0xffU << (8u * cycleNdx);
       ptr = (ptr & ~mask) | (uint32_t(val) << (8u * cycleNdx));
+      EMC_TRACE(EMC_TRACE_PTR_WRITE, ptr, val);
+      emc_want(ptr);                      //  Held from the end of this instruction, if the bank isn't cached
       // if(&ptr == &m_emc_ptr2)
       // {
       //   if(Trace_ptr_2_writes_index < 1024)
@@ -1517,24 +1820,6 @@ void emc_w(uint8_t val)
       //   }
       // }
     }
-#if ENABLE_TRACE_EMC
-    if (Trace_index == 0)
-    {
-      pin_isr_count = 0;
-    }
-
-    if (Trace_index < EMC_DIAG_BUF_SIZE)
-    {
-      trace_ptr                 = &EMC_Trace_1[Trace_index];
-      trace_ptr->Trace_val      = val;
-      trace_ptr->ptr_1_contents = m_emc_ptr1;
-      trace_ptr->ptr_2_contents = m_emc_ptr2;
-      trace_ptr->Trace_cycleNdx = cycleNdx;
-      trace_ptr->Trace_mask     = mask;
-      trace_ptr->Cycle_count    = pin_isr_count;
-      Trace_index++;
-    }
-#endif
   }
 }
 
@@ -1542,8 +1827,8 @@ bool on_Diag_Read_PTR2(void)
 {
   if(!diag_snap_lock)
   {
-    diag_snap_PTR2 = m_emc_ptr2;                            //  Looks like this is only needed when ENABLE_TRACE_EMC is enabled
-    diag_snap_lock = true;                                  //  Looks like this is only needed when ENABLE_TRACE_EMC is enabled, and is only set false in that potentially (usually) disabled code.
+    diag_snap_PTR2 = m_emc_ptr2;
+    diag_snap_lock = true;
   }
   readData = (m_emc_ptr2 >> (8 * Diag_Read_PTR2_ctr++));    //  No need to mask, dest is 8 bits
   if(Diag_Read_PTR2_ctr >= 3)
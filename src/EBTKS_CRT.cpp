@@ -41,42 +41,14 @@ DMAMEM uint8_t compress[8192];
 //
 
 //
-//  These definitions are for the HP86 and HP87
+//  The CRTSTS bit definitions for both machine families (CRTSTS87_ and CRTSTS85_) are in EBTKS.h
 //
-//  #define HP86_87_CRTSAD  (0177700)       //  CRT START ADDRESS   HP86/87   These 4 are already defined with the other I/O addresses
-//  #define HP86_87_CRTBAD  (0177701)       //  CRT BYTE ADDRESS    HP86/87   in EBTKS.H
-//  #define HP86_87_CRTSTS  (0177702)       //  CRT STATUS          HP86/87
-//  #define HP86_87_CRTDAT  (0177703)       //  CRT DATA            HP86/87
-//
-//  CRTSTS Read bit functions
-//
-#define CRTSTS87_GRAPH      (1 << 7)        //  1 = graphics mode, 0 = alpha mode
-#define CRTSTS87_MODE       (1 << 6)        //  0 = normal graphics 400 pixels/line/ 1 = graph all 544 pixels/line
-#define CRTSTS87_INV        (1 << 5)        //  1 = inverse, 0 = normal
-#define CRTSTS87_ALPHA      (1 << 3)        //  1 = 24 lines of alpha (10 pixels per char height), 0 = 16 lines (15 pixels height)
-#define CRTSTS87_PWRD       (1 << 2)        //  1 = powerdown,0 = normal operation
-#define CRTSTS87_BLANK      (1 << 1)        //  1 = screen blanked. when blanked, you get higher speed memory access
-#define CRTSTS87_BUSY       (1 << 0)        //  1 = CRT controller is busy
 
-//
-//  These definitions are for the HP83, HP85A/B, and 9915A/B. See HP85 Assembler manual, PDF page 273
-//
-//  #define CRTSAD          (0177404)       //  CRT START ADDRESS HP85A/B   These 4 are already defined with the other I/O addresses
-//  #define CRTBAD          (0177405)       //  CRT BYTE ADDRESS  HP85A/B   in EBTKS.H
-//  #define CRTSTS          (0177406)       //  CRT STATUS        HP85A/B
-//  #define CRTDAT          (0177407)       //  CRT DATA          HP85A/B
-//
-//  CRTSTS Read bit functions
-//
-#define CRTSTS85_GRAPH        (error)       //  Can't read this status
-#define CRTSTS85_MODE         (error)       //  There is no mode bit
-#define CRTSTS85_INV          (error)       //  There is no invert bit
-#define CRTSTS85_ALPHA        (error)       //  Only 1 character height
-#define CRTSTS85_PWRD         (error)       //  Can't read this status
-#define CRTSTS85_BLANK        (error)       //  There is no blank bit
-#define CRTSTS85_BUSY         (1 << 7)      //  1 = CRT controller is busy
-#define CRTSTS85_DISPLAY_TIME (1 << 1)      //  1 = CRT Controller is sending pixels to CRT (not retrace time)
-#define CRTSTS85_DATA_READY   (1 << 0)      //  Requested data to be read from CRT RAM is now available.  (we could super duper speed this up by just reading our local copy, if we trust it)
+#if ENABLE_CRT_RECORD
+#define CRT_RECORD(reg, val)          do { if (CRT_Record_Active) CRT_Record_Write(reg, val); } while (0)
+#else
+#define CRT_RECORD(reg, val)          do { } while (0)
+#endif
 
 volatile bool writeCRTflag = false;
 
@@ -88,6 +60,16 @@ uint16_t sadAddr = 0;
 
 bool Is8687 = false;                        //  True if video is HP86/87 else HP85
 
+//
+//  Dirty blocks of current_screen.vram, set by the CRTDAT handlers with one OR per write, and taken by
+//  CRT_Dirty_Take(). On the HP85 the byte index is badAddr / 2 and the block is that / 32, so badAddr >> 6
+//
+
+static volatile uint32_t  crt_dirty_pending[CRT_DIRTY_WORDS];
+static volatile bool      crt_dirty_view_pending;
+static uint32_t           crt_dirty_local[CRT_DIRTY_WORDS];       //  From CRT_Dirty_Mark_Range(), never touched by the ISR
+static struct S_CRT_Dirty crt_dirty[CRT_DIRTY_CONSUMERS];
+
 //
 //  video memory can only be accessed in the retrace time
 //
@@ -100,15 +82,6 @@ bool Is8687 = false;                        //  True if video is HP86/87 else HP
 #define HP87_87_LAST_ALPHA      (4319)      // last addr of sad/bad in alpha mode
 #define HP86_87_LAST_GPAPH      (0x3FC0)
 
-// structure to hold the video subsystem snapshot
-typedef struct
-{
-  uint8_t vram[16384];
-  uint16_t sadAddr;
-  uint16_t badAddr;
-  uint8_t  ctrl;
-} video_capt_t;
-
 video_capt_t current_screen;                // contains the current HP85/86/87 screen state
 video_capt_t captured_screen;               // the current screen is copied into here when captured
 
@@ -152,11 +125,13 @@ void CRT_Timing_Test_5(void);
 
 void ioWriteCrtSad(uint8_t val) //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_SAD, val);
   if (sadFlag)
   {                                             //  If true, we are doing the high byte
     sadAddr |= (uint16_t)val << 8;              //  High byte
     sadAddr &= 037777;                          //  Limit it to valid addresses for 16 k nibbles of RAM
     current_screen.sadAddr = sadAddr;
+    crt_dirty_view_pending = true;
   }
   else
   { //  Low byte
@@ -176,6 +151,7 @@ void ioWriteCrtSad(uint8_t val) //  This function is running within an ISR, keep
 
 void ioWriteCrtBad(uint8_t val)                 //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_BAD, val);
   if (badFlag)
   {
     badAddr |= (uint16_t)val << 8;              //  High byte
@@ -197,7 +173,9 @@ void ioWriteCrtBad(uint8_t val)                 //  This function is running wit
 
 void ioWriteCrtCtrl(uint8_t val) //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_CTRL, val);
   current_screen.ctrl = val;
+  crt_dirty_view_pending = true;
 }
 
 //  The following comments only apply to this routine, for systems with 32x16 alpha screens (and 64 lines of memory)
@@ -227,6 +205,7 @@ void ioWriteCrtCtrl(uint8_t val) //  This function is running within an ISR, kee
 
 void ioWriteCrtDat(uint8_t val) //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_DAT, val);
   if (badAddr & 1)                                              //  If addr is ODD - we split nibbles. Does this ever happen in real life?
   {                                                             //  Code by RB. Reviewed by PMF 7/17/2020
                                                                 //  So the normal situation is Characters are written to even addresses, MS_nibble
@@ -238,11 +217,13 @@ void ioWriteCrtDat(uint8_t val) //  This function is running within an ISR, keep
     current_screen.vram[badAddr >> 1] |= (val >> 4);            //  and insert the MS_nibble.
     current_screen.vram[(badAddr >> 1) + 1] &= 0x0FU;           //  Go to the next logical byte, zero out the top 4 bits,
     current_screen.vram[(badAddr >> 1) + 1] |= (val << 4);      //  and insert the LS_nibble
+    crt_dirty_pending[((badAddr + 2) & 037777) >> 11] |= 1U << (((badAddr + 2) >> 6) & 31);   //  The next byte may be in the next block
   }
   else                                                           //  Else Even address is just a byte write
   {
     current_screen.vram[badAddr >> 1] = val;
   }
+  crt_dirty_pending[badAddr >> 11] |= 1U << ((badAddr >> 6) & 31);
 
   badAddr += 2;
   badAddr &= 037777;                                            //  Constrain the graphics addr
@@ -254,11 +235,13 @@ void ioWriteCrtDat(uint8_t val) //  This function is running within an ISR, keep
 //
 void ioWrite8687CrtSad(uint8_t val)                             //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_SAD, val);
   if (sadFlag)
   {                                                             //  If true, we are doing the high byte
     sadAddr |= (uint16_t)val << 8;                              //  High byte
     sadAddr &= 037777;                                          //  Just clip it to a legal value
     current_screen.sadAddr = sadAddr;
+    crt_dirty_view_pending = true;
   }
   else
   { //  Low byte
@@ -272,6 +255,7 @@ void ioWrite8687CrtSad(uint8_t val)                             //  This functio
 //
 void ioWrite8687CrtBad(uint8_t val)                             //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_BAD, val);
   if (badFlag)
   {
     badAddr |= (uint16_t)val << 8;                              //  High byte
@@ -290,7 +274,9 @@ void ioWrite8687CrtBad(uint8_t val)                             //  This functio
 //
 void ioWrite8687CrtCtrl(uint8_t val)                            //  This function is running within an ISR, keep it short and fast.
 {
+  CRT_RECORD(CRT_RECORD_CTRL, val);
   current_screen.ctrl = val;
+  crt_dirty_view_pending = true;
 }
 
 //
@@ -299,11 +285,83 @@ void ioWrite8687CrtCtrl(uint8_t val)                            //  This functio
 //
 void ioWrite8687CrtDat(uint8_t val)                             //  This function is running within an ISR, keep it short and fast.
 {
+  uint32_t  block = badAddr / CRT_DIRTY_BLOCK_8687;             //  Constant divide, the compiler makes it a multiply
+
+  CRT_RECORD(CRT_RECORD_DAT, val);
+  crt_dirty_pending[block >> 5] |= 1U << (block & 31);
   current_screen.vram[badAddr++] = val;
   badAddr &= 037777;                                            //  Constrain the graphics addr
   writeCRTflag = true;                                          //  Flag Mirror_Video_RAM has changed
 }
 
+//
+//  Changes to current_screen.vram since this consumer last took them. The pending bits from the ISR are
+//  taken with interrupts disabled (just long enough to copy CRT_DIRTY_WORDS words), then merged into every
+//  consumer's copy, so each consumer sees every change once. Returns true if anything changed
+//
+
+bool CRT_Dirty_Take(uint8_t consumer, struct S_CRT_Dirty *dirty)
+{
+  uint32_t    pending[CRT_DIRTY_WORDS];
+  uint32_t    any = 0;
+  bool        view;
+  int         c, w;
+
+  __disable_irq();
+  for (w = 0 ; w < CRT_DIRTY_WORDS ; w++)
+  {
+    pending[w] = crt_dirty_pending[w];
+    crt_dirty_pending[w] = 0;
+  }
+  view = crt_dirty_view_pending;
+  crt_dirty_view_pending = false;
+  __enable_irq();
+  for (w = 0 ; w < CRT_DIRTY_WORDS ; w++)
+  {
+    pending[w] |= crt_dirty_local[w];
+    crt_dirty_local[w] = 0;
+  }
+
+  for (c = 0 ; c < CRT_DIRTY_CONSUMERS ; c++)
+  {
+    for (w = 0 ; w < CRT_DIRTY_WORDS ; w++)
+    {
+      crt_dirty[c].blocks[w] |= pending[w];
+    }
+    crt_dirty[c].view |= view;
+  }
+
+  *dirty = crt_dirty[consumer];
+  dirty->block_size = Is8687 ? CRT_DIRTY_BLOCK_8687 : CRT_DIRTY_BLOCK_85;
+  memset(&crt_dirty[consumer], 0, sizeof(crt_dirty[consumer]));
+  for (w = 0 ; w < CRT_DIRTY_WORDS ; w++)
+  {
+    any |= dirty->blocks[w];
+  }
+  return any || dirty->view;
+}
+
+//
+//  For changes to current_screen.vram that are made by EBTKS, not seen by the ISR. first is a vram index.
+//  Only for loop() context, and safe while EBTKS owns the bus, as it doesn't touch the interrupt enable
+//
+
+void CRT_Dirty_Mark_Range(uint32_t first, uint32_t length)
+{
+  uint32_t    block_size = Is8687 ? CRT_DIRTY_BLOCK_8687 : CRT_DIRTY_BLOCK_85;
+  uint32_t    block, last;
+
+  if (length == 0)
+  {
+    return;
+  }
+  last = (first + length - 1) / block_size;
+  for (block = first / block_size ; block <= last ; block++)
+  {
+    crt_dirty_local[(block >> 5) % CRT_DIRTY_WORDS] |= 1U << (block & 31);
+  }
+}
+
 //
 //  This function uses the appropriate registers depending on machine type to read the CRT Status register
 //  DMA must have been previously set up
@@ -425,6 +483,61 @@ void Safe_Write_CRTDAT(uint8_t val)
   }
 }
 
+//
+//  Write length bytes to CRT memory, starting at vram index (the byte address on the HP86/87, half the nibble
+//  address on the HP85), and keep current_screen and the dirty blocks up to date. CRTBAD is left after the
+//  last byte, callers restore it if they need to.
+//
+//  Safe_Write_CRTDAT_with_DMA_Active() reads the status as fast as it can until the controller is not busy, so
+//  a write during display time costs hundreds of status reads. Here the status is still read before every write
+//  (a write while busy is lost), but not right after a write (the controller is busy for at least
+//  CRT_SPAN_SETTLE_NS), and only every CRT_SPAN_DISPLAY_POLL_NS while the HP85 is in display time, when
+//  writes are held off until close to the retrace (see CRT_Timing_Test_1). On the HP86/87, a blanked screen
+//  (CRTSTS87_BLANK) gives the fastest access, see CRT_restore_screen()
+//
+
+static uint32_t crt_span_status_reads;
+
+void CRT_Write_Span_with_DMA_Active(uint32_t index, const uint8_t *data, uint32_t length)
+{
+  uint32_t    sts_addr  = Is8687 ? HP86_87_CRTSTS : CRTSTS;
+  uint32_t    dat_addr  = Is8687 ? HP86_87_CRTDAT : CRTDAT;
+  uint32_t    vram_mask = Is8687 ? 037777 : 017777;
+  uint8_t     busy      = Is8687 ? CRTSTS87_BUSY : CRTSTS85_BUSY;
+  uint8_t     status, val;
+
+  index &= vram_mask;
+  Safe_Write_CRTBAD_with_DMA_Active(Is8687 ? index : index << 1);
+  if (index + length > vram_mask + 1)
+  {
+    CRT_Dirty_Mark_Range(index, vram_mask + 1 - index);
+    CRT_Dirty_Mark_Range(0, index + length - (vram_mask + 1));
+  }
+  else
+  {
+    CRT_Dirty_Mark_Range(index, length);
+  }
+
+  while (length--)
+  {
+    while (1)
+    {
+      DMA_Read_Block(sts_addr, &status, 1);
+      crt_span_status_reads++;
+      if (!(status & busy))
+      {
+        break;
+      }
+      EBTKS_delay_ns((!Is8687 && (status & CRTSTS85_DISPLAY_TIME)) ? CRT_SPAN_DISPLAY_POLL_NS : CRT_SPAN_BUSY_POLL_NS);
+    }
+    val = *data++;
+    DMA_Write_Block(dat_addr, &val, 1);
+    current_screen.vram[index] = val;
+    index = (index + 1) & vram_mask;                            //  The controller wraps the same way
+    EBTKS_delay_ns(CRT_SPAN_SETTLE_NS);
+  }
+}
+
 DMAMEM uint8_t serial2_tx_buff[3000];
 
 void initCrtEmu()
@@ -467,7 +580,7 @@ void initCrtEmu()
 //        This uses sadAddr, the start address in memory where data is fetched for the top left of the screen
 //
 
-void Write_on_CRT_Alpha(uint16_t row, uint16_t column, const char *text)
+void Write_on_CRT_Alpha_with_DMA_Active(uint16_t row, uint16_t column, const char *text)
 {
   uint16_t badAddr_restore;
   uint16_t local_badAddr;
@@ -503,28 +616,24 @@ void Write_on_CRT_Alpha(uint16_t row, uint16_t column, const char *text)
   // Serial.flush();
   // delay(50);                                                                 //  Really make sure message gets to Serial port
 
-  assert_DMA_Request(); //  Don't keep negotiating for DMA. Do it once, send the string, and release. Makes status checks faster too
-  while (!DMA_Active) {}                                                        //  Wait for acknowledgment, and Bus ownership
-
-  Safe_Write_CRTBAD_with_DMA_Active(local_badAddr);
-  while (*text)
-  {
-    Safe_Write_CRTDAT_with_DMA_Active(*text);
-    if (Is8687)
-    {
-      current_screen.vram[local_badAddr++] = *text;
-    }
-    else
-    {
-      current_screen.vram[local_badAddr >> 1] = *text;
-      local_badAddr += 2;
-    }
-    text++;
-  }
+  CRT_Write_Span_with_DMA_Active(Is8687 ? local_badAddr : local_badAddr >> 1, (const uint8_t *)text, strlen(text));
   //
   //  Restore CRTBAD
   //
   Safe_Write_CRTBAD_with_DMA_Active(badAddr_restore);
+}
+
+//
+//  The bus is acquired just once for the whole string, so the status checks are faster too.
+//  From loop() code that shouldn't wait for the bus, use DMA_Queue_CRT_Text() instead
+//
+
+void Write_on_CRT_Alpha(uint16_t row, uint16_t column, const char *text)
+{
+  assert_DMA_Request(); //  Don't keep negotiating for DMA. Do it once, send the string, and release. Makes status checks faster too
+  while (!DMA_Active) {}                                                        //  Wait for acknowledgment, and Bus ownership
+
+  Write_on_CRT_Alpha_with_DMA_Active(row, column, text);
 
   release_DMA_request();
   while (DMA_Active) {}       // Wait for release
@@ -870,28 +979,121 @@ void CRT_Timing_Test_5(void)
   Write_on_CRT_Alpha(8, 0, "That's all folks");
 }
 
-void writePixel(int x, int y, int color)
+//
+//  "crt bench". Rewrite the first screen of alpha memory (512 characters on the HP85, 16 lines of 80 on the
+//  HP86/87) with what the mirror says is already there, so nothing on the screen changes. First with a busy
+//  check before every byte, as CRT_restore_screen() used to, then with CRT_Write_Span_with_DMA_Active(),
+//  and on the HP86/87 also with the screen blanked. Reports characters per second, status reads per
+//  character, and how long the bus was held
+//
+
+static uint8_t crt_bench_data[80 * 16];
+
+static void CRT_Bench_Report(const char *name, uint32_t length, uint32_t cycles, uint32_t reads)
 {
-  if (Is8687)
+  Serial.printf("%-26s %7u chars/s   %5u.%02u status reads/char   bus held %u us\n", name,
+                (uint32_t)(((uint64_t)length * F_CPU_ACTUAL) / cycles), reads / length, (reads % length) * 100 / length,
+                (uint32_t)(((uint64_t)cycles * 1000000) / F_CPU_ACTUAL));
+}
+
+void CRT_Bench(void)
+{
+  uint32_t    length = Is8687 ? 80 * 16 : 512;
+  uint32_t    dat_addr = Is8687 ? HP86_87_CRTDAT : CRTDAT;
+  uint32_t    start, cycles, reads, i;
+  uint8_t     ctrl;
+
+  memcpy(crt_bench_data, current_screen.vram, length);
+  Serial.printf("CRT bench on %s, %u characters\n", get_machineType(), length);
+  Serial.flush();
+
+  //
+  //  Busy check before every byte
+  //
+  assert_DMA_Request();
+  while (!DMA_Active) {}
+  Safe_Write_CRTBAD_with_DMA_Active(0);
+  reads = 0;
+  start = ARM_DWT_CYCCNT;
+  for (i = 0; i < length; i++)
+  {
+    do
+    {
+      reads++;
+    } while (Safe_CRT_is_Busy_with_DMA_Active());
+    DMA_Write_Block(dat_addr, &crt_bench_data[i], 1);
+  }
+  cycles = ARM_DWT_CYCCNT - start;
+  Safe_Write_CRTBAD_with_DMA_Active(badAddr);
+  release_DMA_request();
+  while (DMA_Active) {}
+  CRT_Bench_Report("Busy check per byte", length, cycles, reads);
+
+  //
+  //  Block write engine
+  //
+  assert_DMA_Request();
+  while (!DMA_Active) {}
+  reads = crt_span_status_reads;
+  start = ARM_DWT_CYCCNT;
+  CRT_Write_Span_with_DMA_Active(0, crt_bench_data, length);
+  cycles = ARM_DWT_CYCCNT - start;
+  reads = crt_span_status_reads - reads;
+  Safe_Write_CRTBAD_with_DMA_Active(badAddr);
+  release_DMA_request();
+  while (DMA_Active) {}
+  CRT_Bench_Report("CRT_Write_Span", length, cycles, reads);
+
+  if (!Is8687)
   {
-    Serial.printf("This function is not yet supported on HP86 or HP87\n");
     return;
   }
 
+  //
+  //  Block write engine, with the HP86/87 screen blanked
+  //
+  assert_DMA_Request();
+  while (!DMA_Active) {}
+  ctrl = current_screen.ctrl | CRTSTS87_BLANK;
+  while (Safe_CRT_is_Busy_with_DMA_Active()) {}
+  DMA_Write_Block(HP86_87_CRTSTS, &ctrl, 1);
+  reads = crt_span_status_reads;
+  start = ARM_DWT_CYCCNT;
+  CRT_Write_Span_with_DMA_Active(0, crt_bench_data, length);
+  cycles = ARM_DWT_CYCCNT - start;
+  reads = crt_span_status_reads - reads;
+  Safe_Write_CRTBAD_with_DMA_Active(badAddr);
+  while (Safe_CRT_is_Busy_with_DMA_Active()) {}
+  DMA_Write_Block(HP86_87_CRTSTS, &current_screen.ctrl, 1);
+  release_DMA_request();
+  while (DMA_Active) {}
+  CRT_Bench_Report("CRT_Write_Span, blanked", length, cycles, reads);
+}
+
+//
+//  Writes one pixel to the CRT, and to current_screen. Pixels off the screen go to row or column 0. HP85 graphics
+//  is 256 x 192, HP86/87 is 400 x 240, or 544 x 240 in GRAPHALL mode, see CRT_Get_Geometry()
+//
+
+void writePixel(int x, int y, int color)
+{
+  struct S_CRT_Geometry   geometry;
+  uint32_t                index;
+  uint8_t                 val;
+  uint16_t                saved_bad;
+
   if (get_screenEmu()) //  Only support direct writing to the CRT if screenEmu is true. Use this to block
-  {                    //  accidentally trying to write to the HP86/87 screen which we don't yet support
-    if (x >= 256)
+  {                    //  accidentally writing to the CRT when the mirror isn't being kept
+    CRT_Get_Geometry(&current_screen, &geometry);
+    if ((x < 0) || (x >= geometry.width))
       x = 0;
-    if (y >= 192)
+    if ((y < 0) || (y >= geometry.height))
       y = 0;
 
-    // calculate write address
-    int offs = (x >> 3) + (y * 32);
-
-    while (DMA_Peek8(CRTSTS) & 0x80) {} //wait until video controller is ready
-    DMA_Poke16(CRTBAD, 0x1000U + (offs * 2));
+    // calculate write address, as an index into vram
+    index = (geometry.graph_base + y * geometry.bytes_per_line + (x >> 3)) & (geometry.vram_size - 1);
 
-    uint8_t val = current_screen.vram[offs];
+    val = current_screen.vram[index];
 
     if (color)
     {
@@ -902,11 +1104,13 @@ void writePixel(int x, int y, int color)
       val &= ~(1 << ((x ^ 7) & 7));
     }
 
-    current_screen.vram[offs] = val;
-    while (DMA_Peek8(CRTSTS) & 0x80)
-    {
-    }; //wait until video controller is ready
-    DMA_Poke8(CRTDAT, val);
+    saved_bad = current_screen.badAddr;
+    assert_DMA_Request();
+    while (!DMA_Active) {}                                      //  Wait for acknowledgment, and Bus ownership
+    CRT_Write_Span_with_DMA_Active(index, &val, 1);             //  Also updates current_screen and the dirty blocks
+    Safe_Write_CRTBAD_with_DMA_Active(saved_bad);               //  So the HP-85's next CRT access goes where it expects
+    release_DMA_request();
+    while (DMA_Active) {}                                       //  Wait for release
   }
 }
 
@@ -915,14 +1119,8 @@ void writeLine(int x0, int y0, int x1, int y1, int color)
   int tmp;
   int16_t steep = abs(y1 - y0) > abs(x1 - x0);
 
-  if (Is8687)
+  if (get_screenEmu()) //  Only support direct writing to the CRT if screenEmu is true
   {
-    Serial.printf("This function is not yet supported on HP86 or HP87\n");
-    return;
-  }
-
-  if (get_screenEmu()) //  Only support direct writing to the CRT if screenEmu is true. Use this to block
-  {                    //  accidentally trying to write to the HP86/87 screen which we don't yet support
     if (steep)
     {
       //swap_int16_t(x0, y0);
@@ -1123,47 +1321,97 @@ void Send_All_CRT_to_Serial(void) //  Implement diag command "show crtall"
   Serial.printf("------------------\n");
 }
 
-void dumpCrtAlphaAsBase64(char *buff, bool comp_graph)
+//
+//  LZS compress length bytes of vram from start, wrapping at vram_size, without a linear copy. HP86/87 graphics can
+//  start anywhere in vram. The two parts go through one incremental compressor, so the output is a single LZS
+//  stream of the bytes in display order, as the remote display expects. Returns out_size if it didn't fit
+//
+
+static size_t crt_compress_vram(uint8_t *out, size_t out_size, uint32_t start, uint32_t length, uint32_t vram_size)
 {
+  LzsSimpleCompressParameters_t   params;                     //  About 2 kB, on the stack only while compressing
+  uint32_t                        first;
+  size_t                          len;
 
-  if (Is8687)
+  first = vram_size - start;
+  if (first > length)
   {
-    Serial.printf("This function is not yet supported on HP86 or HP87\n");
-    return;
+    first = length;
   }
-  //
-  //  copy with wrap around for the alpha buffer
-  //  the 'virtual' screen is 32 x 64 lines
-  //
-  int addr = current_screen.sadAddr / 2;
+  lzs_simple_compress_init(&params);
+  params.outPtr    = out;
+  params.outLength = out_size;
+  params.inPtr     = &current_screen.vram[start];
+  params.inLength  = first;
+  len = lzs_simple_compress_incremental(&params, false);
+  if (params.status & LZS_C_STATUS_NO_OUTPUT_BUFFER_SPACE)
+  {
+    return len;
+  }
+  params.inPtr     = &current_screen.vram[0];
+  params.inLength  = length - first;
+  do                                                          //  Until the end marker is out, or there is no room for it
+  {
+    len += lzs_simple_compress_incremental(&params, true);
+  } while ((params.status & (LZS_C_STATUS_END_MARKER | LZS_C_STATUS_NO_OUTPUT_BUFFER_SPACE)) == 0);
+  return len;
+}
 
+//
+//  Base64 of the visible alpha screen (columns x lines bytes), or of the LZS compressed graphics. On the HP85 the
+//  graphics export is all of vram, as the remote display has always had it, with graphics at offset 0x800. On the
+//  HP86/87 it is just the graphics, bytes_per_line x 240 bytes. Returns false with an empty string if the compressed
+//  graphics don't fit the reply, see CRT_EXPORT_MAX_BYTES
+//
+
+bool dumpCrtAlphaAsBase64(char *buff, bool comp_graph)
+{
+  struct S_CRT_Geometry   geometry;
+  uint32_t                addr, a;
+  int                     len;
+
+  CRT_Get_Geometry(&current_screen, &geometry);
 
   if (comp_graph == true)
   {
-    //compress the vbuff
-    int len = lzs_simple_compress(compress, sizeof(compress), &current_screen.vram[0], 8192);
-    /*for (i = 0; i < len; i++)
+    if (Is8687)
     {
-      Base64.streamEncode(compress[i++]);
-    }*/
+      len = crt_compress_vram(compress, CRT_EXPORT_MAX_BYTES + 1, geometry.graph_base,
+                              geometry.bytes_per_line * geometry.height, geometry.vram_size);
+    }
+    else
+    {
+      len = lzs_simple_compress(compress, CRT_EXPORT_MAX_BYTES + 1, &current_screen.vram[0], 8192);
+    }
+    if (len > CRT_EXPORT_MAX_BYTES)                             //  Compression gave up at the end of the buffer
+    {
+      buff[0] = 0;
+      Serial.printf("Framebuff doesn't compress to %d bytes, use get_delta\r\n", CRT_EXPORT_MAX_BYTES);
+      return false;
+    }
     Base64.Xencode(buff,(char *)compress,len);
     Serial.printf("Framebuff compress:%d,%d\r\n",len,strlen(buff));
   }
   else
   {
+    //
+    //  copy with wrap around for the alpha buffer
+    //
+    addr = geometry.alpha_start;
     Base64.beginStreamEncode(buff);
-    for (int a = 0; a < 512; a++)
+    for (a = 0; a < (uint32_t)(geometry.columns * geometry.lines); a++)
     {
       Base64.streamEncode(current_screen.vram[addr++]);
-      if (addr > 2047)
+      if (addr >= geometry.alpha_wrap)
       {
         addr = 0;
       }
     }
-     Base64.finalStreamEncode();
+    Base64.finalStreamEncode();
   }
- 
+
   Serial.printf("Final len:%d\r\n",strlen(buff));
+  return true;
 }
 
 //
@@ -1189,46 +1437,78 @@ void CRT_capture_screen(void)
 //
 void CRT_restore_screen(void)
 {
-  Safe_Write_CRTBAD(0);
-  Safe_Write_CRTSAD(captured_screen.sadAddr);
+  uint32_t  alpha_end, first, last, i, changed;
+  uint8_t   ctrl;
+  bool      blank;
 
-  // Serial.printf("CRTBAD and CRTBAD set to 0\n");
-  // delay(1000);
-  // Serial.printf("Start block DMA\n");                        //  no reporting until DMA end, as interrupts are off
+  Safe_Write_CRTSAD(captured_screen.sadAddr);
 
   //  Start DMA mode
   assert_DMA_Request();                                         //  Don't keep negotiating for DMA. Do it once, send the string, and release. Makes status checks faster too
   while (!DMA_Active) {}                                        //  Wait for acknowledgment, and Bus ownership
 
   uint8_t mode = Safe_Read_CRTSTS_with_DMA_Active();
-  uint16_t High_Alpha_Address;
 
   //  Bus is now ours, all interrupts are disabled on Teensy
   //
-  //  First copy the Alpha Data
+  //  Copy the Alpha Data. current_screen mirrors what is in CRT memory, so only the bytes that differ are
+  //  written, in spans that are merged across short unchanged gaps
   //
   if (Is8687)
   { //    HP86A/B, HP87A/XM
+    alpha_end = (mode & 0x40) ? 037677 + 1 : 010337 + 1;        //  Alpha All mode, or Alpha Normal mode
     //
-    //  restore all 16 kB , regardless of Alpha/Graphics mode, Normal/All mode
+    //  #####  if we are in Graphics All mode , expect this to fail
     //
-    High_Alpha_Address = 010337;                                        //  Alpha mode, Normal mode
-    if (mode & 0x40)
+  }
+  else
+  {                                                             //    HP83, HP85A/B, HP9915A/B
+    alpha_end = 2048;                                           //  CRT memory for these computers is 32 columns x 64 lines (16 visible) , 2048 chars total
+  }
+
+  changed = 0;
+  for (i = 0; i < alpha_end; i++)
+  {
+    if (!CRT_RESTORE_CHANGED_ONLY || (captured_screen.vram[i] != current_screen.vram[i]))
     {
-      High_Alpha_Address = 037677;
+      changed++;
     }
-    //
-    //  #####  if we are in Graphics All mode , expect this to fail
-    //
+  }
 
-    for (int ch = 0; ch <= High_Alpha_Address; ch++)
+  //
+  //  Big HP86/87 restores blank the screen, so the controller doesn't have to share CRT memory with the display.
+  //  The final write of captured_screen.ctrl to CRTSTS unblanks it
+  //
+  blank = Is8687 && (CRT_SPAN_BLANK_8687_MIN != 0) && (changed >= CRT_SPAN_BLANK_8687_MIN);
+  if (blank)
+  {
+    ctrl = current_screen.ctrl | CRTSTS87_BLANK;
+    while (Safe_CRT_is_Busy_with_DMA_Active()) {}
+    DMA_Write_Block(HP86_87_CRTSTS, &ctrl, 1);
+  }
+
+  for (first = 0; changed && (first < alpha_end); first = last + 1)
+  {
+    last = first;
+    if (CRT_RESTORE_CHANGED_ONLY && (captured_screen.vram[first] == current_screen.vram[first]))
     {
-      while (Safe_CRT_is_Busy_with_DMA_Active()) {}
-      DMA_Write_Block(HP86_87_CRTDAT, &captured_screen.vram[ch], 1);
+      continue;
     }
-    //
-    //  Now restore CRTSAD and CRTBAD
-    //
+    for (i = first + 1; (i < alpha_end) && (i <= last + CRT_SPAN_MERGE_GAP); i++)
+    {
+      if (!CRT_RESTORE_CHANGED_ONLY || (captured_screen.vram[i] != current_screen.vram[i]))
+      {
+        last = i;
+      }
+    }
+    CRT_Write_Span_with_DMA_Active(first, &captured_screen.vram[first], last - first + 1);
+  }
+
+  //
+  //  Now restore CRTSAD and CRTBAD
+  //
+  if (Is8687)
+  {
     while (Safe_CRT_is_Busy_with_DMA_Active()) {}
     DMA_Write_Block(HP86_87_CRTBAD, (uint8_t *)&captured_screen.badAddr, 2);
     while (Safe_CRT_is_Busy_with_DMA_Active()) {}
@@ -1236,15 +1516,7 @@ void CRT_restore_screen(void)
     DMA_Write_Block(HP86_87_CRTSTS, (uint8_t *)&captured_screen.ctrl, 1);
   }
   else
-  {                                                                     //    HP83, HP85A/B, HP9915A/B
-    for (int ch = 0; ch < 2048; ch++)                                   //  CRT memory for these computers is 32 columns x 64 lines (16 visible) , 2048 chars total
-    {
-      while (Safe_CRT_is_Busy_with_DMA_Active()) {}
-      DMA_Write_Block(CRTDAT, &captured_screen.vram[ch], 1);
-    }
-    //
-    //  Now restore CRTSAD and CRTBAD
-    //
+  {
     while (Safe_CRT_is_Busy_with_DMA_Active()) {}
     DMA_Write_Block(CRTBAD, (uint8_t *)&captured_screen.badAddr, 2);
     while (Safe_CRT_is_Busy_with_DMA_Active()) {}
@@ -1252,6 +1524,8 @@ void CRT_restore_screen(void)
     DMA_Write_Block(CRTSTS, (uint8_t *)&captured_screen.ctrl, 1);
   }
 
+  CRT_Dirty_Mark_Range(0, sizeof(current_screen.vram));
+  crt_dirty_view_pending = true;
   memcpy(&current_screen, &captured_screen, sizeof(video_capt_t));      //  Do this while in DMA mode, so that the user on the Series80 computer
                                                                         //  can't change things while we are doing the copy
 
@@ -0,0 +1,396 @@
+//
+//  CRT recorder
+//
+//  Records every write the HP-85 makes to the CRT registers, with the time it happened, so that what was on the
+//  screen can be played back later, exactly and at the original speed. A recording is much smaller than a series of
+//  screen captures: about 4 bytes for each character the HP-85 writes, and nothing while the screen is idle.
+//
+//      crt record start [FILE]     Start recording to FILE (default CRT_RECORD_FILENAME)
+//      crt record stop             Stop, and close the file
+//      crt record                  Show the recorder status
+//
+//  While CRT_Record_Active, the write handlers in EBTKS_CRT.cpp (ioWriteCrt*() and ioWrite8687Crt*()) call
+//  CRT_Record_Write(), which adds an event to crt_record_isr_ring[] with ARM_DWT_CYCCNT and systick_millis_count.
+//  The ISR only moves crt_record_isr_head, and loop() only moves crt_record_isr_tail, so the ring needs no
+//  locking. If loop() falls behind and the ring fills, new events are counted and dropped, and the file says how
+//  many were lost. CRT_Record_Poll() moves events on to crt_record_ring[], encodes them into crt_record_buffer,
+//  and writes it to the SD Card when it is full, or CRT_RECORD_SYNC_MS after the last write.
+//
+//  crt_record_isr_ring[] is small and in DTCM, as a PSRAM cache miss would take longer than the ISR can spare.
+//  crt_record_ring[] is in EXTMEM, only loop() touches it, and it covers the time an SD Card write can take.
+//  "crt record start" refuses if PSRAM_Holds_EXTMEM() is false.
+//
+//  A recording starts with the CRT state and the whole of current_screen.vram, so it can be played back from any
+//  point in a session. vram is written just after recording starts, so it may already have the first few
+//  recorded writes, which play back to the same result. Writes that EBTKS itself makes to the CRT with DMA (status
+//  messages, CRT_restore_screen()) don't go through the handlers, and are not recorded.
+//
+//  tools/crt_stream/crt_replay plays a recording back, and prints or saves the screen as images.
+//
+//  File format, all multi-byte values are little endian:
+//        8 bytes     "EBTKSCRT"
+//        uint16      Format version, currently 1
+//        uint16      Header length in bytes, currently 32. vram starts here
+//        uint32      Cycle counter rate, in Hz (F_CPU_ACTUAL)
+//        uint32      systick_millis_count at the start
+//        uint16      vram size, 8192 for the HP83/85/9915, 16384 for the HP86/87
+//        uint16      sadAddr, the start address as the write handlers hold it (just the low byte if CRT_RECORD_SAD_HIGH)
+//        uint16      badAddr, likewise
+//        uint16      current_screen.sadAddr, the start address on display
+//        uint8       ctrl, the last write to the control register
+//        uint8       Flags. CRT_RECORD_8687, CRT_RECORD_SAD_HIGH (the next SAD write is the high byte), CRT_RECORD_BAD_HIGH
+//        2 bytes     0
+//      Then vram size bytes of current_screen.vram, and then events. Each starts with a code byte
+//        0..3        A write to SAD, BAD, CTRL or DAT (enum crt_record_regs). Followed by the byte written, and then
+//                    the cycles since the event before, as a LEB128 (7 bits per byte, low bits first, bit 7 set if
+//                    more bytes follow)
+//        0x10        Events were lost, as the ring was full. Followed by how many, LEB128
+//        0x11        A gap of CRT_RECORD_GAP_MS or more. Followed by its length in milliseconds, LEB128. The next
+//                    event's cycle count is from the end of the gap. (The cycle counter wraps every 7 seconds)
+//        0x12        End of the recording
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_CRT_RECORD
+
+#define CRT_RECORD_VERSION          (1)
+#define CRT_RECORD_HEADER_LENGTH    (32)
+#define CRT_RECORD_8687             (0x01)
+#define CRT_RECORD_SAD_HIGH         (0x02)
+#define CRT_RECORD_BAD_HIGH         (0x04)
+#define CRT_RECORD_LOST             (0x10)
+#define CRT_RECORD_GAP              (0x11)
+#define CRT_RECORD_END              (0x12)
+#define CRT_RECORD_GAP_MS           (1000)
+#define CRT_RECORD_EVENT_MAX        (16)                        //  Longest encoding of one event, with a gap before it
+#define CRT_RECORD_WRITE_BYTES      (512)
+
+extern bool       badFlag, sadFlag;                             //  EBTKS_CRT.cpp
+extern uint16_t   badAddr, sadAddr;
+
+struct S_CRT_Record_Event
+{
+  uint32_t      cycles;                                   //  ARM_DWT_CYCCNT
+  uint32_t      millis;                                   //  systick_millis_count
+  uint8_t       reg;                                      //  enum crt_record_regs
+  uint8_t       val;
+  uint8_t       spare[2];
+};
+
+volatile bool               CRT_Record_Active;
+
+static struct S_CRT_Record_Event crt_record_isr_ring[CRT_RECORD_ISR_RING_SIZE];
+static volatile uint32_t    crt_record_isr_head;            //  Events added, by the ISR
+static volatile uint32_t    crt_record_isr_tail;            //  Events moved on to crt_record_ring[], by crt_record_move()
+static volatile uint32_t    crt_record_lost;                //  Events dropped because crt_record_isr_ring[] was full
+EXTMEM static struct S_CRT_Record_Event crt_record_ring[CRT_RECORD_RING_SIZE];
+static uint32_t             crt_record_head;                //  Events added, by crt_record_move()
+static uint32_t             crt_record_tail;                //  Events taken, by CRT_Record_Encode()
+static uint32_t             crt_record_lost_reported;
+static uint32_t             crt_record_last_cycles;
+static uint32_t             crt_record_last_millis;
+
+static FsFile               crt_record_file;
+static bool                 crt_record_open;
+static char                 crt_record_filename[258];
+static uint8_t              crt_record_buffer[CRT_RECORD_WRITE_BYTES + CRT_RECORD_EVENT_MAX];
+static uint32_t             crt_record_fill;
+static uint32_t             crt_record_write_millis;
+static uint32_t             crt_record_sync_millis;
+static uint32_t             crt_record_start_millis;
+static uint32_t             crt_record_events, crt_record_bytes;
+
+//
+//  Only called if CRT_Record_Active, from the CRT write handlers, within the ISR
+//
+
+FASTRUN void CRT_Record_Write(uint8_t reg, uint8_t val)
+{
+  struct S_CRT_Record_Event   *event;
+  uint32_t                    head = crt_record_isr_head;
+
+  if (head - crt_record_isr_tail >= CRT_RECORD_ISR_RING_SIZE)
+  {
+    crt_record_lost++;
+    return;
+  }
+  event = &crt_record_isr_ring[head & (CRT_RECORD_ISR_RING_SIZE - 1)];
+  event->cycles = ARM_DWT_CYCCNT;
+  event->millis = systick_millis_count;
+  event->reg    = reg;
+  event->val    = val;
+  crt_record_isr_head = head + 1;                           //  Only after the event is complete
+}
+
+//
+//  Move events from the ISR's ring to crt_record_ring[], while there is room. From loop(), never the ISR
+//
+
+static void crt_record_move(void)
+{
+  uint32_t    isr_tail = crt_record_isr_tail;
+  uint32_t    isr_head = crt_record_isr_head;
+
+  while ((isr_tail != isr_head) && (crt_record_head - crt_record_tail < CRT_RECORD_RING_SIZE))
+  {
+    crt_record_ring[crt_record_head & (CRT_RECORD_RING_SIZE - 1)] = crt_record_isr_ring[isr_tail & (CRT_RECORD_ISR_RING_SIZE - 1)];
+    crt_record_head++;
+    isr_tail++;
+  }
+  crt_record_isr_tail = isr_tail;                           //  The ISR can use the slots from here on
+}
+
+static uint32_t crt_record_leb128(uint8_t *out, uint32_t value)
+{
+  uint32_t    length = 0;
+
+  while (value >= 0x80)
+  {
+    out[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[length++] = value;
+  return length;
+}
+
+//
+//  Start recording. Fills in the CRT_RECORD_HEADER_LENGTH byte header (vram follows it in the file), clears the
+//  ring, and turns on CRT_Record_Active. Returns the header length
+//
+
+uint32_t CRT_Record_Begin(uint8_t *header)
+{
+  uint32_t    values[2];
+  uint16_t    words[4];
+
+  CRT_Record_Active = false;
+  crt_record_isr_head = 0;
+  crt_record_isr_tail = 0;
+  crt_record_head = 0;
+  crt_record_tail = 0;
+  crt_record_lost = 0;
+  crt_record_lost_reported = 0;
+
+  memset(header, 0, CRT_RECORD_HEADER_LENGTH);
+  memcpy(header, "EBTKSCRT", 8);
+  header[8]  = CRT_RECORD_VERSION;
+  header[10] = CRT_RECORD_HEADER_LENGTH;
+  values[0]  = F_CPU_ACTUAL;
+  values[1]  = systick_millis_count;
+  words[0]   = Is8687 ? 16384 : 8192;
+  words[1]   = sadAddr;
+  words[2]   = badAddr;
+  words[3]   = current_screen.sadAddr;
+  memcpy(header + 12, values, sizeof(values));              //  Teensy is little endian, as is the format
+  memcpy(header + 20, words, sizeof(words));
+  header[28] = current_screen.ctrl;
+  header[29] = (Is8687 ? CRT_RECORD_8687 : 0) | (sadFlag ? CRT_RECORD_SAD_HIGH : 0) | (badFlag ? CRT_RECORD_BAD_HIGH : 0);
+
+  crt_record_last_cycles = ARM_DWT_CYCCNT;
+  crt_record_last_millis = values[1];
+  CRT_Record_Active = true;
+  return CRT_RECORD_HEADER_LENGTH;
+}
+
+//
+//  Take events from the rings and encode them into out, while there is room for another. Returns the bytes used
+//
+
+uint32_t CRT_Record_Encode(uint8_t *out, uint32_t size)
+{
+  struct S_CRT_Record_Event   *event;
+  uint32_t                    length = 0, lost, delta;
+
+  crt_record_move();
+  while (size - length >= CRT_RECORD_EVENT_MAX)
+  {
+    lost = crt_record_lost;
+    if (lost != crt_record_lost_reported)
+    {
+      out[length++] = CRT_RECORD_LOST;
+      length += crt_record_leb128(out + length, lost - crt_record_lost_reported);
+      crt_record_lost_reported = lost;
+      continue;
+    }
+    if (crt_record_tail == crt_record_head)
+    {
+      break;
+    }
+    event = &crt_record_ring[crt_record_tail & (CRT_RECORD_RING_SIZE - 1)];
+    if (event->millis - crt_record_last_millis >= CRT_RECORD_GAP_MS)
+    {
+      out[length++] = CRT_RECORD_GAP;
+      length += crt_record_leb128(out + length, event->millis - crt_record_last_millis);
+      delta = 0;
+    }
+    else
+    {
+      delta = event->cycles - crt_record_last_cycles;
+    }
+    crt_record_last_cycles = event->cycles;
+    crt_record_last_millis = event->millis;
+    out[length++] = event->reg;
+    out[length++] = event->val;
+    length += crt_record_leb128(out + length, delta);
+    crt_record_tail = crt_record_tail + 1;
+    crt_record_events++;
+    if (crt_record_tail == crt_record_head)
+    {
+      crt_record_move();                                    //  Whatever the ISR added since
+    }
+  }
+  return length;
+}
+
+//
+//  Write crt_record_buffer to the file. Every CRT_RECORD_SYNC_MS, also flush the file, so the directory entry
+//  has the new size
+//
+
+static bool crt_record_flush(void)
+{
+  bool      ok;
+
+  ok = crt_record_file.write(crt_record_buffer, crt_record_fill) == crt_record_fill;
+  crt_record_bytes += crt_record_fill;
+  crt_record_fill = 0;
+  crt_record_write_millis = systick_millis_count;
+  if (crt_record_write_millis - crt_record_sync_millis >= CRT_RECORD_SYNC_MS)
+  {
+    crt_record_file.flush();
+    crt_record_sync_millis = crt_record_write_millis;
+  }
+  return ok;
+}
+
+static void crt_record_status(void)
+{
+  Serial.printf("CRT recorder is %s", crt_record_open ? "on" : "off");
+  if (crt_record_open || crt_record_events)
+  {
+    Serial.printf(", %s: %u events, %u bytes, %u lost, %u s", crt_record_filename, crt_record_events,
+                  crt_record_bytes + crt_record_fill, crt_record_lost, (systick_millis_count - crt_record_start_millis) / 1000);
+  }
+  Serial.printf("\n");
+}
+
+static void crt_record_start(const char *filename)
+{
+  uint8_t     header[CRT_RECORD_HEADER_LENGTH];
+  bool        ok;
+
+  if (crt_record_open)
+  {
+    Serial.printf("Already recording to %s\n", crt_record_filename);
+    return;
+  }
+  if (!PSRAM_Holds_EXTMEM())
+  {
+    Serial.printf("The CRT recorder needs PSRAM for its %u byte event ring\n", (uint32_t)sizeof(crt_record_ring));
+    return;
+  }
+  if (!(crt_record_file = SD.open(filename, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Could not create %s\n", filename);
+    return;
+  }
+  strlcpy(crt_record_filename, filename, sizeof(crt_record_filename));
+  crt_record_events = 0;
+  crt_record_fill   = 0;
+  crt_record_start_millis = crt_record_write_millis = crt_record_sync_millis = systick_millis_count;
+  CRT_Record_Begin(header);
+  ok = crt_record_file.write(header, sizeof(header)) == sizeof(header);
+  ok = ok && (crt_record_file.write(current_screen.vram, Is8687 ? 16384 : 8192) == (Is8687 ? 16384U : 8192U));
+  crt_record_bytes = crt_record_file.size();
+  if (!ok)
+  {
+    CRT_Record_Active = false;
+    crt_record_file.close();
+    Serial.printf("Error writing %s\n", filename);
+    return;
+  }
+  crt_record_open = true;
+  crt_record_status();
+}
+
+static void crt_record_stop(void)
+{
+  bool      ok = true;
+
+  if (!crt_record_open)
+  {
+    crt_record_status();
+    return;
+  }
+  CRT_Record_Active = false;
+  while (ok && (crt_record_tail != crt_record_head || crt_record_isr_tail != crt_record_isr_head ||
+                crt_record_lost != crt_record_lost_reported))
+  {
+    crt_record_fill += CRT_Record_Encode(crt_record_buffer + crt_record_fill, sizeof(crt_record_buffer) - crt_record_fill);
+    if (crt_record_fill >= CRT_RECORD_WRITE_BYTES)
+    {
+      ok = crt_record_flush();
+    }
+  }
+  crt_record_buffer[crt_record_fill++] = CRT_RECORD_END;
+  ok = ok && crt_record_flush();
+  crt_record_file.close();
+  crt_record_open = false;
+  if (!ok)
+  {
+    Serial.printf("Error writing %s\n", crt_record_filename);
+  }
+  crt_record_status();
+}
+
+void CRT_Record_Poll(void)
+{
+  if (!crt_record_open)
+  {
+    return;
+  }
+  crt_record_fill += CRT_Record_Encode(crt_record_buffer + crt_record_fill, sizeof(crt_record_buffer) - crt_record_fill);
+  if ((crt_record_fill >= CRT_RECORD_WRITE_BYTES) ||
+      (crt_record_fill && (systick_millis_count - crt_record_write_millis >= CRT_RECORD_SYNC_MS)))
+  {
+    if (!crt_record_flush())
+    {
+      Serial.printf("Error writing %s, recording stopped\n", crt_record_filename);
+      CRT_Record_Active = false;
+      crt_record_file.close();
+      crt_record_open = false;
+    }
+  }
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "crt record"
+//
+
+void CRT_Record_Command(void)
+{
+  const char  *args = serial_string + 10;
+
+  while (*args == ' ') args++;
+
+  if (strncasecmp(args, "start", 5) == 0)
+  {
+    args += 5;
+    while (*args == ' ') args++;
+    crt_record_start(*args ? args : CRT_RECORD_FILENAME);
+  }
+  else if (strcasecmp(args, "stop") == 0)
+  {
+    crt_record_stop();
+  }
+  else
+  {
+    crt_record_status();
+    Serial.printf("crt record start [FILE], crt record stop\n");
+  }
+}
+
+#endif
@@ -0,0 +1,261 @@
+//
+//  CRT screen rendering
+//
+//  Turns a video_capt_t (current_screen, or a copy of it) into a 1 bit per pixel image, as the CRT shows it.
+//  Used by "screenshot" (EBTKS_Screenshot.cpp), and by the host tools in tools/crt_stream, which build this
+//  file against the tools/bus_sim shim. Nothing here touches the bus or the SD Card.
+//
+//  CRT_Get_Geometry() works out what part of vram is on the screen, from the start address and the mode bits.
+//  CRT_Render_Rows() renders image rows, a few at a time, so a caller in loop() never holds things up for long.
+//
+//  Rows are packed 8 pixels per byte, leftmost pixel in the MSB, with 1 for a lit pixel. That is the order of
+//  graphics memory, and also of the PBM (P4) format, where 1 is black, so a PBM file of the rows is the screen
+//  as ink on paper.
+//
+//    Alpha         Each character is a cell 8 pixels wide and char_height high. The glyph is 5 x 7, one pixel
+//                  in from the left, and (char_height - 8) / 2 rows down. Characters with bit 7 set are
+//                  underlined, on the row after the glyph's gap row. Alpha memory wraps at alpha_wrap, so a
+//                  screen that starts near the end of alpha memory continues from vram[0].
+//    Graphics      bytes_per_line bytes per row, from graph_base, wrapping at vram_size. On the HP86/87 graph_base
+//                  is the start address (CRTSAD) while in graphics mode.
+//    Inverse       The HP86/87 CRTSTS87_INV bit inverts everything, alpha and graphics.
+//
+//  The character table is a generic 5 x 7 font for the printable ASCII part of the Series 80 character set,
+//  0x20 to 0x7E. It is not the CRT character ROM, whose glyphs differ in places. The Series 80 special characters
+//  (codes below 0x20, and 0x7F) are drawn as an open box, so they show up on a screenshot but aren't mistaken
+//  for anything else.
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+//
+//  5 columns per character, bit 0 is the top row
+//
+
+static const uint8_t crt_render_font[95][5] =
+{
+  {0x00, 0x00, 0x00, 0x00, 0x00},   //  0x20  space
+  {0x00, 0x00, 0x5F, 0x00, 0x00},   //  0x21  !
+  {0x00, 0x07, 0x00, 0x07, 0x00},   //  0x22  "
+  {0x14, 0x7F, 0x14, 0x7F, 0x14},   //  0x23  #
+  {0x24, 0x2A, 0x7F, 0x2A, 0x12},   //  0x24  $
+  {0x23, 0x13, 0x08, 0x64, 0x62},   //  0x25  %
+  {0x36, 0x49, 0x55, 0x22, 0x50},   //  0x26  &
+  {0x00, 0x05, 0x03, 0x00, 0x00},   //  0x27  '
+  {0x00, 0x1C, 0x22, 0x41, 0x00},   //  0x28  (
+  {0x00, 0x41, 0x22, 0x1C, 0x00},   //  0x29  )
+  {0x14, 0x08, 0x3E, 0x08, 0x14},   //  0x2A  *
+  {0x08, 0x08, 0x3E, 0x08, 0x08},   //  0x2B  +
+  {0x00, 0x50, 0x30, 0x00, 0x00},   //  0x2C  ,
+  {0x08, 0x08, 0x08, 0x08, 0x08},   //  0x2D  -
+  {0x00, 0x60, 0x60, 0x00, 0x00},   //  0x2E  .
+  {0x20, 0x10, 0x08, 0x04, 0x02},   //  0x2F  /
+  {0x3E, 0x51, 0x49, 0x45, 0x3E},   //  0x30  0
+  {0x00, 0x42, 0x7F, 0x40, 0x00},   //  0x31  1
+  {0x42, 0x61, 0x51, 0x49, 0x46},   //  0x32  2
+  {0x21, 0x41, 0x45, 0x4B, 0x31},   //  0x33  3
+  {0x18, 0x14, 0x12, 0x7F, 0x10},   //  0x34  4
+  {0x27, 0x45, 0x45, 0x45, 0x39},   //  0x35  5
+  {0x3C, 0x4A, 0x49, 0x49, 0x30},   //  0x36  6
+  {0x01, 0x71, 0x09, 0x05, 0x03},   //  0x37  7
+  {0x36, 0x49, 0x49, 0x49, 0x36},   //  0x38  8
+  {0x06, 0x49, 0x49, 0x29, 0x1E},   //  0x39  9
+  {0x00, 0x36, 0x36, 0x00, 0x00},   //  0x3A  :
+  {0x00, 0x56, 0x36, 0x00, 0x00},   //  0x3B  ;
+  {0x08, 0x14, 0x22, 0x41, 0x00},   //  0x3C  <
+  {0x14, 0x14, 0x14, 0x14, 0x14},   //  0x3D  =
+  {0x00, 0x41, 0x22, 0x14, 0x08},   //  0x3E  >
+  {0x02, 0x01, 0x51, 0x09, 0x06},   //  0x3F  ?
+  {0x32, 0x49, 0x79, 0x41, 0x3E},   //  0x40  @
+  {0x7E, 0x11, 0x11, 0x11, 0x7E},   //  0x41  A
+  {0x7F, 0x49, 0x49, 0x49, 0x36},   //  0x42  B
+  {0x3E, 0x41, 0x41, 0x41, 0x22},   //  0x43  C
+  {0x7F, 0x41, 0x41, 0x22, 0x1C},   //  0x44  D
+  {0x7F, 0x49, 0x49, 0x49, 0x41},   //  0x45  E
+  {0x7F, 0x09, 0x09, 0x09, 0x01},   //  0x46  F
+  {0x3E, 0x41, 0x49, 0x49, 0x7A},   //  0x47  G
+  {0x7F, 0x08, 0x08, 0x08, 0x7F},   //  0x48  H
+  {0x00, 0x41, 0x7F, 0x41, 0x00},   //  0x49  I
+  {0x20, 0x40, 0x41, 0x3F, 0x01},   //  0x4A  J
+  {0x7F, 0x08, 0x14, 0x22, 0x41},   //  0x4B  K
+  {0x7F, 0x40, 0x40, 0x40, 0x40},   //  0x4C  L
+  {0x7F, 0x02, 0x0C, 0x02, 0x7F},   //  0x4D  M
+  {0x7F, 0x04, 0x08, 0x10, 0x7F},   //  0x4E  N
+  {0x3E, 0x41, 0x41, 0x41, 0x3E},   //  0x4F  O
+  {0x7F, 0x09, 0x09, 0x09, 0x06},   //  0x50  P
+  {0x3E, 0x41, 0x51, 0x21, 0x5E},   //  0x51  Q
+  {0x7F, 0x09, 0x19, 0x29, 0x46},   //  0x52  R
+  {0x46, 0x49, 0x49, 0x49, 0x31},   //  0x53  S
+  {0x01, 0x01, 0x7F, 0x01, 0x01},   //  0x54  T
+  {0x3F, 0x40, 0x40, 0x40, 0x3F},   //  0x55  U
+  {0x1F, 0x20, 0x40, 0x20, 0x1F},   //  0x56  V
+  {0x3F, 0x40, 0x38, 0x40, 0x3F},   //  0x57  W
+  {0x63, 0x14, 0x08, 0x14, 0x63},   //  0x58  X
+  {0x07, 0x08, 0x70, 0x08, 0x07},   //  0x59  Y
+  {0x61, 0x51, 0x49, 0x45, 0x43},   //  0x5A  Z
+  {0x00, 0x7F, 0x41, 0x41, 0x00},   //  0x5B  [
+  {0x02, 0x04, 0x08, 0x10, 0x20},   //  0x5C  backslash
+  {0x00, 0x41, 0x41, 0x7F, 0x00},   //  0x5D  ]
+  {0x04, 0x02, 0x01, 0x02, 0x04},   //  0x5E  ^
+  {0x40, 0x40, 0x40, 0x40, 0x40},   //  0x5F  _
+  {0x00, 0x01, 0x02, 0x04, 0x00},   //  0x60  `
+  {0x20, 0x54, 0x54, 0x54, 0x78},   //  0x61  a
+  {0x7F, 0x48, 0x44, 0x44, 0x38},   //  0x62  b
+  {0x38, 0x44, 0x44, 0x44, 0x20},   //  0x63  c
+  {0x38, 0x44, 0x44, 0x48, 0x7F},   //  0x64  d
+  {0x38, 0x54, 0x54, 0x54, 0x18},   //  0x65  e
+  {0x08, 0x7E, 0x09, 0x01, 0x02},   //  0x66  f
+  {0x0C, 0x52, 0x52, 0x52, 0x3E},   //  0x67  g
+  {0x7F, 0x08, 0x04, 0x04, 0x78},   //  0x68  h
+  {0x00, 0x44, 0x7D, 0x40, 0x00},   //  0x69  i
+  {0x20, 0x40, 0x44, 0x3D, 0x00},   //  0x6A  j
+  {0x7F, 0x10, 0x28, 0x44, 0x00},   //  0x6B  k
+  {0x00, 0x41, 0x7F, 0x40, 0x00},   //  0x6C  l
+  {0x7C, 0x04, 0x18, 0x04, 0x78},   //  0x6D  m
+  {0x7C, 0x08, 0x04, 0x04, 0x78},   //  0x6E  n
+  {0x38, 0x44, 0x44, 0x44, 0x38},   //  0x6F  o
+  {0x7C, 0x14, 0x14, 0x14, 0x08},   //  0x70  p
+  {0x08, 0x14, 0x14, 0x18, 0x7C},   //  0x71  q
+  {0x7C, 0x08, 0x04, 0x04, 0x08},   //  0x72  r
+  {0x48, 0x54, 0x54, 0x54, 0x20},   //  0x73  s
+  {0x04, 0x3F, 0x44, 0x40, 0x20},   //  0x74  t
+  {0x3C, 0x40, 0x40, 0x20, 0x7C},   //  0x75  u
+  {0x1C, 0x20, 0x40, 0x20, 0x1C},   //  0x76  v
+  {0x3C, 0x40, 0x30, 0x40, 0x3C},   //  0x77  w
+  {0x44, 0x28, 0x10, 0x28, 0x44},   //  0x78  x
+  {0x0C, 0x50, 0x50, 0x50, 0x3C},   //  0x79  y
+  {0x44, 0x64, 0x54, 0x4C, 0x44},   //  0x7A  z
+  {0x00, 0x08, 0x36, 0x41, 0x00},   //  0x7B  {
+  {0x00, 0x00, 0x7F, 0x00, 0x00},   //  0x7C  |
+  {0x00, 0x41, 0x36, 0x08, 0x00},   //  0x7D  }
+  {0x08, 0x04, 0x08, 0x10, 0x08},   //  0x7E  ~
+};
+
+//
+//  Where the visible screen is in vram, from the mode bits of a screen capture. For the HP86/87, ctrl is the last
+//  value written to CRTSTS (see the CRTSTS87_ defines). The HP85 has one alpha and one graphics layout, so only
+//  bit 7 of the last CRTCTRL write (graphics mode, same place as CRTSTS87_GRAPH) matters
+//
+
+void CRT_Get_Geometry(const video_capt_t *screen, struct S_CRT_Geometry *geometry)
+{
+  geometry->is8687   = Is8687;
+  geometry->graphics = (screen->ctrl & CRTSTS87_GRAPH) != 0;
+  if (Is8687)
+  {
+    geometry->all            = (screen->ctrl & CRTSTS87_MODE) != 0;
+    geometry->columns        = 80;
+    geometry->lines          = (screen->ctrl & CRTSTS87_ALPHA) ? 24 : 16;
+    geometry->char_height    = (screen->ctrl & CRTSTS87_ALPHA) ? 10 : 15;
+    geometry->alpha_wrap     = geometry->all ? 16320 : 4320;    //  ALPHALL uses all of vram, but for the last part line
+    geometry->alpha_start    = screen->sadAddr % geometry->alpha_wrap;
+    geometry->width          = geometry->all ? 544 : 400;
+    geometry->height         = 240;
+    geometry->bytes_per_line = geometry->width / 8;
+    geometry->graph_base     = geometry->graphics ? screen->sadAddr : 4320;   //  In graphics mode CRTSAD is the graphics start.
+                                                                //  Otherwise 010340, just after normal alpha memory
+    geometry->vram_size      = 16384;
+  }
+  else
+  {
+    geometry->all            = false;
+    geometry->columns        = 32;
+    geometry->lines          = 16;
+    geometry->char_height    = 12;
+    geometry->alpha_wrap     = 2048;
+    geometry->alpha_start    = (screen->sadAddr / 2) % 2048;    //  sadAddr is a nibble address
+    geometry->width          = 256;
+    geometry->height         = 192;
+    geometry->bytes_per_line = 32;
+    geometry->graph_base     = 0x800;                           //  Nibble address 010000
+    geometry->vram_size      = 8192;
+  }
+}
+
+//
+//  Size of the rendered image, in pixels. Widths are all multiples of 8
+//
+
+void CRT_Render_Size(const struct S_CRT_Geometry *geometry, uint32_t *width, uint32_t *height)
+{
+  if (geometry->graphics)
+  {
+    *width  = geometry->width;
+    *height = geometry->height;
+  }
+  else
+  {
+    *width  = geometry->columns * 8;
+    *height = geometry->lines * geometry->char_height;
+  }
+}
+
+//
+//  One row of a character cell, 8 pixels, leftmost in the MSB
+//
+
+static uint8_t crt_render_cell_row(uint8_t ch, uint32_t row, uint32_t char_height)
+{
+  uint32_t    glyph_top = (char_height - 8) / 2;
+  uint32_t    glyph_row = row - glyph_top;                  //  Wraps to a big number above the glyph
+  uint8_t     code = ch & 0x7F;
+  uint8_t     bits = 0;
+  uint32_t    column;
+
+  if ((ch & 0x80) && (row == glyph_top + 8))
+  {
+    return 0xFF;                                            //  Underline
+  }
+  if (glyph_row >= 7)
+  {
+    return 0;
+  }
+  if ((code < 0x20) || (code == 0x7F))
+  {
+    return ((glyph_row == 0) || (glyph_row == 6)) ? 0x7C : 0x44;
+  }
+  for (column = 0 ; column < 5 ; column++)
+  {
+    if (crt_render_font[code - 0x20][column] & (1 << glyph_row))
+    {
+      bits |= 0x40 >> column;
+    }
+  }
+  return bits;
+}
+
+//
+//  Render count image rows, starting at row first, into out. Each row is width / 8 bytes (see CRT_Render_Size())
+//
+
+void CRT_Render_Rows(const video_capt_t *screen, const struct S_CRT_Geometry *geometry, uint32_t first, uint32_t count,
+                     uint8_t *out)
+{
+  uint8_t     invert = (geometry->is8687 && (screen->ctrl & CRTSTS87_INV)) ? 0xFF : 0x00;
+  uint32_t    y, column, index, cell_row;
+
+  for (y = first ; y < first + count ; y++)
+  {
+    if (geometry->graphics)
+    {
+      index = geometry->graph_base + y * geometry->bytes_per_line;
+      for (column = 0 ; column < geometry->bytes_per_line ; column++)
+      {
+        *out++ = screen->vram[(index + column) & (geometry->vram_size - 1)] ^ invert;
+      }
+      continue;
+    }
+    index    = (geometry->alpha_start + (y / geometry->char_height) * geometry->columns) % geometry->alpha_wrap;
+    cell_row = y % geometry->char_height;
+    for (column = 0 ; column < geometry->columns ; column++)
+    {
+      *out++ = crt_render_cell_row(screen->vram[index], cell_row, geometry->char_height) ^ invert;
+      if (++index >= geometry->alpha_wrap)
+      {
+        index = 0;
+      }
+    }
+  }
+}
@@ -0,0 +1,217 @@
+//
+//  Incremental screen stream for the remote display
+//
+//  "get_graph" sends all of current_screen.vram, LZS compressed and Base64 encoded, on every request.
+//  "get_delta" (see EBTKS_ESP.h) sends a frame from CRT_Stream_Frame() instead, which only carries the
+//  blocks of vram that changed since the last frame (CRT_Dirty_Take(CRT_DIRTY_REMOTE, ...)), plus the start
+//  address and control register. A block is an alpha row, 32 bytes on the HP83/85/9915 and 80 on the HP86/87.
+//
+//  Frames are numbered. Each request carries the number of the last frame the peer applied. If that isn't the
+//  last frame sent (a frame was lost, the peer restarted, or this is the first request, with ack 0) the next
+//  frame is a keyframe: the peer starts from a zeroed vram, and every block is sent again. A frame holds at
+//  most CRT_STREAM_FRAME_MAX bytes, so a keyframe (or a big change) may take several frames. Blocks that
+//  don't fit are sent in the next frame, which is requested right away if the MORE flag is set.
+//
+//  Contiguous changed blocks are sent as one run, of at most CRT_STREAM_RUN_BYTES, compressed with
+//  lzs_simple_compress(). A run that doesn't get smaller is sent as it is.
+//
+//  Frame format, all multi-byte values are little endian:
+//        uint8       Format version, currently 1
+//        uint8       Flags. CRT_STREAM_KEY, CRT_STREAM_8687, CRT_STREAM_MORE
+//        uint32      Frame number. The first is 1
+//        uint16      Size of vram, 8192 on the HP83/85/9915, 16384 on the HP86/87
+//        uint16      sadAddr, as written to CRTSAD
+//        uint8       ctrl, as written to CRTSTS
+//        uint8       Block size in bytes
+//        uint8       Number of runs
+//        uint8       0
+//      Then for each run
+//        uint8       First block
+//        uint8       Number of blocks. The last block of vram may be short
+//        uint16      Length of the data that follows. Bit 15 set if it is not compressed
+//        N bytes     Data
+//
+//  tools/crt_stream decodes frames, and rebuilds the screen.
+//
+//      crt stream              Frame counts and sizes
+//      crt stream dump         Print a keyframe, and the frames that complete it, Base64 encoded, one per line.
+//                              The remote display then gets a keyframe too, as its ack no longer matches
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+#include "Base64.h"
+#include "lzs.h"
+
+#if ENABLE_CRT_STREAM
+
+#define CRT_STREAM_VERSION        (1)
+#define CRT_STREAM_HEADER_LENGTH  (14)
+#define CRT_STREAM_RUN_HEADER     (4)
+#define CRT_STREAM_RAW            (0x8000U)
+
+#define CRT_STREAM_KEY            (0x01)                      //  Zero vram before applying this frame
+#define CRT_STREAM_8687           (0x02)
+#define CRT_STREAM_MORE           (0x04)                      //  Changes are waiting for the next frame
+
+extern Base64Class Base64;                                    //  EBTKS_CRT.cpp
+
+static uint32_t   crt_stream_seq;                             //  Number of the last frame sent
+static uint32_t   crt_stream_unsent[CRT_DIRTY_WORDS];         //  Changed blocks not sent yet
+static bool       crt_stream_more;
+static uint32_t   crt_stream_frames, crt_stream_keyframes, crt_stream_bytes, crt_stream_vram_bytes;
+
+static inline bool crt_stream_block_unsent(uint32_t block)
+{
+  return (crt_stream_unsent[block >> 5] >> (block & 31)) & 1;
+}
+
+static void put16(uint8_t *p, uint32_t val)
+{
+  p[0] = val;
+  p[1] = val >> 8;
+}
+
+//
+//  Build the next frame in frame[], at most size bytes. ack is the number of the last frame the peer applied.
+//  Returns the frame length. Only for loop() context
+//
+
+uint32_t CRT_Stream_Frame(uint32_t ack, uint8_t *frame, uint32_t size)
+{
+  struct S_CRT_Dirty  dirty;
+  uint32_t    vram_size, block_size, blocks, run_blocks;
+  uint32_t    first, count, bytes, length, pos, runs, w;
+  uint8_t     flags = 0;
+
+  CRT_Dirty_Take(CRT_DIRTY_REMOTE, &dirty);
+  block_size = dirty.block_size;
+  vram_size  = Is8687 ? 16384 : 8192;
+  blocks     = (vram_size + block_size - 1) / block_size;
+  run_blocks = CRT_STREAM_RUN_BYTES / block_size;
+
+  if ((crt_stream_seq == 0) || (ack != crt_stream_seq))
+  {
+    memset(crt_stream_unsent, 0, sizeof(crt_stream_unsent));
+    for (first = 0 ; first < blocks ; first++)
+    {
+      crt_stream_unsent[first >> 5] |= 1U << (first & 31);
+    }
+    flags |= CRT_STREAM_KEY;
+    crt_stream_keyframes++;
+  }
+  else
+  {
+    for (w = 0 ; w < CRT_DIRTY_WORDS ; w++)
+    {
+      crt_stream_unsent[w] |= dirty.blocks[w];
+    }
+  }
+  if (Is8687)
+  {
+    flags |= CRT_STREAM_8687;
+  }
+  crt_stream_seq++;
+
+  pos  = CRT_STREAM_HEADER_LENGTH;
+  runs = 0;
+  for (first = 0 ; first < blocks ; first += count)
+  {
+    if (!crt_stream_block_unsent(first))
+    {
+      count = 1;
+      continue;
+    }
+    for (count = 1 ; (count < run_blocks) && (first + count < blocks) && crt_stream_block_unsent(first + count) ; count++) {}
+    bytes = count * block_size;
+    if (first * block_size + bytes > vram_size)
+    {
+      bytes = vram_size - first * block_size;
+    }
+    if ((runs == 255) || (pos + CRT_STREAM_RUN_HEADER + LZS_COMPRESSED_MAX(bytes) > size))
+    {
+      flags |= CRT_STREAM_MORE;                               //  The rest waits for the next frame
+      break;
+    }
+    length = lzs_simple_compress(&frame[pos + CRT_STREAM_RUN_HEADER], size - pos - CRT_STREAM_RUN_HEADER,
+                                 &current_screen.vram[first * block_size], bytes);
+    if (length >= bytes)
+    {
+      memcpy(&frame[pos + CRT_STREAM_RUN_HEADER], &current_screen.vram[first * block_size], bytes);
+      length = bytes | CRT_STREAM_RAW;
+    }
+    frame[pos]     = first;
+    frame[pos + 1] = count;
+    put16(&frame[pos + 2], length);
+    pos += CRT_STREAM_RUN_HEADER + (length & ~CRT_STREAM_RAW);
+    runs++;
+    crt_stream_vram_bytes += bytes;
+    for (w = first ; w < first + count ; w++)
+    {
+      crt_stream_unsent[w >> 5] &= ~(1U << (w & 31));
+    }
+  }
+
+  frame[0]  = CRT_STREAM_VERSION;
+  frame[1]  = flags;
+  frame[2]  = crt_stream_seq;
+  frame[3]  = crt_stream_seq >> 8;
+  frame[4]  = crt_stream_seq >> 16;
+  frame[5]  = crt_stream_seq >> 24;
+  put16(&frame[6], vram_size);
+  put16(&frame[8], current_screen.sadAddr);
+  frame[10] = current_screen.ctrl;
+  frame[11] = block_size;
+  frame[12] = runs;
+  frame[13] = 0;
+
+  crt_stream_more = (flags & CRT_STREAM_MORE) != 0;
+  crt_stream_frames++;
+  crt_stream_bytes += pos;
+  return pos;
+}
+
+uint32_t CRT_Stream_Seq(void)
+{
+  return crt_stream_seq;
+}
+
+bool CRT_Stream_More(void)
+{
+  return crt_stream_more;
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "crt stream"
+//
+
+void CRT_Stream_Command(void)
+{
+  static uint8_t  frame[CRT_STREAM_FRAME_MAX];
+  static char     text[(CRT_STREAM_FRAME_MAX + 2) / 3 * 4 + 1];
+  const char      *args = serial_string + 10;
+  uint32_t        length;
+
+  while (*args == ' ') args++;
+  if (strcasecmp(args, "dump") == 0)
+  {
+    length = 0;
+    do
+    {
+      length = CRT_Stream_Frame(length ? crt_stream_seq : 0, frame, sizeof(frame));     //  Starts with a keyframe
+      Base64.encode(text, (char *)frame, length);
+      Serial.printf("%s\n", text);
+    } while (crt_stream_more);
+    return;
+  }
+  Serial.printf("CRT stream: %u frames, %u keyframes, last frame %u. %u bytes sent for %u bytes of vram\n",
+                crt_stream_frames, crt_stream_keyframes, crt_stream_seq, crt_stream_bytes, crt_stream_vram_bytes);
+  if (crt_stream_frames)
+  {
+    Serial.printf("Average frame is %u bytes\n", crt_stream_bytes / crt_stream_frames);
+  }
+}
+
+#endif
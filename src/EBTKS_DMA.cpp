@@ -235,13 +235,14 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
   //
   buffer_index = 0;                  //  Index into the DMA buffer, and also indicates how many bytes we have transfered so far
   //
-  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh
+  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh.
+  //  DMA_Burst_Length and DMA_Burst_Break_Cycles default to MAX_DMA_BURST_LENGTH and DMA_BURST_BREAK_CYCLES, CONFIG.TXT can change them
   //
-  while((bytecount - buffer_index) > MAX_DMA_BURST_LENGTH)
+  while((bytecount - buffer_index) > DMA_Burst_Length)
   {                                  //  We have more than the max burst length still to be completed
-    DMA_Read_Burst(&buffer[buffer_index], MAX_DMA_BURST_LENGTH);
-    buffer_index += MAX_DMA_BURST_LENGTH;
-    for (refresh_count = 0 ; refresh_count < (DMA_BURST_BREAK_CYCLES - 1); refresh_count++)
+    DMA_Read_Burst(&buffer[buffer_index], DMA_Burst_Length);
+    buffer_index += DMA_Burst_Length;
+    for (refresh_count = 0 ; refresh_count < (DMA_Burst_Break_Cycles - 1); refresh_count++)
     {
       WAIT_WHILE_PHI_1_LOW;
       WAIT_WHILE_PHI_1_HIGH;
@@ -259,7 +260,7 @@ int32_t DMA_Read_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t b
     WAIT_WHILE_PHI_1_HIGH;
   }
   //
-  //  When we get here, there is at most MAX_DMA_BURST_LENGTH transfers pending
+  //  When we get here, there is at most DMA_Burst_Length transfers pending
   //
   DMA_Read_Burst(&buffer[buffer_index], bytecount - buffer_index);
 
@@ -470,7 +471,7 @@ static int32_t DMA_Read_Burst(uint8_t buffer[], uint32_t bytecount)
     buffer[buffer_index++] = data_from_IO_bus;     //  Save the data that has just been read
   }
 
-  if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
+  if ((Logic_Analyzer_State == ANALYZER_ACQUIRING) || (Logic_Analyzer_State >= ANALYZER_STREAMING))
   {
     DMA_Logic_Analyzer_Support(buffer, bytecount, 0);
   }
@@ -532,14 +533,15 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
   //
   buffer_index = 0;              //  Index into the DMA buffer, and also indicates how many bytes we have transfered so far
   //
-  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh
+  //  DMA burst length is limited so that we can allow for some idle cycles for the 1MA2 DRAM memory controller to do refresh.
+  //  DMA_Burst_Length and DMA_Burst_Break_Cycles default to MAX_DMA_BURST_LENGTH and DMA_BURST_BREAK_CYCLES, CONFIG.TXT can change them
   //
-  while((bytecount - buffer_index) > MAX_DMA_BURST_LENGTH)
+  while((bytecount - buffer_index) > DMA_Burst_Length)
   {  //  We have more than the max burst length still to be completed
-    DMA_Write_Burst(&buffer[buffer_index], MAX_DMA_BURST_LENGTH);     //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
+    DMA_Write_Burst(&buffer[buffer_index], DMA_Burst_Length);         //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
                                                                       //  /RC not asserted, U2 disabled, T4 bus is output, I/O bus direction is from HP
-    buffer_index += MAX_DMA_BURST_LENGTH;
-    for (refresh_count = 0 ; refresh_count < (DMA_BURST_BREAK_CYCLES - 1); refresh_count++)
+    buffer_index += DMA_Burst_Length;
+    for (refresh_count = 0 ; refresh_count < (DMA_Burst_Break_Cycles - 1); refresh_count++)
     {
       WAIT_WHILE_PHI_1_LOW;
       WAIT_WHILE_PHI_1_HIGH;
@@ -557,7 +559,7 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
     WAIT_WHILE_PHI_1_HIGH;
   }
   //
-  //  When we get here, there is at most MAX_DMA_BURST_LENGTH transfers pending
+  //  When we get here, there is at most DMA_Burst_Length transfers pending
   //
   DMA_Write_Burst(&buffer[buffer_index], bytecount - buffer_index);     //  On exit, we are just after the falling edge of Phi 1, /WRX is not asserted,
                                                                         //  /RC not asserted, U2 disabled, T4 bus is output, I/O bus direction is from HP
@@ -568,6 +570,10 @@ int32_t DMA_Write_Block(uint32_t DMA_Target_Address, uint8_t buffer[], uint32_t
   SET_T4_BUS_TO_INPUT;
   ENABLE_BUS_BUFFER_U2;
 
+#if ENABLE_HP85_RAM_SHADOW
+  HP85_Shadow_Update(DMA_Target_Address, buffer, bytecount);      //  The ISR doesn't see our own DMA writes
+#endif
+
   return bytecount;
 }
 
@@ -651,7 +657,7 @@ static int32_t DMA_Write_Burst(uint8_t buffer[], uint32_t bytecount)
   //  /RC is asserted and the last data byte to be written is on the data bus
   //
 
-  if (Logic_Analyzer_State == ANALYZER_ACQUIRING)
+  if ((Logic_Analyzer_State == ANALYZER_ACQUIRING) || (Logic_Analyzer_State >= ANALYZER_STREAMING))
   {
     DMA_Logic_Analyzer_Support(buffer, bytecount, 1);
   }
@@ -665,6 +671,15 @@ uint8_t DMA_Peek8(uint32_t address)
 {
   uint8_t data;
 
+#if ENABLE_HP85_RAM_SHADOW
+  uint8_t *shadow;
+
+  if ((shadow = HP85_Shadow_Ptr(address, 1)) != NULL)
+  {
+    return *shadow;                                     //  HP-85 RAM, no need for the bus
+  }
+#endif
+
   assert_DMA_Request();
   while(!DMA_Active){}      // Wait for acknowledgment, and Bus ownership
 
@@ -680,6 +695,15 @@ uint16_t DMA_Peek16(uint32_t address)
 {
   uint16_t data;
 
+#if ENABLE_HP85_RAM_SHADOW
+  uint8_t *shadow;
+
+  if ((shadow = HP85_Shadow_Ptr(address, 2)) != NULL)
+  {
+    return shadow[0] | (shadow[1] << 8);
+  }
+#endif
+
   assert_DMA_Request();
   while(!DMA_Active){};     // Wait for acknowledgment, and Bus ownership
   DMA_Read_Block(address , (uint8_t *)&data , 2);
@@ -710,6 +734,137 @@ void DMA_Poke16(uint32_t address, uint16_t val)
   while(DMA_Active){};      // Wait for release
 }
 
+////////////////////////////////////////////////////////////////////////////////  DMA Sessions, many transfers in one bus acquisition  ///////////////////////////////////////////////////////
+
+//
+//  Each DMA_Peek8() etc. does its own assert_DMA_Request() (about 2 us), waits for the HP-85 to halt,
+//  does one transfer, and releases the bus. A session collects a list of reads and writes (segments)
+//  at any addresses, and DMA_Session_Run() does them all while the bus is owned once. A segment that
+//  continues the previous one (same direction, next HP-85 address, next byte of the buffer) is merged
+//  with it, so a caller that adds one byte at a time still gets burst transfers.
+//
+//      struct S_DMA_Session  session;
+//
+//      DMA_Session_Begin(&session);
+//      DMA_Session_Read(&session, address_1, buffer_1, length_1);
+//      DMA_Session_Write(&session, address_2, buffer_2, length_2);
+//      DMA_Session_Run(&session);                                  //  buffer_1 is valid after this
+//
+//  If more than DMA_SESSION_MAX_SEGMENTS segments, or more than MAX_DMA_TRANSFER_LENGTH bytes are added,
+//  the session is run early to make room, so a read buffer is only guaranteed to be valid after
+//  DMA_Session_Run(). All interrupts are disabled while the bus is owned, and this keeps that to
+//  about 0.5 ms, so USB and the Tape/Disk emulation are not held up by a long transfer.
+//
+//  DMA_Read_Block() and DMA_Write_Block() split a segment into bursts of DMA_Burst_Length with
+//  DMA_Burst_Break_Cycles idle cycles between them, for the 1MA2 DRAM refresh. DMA_Session_Run() keeps
+//  track of the length of the last burst of each segment, and if the first burst of the next segment
+//  would make it longer than DMA_Burst_Length, it waits the same break cycles first.
+//
+
+void DMA_Session_Begin(struct S_DMA_Session *session)
+{
+  session->count   = 0;
+  session->pending = 0;
+  session->bytes   = 0;
+}
+
+static void DMA_Session_Add(struct S_DMA_Session *session, uint32_t address, uint8_t *buffer, uint32_t length, bool write)
+{
+  struct S_DMA_Segment  *last;
+
+  if (length == 0)
+  {
+    return;
+  }
+  if ((session->pending + length > MAX_DMA_TRANSFER_LENGTH) && session->count)
+  {
+    DMA_Session_Run(session);
+  }
+  if (session->count)
+  {
+    last = &session->segment[session->count - 1];
+    if ((last->write == write) && (last->address + last->length == address) && (last->buffer + last->length == buffer))
+    {
+      last->length     += length;
+      session->pending += length;
+      return;
+    }
+  }
+  if (session->count == DMA_SESSION_MAX_SEGMENTS)
+  {
+    DMA_Session_Run(session);
+  }
+  session->segment[session->count].address = address;
+  session->segment[session->count].buffer  = buffer;
+  session->segment[session->count].length  = length;
+  session->segment[session->count].write   = write;
+  session->count++;
+  session->pending += length;
+}
+
+void DMA_Session_Read(struct S_DMA_Session *session, uint32_t address, uint8_t *buffer, uint32_t length)
+{
+  DMA_Session_Add(session, address, buffer, length, false);
+}
+
+void DMA_Session_Write(struct S_DMA_Session *session, uint32_t address, const uint8_t *buffer, uint32_t length)
+{
+  DMA_Session_Add(session, address, (uint8_t *)buffer, length, true);
+}
+
+//
+//  Do all the segments in one bus acquisition, and empty the list. Returns the total bytes transferred
+//  since DMA_Session_Begin()
+//
+
+uint32_t DMA_Session_Run(struct S_DMA_Session *session)
+{
+  struct S_DMA_Segment  *segment;
+  uint32_t              index, burst, first;
+  uint8_t               refresh_count;
+
+  if (session->count == 0)
+  {
+    return session->bytes;
+  }
+
+  assert_DMA_Request();
+  while(!DMA_Active){};     // Wait for acknowledgment, and Bus ownership
+
+  burst = 0;                //  Length of the burst that the previous segment ended with
+  for (index = 0 ; index < session->count ; index++)
+  {
+    segment = &session->segment[index];
+    first = (segment->length > DMA_Burst_Length) ? DMA_Burst_Length : segment->length;
+    if (burst + first > DMA_Burst_Length)
+    {
+      for (refresh_count = 0 ; refresh_count < DMA_Burst_Break_Cycles ; refresh_count++)
+      {
+        WAIT_WHILE_PHI_1_LOW;
+        WAIT_WHILE_PHI_1_HIGH;
+      }
+      burst = 0;
+    }
+    if (segment->write)
+    {
+      DMA_Write_Block(segment->address, segment->buffer, segment->length);
+    }
+    else
+    {
+      DMA_Read_Block(segment->address, segment->buffer, segment->length);
+    }
+    burst = (segment->length > DMA_Burst_Length) ? ((segment->length - 1) % DMA_Burst_Length) + 1 : burst + segment->length;
+    session->bytes += segment->length;
+  }
+
+  release_DMA_request();
+  while(DMA_Active){};      // Wait for release
+
+  session->count   = 0;
+  session->pending = 0;
+  return session->bytes;
+}
+
 //
 //  Since we are doing DMA (otherwise why call this routine), Pin change interrupts for Phi 1 and Phi 2 are disabled.
 //  DMA is released 200 ns after the falling edge of Phi 2
@@ -740,6 +895,9 @@ void release_DMA_request(void)
     WAIT_WHILE_PHI_2_LOW;
   }
   delayNanoseconds(30);                     //  Tuned to make the release occur 100 ns after Phi 2 rising.
+#if ENABLE_EMC_SUPPORT
+  if (!EMC_Bank_Wanted)                     //  Else the HP-85 stays held, and the ISR releases it. See EBTKS_EMC_Cache.cpp
+#endif
   RELEASE_HALT;                             //  Release HALT 100 ns after Phi_2 Rising,
   DMA_Active = false;
 
@@ -809,8 +967,35 @@ static void DMA_Logic_Analyzer_Support(uint8_t buffer[], uint32_t bytecount, int
         if (--Logic_Analyzer_Samples_Till_Done == 0)
         {
           Logic_Analyzer_State = ANALYZER_ACQUISITION_DONE;
+          select_pinChange_isr();
         }
       }
     }
   }
+#if ENABLE_LA_STREAM
+  //
+  //  Streaming and deep capture trigger in the background, so every DMA byte goes into the stream ring buffer.
+  //  Interrupts are disabled during DMA, so this can't race with the ISR storing samples
+  //
+  else if (Logic_Analyzer_State >= ANALYZER_STREAMING)
+  {
+    while(index < bytecount)
+    {
+      Logic_Analyzer_main_sample = (DMA_Addr_for_Logic_Analyzer++ << 8) | buffer[index++] | ((mode == 0) ? 0x85000000 : 0x83000000);
+      Logic_Analyzer_aux_sample  =  getRselec() & 0x000000FF;
+      if ((LA_Stream_Head - LA_Stream_Tail) < LA_STREAM_RING_SIZE)
+      {
+        LA_Stream_Ring[LA_Stream_Head & (LA_STREAM_RING_SIZE - 1)].main = Logic_Analyzer_main_sample | LA_Stream_Gap_Flag;
+        LA_Stream_Ring[LA_Stream_Head & (LA_STREAM_RING_SIZE - 1)].aux  = Logic_Analyzer_aux_sample;
+        LA_Stream_Head++;
+        LA_Stream_Gap_Flag = 0;
+      }
+      else
+      {
+        LA_Stream_Dropped++;
+        LA_Stream_Gap_Flag = LA_STREAM_GAP_BIT;
+      }
+    }
+  }
+#endif
 }
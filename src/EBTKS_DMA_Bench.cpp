@@ -0,0 +1,297 @@
+//
+//  DMA benchmark
+//
+//  DMA_Read_Block() and DMA_Write_Block() break a transfer into bursts of DMA_Burst_Length bus cycles, with
+//  DMA_Burst_Break_Cycles idle cycles between them so the 1MA2 can catch up on postponed DRAM refresh (see
+//  the comments for MAX_DMA_BURST_LENGTH in EBTKS_Config.h). Longer bursts are faster, but how long is safe
+//  depends on the machine. "dma bench" measures it:
+//
+//      dma bench           Use DMA_BENCH_SCRATCH_SIZE bytes of free RAM, just above NXTMEM (HP85 family only)
+//      dma bench ADDR      Use DMA_BENCH_SCRATCH_SIZE bytes of HP-85 DRAM at octal ADDR. Required on HP86/87
+//      dma bench long ...  Also try bursts longer than DMA_BURST_REFRESH_LIMIT, that can starve DRAM refresh
+//
+//  For each burst length, the scratch area is tested DMA_BENCH_CHUNK bytes at a time. Each acquisition of
+//  the bus saves a chunk (at the CONFIG.TXT burst setting), writes a pattern, reads it back, checks it, and
+//  writes the saved bytes back before the bus is released, so the HP-85 program is not disturbed by the
+//  pattern itself. That is 4 x DMA_BENCH_CHUNK = 256 bus cycles, the same as MAX_DMA_TRANSFER_LENGTH, so
+//  interrupts are off for about 0.5 ms at a time. This is repeated for DMA_BENCH_PASSES passes, with a
+//  different pattern each time. The system ROM at 000000 is read in its own acquisitions, and compared with
+//  a copy read at the CONFIG.TXT setting. Rates are timed with ARM_DWT_CYCCNT, while the bus is owned.
+//
+//  The 1MA2 postpones at most two refresh cycles (see MAX_DMA_BURST_LENGTH in EBTKS_Config.h), so a burst of
+//  more than DMA_BURST_REFRESH_LIMIT cycles can drop a refresh, and that can corrupt any row of DRAM, not
+//  just the scratch area. Those bursts are only tried with "dma bench long", on a machine with nothing in
+//  memory worth keeping, and the HP-85 should be reset afterwards.
+//
+//  The result is a table of KB/s and errors, and the CONFIG.TXT lines for the longest burst with no
+//  errors, up to DMA_BURST_REFRESH_LIMIT as CONFIG.TXT clamps longer ones. CONFIG.TXT is not changed,
+//  as a short test can't prove that a burst length is safe, and the choice should be made by the owner
+//  of the machine.
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_DMA_BENCH
+
+#define DMA_BENCH_CHUNK               (MAX_DMA_TRANSFER_LENGTH / 4)   //  Save, write, read back and restore a chunk in each acquisition
+#define DMA_BENCH_ROM_ADDRESS         (0000000)
+#define DMA_BENCH_NXTMEM_GAP          (64)                      //  Leave this much above NXTMEM alone
+
+static const uint8_t  dma_bench_bursts[] = {4, 8, 12, 15, 18, 20, 24, 32, 48, 64};
+
+struct S_DMA_Bench_Result
+{
+  uint32_t    burst;
+  uint32_t    write_cycles, read_cycles, rom_cycles;
+  uint32_t    write_bytes, read_bytes, rom_bytes;
+  uint32_t    errors, rom_errors;
+};
+
+static uint8_t    dma_bench_original[DMA_BENCH_SCRATCH_SIZE];
+static uint8_t    dma_bench_saved[DMA_BENCH_CHUNK];
+static uint8_t    dma_bench_pattern[DMA_BENCH_SCRATCH_SIZE];
+static uint8_t    dma_bench_readback[DMA_BENCH_SCRATCH_SIZE];
+static uint8_t    dma_bench_rom[DMA_BENCH_SCRATCH_SIZE];
+
+static uint32_t dma_bench_kbs(uint32_t bytes, uint32_t cycles)
+{
+  if (cycles == 0)
+  {
+    return 0;
+  }
+  return (uint32_t)(((uint64_t)bytes * F_CPU_ACTUAL) / ((uint64_t)cycles * 1024));
+}
+
+//
+//  The pattern changes with each pass, so stuck bits and bytes left over from the last pass both show up.
+//  Odd passes are the complement of the even ones
+//
+
+static void dma_bench_make_pattern(uint32_t pass, uint32_t burst)
+{
+  uint32_t    i;
+  uint8_t     val;
+
+  for (i = 0 ; i < DMA_BENCH_SCRATCH_SIZE ; i++)
+  {
+    val = (uint8_t)((i * 37) + (pass >> 1) * 11 + burst + (i >> 3));
+    dma_bench_pattern[i] = (pass & 1) ? ~val : val;
+  }
+}
+
+static uint32_t dma_bench_compare(const uint8_t *expected, const uint8_t *actual)
+{
+  uint32_t    i, errors = 0;
+
+  for (i = 0 ; i < DMA_BENCH_SCRATCH_SIZE ; i++)
+  {
+    if (expected[i] != actual[i]) errors++;
+  }
+  return errors;
+}
+
+//
+//  Run one burst length. The CONFIG.TXT setting is used to save and restore the scratch area,
+//  and the tested one for everything else
+//
+
+static void dma_bench_run(uint32_t scratch, uint32_t burst, uint32_t default_burst, struct S_DMA_Bench_Result *result)
+{
+  uint32_t    pass, chunk, start;
+
+  memset(result, 0, sizeof(*result));
+  result->burst = burst;
+
+  for (pass = 0 ; pass < DMA_BENCH_PASSES ; pass++)
+  {
+    dma_bench_make_pattern(pass, burst);
+
+    for (chunk = 0 ; chunk < DMA_BENCH_SCRATCH_SIZE ; chunk += DMA_BENCH_CHUNK)
+    {
+      assert_DMA_Request();
+      while(!DMA_Active){};     // Wait for acknowledgment, and Bus ownership
+
+      DMA_Burst_Length = default_burst;
+      DMA_Read_Block(scratch + chunk, dma_bench_saved, DMA_BENCH_CHUNK);
+      DMA_Burst_Length = burst;
+
+      start = ARM_DWT_CYCCNT;
+      DMA_Write_Block(scratch + chunk, &dma_bench_pattern[chunk], DMA_BENCH_CHUNK);
+      result->write_cycles += ARM_DWT_CYCCNT - start;
+      result->write_bytes  += DMA_BENCH_CHUNK;
+
+      start = ARM_DWT_CYCCNT;
+      DMA_Read_Block(scratch + chunk, &dma_bench_readback[chunk], DMA_BENCH_CHUNK);
+      result->read_cycles += ARM_DWT_CYCCNT - start;
+      result->read_bytes  += DMA_BENCH_CHUNK;
+
+      DMA_Burst_Length = default_burst;
+      DMA_Write_Block(scratch + chunk, dma_bench_saved, DMA_BENCH_CHUNK);
+
+      release_DMA_request();
+      while(DMA_Active){};      // Wait for release
+    }
+    result->errors += dma_bench_compare(dma_bench_pattern, dma_bench_readback);
+
+    assert_DMA_Request();
+    while(!DMA_Active){};
+    DMA_Burst_Length = burst;
+    start = ARM_DWT_CYCCNT;
+    DMA_Read_Block(DMA_BENCH_ROM_ADDRESS, dma_bench_readback, DMA_BENCH_SCRATCH_SIZE);
+    result->rom_cycles += ARM_DWT_CYCCNT - start;
+    result->rom_bytes  += DMA_BENCH_SCRATCH_SIZE;
+    DMA_Burst_Length = default_burst;
+    release_DMA_request();
+    while(DMA_Active){};
+    result->rom_errors += dma_bench_compare(dma_bench_rom, dma_bench_readback);
+  }
+}
+
+//
+//  Free RAM above NXTMEM, on the HP85 family. 0 if there isn't enough, or it isn't HP-85 DRAM
+//
+
+static uint32_t dma_bench_default_scratch(void)
+{
+  uint32_t    nxtmem, lavail, scratch;
+
+  if (get_machineNum() >= MACH_HP86A)
+  {
+    Serial.printf("On the HP86/87, give the octal address of %d free bytes: dma bench ADDR\n", DMA_BENCH_SCRATCH_SIZE);
+    return 0;
+  }
+  nxtmem  = DMA_Peek16(NXTMEM);
+  lavail  = DMA_Peek16(LAVAIL);
+  scratch = nxtmem + DMA_BENCH_NXTMEM_GAP;
+  if ((lavail < scratch) || (lavail - scratch < 2 * DMA_BENCH_SCRATCH_SIZE))
+  {
+    Serial.printf("Not enough free memory between NXTMEM %06o and LAVAIL %06o. Try SCRATCH, or dma bench ADDR\n", nxtmem, lavail);
+    return 0;
+  }
+  return scratch;
+}
+
+void DMA_Bench_Command(void)
+{
+  const char  *args = serial_string + 9;
+  char        *end;
+  uint32_t    scratch, default_burst, i, best, count, errors, limit;
+  struct S_DMA_Bench_Result   results[sizeof(dma_bench_bursts)];
+  struct S_DMA_Bench_Result   *result;
+
+  while (*args == ' ') args++;
+  limit = DMA_BURST_REFRESH_LIMIT;
+  if (strncasecmp(args, "long", 4) == 0)
+  {
+    limit = DMA_BURST_LENGTH_LIMIT;
+    args += 4;
+    while (*args == ' ') args++;
+  }
+  if (*args)
+  {
+    scratch = strtoul(args, &end, 8);
+    if ((end == args) || (scratch < 0100000) || (scratch + DMA_BENCH_SCRATCH_SIZE > 0177400))
+    {
+      Serial.printf("dma bench ADDR, with ADDR in octal, in RAM from 100000 to %06o\n", 0177400 - DMA_BENCH_SCRATCH_SIZE);
+      return;
+    }
+  }
+  else if ((scratch = dma_bench_default_scratch()) == 0)
+  {
+    return;
+  }
+  if ((busReadPages[scratch >> 8] != NULL) || (busReadPages[(scratch + DMA_BENCH_SCRATCH_SIZE - 1) >> 8] != NULL))
+  {
+    Serial.printf("%06o is memory that EBTKS provides, which DMA can't reach. Use dma bench ADDR\n", scratch);
+    return;
+  }
+
+  default_burst = DMA_Burst_Length;
+  Serial.printf("DMA bench on %s, scratch %06o to %06o, %d passes. Burst is %u, break %u cycles\n",
+                get_machineType(), scratch, scratch + DMA_BENCH_SCRATCH_SIZE - 1, DMA_BENCH_PASSES,
+                DMA_Burst_Length, DMA_Burst_Break_Cycles);
+  if (limit > DMA_BURST_REFRESH_LIMIT)
+  {
+    Serial.printf("Bursts over %d can starve DRAM refresh, and corrupt any HP-85 memory. Reset the HP-85 afterwards\n",
+                  DMA_BURST_REFRESH_LIMIT);
+  }
+  else
+  {
+    Serial.printf("Bursts over %d are skipped, as they can starve DRAM refresh. Use dma bench long to try them\n",
+                  DMA_BURST_REFRESH_LIMIT);
+  }
+
+  //
+  //  Reference copies of the ROM and the scratch area, at the CONFIG.TXT setting
+  //
+  assert_DMA_Request();
+  while(!DMA_Active){};
+  DMA_Read_Block(DMA_BENCH_ROM_ADDRESS, dma_bench_rom, DMA_BENCH_SCRATCH_SIZE);
+  release_DMA_request();
+  while(DMA_Active){};
+  assert_DMA_Request();
+  while(!DMA_Active){};
+  DMA_Read_Block(scratch, dma_bench_original, DMA_BENCH_SCRATCH_SIZE);
+  release_DMA_request();
+  while(DMA_Active){};
+
+  count = 0;
+  for (i = 0 ; i < sizeof(dma_bench_bursts) ; i++)
+  {
+    if (dma_bench_bursts[i] > limit)
+    {
+      break;
+    }
+    dma_bench_run(scratch, dma_bench_bursts[i], default_burst, &results[count++]);
+  }
+  DMA_Burst_Length = default_burst;
+
+  //
+  //  Check that the scratch area is as it was. If it isn't, the restore was corrupted by the DMA at the end
+  //
+  assert_DMA_Request();
+  while(!DMA_Active){};
+  DMA_Read_Block(scratch, dma_bench_readback, DMA_BENCH_SCRATCH_SIZE);
+  release_DMA_request();
+  while(DMA_Active){};
+  errors = dma_bench_compare(dma_bench_original, dma_bench_readback);
+
+  Serial.printf("\nBurst   Write KB/s   Read KB/s   ROM KB/s   RAM errors   ROM errors\n");
+  best = 0;
+  for (i = 0 ; i < count ; i++)
+  {
+    result = &results[i];
+    Serial.printf("%5u   %10u   %9u   %8u   %10u   %10u\n", result->burst,
+                  dma_bench_kbs(result->write_bytes, result->write_cycles),
+                  dma_bench_kbs(result->read_bytes, result->read_cycles),
+                  dma_bench_kbs(result->rom_bytes, result->rom_cycles),
+                  result->errors, result->rom_errors);
+    if ((result->errors == 0) && (result->rom_errors == 0) && (best == i))
+    {
+      best = i + 1;                                         //  Longest burst with no errors at it or any shorter length
+    }
+  }
+  if (errors)
+  {
+    Serial.printf("\n%u bytes of the scratch area were not restored. Reset the HP-85 before going on\n", errors);
+  }
+  if (best == 0)
+  {
+    Serial.printf("\nErrors at every burst length. Leave CONFIG.TXT as it is, and check the machine\n");
+    return;
+  }
+  Serial.printf("\nLongest burst with no errors is %u. A short test can't prove it is safe, so allow some margin.\n",
+                results[best - 1].burst);
+  while ((best > 1) && (results[best - 1].burst > DMA_BURST_REFRESH_LIMIT))
+  {
+    best--;                                                 //  CONFIG.TXT clamps longer bursts
+  }
+  Serial.printf("To use %u, add this to the \"DMA\" section of CONFIG.TXT:\n\n", results[best - 1].burst);
+  Serial.printf("    \"%s\": {\n      \"BurstLength\": %u,\n      \"BreakCycles\": %u\n    }\n\n",
+                get_machineType(), results[best - 1].burst, DMA_Burst_Break_Cycles);
+}
+
+#endif
@@ -0,0 +1,271 @@
+//
+//  Queued DMA
+//
+//  DMA_Peek8(), Write_on_CRT_Alpha() and the rest wait for the HP-85 to give up the bus, do the transfer,
+//  and wait for the release, so everything else in loop() (tape.poll(), loopTranslator(), the ESP32,
+//  serial commands) stops while they run. Code that doesn't need the result right away can put the
+//  transfer in this queue instead, and DMA_Queue_Service() (from loop()) does as many queued jobs as fit
+//  in DMA_QUEUE_BUDGET bytes with one bus acquisition. When a job is done, its done flag is set and its
+//  callback is called. Both are optional.
+//
+//      DMA_Queue_Read(address, buffer, length, done, callback, context)
+//      DMA_Queue_Write(address, buffer, length, done, callback, context)
+//      DMA_Queue_CRT_Write(address, data, length)          Write to a CRT register, when the CRT is not busy
+//      DMA_Queue_CRT_Text(row, column, text)               As Write_on_CRT_Alpha()
+//      DMA_Queue_Delay(ms)                                 The next job queued starts at least ms after the one before it
+//      DMA_Queue_Flush()                                   Wait until the queue is empty
+//
+//  Writes of up to DMA_JOB_DATA_SIZE bytes (and all CRT jobs) are copied into the job, so the caller's buffer
+//  can be reused right away. For longer writes, and all reads, the buffer must stay valid until the job is done.
+//  Reads and writes longer than DMA_QUEUE_BUDGET are split into several jobs, and only the last one sets the
+//  done flag and calls the callback. The budget limits how long interrupts are disabled, but a job is
+//  always started if it is the first in a service, so one CRT job can take longer while the CRT is busy.
+//  A job with a delay is only started once the delay has passed since the service before it, and never in the
+//  same service as an earlier job. loop() carries on meanwhile, so paced output (the boot messages) doesn't block.
+//
+//  If the queue is full, it is serviced right away to make room, waiting out any delay. The queue is only used
+//  from loop() context, never from an ISR, so it needs no locking.
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_DMA_QUEUE
+
+enum dma_job_type
+{
+  DMA_JOB_READ = 0,
+  DMA_JOB_WRITE,
+  DMA_JOB_CRT_WRITE,
+  DMA_JOB_CRT_TEXT
+};
+
+struct S_DMA_Job
+{
+  uint8_t       type;
+  uint16_t      row, column;                              //  DMA_JOB_CRT_TEXT
+  uint32_t      delay_ms;                                 //  From the end of the service before this job, see DMA_Queue_Delay()
+  uint32_t      address;
+  uint8_t       *buffer;                                  //  The caller's buffer, or data[]
+  uint32_t      length;
+  volatile bool *done;
+  void          (*callback)(void *context);
+  void          *context;
+  uint8_t       data[DMA_JOB_DATA_SIZE + 1];              //  + 1 for the 0x00 at the end of CRT text
+};
+
+struct S_DMA_Job_Finished
+{
+  volatile bool *done;
+  void          (*callback)(void *context);
+  void          *context;
+};
+
+static struct S_DMA_Job   dma_queue[DMA_QUEUE_LENGTH];
+static uint32_t           dma_queue_head;                 //  Next job to do
+static uint32_t           dma_queue_tail;                 //  Next free job. Empty if head == tail
+static uint32_t           dma_queue_next_delay;           //  For the next job queued
+static uint32_t           dma_queue_last_ms;              //  millis() at the end of the last service
+
+uint32_t DMA_Queue_Pending(void)
+{
+  return dma_queue_tail - dma_queue_head;
+}
+
+//
+//  Get the next free job, servicing the queue first if it is full
+//
+
+static struct S_DMA_Job *DMA_Queue_Alloc(uint8_t type)
+{
+  struct S_DMA_Job  *job;
+
+  while (DMA_Queue_Pending() == DMA_QUEUE_LENGTH)
+  {
+    DMA_Queue_Service();
+  }
+  job = &dma_queue[dma_queue_tail % DMA_QUEUE_LENGTH];
+  memset(job, 0, offsetof(struct S_DMA_Job, data));
+  job->type     = type;
+  job->delay_ms = dma_queue_next_delay;
+  dma_queue_next_delay = 0;
+  return job;
+}
+
+void DMA_Queue_Delay(uint32_t ms)
+{
+  dma_queue_next_delay = ms;
+}
+
+static void DMA_Queue_Transfer(uint8_t type, uint32_t address, uint8_t *buffer, uint32_t length,
+                               volatile bool *done, void (*callback)(void *context), void *context)
+{
+  struct S_DMA_Job  *job;
+  uint32_t          chunk;
+
+  if (done)
+  {
+    *done = false;
+  }
+  do
+  {
+    chunk = (length > DMA_QUEUE_BUDGET) ? DMA_QUEUE_BUDGET : length;
+    job = DMA_Queue_Alloc(type);
+    job->address = address;
+    job->length  = chunk;
+    job->buffer  = buffer;
+    if ((type == DMA_JOB_WRITE) && (chunk <= DMA_JOB_DATA_SIZE))
+    {
+      memcpy(job->data, buffer, chunk);
+      job->buffer = job->data;
+    }
+    address += chunk;
+    buffer  += chunk;
+    length  -= chunk;
+    if (length == 0)
+    {
+      job->done     = done;
+      job->callback = callback;
+      job->context  = context;
+    }
+    dma_queue_tail++;
+  } while (length);
+}
+
+void DMA_Queue_Read(uint32_t address, uint8_t *buffer, uint32_t length, volatile bool *done,
+                    void (*callback)(void *context), void *context)
+{
+  DMA_Queue_Transfer(DMA_JOB_READ, address, buffer, length, done, callback, context);
+}
+
+void DMA_Queue_Write(uint32_t address, const uint8_t *buffer, uint32_t length, volatile bool *done,
+                     void (*callback)(void *context), void *context)
+{
+  DMA_Queue_Transfer(DMA_JOB_WRITE, address, (uint8_t *)buffer, length, done, callback, context);
+}
+
+void DMA_Queue_CRT_Write(uint32_t address, const uint8_t *data, uint32_t length)
+{
+  struct S_DMA_Job  *job;
+
+  if (length > DMA_JOB_DATA_SIZE)
+  {
+    length = DMA_JOB_DATA_SIZE;
+  }
+  job = DMA_Queue_Alloc(DMA_JOB_CRT_WRITE);
+  job->address = address;
+  job->length  = length;
+  job->buffer  = job->data;
+  memcpy(job->data, data, length);
+  dma_queue_tail++;
+}
+
+//
+//  Text longer than DMA_JOB_DATA_SIZE (a full HP86/87 line) is cut off
+//
+
+void DMA_Queue_CRT_Text(uint16_t row, uint16_t column, const char *text)
+{
+  struct S_DMA_Job  *job;
+
+  job = DMA_Queue_Alloc(DMA_JOB_CRT_TEXT);
+  job->row    = row;
+  job->column = column;
+  strlcpy((char *)job->data, text, sizeof(job->data));
+  job->length = strlen((char *)job->data);
+  job->buffer = job->data;
+  dma_queue_tail++;
+}
+
+//
+//  Do the queued jobs that fit in DMA_QUEUE_BUDGET bytes, in one bus acquisition. Completion flags and
+//  callbacks are handled after the bus is released, when interrupts are enabled again
+//
+
+void DMA_Queue_Service(void)
+{
+  struct S_DMA_Job  *job;
+  struct S_DMA_Job_Finished  finished[DMA_QUEUE_LENGTH];
+  uint32_t          first, last, bytes, count, i;
+
+  if (dma_queue_head == dma_queue_tail)
+  {
+    return;
+  }
+  job = &dma_queue[dma_queue_head % DMA_QUEUE_LENGTH];
+  if ((millis() - dma_queue_last_ms) < job->delay_ms)
+  {
+    return;
+  }
+
+  assert_DMA_Request();
+  while(!DMA_Active){};     // Wait for acknowledgment, and Bus ownership
+
+  first = dma_queue_head;
+  bytes = 0;
+  for (last = first ; last != dma_queue_tail ; last++)
+  {
+    job = &dma_queue[last % DMA_QUEUE_LENGTH];
+    if ((last != first) && ((bytes + job->length > DMA_QUEUE_BUDGET) || job->delay_ms))
+    {
+      break;
+    }
+    switch (job->type)
+    {
+      case DMA_JOB_READ:
+        DMA_Read_Block(job->address, job->buffer, job->length);
+        break;
+      case DMA_JOB_WRITE:
+        DMA_Write_Block(job->address, job->buffer, job->length);
+        break;
+      case DMA_JOB_CRT_WRITE:
+        while (Safe_CRT_is_Busy_with_DMA_Active()) {}
+        DMA_Write_Block(job->address, job->buffer, job->length);
+        break;
+      case DMA_JOB_CRT_TEXT:
+        Write_on_CRT_Alpha_with_DMA_Active(job->row, job->column, (const char *)job->buffer);
+        break;
+    }
+    bytes += job->length;
+  }
+
+  release_DMA_request();
+  while(DMA_Active){};      // Wait for release
+  dma_queue_last_ms = millis();
+
+  //
+  //  Free the jobs before any callbacks, as they may queue more jobs
+  //
+  count = last - first;
+  for (i = 0 ; i < count ; i++)
+  {
+    job = &dma_queue[(first + i) % DMA_QUEUE_LENGTH];
+    finished[i].done     = job->done;
+    finished[i].callback = job->callback;
+    finished[i].context  = job->context;
+  }
+  dma_queue_head = last;
+  for (i = 0 ; i < count ; i++)
+  {
+    if (finished[i].done)
+    {
+      *finished[i].done = true;
+    }
+    if (finished[i].callback)
+    {
+      finished[i].callback(finished[i].context);
+    }
+  }
+}
+
+void DMA_Queue_Flush(void)
+{
+  while (dma_queue_head != dma_queue_tail)
+  {
+    DMA_Queue_Service();
+  }
+}
+
+#endif
@@ -0,0 +1,359 @@
+//
+//  EMC memory, PSRAM backing store with a DMAMEM bank cache
+//
+//  EMC memory used to be a single DMAMEM array, which limited it to 8 banks (256 kB). Now all
+//  EMC_MAX_BANKS banks live in PSRAM (EXTMEM), and up to EMC_CACHE_BANKS of them are copied into
+//  DMAMEM. emc_r() and emc_w() in the ISR only ever access the cache: EMC_Bank_Ptr[bank] points at
+//  the bank's cache slot, or is NULL if the bank is only in PSRAM. The ISR never touches the PSRAM,
+//  as a data cache miss on it (a 32 byte line fill over QSPI, about 1 us, twice that if a dirty line
+//  has to be written back first) does not fit in the time the ISR has to answer an EMC read.
+//
+//  So a bank is brought into the cache before the HP-85 gets to it. Every time an EMC pointer is
+//  written or moves, emc_want() in the ISR checks the banks within EMC_HOLD_MARGIN bytes of it. If
+//  one is not cached, it sets the bank's bit in EMC_Bank_Wanted, and from the next bus cycle the ISR
+//  holds the HP-85 with HALT, which the CPU obeys at the end of the current instruction. An
+//  instruction moves at most 8 bytes through a pointer, so that is before it can reach the bank.
+//  emc_cache_poll() in loop() sees EMC_Bank_Wanted, copies the banks in (evicting the least recently
+//  used ones), and clears it, and the ISR then releases HALT. The HP-85 is held for about two 32 kB
+//  copies per bank, plus however long loop() takes to get to emc_cache_poll().
+//
+//  If the HP-85 gets to a bank that is not cached anyway, the ISR counts it in EMC_Bank_Misses: a
+//  read returns 0xFF and a write is lost. This should never happen, "emc cache" shows the count.
+//  Banks within EMC_HOLD_MARGIN of either pointer are never evicted.
+//
+//  Every EMC_CACHE_POLL_MS, emc_cache_rebalance() notes which cached banks were accessed since the
+//  last poll, which is the "recently used" for choosing what to evict.
+//
+//  The copies are done with interrupts enabled, since the ISR has to see every bus cycle. The ISR
+//  increments EMC_Bank_Generation[bank] after every write. A copy takes the generation before it
+//  starts, and then, with interrupts disabled for just a few instructions, only switches
+//  EMC_Bank_Ptr[bank] if the generation has not changed. If it has, the HP-85 wrote to the bank
+//  during the copy, the old mapping is kept, and the move is tried again on the next poll.
+//
+//  The PSRAM copy of a cached bank is only brought up to date when the bank is evicted, and only if
+//  it was written while cached (its generation is not the one it was loaded with).
+//
+//  The worst case HALT time, and whether EMC_Bank_Misses stays 0 with real EMC programs, have not
+//  been measured on hardware yet. "show isrstats" (with ENABLE_ISR_STATS) times the cache accesses,
+//  and "emc cache" has the number of holds and misses.
+//
+//  Without PSRAM (or with "PSRAM": false in the EMC section of CONFIG.TXT) there is nowhere to put
+//  the extra banks. EBTKS_SD.cpp limits EMC to EMC_CACHE_BANKS banks, and they are all permanently
+//  mapped to the cache.
+//
+//      emc cache       Show the bank map and the cache statistics
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_EMC_SUPPORT
+
+#define EMC_SLOT_FREE               (-1)
+
+struct S_EMC_Cache_Slot
+{
+  int32_t       bank;                                       //  Offset from the first EMC bank, or EMC_SLOT_FREE
+  uint32_t      loaded_generation;                          //  EMC_Bank_Generation[bank] when the PSRAM copy was last the same as the cache
+  uint32_t      last_used;                                  //  emc_cache_polls when the bank was last accessed
+  uint32_t      accesses;                                   //  Accesses in the last poll interval
+};
+
+EXTMEM static uint8_t               emc_store[EMC_MAX_BANKS][EMC_BANK_SIZE];
+DMAMEM static uint8_t               emc_cache[EMC_CACHE_BANKS][EMC_BANK_SIZE];
+static struct S_EMC_Cache_Slot      emc_slots[EMC_CACHE_BANKS];
+
+extern uint32_t   m_emc_ptr1, m_emc_ptr2;                   //  EBTKS_Bus_Interface_ISR.cpp
+
+static uint32_t   emc_cache_num_banks;                      //  0 until emc_cache_init()
+static bool       emc_cache_use_store;                      //  false if there is no PSRAM
+static uint32_t   emc_cache_polls;
+static uint32_t   emc_cache_last_poll_ms;
+static uint32_t   emc_cache_fills;
+static uint32_t   emc_cache_write_backs;
+static uint32_t   emc_cache_retries;                        //  Copies abandoned because the HP-85 wrote to the bank
+static uint32_t   emc_cache_holds;                          //  Times the HP-85 was held for EMC_Bank_Wanted
+
+static_assert(EMC_MAX_BANKS <= 32, "EMC_Bank_Wanted has one bit per bank");
+
+//
+//  Switch the bank to NULL (PSRAM only), writing the cache copy back first if it has changed.
+//  Returns false if the bank was written during the write back, and is still cached
+//
+
+static bool emc_cache_unmap(uint32_t slot)
+{
+  uint32_t    bank = emc_slots[slot].bank;
+  uint32_t    generation = EMC_Bank_Generation[bank];
+  bool        unchanged;
+
+  if (generation != emc_slots[slot].loaded_generation)
+  {
+    memcpy(emc_store[bank], emc_cache[slot], EMC_BANK_SIZE);
+    emc_slots[slot].loaded_generation = generation;
+    emc_cache_write_backs++;
+  }
+  __disable_irq();
+  if ((unchanged = (EMC_Bank_Generation[bank] == generation)))
+  {
+    EMC_Bank_Ptr[bank] = NULL;
+  }
+  __enable_irq();
+  if (!unchanged)
+  {
+    emc_cache_retries++;
+    return false;
+  }
+  emc_slots[slot].bank = EMC_SLOT_FREE;
+  return true;
+}
+
+//
+//  Copy the bank into a free slot and switch to it. Returns false if the bank was written during the copy,
+//  which only loop() code (an EMC snapshot load) can do while the bank is not mapped
+//
+
+static bool emc_cache_map(uint32_t slot, uint32_t bank)
+{
+  uint32_t    generation = EMC_Bank_Generation[bank];
+  bool        unchanged;
+
+  memcpy(emc_cache[slot], emc_store[bank], EMC_BANK_SIZE);
+  __disable_irq();
+  if ((unchanged = (EMC_Bank_Generation[bank] == generation)))
+  {
+    EMC_Bank_Ptr[bank] = emc_cache[slot];
+  }
+  __enable_irq();
+  if (!unchanged)
+  {
+    emc_cache_retries++;
+    return false;
+  }
+  emc_slots[slot].bank              = bank;
+  emc_slots[slot].loaded_generation = generation;
+  emc_slots[slot].last_used         = emc_cache_polls;
+  emc_cache_fills++;
+  return true;
+}
+
+//
+//  Banks within EMC_HOLD_MARGIN bytes of either EMC pointer, as emc_want() in the ISR sees them. One bit per bank
+//
+
+static uint32_t emc_cache_pointer_banks(void)
+{
+  uint32_t    ptrs[2] = {m_emc_ptr1, m_emc_ptr2};
+  uint32_t    span = emc_cache_num_banks * EMC_BANK_SIZE;
+  uint32_t    i, offset, banks = 0;
+
+  for (i = 0 ; i < 2 ; i++)
+  {
+    offset = ptrs[i] - get_EMC_StartAddress() + EMC_HOLD_MARGIN;
+    if (offset < span) banks |= 1U << (offset / EMC_BANK_SIZE);
+    offset = ptrs[i] - get_EMC_StartAddress() - EMC_HOLD_MARGIN;
+    if (offset < span) banks |= 1U << (offset / EMC_BANK_SIZE);
+  }
+  return banks;
+}
+
+//
+//  Called from emc_init(), before the EMC I/O handlers are installed. Banks start out as zeros.
+//  With PSRAM, the first EMC_CACHE_BANKS banks start out in the cache, so a configuration that
+//  fits in the cache never touches PSRAM
+//
+
+void emc_cache_init(void)
+{
+  uint32_t    bank, slot;
+
+  emc_cache_num_banks = get_EMC_NumBanks();
+  emc_cache_use_store = get_EMC_PSRAM();
+  if (emc_cache_num_banks > (emc_cache_use_store ? EMC_MAX_BANKS : EMC_CACHE_BANKS))
+  {
+    emc_cache_num_banks = emc_cache_use_store ? EMC_MAX_BANKS : EMC_CACHE_BANKS;      //  EBTKS_SD.cpp should already have done this
+  }
+  emc_cache_polls       = 0;
+  emc_cache_fills       = 0;
+  emc_cache_write_backs = 0;
+  emc_cache_retries     = 0;
+  emc_cache_holds       = 0;
+  EMC_Bank_Wanted       = 0;
+  EMC_Bank_Misses       = 0;
+
+  memset(emc_cache, 0, sizeof(emc_cache));
+  if (emc_cache_use_store)
+  {
+    memset(emc_store, 0, emc_cache_num_banks * EMC_BANK_SIZE);
+  }
+  for (bank = 0 ; bank < EMC_MAX_BANKS ; bank++)
+  {
+    EMC_Bank_Generation[bank] = 0;
+    EMC_Bank_Accesses[bank]   = 0;
+    EMC_Bank_Ptr[bank]        = NULL;
+  }
+  for (slot = 0 ; slot < EMC_CACHE_BANKS ; slot++)
+  {
+    memset(&emc_slots[slot], 0, sizeof(emc_slots[slot]));
+    emc_slots[slot].bank = EMC_SLOT_FREE;
+    if (slot < emc_cache_num_banks)
+    {
+      emc_slots[slot].bank = slot;
+      EMC_Bank_Ptr[slot]   = emc_cache[slot];
+    }
+  }
+}
+
+//
+//  Where loop() code (EMC snapshots, hp85_read()) finds a bank: the cache slot if it is cached, else
+//  the PSRAM copy. NULL if the bank is not in use. Anything that writes through it must increment
+//  EMC_Bank_Generation[bank] afterwards, as the ISR does
+//
+
+uint8_t *emc_cache_bank_data(uint32_t bank)
+{
+  if (bank >= emc_cache_num_banks)
+  {
+    return NULL;
+  }
+  if (EMC_Bank_Ptr[bank] != NULL)
+  {
+    return EMC_Bank_Ptr[bank];
+  }
+  return emc_cache_use_store ? emc_store[bank] : NULL;
+}
+
+//
+//  Bring in the banks in EMC_Bank_Wanted, evicting the least recently used banks that no pointer is near.
+//  A bank whose copy is abandoned stays wanted, and is tried again on the next call
+//
+
+static void emc_cache_fetch(void)
+{
+  uint32_t    wanted = EMC_Bank_Wanted;
+  uint32_t    keep, done = 0, bank, slot, victim;
+
+  keep = emc_cache_pointer_banks() | wanted;
+  for (bank = 0 ; bank < emc_cache_num_banks ; bank++)
+  {
+    if (!(wanted & (1U << bank)))
+    {
+      continue;
+    }
+    if (EMC_Bank_Ptr[bank] != NULL)
+    {
+      done |= 1U << bank;                                   //  Fetched already, the ISR asked again before it saw that
+      continue;
+    }
+    victim = EMC_CACHE_BANKS;
+    for (slot = 0 ; slot < EMC_CACHE_BANKS ; slot++)
+    {
+      if (emc_slots[slot].bank == EMC_SLOT_FREE)
+      {
+        victim = slot;
+        break;
+      }
+      if (keep & (1U << emc_slots[slot].bank))
+      {
+        continue;
+      }
+      if ((victim == EMC_CACHE_BANKS) || (emc_slots[slot].last_used < emc_slots[victim].last_used))
+      {
+        victim = slot;
+      }
+    }
+    if (victim == EMC_CACHE_BANKS)
+    {
+      break;                                                //  Every slot is near a pointer, or wanted. Can't happen with 8 slots
+    }
+    if ((emc_slots[victim].bank != EMC_SLOT_FREE) && !emc_cache_unmap(victim))
+    {
+      continue;
+    }
+    if (emc_cache_map(victim, bank))
+    {
+      done |= 1U << bank;
+    }
+  }
+  if (done)
+  {
+    __disable_irq();
+    EMC_Bank_Wanted &= ~done;                               //  The ISR releases HALT when this is 0
+    __enable_irq();
+    emc_cache_holds++;
+  }
+}
+
+//
+//  One round of the replacement policy: note which cached banks were used since the last round, then fetch
+//  any wanted banks. emc_cache_poll() calls it every EMC_CACHE_POLL_MS, and at once when a bank is wanted.
+//  The host test in tools/bus_sim calls it directly
+//
+
+void emc_cache_rebalance(void)
+{
+  uint32_t    slot;
+
+  emc_cache_polls++;
+  for (slot = 0 ; slot < EMC_CACHE_BANKS ; slot++)
+  {
+    if (emc_slots[slot].bank != EMC_SLOT_FREE)
+    {
+      emc_slots[slot].accesses = EMC_Bank_Accesses[emc_slots[slot].bank];
+      EMC_Bank_Accesses[emc_slots[slot].bank] = 0;          //  An ISR increment between these two is lost, which doesn't matter
+      if (emc_slots[slot].accesses)
+      {
+        emc_slots[slot].last_used = emc_cache_polls;
+      }
+    }
+  }
+  if (emc_cache_use_store && EMC_Bank_Wanted)
+  {
+    emc_cache_fetch();
+  }
+}
+
+void emc_cache_poll(void)
+{
+  if (emc_cache_num_banks == 0)
+  {
+    return;
+  }
+  if (!EMC_Bank_Wanted && ((millis() - emc_cache_last_poll_ms) < EMC_CACHE_POLL_MS))
+  {
+    return;
+  }
+  emc_cache_last_poll_ms = millis();
+  emc_cache_rebalance();
+}
+
+void EMC_Cache_Info(void)
+{
+  int         bank, slot;
+
+  if (emc_cache_num_banks == 0)
+  {
+    Serial.printf("EMC is not enabled\n");
+    return;
+  }
+  Serial.printf("EMC banks %d to %d, %s\n", get_EMC_StartBank(), get_EMC_StartBank() + emc_cache_num_banks - 1,
+                emc_cache_use_store ? "stored in PSRAM" : "no PSRAM, all in the cache");
+  Serial.printf("%u fills, %u write backs, %u retries, %u holds, %u misses\n", emc_cache_fills, emc_cache_write_backs,
+                emc_cache_retries, emc_cache_holds, EMC_Bank_Misses);
+  Serial.printf("Slot  Bank  Writes since load  Last interval accesses\n");
+  for (slot = 0 ; slot < EMC_CACHE_BANKS ; slot++)
+  {
+    if (emc_slots[slot].bank == EMC_SLOT_FREE)
+    {
+      Serial.printf("%4d  free\n", slot);
+      continue;
+    }
+    bank = emc_slots[slot].bank;
+    Serial.printf("%4d  %4d  %17u  %22u\n", slot, bank + get_EMC_StartBank(),
+                  EMC_Bank_Generation[bank] - emc_slots[slot].loaded_generation, emc_slots[slot].accesses);
+  }
+}
+
+#endif
@@ -0,0 +1,362 @@
+//
+//  EMC snapshots
+//
+//  EMC memory is lost at power off, and an Electronic Disk or a big EMC workload can take minutes to
+//  rebuild. A snapshot saves the EMC memory, both EMC pointers and DRP to a file on the SD Card, and
+//  restoring it takes a few seconds.
+//
+//      emc save [FILE]                 Save a snapshot (default EMC_SNAPSHOT_FILENAME)
+//      emc load [FILE]                 Restore a snapshot, only while EBTKS holds the HP-85 in reset
+//      emc load force [FILE]           Restore a snapshot while the HP-85 is running
+//      AUXCMD 0, 31, "FILE", ""        Save a snapshot, from BASIC
+//      AUXCMD 0, 32, "FILE", ""        Restore a snapshot, from BASIC
+//      "Restore": "FILE"               In the EMC section of CONFIG.TXT. Restore the snapshot at power up,
+//                                      before PWO is released
+//
+//  The snapshot has to be taken while the HP-85 is not writing to EMC. While an AUXCMD keyword is being
+//  processed, the HP-85 is waiting in the AUXROM for EBTKS to finish, so that is the safe way to do it.
+//  Holding the HP-85 with DMA is not an option, because interrupts (and so the SD Card and USB) are off
+//  while EBTKS has the bus. "emc save" from the serial port runs while the HP-85 is running. It uses
+//  the EMC bank write counts (EMC_Bank_Generation[]) to detect a write during the save, and tries again,
+//  up to EMC_SNAPSHOT_RETRIES times.
+//
+//  Loading a snapshot replaces EMC memory, which the HP-85 may be running a program from (or have an
+//  Electronic Disk in) at the time. So "emc load" from the serial port refuses unless EBTKS is holding
+//  PWO, and "emc load force" has to be used to load while the HP-85 runs. The power up restore is done
+//  before PWO is released, and AUXCMD usage 32 is asked for by the HP-85 program itself.
+//
+//  File format, all multi-byte values are little endian:
+//        8 bytes     "EBTKSEMC"
+//        uint16      Format version, currently 1
+//        uint16      Header length in bytes, currently 32. Runs start here
+//        uint32      First EMC bank
+//        uint32      Number of EMC banks
+//        uint32      EMC pointer 1
+//        uint32      EMC pointer 2
+//        uint8       DRP, then 3 bytes of 0
+//      Then runs of non-zero data. EMC memory is scanned in blocks of EMC_SNAPSHOT_BLOCK bytes, and
+//      all zero blocks are skipped. Each run is
+//        uint32      Offset from the start of EMC memory
+//        uint32      Length in bytes
+//        Length bytes of EMC memory
+//      The last run has offset 0xFFFFFFFF and length 0, and is followed by
+//        uint32      CRC-32 (as used by zip) of everything before it
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_EMC_SNAPSHOT
+
+#define EMC_SNAPSHOT_VERSION        (1)
+#define EMC_SNAPSHOT_HEADER_LENGTH  (32)
+#define EMC_SNAPSHOT_END            (0xFFFFFFFFU)
+
+extern uint32_t           m_emc_ptr1, m_emc_ptr2;           //  EBTKS_Bus_Interface_ISR.cpp
+extern volatile uint8_t   m_emc_drp;
+
+static uint8_t    emc_snapshot_buffer[EMC_SNAPSHOT_BLOCK];  //  SD transfers can't be from PSRAM, so everything goes through here
+static uint32_t   emc_snapshot_crc;
+static FsFile     emc_snapshot_file;
+
+static bool emc_snapshot_write(const void *data, uint32_t length)
+{
+  emc_snapshot_crc = crc32_update(emc_snapshot_crc, data, length);
+  return emc_snapshot_file.write(data, length) == length;
+}
+
+static bool emc_snapshot_read(void *data, uint32_t length)
+{
+  if (emc_snapshot_file.read(data, length) != (int)length)
+  {
+    return false;
+  }
+  emc_snapshot_crc = crc32_update(emc_snapshot_crc, data, length);
+  return true;
+}
+
+//
+//  Copies the block at offset (from the start of EMC memory) into emc_snapshot_buffer[], and returns
+//  true if it is all zeros
+//
+
+static bool emc_snapshot_block_is_zero(uint32_t offset)
+{
+  uint32_t    *words = (uint32_t *)emc_snapshot_buffer;
+  uint32_t    i, bits = 0;
+
+  memcpy(emc_snapshot_buffer, &emc_cache_bank_data(offset / EMC_BANK_SIZE)[offset % EMC_BANK_SIZE], EMC_SNAPSHOT_BLOCK);
+  for (i = 0 ; i < EMC_SNAPSHOT_BLOCK / 4 ; i++)
+  {
+    bits |= words[i];
+  }
+  return bits == 0;
+}
+
+static bool emc_snapshot_write_all(uint32_t num_banks)
+{
+  uint8_t     header[EMC_SNAPSHOT_HEADER_LENGTH];
+  uint32_t    values[6];
+  uint32_t    size = num_banks * EMC_BANK_SIZE;
+  uint32_t    offset, end;
+  bool        ok;
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, "EBTKSEMC", 8);
+  header[8]  = EMC_SNAPSHOT_VERSION;
+  header[10] = EMC_SNAPSHOT_HEADER_LENGTH;
+  values[0]  = get_EMC_StartBank();
+  values[1]  = num_banks;
+  values[2]  = m_emc_ptr1;
+  values[3]  = m_emc_ptr2;
+  values[4]  = m_emc_drp;
+  memcpy(header + 12, values, 5 * sizeof(uint32_t));        //  Teensy is little endian, as is the format
+
+  emc_snapshot_crc = 0;
+  ok = emc_snapshot_write(header, sizeof(header));
+  offset = 0;
+  while (ok && (offset < size))
+  {
+    if (emc_snapshot_block_is_zero(offset))
+    {
+      offset += EMC_SNAPSHOT_BLOCK;
+      continue;
+    }
+    //
+    //  Find the end of the run, then write it. The first block is re-read, since finding the end of the
+    //  run overwrote emc_snapshot_buffer[]
+    //
+    for (end = offset + EMC_SNAPSHOT_BLOCK ; (end < size) && !emc_snapshot_block_is_zero(end) ; end += EMC_SNAPSHOT_BLOCK)
+    {
+    }
+    values[0] = offset;
+    values[1] = end - offset;
+    ok = emc_snapshot_write(values, 2 * sizeof(uint32_t));
+    for ( ; ok && (offset < end) ; offset += EMC_SNAPSHOT_BLOCK)
+    {
+      emc_snapshot_block_is_zero(offset);
+      ok = emc_snapshot_write(emc_snapshot_buffer, EMC_SNAPSHOT_BLOCK);
+    }
+  }
+  values[0] = EMC_SNAPSHOT_END;
+  values[1] = 0;
+  ok = ok && emc_snapshot_write(values, 2 * sizeof(uint32_t));
+  values[2] = emc_snapshot_crc;
+  ok = ok && emc_snapshot_write(&values[2], sizeof(uint32_t));
+  return ok;
+}
+
+bool EMC_Snapshot_Save(const char *filename)
+{
+  uint32_t    generation[EMC_MAX_BANKS];
+  uint32_t    num_banks = get_EMC_NumBanks();
+  uint32_t    attempt, bank;
+  bool        ok, changed;
+
+  if (!get_EMC_Enable())
+  {
+    Serial.printf("EMC is not enabled\n");
+    return false;
+  }
+  for (attempt = 0 ; attempt < EMC_SNAPSHOT_RETRIES ; attempt++)
+  {
+    for (bank = 0 ; bank < num_banks ; bank++)
+    {
+      generation[bank] = EMC_Bank_Generation[bank];
+    }
+    if (!(emc_snapshot_file = SD.open(filename, O_RDWR | O_TRUNC | O_CREAT)))
+    {
+      Serial.printf("Could not create %s\n", filename);
+      return false;
+    }
+    ok = emc_snapshot_write_all(num_banks);
+    Serial.printf("%s %s, %u bytes for %u kB of EMC\n", ok ? "Saved" : "Error writing", filename,
+                  (uint32_t)emc_snapshot_file.size(), num_banks * (EMC_BANK_SIZE / 1024));
+    emc_snapshot_file.close();
+    if (!ok)
+    {
+      return false;
+    }
+    changed = false;
+    for (bank = 0 ; bank < num_banks ; bank++)
+    {
+      changed |= (generation[bank] != EMC_Bank_Generation[bank]);
+    }
+    if (!changed)
+    {
+      return true;
+    }
+    Serial.printf("The HP-85 wrote to EMC while it was being saved\n");
+  }
+  Serial.printf("%s may not be consistent. Use AUXCMD 0, 31, \"%s\", \"\" from BASIC instead\n", filename, filename);
+  return false;
+}
+
+//
+//  First pass over the file, check the header and the CRC
+//
+
+static bool emc_snapshot_check(const char *filename, uint32_t *values)
+{
+  uint8_t     header[EMC_SNAPSHOT_HEADER_LENGTH];
+  uint32_t    run[2];
+  uint32_t    crc, length;
+
+  if (!(emc_snapshot_file = SD.open(filename, FILE_READ)))
+  {
+    Serial.printf("Couldn't open %s\n", filename);
+    return false;
+  }
+  emc_snapshot_crc = 0;
+  if (!emc_snapshot_read(header, sizeof(header)) || (memcmp(header, "EBTKSEMC", 8) != 0) ||
+      (header[8] != EMC_SNAPSHOT_VERSION) || (header[10] != EMC_SNAPSHOT_HEADER_LENGTH))
+  {
+    Serial.printf("%s is not an EMC snapshot\n", filename);
+    goto fail;
+  }
+  memcpy(values, header + 12, 5 * sizeof(uint32_t));
+  while (1)
+  {
+    if (!emc_snapshot_read(run, sizeof(run)))
+    {
+      goto truncated;
+    }
+    if (run[0] == EMC_SNAPSHOT_END)
+    {
+      break;
+    }
+    if (run[0] % EMC_SNAPSHOT_BLOCK)
+    {
+      goto truncated;
+    }
+    for (length = run[1] ; length ; length -= EMC_SNAPSHOT_BLOCK)
+    {
+      if ((length < EMC_SNAPSHOT_BLOCK) || !emc_snapshot_read(emc_snapshot_buffer, EMC_SNAPSHOT_BLOCK))
+      {
+        goto truncated;
+      }
+    }
+  }
+  crc = emc_snapshot_crc;
+  if (!emc_snapshot_read(run, sizeof(uint32_t)))
+  {
+    goto truncated;
+  }
+  if (run[0] != crc)
+  {
+    Serial.printf("%s has a bad CRC\n", filename);
+    goto fail;
+  }
+  emc_snapshot_file.close();
+  return true;
+
+truncated:
+  Serial.printf("%s is truncated or corrupt\n", filename);
+fail:
+  emc_snapshot_file.close();
+  return false;
+}
+
+//
+//  Restore a snapshot. Banks that are not in the current EMC configuration are skipped, and banks that
+//  are not in the snapshot are cleared. EMC_Bank_Generation[] is bumped for every bank that changes, so that
+//  banks in the cache are written back to PSRAM when they are evicted
+//
+
+bool EMC_Snapshot_Load(const char *filename)
+{
+  uint8_t     header[EMC_SNAPSHOT_HEADER_LENGTH];
+  uint32_t    values[5];
+  uint32_t    run[2];
+  uint32_t    num_banks = get_EMC_NumBanks();
+  uint32_t    size = num_banks * EMC_BANK_SIZE;
+  uint32_t    bank, skipped = 0;
+
+  if (!get_EMC_Enable())
+  {
+    Serial.printf("EMC is not enabled\n");
+    return false;
+  }
+  if (!emc_snapshot_check(filename, values))
+  {
+    return false;
+  }
+  if ((values[0] != (uint32_t)get_EMC_StartBank()) || (values[1] != num_banks))
+  {
+    Serial.printf("%s is from EMC banks %u to %u, EMC is now banks %u to %u\n", filename, values[0], values[0] + values[1] - 1,
+                  get_EMC_StartBank(), get_EMC_StartBank() + num_banks - 1);
+  }
+
+  for (bank = 0 ; bank < num_banks ; bank++)
+  {
+    memset(emc_cache_bank_data(bank), 0, EMC_BANK_SIZE);
+    EMC_Bank_Generation[bank]++;
+  }
+
+  emc_snapshot_file = SD.open(filename, FILE_READ);
+  emc_snapshot_read(header, sizeof(header));
+  while (emc_snapshot_read(run, sizeof(run)) && (run[0] != EMC_SNAPSHOT_END))
+  {
+    for ( ; run[1] ; run[0] += EMC_SNAPSHOT_BLOCK, run[1] -= EMC_SNAPSHOT_BLOCK)
+    {
+      emc_snapshot_read(emc_snapshot_buffer, EMC_SNAPSHOT_BLOCK);
+      if (run[0] >= size)
+      {
+        skipped += EMC_SNAPSHOT_BLOCK;
+        continue;
+      }
+      memcpy(&emc_cache_bank_data(run[0] / EMC_BANK_SIZE)[run[0] % EMC_BANK_SIZE], emc_snapshot_buffer, EMC_SNAPSHOT_BLOCK);
+      EMC_Bank_Generation[run[0] / EMC_BANK_SIZE]++;
+    }
+  }
+  emc_snapshot_file.close();
+
+  m_emc_ptr1 = values[2];
+  m_emc_ptr2 = values[3];
+  m_emc_drp  = values[4];
+  Serial.printf("Restored %s, EMC pointers %08o %08o, DRP %03o\n", filename, m_emc_ptr1, m_emc_ptr2, m_emc_drp);
+  if (skipped)
+  {
+    Serial.printf("%u bytes beyond the current EMC banks were not restored\n", skipped);
+  }
+  return true;
+}
+
+//
+//  "emc save [FILE]" and "emc load [FILE]". Parameters are parsed from serial_string
+//
+
+void EMC_Snapshot_Command(void)
+{
+  const char  *filename = serial_string + 8;
+  bool        save = (strncasecmp(serial_string, "emc save", 8) == 0);
+  bool        force = false;
+
+  while (*filename == ' ') filename++;
+  if (!save && (strncasecmp(filename, "force", 5) == 0) && ((filename[5] == ' ') || (filename[5] == '\0')))
+  {
+    force = true;
+    filename += 5;
+    while (*filename == ' ') filename++;
+  }
+  if (*filename == '\0')
+  {
+    filename = EMC_SNAPSHOT_FILENAME;
+  }
+  if (save)
+  {
+    EMC_Snapshot_Save(filename);
+  }
+  else if (force || GET_ASSERT_PWO_OUT)
+  {
+    EMC_Snapshot_Load(filename);
+  }
+  else
+  {
+    Serial.printf("The HP-85 is running, and may be using EMC memory. Use 'emc load force [FILE]' to load anyway\n");
+  }
+}
+
+#endif
@@ -0,0 +1,261 @@
+//
+//  EMC trace
+//
+//  Tracing EMC activity used to need a special build (ENABLE_TRACE_EMC or ENABLE_TRACE_PTR2), each with
+//  its own buffer, address window and print code. Now one build with ENABLE_EMC_TRACE has it all, switched
+//  on at run time with the window as a parameter. ENABLE_EMC_TRACE is on by default, the ring is 8 kB of
+//  RAM2. While tracing is on, the EMC handlers in EBTKS_Bus_Interface_ISR.cpp call EMC_Trace_Record() for
+//  every indirect read and write, pointer decrement, and pointer register read and write. Events whose
+//  pointer is in the address window go into EMC_Trace_Ring[], a ring of EMC_TRACE_RING_SIZE 16 byte
+//  events, so it always holds the most recent ones. While it is off, the cost is one predictable branch.
+//
+//      emc trace on [LOW HIGH]     Clear the ring and start tracing. LOW and HIGH (octal, inclusive)
+//                                  limit it to pointers in that window. The default is all addresses
+//      emc trace off               Stop tracing. The ring is kept
+//      emc trace show [N]          Print the last N events (default 40)
+//      emc trace dump              Send the ring over USB serial, as a binary frame
+//      emc trace save [FILE]       Write the ring to FILE (default EMC_TRACE_FILENAME)
+//      emc trace                   Show the trace status
+//
+//  Tracing is paused while the ring is being shown, dumped or saved. tools/la_decode prints a dump as a table.
+//
+//  Frame format, all multi-byte values are little endian:
+//        8 bytes     "EBTKSEMT"
+//        uint16      Format version, currently 1
+//        uint16      Header length in bytes, currently 32. Events start here
+//        uint32      Number of events in the frame
+//        uint32      Number of events recorded, more than the number in the frame if the ring wrapped
+//        uint32      Window low, and window high
+//        uint32      Reserved, 0
+//      Then, oldest first, for each event (struct S_EMC_Trace_Event)
+//        uint32      Pointer. For EMC_TRACE_PTR_WRITE, the pointer after the write
+//        uint32      pin_isr_count, the bus cycle count
+//        uint8       Operation, enum emc_trace_ops in EBTKS_Global_Data.h
+//        uint8       Data byte. For EMC_TRACE_DEC, the amount the pointer is decremented by
+//        uint8       DRP
+//        uint8       cycleNdx, the byte of a multi-byte transfer
+//        uint8       EMC mode (I/O address - 0xFFC8). Bit 2 selects PTR2
+//        3 bytes     0
+//      And finally
+//        uint32      CRC-32 (as used by zip) of everything before it
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_EMC_TRACE
+
+#define EMC_TRACE_VERSION           (1)
+#define EMC_TRACE_HEADER_LENGTH     (32)
+#define EMC_TRACE_BLOCK_EVENTS      (32)                        //  Events per write to the SD Card
+
+static uint32_t   emc_trace_crc;
+static FsFile     emc_trace_file;
+
+static const char *emc_trace_op_name(uint8_t op)
+{
+  switch (op)
+  {
+    case EMC_TRACE_READ:        return "read";
+    case EMC_TRACE_WRITE:       return "write";
+    case EMC_TRACE_DEC:         return "dec";
+    case EMC_TRACE_PTR_READ:    return "ptr rd";
+    case EMC_TRACE_PTR_WRITE:   return "ptr wr";
+    default:                    return "?";
+  }
+}
+
+//
+//  Number of events in the ring, and the ring index of the oldest
+//
+
+static uint32_t emc_trace_available(uint32_t *oldest)
+{
+  uint32_t    count = EMC_Trace_Count;
+
+  if (count > EMC_TRACE_RING_SIZE)
+  {
+    *oldest = count & (EMC_TRACE_RING_SIZE - 1);
+    return EMC_TRACE_RING_SIZE;
+  }
+  *oldest = 0;
+  return count;
+}
+
+static void emc_trace_status(void)
+{
+  Serial.printf("EMC trace is %s, window %08o to %08o, %u events recorded, ring holds %d\n",
+                EMC_Trace_Active ? "on" : "off", EMC_Trace_Low, EMC_Trace_Low + EMC_Trace_Span,
+                EMC_Trace_Count, EMC_TRACE_RING_SIZE);
+}
+
+static void emc_trace_on(const char *args)
+{
+  char        *end;
+  uint32_t    low, high;
+
+  low  = 0;
+  high = 0xFFFFFFFFU;
+  while (*args == ' ') args++;
+  if (*args)
+  {
+    low  = strtoul(args, &end, 8);
+    high = strtoul(end, &end, 8);
+    if ((end == args) || (high < low))
+    {
+      Serial.printf("emc trace on LOW HIGH, with the window in octal and LOW <= HIGH\n");
+      return;
+    }
+  }
+  EMC_Trace_Active = false;
+  EMC_Trace_Low    = low;
+  EMC_Trace_Span   = high - low;
+  EMC_Trace_Count  = 0;
+  memset(EMC_Trace_Ring, 0, sizeof(EMC_Trace_Ring));
+  EMC_Trace_Active = true;
+  emc_trace_status();
+}
+
+static void emc_trace_show(uint32_t lines)
+{
+  uint32_t    oldest, count, first, i;
+  struct S_EMC_Trace_Event  *event;
+
+  emc_trace_status();
+  count = emc_trace_available(&oldest);
+  first = (count > lines) ? count - lines : 0;
+  Serial.printf("\n     Cycle  Op      Pointer   Data  DRP  Ndx  PTR\n");
+  for (i = first ; i < count ; i++)
+  {
+    event = &EMC_Trace_Ring[(oldest + i) & (EMC_TRACE_RING_SIZE - 1)];
+    Serial.printf("%10u  %-6s  %08o  %03o   %03o  %3u  %u\n", event->cycle, emc_trace_op_name(event->op),
+                  event->ptr, event->data, event->drp, event->cycle_ndx, (event->mode & 0x04) ? 2 : 1);
+  }
+}
+
+//
+//  Send bytes to USB serial, or to emc_trace_file if to_file, and update the running CRC
+//
+
+static bool emc_trace_out(bool to_file, const void *data, uint32_t length)
+{
+  emc_trace_crc = crc32_update(emc_trace_crc, data, length);
+  if (to_file)
+  {
+    return emc_trace_file.write(data, length) == length;
+  }
+  Serial.write((const uint8_t *)data, length);
+  return true;
+}
+
+static bool emc_trace_send(bool to_file)
+{
+  uint8_t     header[EMC_TRACE_HEADER_LENGTH];
+  struct S_EMC_Trace_Event  block[EMC_TRACE_BLOCK_EVENTS];
+  uint32_t    values[5];
+  uint32_t    oldest, count, i, n;
+  bool        ok;
+
+  count = emc_trace_available(&oldest);
+  memcpy(header, "EBTKSEMT", 8);
+  header[8]  = EMC_TRACE_VERSION;
+  header[9]  = 0;
+  header[10] = EMC_TRACE_HEADER_LENGTH;
+  header[11] = 0;
+  values[0] = count;
+  values[1] = EMC_Trace_Count;
+  values[2] = EMC_Trace_Low;
+  values[3] = EMC_Trace_Low + EMC_Trace_Span;
+  values[4] = 0;
+  memcpy(header + 12, values, 5 * sizeof(uint32_t));        //  Teensy is little endian, as is the format
+
+  emc_trace_crc = 0;
+  ok = emc_trace_out(to_file, header, sizeof(header));
+  for (i = 0 ; ok && (i < count) ; i += n)
+  {
+    for (n = 0 ; (n < EMC_TRACE_BLOCK_EVENTS) && (i + n < count) ; n++)
+    {
+      block[n] = EMC_Trace_Ring[(oldest + i + n) & (EMC_TRACE_RING_SIZE - 1)];
+    }
+    ok = emc_trace_out(to_file, block, n * sizeof(block[0]));
+  }
+  if (ok)
+  {
+    values[0] = emc_trace_crc;
+    ok = emc_trace_out(to_file, &values[0], sizeof(uint32_t));
+  }
+  if (!to_file)
+  {
+    Serial.flush();
+  }
+  return ok;
+}
+
+static void emc_trace_save(const char *filename)
+{
+  bool      ok;
+
+  if (!(emc_trace_file = SD.open(filename, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Could not create %s\n", filename);
+    return;
+  }
+  ok = emc_trace_send(true);
+  emc_trace_file.close();
+  Serial.printf("%s %s, %u events\n", ok ? "Saved" : "Error writing", filename,
+                (EMC_Trace_Count > EMC_TRACE_RING_SIZE) ? EMC_TRACE_RING_SIZE : EMC_Trace_Count);
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "emc trace"
+//
+
+void EMC_Trace_Command(void)
+{
+  const char  *args = serial_string + 9;
+  bool        was_active;
+
+  while (*args == ' ') args++;
+
+  if (strncasecmp(args, "on", 2) == 0)
+  {
+    emc_trace_on(args + 2);
+    return;
+  }
+  if (strcasecmp(args, "off") == 0)
+  {
+    EMC_Trace_Active = false;
+    emc_trace_status();
+    return;
+  }
+
+  was_active = EMC_Trace_Active;
+  EMC_Trace_Active = false;                                 //  So the ring doesn't change while it is read
+  if (strncasecmp(args, "show", 4) == 0)
+  {
+    uint32_t  lines = strtoul(args + 4, NULL, 10);
+
+    emc_trace_show(lines ? lines : 40);
+  }
+  else if (strcasecmp(args, "dump") == 0)
+  {
+    emc_trace_send(false);
+    Serial.printf("\n");
+  }
+  else if (strncasecmp(args, "save", 4) == 0)
+  {
+    args += 4;
+    while (*args == ' ') args++;
+    emc_trace_save(*args ? args : EMC_TRACE_FILENAME);
+  }
+  else
+  {
+    emc_trace_status();
+    Serial.printf("emc trace on [LOW HIGH], emc trace off, emc trace show [N], emc trace dump, emc trace save [FILE]\n");
+  }
+  EMC_Trace_Active = was_active;
+}
+
+#endif
@@ -0,0 +1,163 @@
+//
+//  Block reads and writes of HP-85 memory, as the HP-85 currently sees it
+//
+//  EBTKS code that needs HP-85 memory (mostly the AUXROM keywords, fetching parameters and storing
+//  results) can't just use DMA, as DMA only reaches memory on the HP-85 side of the bus. While EBTKS
+//  owns the bus its ISR is not running, so it does not answer for the memory it provides itself.
+//  hp85_read() and hp85_write() split the range into runs by what backs each address:
+//
+//      EBTKS RAM           The HP-85A 16K RAM expansion               block copy
+//      EBTKS ROM           The selected ROM, if EBTKS provides it      block copy (writes are ignored, as on the bus)
+//      AUXROM RAM window   070000..075777 while an AUXROM is selected  block copy
+//      EMC                 Addresses 0200000 and up, EBTKS EMC memory  block copy, by bank
+//      Everything else     HP-85 DRAM, ROMs and I/O                    one DMA session for the whole range
+//
+//  The first three are found the same way the bus ISR finds them, through busReadPages[] and busWritePages[],
+//  so this always matches what the HP-85 would read at that moment. HP-85 RAM is read from the shadow
+//  (EBTKS_HP85_Shadow.cpp) when it is valid, and only written by DMA. Addresses above 0177777 are only
+//  reachable through the EMC pointer registers, so only EMC memory that EBTKS provides can be accessed there.
+//  AUXROM_Fetch_Memory() and AUXROM_Store_Memory() take 16 bit bus addresses and never get there.
+//
+//  Must not be called from an ISR, as DMA needs the bus ISR. Returns false if part of the range is EMC
+//  memory that EBTKS does not provide. Those bytes read as 0377, as an unanswered bus read would, and
+//  writes to them are lost
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#define HP85_ADDRESS_SPACE          (0x10000U)
+
+//
+//  Pointer to the EBTKS copy of an EMC address, and how many bytes follow it in the same bank.
+//  NULL if EBTKS does not provide that address
+//
+
+static uint8_t *hp85_emc_run(uint32_t addr, uint32_t *run)
+{
+#if ENABLE_EMC_SUPPORT
+  uint32_t    offset;
+  uint8_t     *bank;
+
+  if (!get_EMC_Enable() || (addr < (uint32_t)get_EMC_StartAddress()) || (addr > (uint32_t)get_EMC_EndAddress()))
+  {
+    return NULL;
+  }
+  offset = addr - get_EMC_StartAddress();
+  if ((bank = emc_cache_bank_data(offset / EMC_BANK_SIZE)) == NULL)
+  {
+    return NULL;
+  }
+  *run = EMC_BANK_SIZE - (offset % EMC_BANK_SIZE);
+  if (*run > (uint32_t)get_EMC_EndAddress() - addr + 1)
+  {
+    *run = get_EMC_EndAddress() - addr + 1;
+  }
+  return &bank[offset % EMC_BANK_SIZE];
+#else
+  (void)addr;
+  (void)run;
+  return NULL;
+#endif
+}
+
+bool hp85_read(uint32_t addr, uint8_t *buf, uint32_t n)
+{
+  struct S_DMA_Session  session;
+  uint8_t               *page, *emc;
+  uint32_t              run;
+  bool                  ok = true;
+
+  DMA_Session_Begin(&session);
+  while (n)
+  {
+    if (addr < HP85_ADDRESS_SPACE)
+    {
+      run = 256 - (addr & 0xFFU);                               //  To the end of the page
+      if (run > n) run = n;
+      if ((page = busReadPages[addr >> 8]) != NULL)
+      {
+        memcpy(buf, &page[addr & 0xFFU], run);
+      }
+#if ENABLE_HP85_RAM_SHADOW
+      else if ((page = HP85_Shadow_Ptr(addr, run)) != NULL)
+      {
+        memcpy(buf, page, run);                                 //  HP-85 RAM, from the shadow
+      }
+#endif
+      else
+      {
+        DMA_Session_Read(&session, addr, buf, run);             //  Merges with the previous page, if it was DMA too
+      }
+    }
+    else
+    {
+      run = 1;
+      if ((emc = hp85_emc_run(addr, &run)) != NULL)
+      {
+        if (run > n) run = n;
+        memcpy(buf, emc, run);
+      }
+      else
+      {
+        *buf = 0377;
+        ok   = false;
+      }
+    }
+    addr += run;
+    buf  += run;
+    n    -= run;
+  }
+  DMA_Session_Run(&session);
+  return ok;
+}
+
+bool hp85_write(uint32_t addr, const uint8_t *buf, uint32_t n)
+{
+  struct S_DMA_Session  session;
+  uint8_t               *page, *emc;
+  uint32_t              run;
+  bool                  ok = true;
+
+  DMA_Session_Begin(&session);
+  while (n)
+  {
+    if (addr < HP85_ADDRESS_SPACE)
+    {
+      run = 256 - (addr & 0xFFU);
+      if (run > n) run = n;
+      if ((page = busWritePages[addr >> 8]) != NULL)
+      {
+        memcpy(&page[addr & 0xFFU], buf, run);
+      }
+      else if (busReadPages[addr >> 8] == NULL)
+      {
+        DMA_Session_Write(&session, addr, buf, run);
+      }
+      //  else it is a ROM that EBTKS provides, and the write goes nowhere
+    }
+    else
+    {
+      run = 1;
+      if ((emc = hp85_emc_run(addr, &run)) != NULL)
+      {
+        if (run > n) run = n;
+        memcpy(emc, buf, run);
+#if ENABLE_EMC_SUPPORT
+        EMC_Bank_Generation[(addr - get_EMC_StartAddress()) / EMC_BANK_SIZE]++;     //  So the EMC bank cache knows it changed
+#endif
+      }
+      else
+      {
+        ok = false;
+      }
+    }
+    addr += run;
+    buf  += run;
+    n    -= run;
+  }
+  DMA_Session_Run(&session);
+  return ok;
+}
@@ -0,0 +1,322 @@
+//
+//  Shadow copy of HP-85 main RAM
+//
+//  The bus ISR sees every write cycle, so onWriteData() queues each write to 0100000..0177377 in
+//  HP85_Shadow_FIFO[], and shadow_drain() applies them to HP85_Shadow[]. With the shadow seeded once by DMA, EBTKS can then read HP-85 RAM (AUXROM parameters,
+//  strings, system variables) with no bus cycles at all:
+//
+//      hp85_read()                 RAM runs are copied from the shadow, no DMA session
+//      DMA_Peek8(), DMA_Peek16()   RAM addresses are read from the shadow, without asking for the bus
+//      shadow dump ADDR [N]        Octal dump of HP-85 memory, through hp85_read()
+//
+//  DMA_Write_Block() updates the shadow itself, as the ISR is not running while EBTKS owns the bus.
+//
+//  HP85_Shadow[] is in EXTMEM. A data cache miss on the PSRAM takes longer than the ISR can spare, so the ISR
+//  never touches it. It adds (addr, data) to HP85_Shadow_FIFO[] in DTCM, the way "la deep" stages samples in
+//  LA_Stream_Ring[], and shadow_drain() copies the FIFO into the shadow from loop(): every HP85_Shadow_Poll(),
+//  and before anything reads the shadow, so a reader always sees every write queued so far. If loop() falls
+//  behind and the FIFO fills, the ISR drops the write and invalidates the shadow, which is then seeded again.
+//  DMA_Write_Block() drains the FIFO before it updates the shadow, so a queued write can't overwrite a newer one.
+//
+//  HP85_Shadow_Span stays 0, so the ISR and DMA_Write_Block() leave the shadow alone, until HP85_Shadow_Poll()
+//  has checked that PSRAM is fitted. Without PSRAM the shadow is never used.
+//
+//  Seeding is done by HP85_Shadow_Poll(), from loop(). It starts once the HP-85 is idle after boot, so its
+//  own RAM test and initialization are over, and reads MAX_DMA_TRANSFER_LENGTH bytes per call. Writes that
+//  happen during seeding are no problem: a chunk that has already been read is updated through the FIFO, and
+//  one that hasn't gets the new value when it is read. The shadow covers RAM up to LWAMEM on the HP85 family,
+//  as addresses with no RAM behind them don't read back what was written. HP86/87 use the whole range.
+//
+//  EMC indirect writes with a pointer below 0200000 go to the first 64K of physical memory, which may be
+//  main RAM, without a write cycle to that address. emc_w() clears HP85_Shadow_Valid for those, and the
+//  shadow is seeded again.
+//
+//      shadow                      Status
+//      shadow check                Compare the shadow with HP-85 RAM, read by DMA
+//      shadow seed                 Seed it again
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_HP85_RAM_SHADOW
+
+static bool       shadow_seeding;
+static uint32_t   shadow_seed_next;                       //  Next address to read
+static uint32_t   shadow_seed_top;
+static uint32_t   shadow_seed_invalidations;              //  HP85_Shadow_Invalidations when seeding started
+static uint32_t   shadow_hits, shadow_bytes;
+static uint32_t   shadow_fifo_max;                        //  Most writes waiting in the FIFO at a drain
+
+//
+//  Apply the queued writes to the shadow. Only from loop() context (or with the bus held), never from an ISR
+//
+
+static void shadow_drain(void)
+{
+  uint32_t                    tail = HP85_Shadow_FIFO_Tail;
+  uint32_t                    head = HP85_Shadow_FIFO_Head;
+  struct S_HP85_Shadow_Write  *write;
+
+  if (head - tail > shadow_fifo_max)
+  {
+    shadow_fifo_max = head - tail;
+  }
+  while (tail != head)
+  {
+    write = &HP85_Shadow_FIFO[tail & (HP85_SHADOW_FIFO_SIZE - 1)];
+    HP85_Shadow[write->addr - HP85_SHADOW_BASE] = write->data;
+    tail++;
+  }
+  HP85_Shadow_FIFO_Tail = tail;                           //  Only now can the ISR re-use these entries
+}
+
+//
+//  Pointer to the shadow copy of addr .. addr + n - 1, or NULL if that range isn't all in the valid shadow.
+//  Pages that EBTKS provides itself are not shadowed, callers use busReadPages[] for those
+//
+
+uint8_t *HP85_Shadow_Ptr(uint32_t addr, uint32_t n)
+{
+  if (!HP85_Shadow_Valid || (addr < HP85_SHADOW_BASE) || (addr + n > HP85_Shadow_Top) || (n == 0))
+  {
+    return NULL;
+  }
+  if ((busReadPages[addr >> 8] != NULL) || (busReadPages[(addr + n - 1) >> 8] != NULL))
+  {
+    return NULL;
+  }
+  shadow_drain();
+  shadow_hits++;
+  shadow_bytes += n;
+  return &HP85_Shadow[addr - HP85_SHADOW_BASE];
+}
+
+//
+//  Called by DMA_Write_Block(), with interrupts disabled
+//
+
+void HP85_Shadow_Update(uint32_t addr, const uint8_t *buf, uint32_t n)
+{
+  if ((HP85_Shadow_Span == 0) || (addr >= HP85_SHADOW_BASE + HP85_SHADOW_SIZE) || (addr + n <= HP85_SHADOW_BASE))
+  {
+    return;
+  }
+  shadow_drain();                                         //  Older queued writes first
+  if (addr < HP85_SHADOW_BASE)
+  {
+    buf += HP85_SHADOW_BASE - addr;
+    n   -= HP85_SHADOW_BASE - addr;
+    addr = HP85_SHADOW_BASE;
+  }
+  if (addr + n > HP85_SHADOW_BASE + HP85_SHADOW_SIZE)
+  {
+    n = HP85_SHADOW_BASE + HP85_SHADOW_SIZE - addr;
+  }
+  memcpy(&HP85_Shadow[addr - HP85_SHADOW_BASE], buf, n);
+}
+
+void HP85_Shadow_Seed(void)
+{
+  HP85_Shadow_Valid = false;
+  if (HP85_Shadow_Span == 0)
+  {
+    return;                                               //  No PSRAM, or HP85_Shadow_Poll() hasn't checked yet
+  }
+  if (get_machineNum() >= MACH_HP86A)
+  {
+    shadow_seed_top = HP85_SHADOW_BASE + HP85_SHADOW_SIZE;
+  }
+  else
+  {
+    shadow_seed_top = DMA_Peek16(LWAMEM) + 1;
+    if ((shadow_seed_top <= HP85_SHADOW_BASE) || (shadow_seed_top > HP85_SHADOW_BASE + HP85_SHADOW_SIZE))
+    {
+      shadow_seed_top = HP85_SHADOW_BASE + HP85_SHADOW_SIZE;
+    }
+  }
+  shadow_seed_invalidations = HP85_Shadow_Invalidations;
+  shadow_seed_next = HP85_SHADOW_BASE;
+  shadow_seeding   = true;
+}
+
+//
+//  Called from loop(). Starts seeding the first time the HP-85 is idle, and again if the shadow was invalidated.
+//  Each call reads at most MAX_DMA_TRANSFER_LENGTH bytes
+//
+
+void HP85_Shadow_Poll(void)
+{
+  uint32_t    length;
+
+  if (HP85_Shadow_Span == 0)
+  {
+    if (!PSRAM_Holds_EXTMEM())
+    {
+      return;
+    }
+    HP85_Shadow_Span = HP85_SHADOW_SIZE;                  //  From here on, the ISR queues writes for the shadow
+  }
+  shadow_drain();
+  if (!shadow_seeding)
+  {
+    if (HP85_Shadow_Valid || !is_hp85_idle())
+    {
+      return;
+    }
+    HP85_Shadow_Seed();
+    return;
+  }
+
+  length = shadow_seed_top - shadow_seed_next;
+  if (length > MAX_DMA_TRANSFER_LENGTH)
+  {
+    length = MAX_DMA_TRANSFER_LENGTH;
+  }
+  if (busReadPages[shadow_seed_next >> 8] == NULL)          //  DMA can't read what EBTKS provides
+  {
+    assert_DMA_Request();
+    while(!DMA_Active){};     // Wait for acknowledgment, and Bus ownership
+    DMA_Read_Block(shadow_seed_next, &HP85_Shadow[shadow_seed_next - HP85_SHADOW_BASE], length);
+    release_DMA_request();
+    while(DMA_Active){};      // Wait for release
+  }
+  shadow_seed_next += length;
+  if (shadow_seed_next < shadow_seed_top)
+  {
+    return;
+  }
+
+  shadow_seeding = false;
+  __disable_irq();
+  if (HP85_Shadow_Invalidations == shadow_seed_invalidations)
+  {
+    HP85_Shadow_Top   = shadow_seed_top;
+    HP85_Shadow_Valid = true;
+  }
+  __enable_irq();
+}
+
+static void shadow_status(void)
+{
+  if (HP85_Shadow_Span == 0)
+  {
+    Serial.printf("HP-85 RAM shadow is not in use, it needs PSRAM\n");
+    return;
+  }
+  Serial.printf("HP-85 RAM shadow is %s, %06o to %06o. %u reads served, %u bytes. Invalidated %u times\n",
+                HP85_Shadow_Valid ? "valid" : (shadow_seeding ? "seeding" : "not valid"),
+                HP85_SHADOW_BASE, (HP85_Shadow_Valid ? HP85_Shadow_Top : shadow_seed_top) - 1,
+                shadow_hits, shadow_bytes, HP85_Shadow_Invalidations);
+  Serial.printf("Write FIFO holds %u of %u, at most %u\n", HP85_Shadow_FIFO_Head - HP85_Shadow_FIFO_Tail,
+                HP85_SHADOW_FIFO_SIZE, shadow_fifo_max);
+}
+
+//
+//  Compare the shadow with RAM, read by DMA. Each chunk is read and compared with the bus held, so
+//  the HP-85 can't change it in between
+//
+
+static void shadow_check(void)
+{
+  uint8_t     buffer[MAX_DMA_TRANSFER_LENGTH];
+  uint32_t    addr, length, i, errors = 0, first = 0;
+
+  if (!HP85_Shadow_Valid)
+  {
+    shadow_status();
+    return;
+  }
+  for (addr = HP85_SHADOW_BASE ; addr < HP85_Shadow_Top ; addr += length)
+  {
+    length = HP85_Shadow_Top - addr;
+    if (length > MAX_DMA_TRANSFER_LENGTH) length = MAX_DMA_TRANSFER_LENGTH;
+    if (busReadPages[addr >> 8] != NULL)
+    {
+      continue;
+    }
+    assert_DMA_Request();
+    while(!DMA_Active){};
+    DMA_Read_Block(addr, buffer, length);
+    shadow_drain();                                         //  Every write up to now, with the bus still held
+    for (i = 0 ; i < length ; i++)
+    {
+      if (buffer[i] != HP85_Shadow[addr + i - HP85_SHADOW_BASE])
+      {
+        if (errors++ == 0) first = addr + i;
+      }
+    }
+    release_DMA_request();
+    while(DMA_Active){};
+  }
+  if (errors)
+  {
+    Serial.printf("%u bytes differ, the first at %06o\n", errors, first);
+  }
+  else
+  {
+    Serial.printf("Shadow matches HP-85 RAM, %06o to %06o\n", HP85_SHADOW_BASE, HP85_Shadow_Top - 1);
+  }
+}
+
+static void shadow_dump(const char *args)
+{
+  uint8_t     line[8];
+  char        *end;
+  uint32_t    addr, count, n, i;
+
+  addr  = strtoul(args, &end, 8);
+  if (end == args)
+  {
+    Serial.printf("shadow dump ADDR [N], with ADDR in octal\n");
+    return;
+  }
+  count = strtoul(end, NULL, 10);
+  if (count == 0) count = 64;
+  if (count > 4096) count = 4096;
+  while (count)
+  {
+    n = (count > 8) ? 8 : count;
+    hp85_read(addr, line, n);
+    Serial.printf("%06o:", addr);
+    for (i = 0 ; i < n ; i++)
+    {
+      Serial.printf(" %03o", line[i]);
+    }
+    Serial.printf("\n");
+    addr  += n;
+    count -= n;
+  }
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "shadow"
+//
+
+void HP85_Shadow_Command(void)
+{
+  const char  *args = serial_string + 6;
+
+  while (*args == ' ') args++;
+  if (strcasecmp(args, "check") == 0)
+  {
+    shadow_check();
+  }
+  else if (strcasecmp(args, "seed") == 0)
+  {
+    HP85_Shadow_Seed();
+    shadow_status();
+  }
+  else if (strncasecmp(args, "dump", 4) == 0)
+  {
+    shadow_dump(args + 4);
+  }
+  else
+  {
+    shadow_status();
+  }
+}
+
+#endif
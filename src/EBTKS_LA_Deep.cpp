@@ -0,0 +1,332 @@
+//
+//  Logic Analyzer deep capture into PSRAM
+//
+//  "la go" keeps 1024 samples in DTCM, which is less than a millisecond of bus activity, and not enough for
+//  long EMC or disk sequences. "la deep" captures into a store of LA_DEEP_STORE_SAMPLES in EXTMEM instead.
+//
+//  The ISR never touches the PSRAM. As for "la stream", it puts samples in LA_Stream_Ring[] (DTCM), and
+//  Logic_Analyzer_Deep_Poll(), called from Logic_Analyzer_Poll(), copies them to the store in bursts and
+//  does the triggering. Triggering uses the pattern, mask and event count from "la setup" (or "la trig").
+//
+//  The store can be split into N segments. Each segment is a circular buffer that records until it has P
+//  pre-trigger samples and sees the trigger, then records Q samples from the trigger (the trigger sample
+//  included), and the next segment starts. So N trigger events are captured without re-arming. If a trigger
+//  sequence has been loaded with "la trig", it is used instead, and restarts from its first state for each segment.
+//
+//      la deep N P Q           Capture N segments, P samples before and Q from the trigger. N defaults to 1,
+//                              P and Q default to half the segment each
+//      la deep show            List the captured segments
+//      la deep show S F C      Show C samples of segment S, starting F samples from the trigger (F < 0 is before)
+//      la deep stop            Stop, keeping the segments that are complete
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_LA_DEEP
+
+#if !ENABLE_LA_STREAM
+#error "ENABLE_LA_DEEP needs ENABLE_LA_STREAM, for the staging ring buffer"
+#endif
+
+#define LA_DEEP_HEARTBEAT_MS        (5000)
+
+extern "C" uint8_t external_psram_size;                     //  Set by startup.c, in MB. 0 if no PSRAM is fitted
+
+struct S_LA_Deep_Sample
+{
+  uint32_t  main;                                           //  Logic_Analyzer_main_sample
+  uint16_t  aux;                                            //  Logic_Analyzer_aux_sample, bits 31..16 are always 0
+} __attribute__((packed));
+
+struct S_LA_Deep_Segment
+{
+  uint32_t  base;                                           //  Index in LA_Deep_Store[] of the first entry of this segment
+  uint32_t  next;                                           //  Where the next sample goes, relative to base
+  uint32_t  valid;                                          //  Samples stored, stops at la_deep_length
+  uint32_t  trigger_position;                               //  Where the trigger sample is, relative to base
+  uint32_t  trigger_sequence;                               //  Sample number of the trigger, counted from when "la deep" started
+  uint32_t  lost;                                           //  Samples lost (ring buffer full) while this segment was capturing
+  bool      complete;
+};
+
+EXTMEM static struct S_LA_Deep_Sample LA_Deep_Store[LA_DEEP_STORE_SAMPLES];
+
+#if ENABLE_EMC_SUPPORT
+#define EMC_STORE_BYTES     (EMC_RAM_SIZE)                  //  emc_store[] in EBTKS_EMC_Cache.cpp, also in EXTMEM
+#else
+#define EMC_STORE_BYTES     (0)
+#endif
+#if ENABLE_HP85_RAM_SHADOW
+#define HP85_SHADOW_BYTES   (HP85_SHADOW_SIZE)              //  HP85_Shadow[] in EBTKS_Bus_Interface_ISR.cpp
+#else
+#define HP85_SHADOW_BYTES   (0)
+#endif
+#if ENABLE_CRT_RECORD
+#define CRT_RECORD_BYTES    (CRT_RECORD_RING_SIZE * 12)     //  crt_record_ring[] in EBTKS_CRT_Record.cpp
+#else
+#define CRT_RECORD_BYTES    (0)
+#endif
+#define EXTMEM_OTHER_BYTES  (EMC_STORE_BYTES + HP85_SHADOW_BYTES + CRT_RECORD_BYTES)
+
+static_assert(sizeof(LA_Deep_Store) + EXTMEM_OTHER_BYTES <= PSRAM_BUDGET, "The deep capture store and the other EXTMEM users don't fit in PSRAM_BUDGET");
+
+static struct S_LA_Deep_Segment   la_deep_segments[LA_DEEP_MAX_SEGMENTS];
+static uint32_t   la_deep_num_segments;
+static uint32_t   la_deep_pre;
+static uint32_t   la_deep_post;
+static uint32_t   la_deep_length;                           //  la_deep_pre + la_deep_post
+static uint32_t   la_deep_current;                          //  Segment being captured
+static bool       la_deep_triggered;
+static int32_t    la_deep_event_count;
+static int32_t    la_deep_event_count_init;
+static uint32_t   la_deep_remaining;                        //  Samples still to capture after the trigger
+static uint32_t   la_deep_sequence;
+static uint32_t   la_deep_lost_at_segment_start;
+static uint32_t   la_deep_heartbeat;
+
+static void la_deep_start_segment(uint32_t segment)
+{
+  la_deep_segments[segment].base     = segment * la_deep_length;
+  la_deep_segments[segment].next     = 0;
+  la_deep_segments[segment].valid    = 0;
+  la_deep_segments[segment].lost     = 0;
+  la_deep_segments[segment].complete = false;
+  la_deep_triggered                  = false;
+  la_deep_event_count                = la_deep_event_count_init;
+  la_deep_lost_at_segment_start      = LA_Stream_Dropped;
+#if ENABLE_LA_SEQUENCER
+  Logic_Analyzer_Sequencer_Reset();
+#endif
+}
+
+static void la_deep_list_segments(void)
+{
+  uint32_t    segment;
+
+  Serial.printf("Deep capture: %u segments of %u samples, %u before the trigger\n", la_deep_num_segments, la_deep_length, la_deep_pre);
+  for (segment = 0 ; segment < la_deep_num_segments ; segment++)
+  {
+    if (!la_deep_segments[segment].complete)
+    {
+      Serial.printf("Segment %2u  not captured\n", segment);
+      continue;
+    }
+    Serial.printf("Segment %2u  trigger at sample %10u  (%10.3f ms)  samples lost %u\n", segment,
+                  la_deep_segments[segment].trigger_sequence,
+                  (16.0/9.808) * la_deep_segments[segment].trigger_sequence / 1000.0,
+                  la_deep_segments[segment].lost);
+  }
+  Serial.printf("\n");
+}
+
+static void la_deep_finish(const char * reason)
+{
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  select_pinChange_isr();                                   //  Back to the ISR variant without the Logic Analyzer
+  Serial.printf("\nLogic Analyzer deep capture finished: %s\n", reason);
+  la_deep_list_segments();
+  Serial.printf("Type 'la deep show S F C' to show C samples of segment S, starting F samples from the trigger\n\n");
+}
+
+static void la_deep_start(const char * args)
+{
+  int         num_segments = 1, pre = -1, post = -1;
+  int         count;
+  uint32_t    max_length;
+
+  if (Logic_Analyzer_State != ANALYZER_IDLE)
+  {
+    Serial.printf("The Logic Analyzer is already running\n");
+    return;
+  }
+  if (!PSRAM_Holds_EXTMEM())
+  {
+    Serial.printf("Deep capture needs %u MB of PSRAM, with the other EXTMEM users, and %u MB is fitted\n",
+                  (uint32_t)((sizeof(LA_Deep_Store) + EXTMEM_OTHER_BYTES + 0xFFFFF) >> 20), external_psram_size);
+    return;
+  }
+
+  count = sscanf(args, "%d %d %d", &num_segments, &pre, &post);
+  if ((num_segments < 1) || (num_segments > LA_DEEP_MAX_SEGMENTS))
+  {
+    Serial.printf("Number of segments must be 1 to %d\n", LA_DEEP_MAX_SEGMENTS);
+    return;
+  }
+  max_length = LA_DEEP_STORE_SAMPLES / num_segments;
+  if (count < 2) pre  = max_length / 2;
+  if (count < 3) post = max_length - pre;
+  if ((pre < 0) || (post < 1) || ((uint32_t)(pre + post) > max_length))
+  {
+    Serial.printf("Need P >= 0, Q >= 1, and N * (P + Q) no more than %d\n", LA_DEEP_STORE_SAMPLES);
+    return;
+  }
+
+  if ((Logic_Analyzer_Event_Count_Init == -1000)           //  "la setup" has not been run, so mask and pattern are 0 and the first sample triggers
+#if ENABLE_LA_SEQUENCER
+      && !Logic_Analyzer_Sequencer_Active
+#endif
+     )
+  {
+    Serial.printf("No trigger has been set up with 'la setup', so each segment triggers as soon as it has %d samples\n", pre);
+  }
+
+  la_deep_num_segments      = num_segments;
+  la_deep_pre               = pre;
+  la_deep_post              = post;
+  la_deep_length            = pre + post;
+  la_deep_current           = 0;
+  la_deep_sequence          = 0;
+  la_deep_event_count_init  = (Logic_Analyzer_Event_Count_Init < 1) ? 1 : Logic_Analyzer_Event_Count_Init;
+  la_deep_heartbeat         = systick_millis_count + LA_DEEP_HEARTBEAT_MS;
+
+  LA_Stream_Head      = 0;
+  LA_Stream_Tail      = 0;
+  LA_Stream_Dropped   = 0;
+  LA_Stream_Gap_Flag  = 0;
+  la_deep_start_segment(0);
+
+  Logic_Analyzer_State = ANALYZER_DEEP_ACQUIRING;           //  Ring buffer and segment must be ready before this
+  select_pinChange_isr();                                   //  Switch to the ISR variant that runs the Logic Analyzer
+  Serial.printf("Logic Analyzer deep capture of %d segments, %d samples before and %d from the trigger. 'la deep stop' to stop\n",
+                num_segments, pre, post);
+}
+
+static void la_deep_show(const char * args)
+{
+  int                 segment = -1, from = -16, count = 64;
+  int                 first, last, relative;
+  uint32_t            position;
+  S_LA_Deep_Segment   *seg;
+
+  if (sscanf(args, "%d %d %d", &segment, &from, &count) < 1)
+  {
+    la_deep_list_segments();
+    return;
+  }
+  if ((segment < 0) || ((uint32_t)segment >= la_deep_num_segments) || !la_deep_segments[segment].complete)
+  {
+    Serial.printf("Segment %d has not been captured\n", segment);
+    return;
+  }
+  seg = &la_deep_segments[segment];
+
+  first = (from < -(int)la_deep_pre) ? -(int)la_deep_pre : from;
+  last  = from + count - 1;
+  if (last >= (int)la_deep_post) last = la_deep_post - 1;
+
+  Serial.printf("Segment %d, trigger at sample %u, samples lost %u\n\n", segment, seg->trigger_sequence, seg->lost);
+  Logic_Analyzer_Print_Heading();
+  for (relative = first ; relative <= last ; relative++)
+  {
+    position = (seg->trigger_position + la_deep_length + relative) % la_deep_length;
+    Logic_Analyzer_Print_Sample(relative, LA_Deep_Store[seg->base + position].main, LA_Deep_Store[seg->base + position].aux, relative == 0);
+    Serial.flush();
+  }
+  Serial.printf("\n\n");
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "la deep"
+//
+
+void Logic_Analyzer_Deep_Command(void)
+{
+  const char  *args = serial_string + 7;
+
+  while (*args == ' ') args++;
+
+  if (strncasecmp(args, "stop", 4) == 0)
+  {
+    if (Logic_Analyzer_State != ANALYZER_DEEP_ACQUIRING)
+    {
+      Serial.printf("There is no deep capture running\n");
+      return;
+    }
+    la_deep_finish("la deep stop");
+    return;
+  }
+  if (strncasecmp(args, "show", 4) == 0)
+  {
+    if (Logic_Analyzer_State == ANALYZER_DEEP_ACQUIRING)
+    {
+      Serial.printf("The deep capture is still running\n");
+      return;
+    }
+    la_deep_show(args + 4);
+    return;
+  }
+  la_deep_start(args);
+}
+
+//
+//  Called from Logic_Analyzer_Poll() during a deep capture. Copy what the ISR has put in the ring buffer
+//  to the store in EXTMEM, checking for the trigger as we go
+//
+
+void Logic_Analyzer_Deep_Poll(void)
+{
+  uint32_t            available;
+  uint32_t            main, aux;
+  S_LA_Deep_Segment   *seg = &la_deep_segments[la_deep_current];
+
+  available = LA_Stream_Head - LA_Stream_Tail;
+  while (available--)
+  {
+    main = LA_Stream_Ring[LA_Stream_Tail & (LA_STREAM_RING_SIZE - 1)].main;
+    aux  = LA_Stream_Ring[LA_Stream_Tail & (LA_STREAM_RING_SIZE - 1)].aux;
+    LA_Stream_Tail++;
+
+    if (!la_deep_triggered && (seg->valid >= la_deep_pre))
+    {
+#if ENABLE_LA_SEQUENCER
+      if (Logic_Analyzer_Sequencer_Active)
+      {
+        la_deep_triggered = Logic_Analyzer_Sequencer_Step(main, aux);
+      }
+      else
+#endif
+      if ( ((main & Logic_Analyzer_Trigger_Mask_1) == Logic_Analyzer_Trigger_Value_1) &&
+           ((aux  & Logic_Analyzer_Trigger_Mask_2) == Logic_Analyzer_Trigger_Value_2)    )
+      {
+        la_deep_triggered = (--la_deep_event_count <= 0);
+      }
+      if (la_deep_triggered)
+      {
+        la_deep_remaining       = la_deep_post;
+        seg->trigger_position   = seg->next;
+        seg->trigger_sequence   = la_deep_sequence;
+      }
+    }
+
+    LA_Deep_Store[seg->base + seg->next].main = main;
+    LA_Deep_Store[seg->base + seg->next].aux  = aux;
+    if (++seg->next == la_deep_length) seg->next = 0;
+    if (seg->valid < la_deep_length) seg->valid++;
+    la_deep_sequence++;
+
+    if (la_deep_triggered && (--la_deep_remaining == 0))
+    {
+      seg->complete = true;
+      seg->lost     = LA_Stream_Dropped - la_deep_lost_at_segment_start;
+      if (++la_deep_current == la_deep_num_segments)
+      {
+        la_deep_finish("all segments captured");
+        return;
+      }
+      la_deep_start_segment(la_deep_current);
+      seg = &la_deep_segments[la_deep_current];
+    }
+  }
+
+  if ((int32_t)(systick_millis_count - la_deep_heartbeat) >= 0)
+  {
+    Serial.printf("la deep: segment %u of %u %s, %u samples lost\n", la_deep_current, la_deep_num_segments,
+                  la_deep_triggered ? "triggered" : "waiting for trigger", LA_Stream_Dropped);
+    la_deep_heartbeat = systick_millis_count + LA_DEEP_HEARTBEAT_MS;
+  }
+}
+
+#endif
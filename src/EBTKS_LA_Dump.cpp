@@ -0,0 +1,212 @@
+//
+//  Logic Analyzer binary dump
+//
+//  Printing the Logic Analyzer results as a table takes several seconds for 1024 samples. A binary dump of
+//  the same samples is about 8 KB, and takes a few milliseconds over USB serial or to the SD Card. The host
+//  tool tools/la_decode turns a dump into the same table, or into a VCD file for a waveform viewer (GTKWave,
+//  PulseView). It also decodes "la stream" files.
+//
+//      la dump                 Send the last capture over USB serial, as a binary frame
+//      la save                 Write the last capture to LA_DUMP_FILENAME
+//      la output MODE          What happens when "la go" finishes: text (the table, default), dump, or save
+//
+//  Frame format, all multi-byte values are little endian:
+//        8 bytes     "EBTKSLAD"
+//        uint16      Format version, currently 1
+//        uint16      Header length in bytes, currently 48. Samples start here
+//        uint32      Number of samples
+//        int32       Index of the trigger sample, -1 if the Logic Analyzer did not trigger
+//        uint32      Pre-trigger samples, as set by "la setup"
+//        uint32      Bus cycle time in ps
+//        uint32      Trigger mask 1, mask 2, pattern 1, pattern 2 from "la setup" (4 values)
+//        uint32      Flags. Bit 0 is set if the trigger was from "la trig" rather than "la setup"
+//      Then, oldest first, for each sample
+//        uint32      Logic_Analyzer_main_sample. See EBTKS_Bus_Interface_ISR.cpp for the layout
+//        uint32      Logic_Analyzer_aux_sample
+//      And finally
+//        uint32      CRC-32 (as used by zip) of everything before it
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_LA_DUMP
+
+#define LA_DUMP_VERSION             (1)
+#define LA_DUMP_HEADER_LENGTH       (48)
+#define LA_DUMP_CYCLE_PS            (1631321)                   //  16 / 9.808 MHz
+
+enum la_output_mode
+{
+  LA_OUTPUT_TEXT = 0,
+  LA_OUTPUT_DUMP,
+  LA_OUTPUT_SAVE
+};
+
+static enum la_output_mode  la_output = LA_OUTPUT_TEXT;
+static uint32_t             la_dump_start;                  //  Buffer index of the oldest sample of the last capture
+static uint32_t             la_dump_count;                  //  0 if there has not been a capture
+static uint32_t             la_dump_crc;
+static FsFile               la_dump_file;
+
+//
+//  Send bytes to USB serial, or to la_dump_file if to_file, and update the running CRC
+//
+
+static bool la_dump_out(bool to_file, const void *data, uint32_t length)
+{
+  la_dump_crc = crc32_update(la_dump_crc, data, length);
+  if (to_file)
+  {
+    return la_dump_file.write(data, length) == length;
+  }
+  Serial.write((const uint8_t *)data, length);
+  return true;
+}
+
+static bool la_dump_send(bool to_file)
+{
+  uint8_t     header[LA_DUMP_HEADER_LENGTH];
+  uint32_t    values[10];
+  uint32_t    sample[2];
+  int32_t     trigger;
+  uint32_t    i, j;
+  bool        ok;
+
+  trigger = (Logic_Analyzer_Index_of_Trigger < 0) ? -1 :
+            (int32_t)((Logic_Analyzer_Index_of_Trigger - la_dump_start) & Logic_Analyzer_Current_Index_Mask);
+  if ((uint32_t)trigger >= la_dump_count)
+  {
+    trigger = -1;                                           //  Trigger is not in the samples (timed out before the buffer filled)
+  }
+
+  memcpy(header, "EBTKSLAD", 8);
+  header[8]  = LA_DUMP_VERSION;
+  header[9]  = 0;
+  header[10] = LA_DUMP_HEADER_LENGTH;
+  header[11] = 0;
+  values[0] = la_dump_count;
+  values[1] = trigger;
+  values[2] = Logic_Analyzer_Pre_Trigger_Samples;
+  values[3] = LA_DUMP_CYCLE_PS;
+  values[4] = Logic_Analyzer_Trigger_Mask_1;
+  values[5] = Logic_Analyzer_Trigger_Mask_2;
+  values[6] = Logic_Analyzer_Trigger_Value_1;
+  values[7] = Logic_Analyzer_Trigger_Value_2;
+  values[8] = 0;
+#if ENABLE_LA_SEQUENCER
+  values[8] |= Logic_Analyzer_Sequencer_Active ? 1 : 0;
+#endif
+  memcpy(header + 12, values, 9 * sizeof(uint32_t));        //  Teensy is little endian, as is the format
+
+  la_dump_crc = 0;
+  ok = la_dump_out(to_file, header, sizeof(header));
+  for (i = 0 ; ok && (i < la_dump_count) ; i++)
+  {
+    j = (la_dump_start + i) & Logic_Analyzer_Current_Index_Mask;
+    sample[0] = Logic_Analyzer_Data_1[j];
+    sample[1] = Logic_Analyzer_Data_2[j];
+    ok = la_dump_out(to_file, sample, sizeof(sample));
+  }
+  if (ok)
+  {
+    values[9] = la_dump_crc;
+    ok = la_dump_out(to_file, &values[9], sizeof(uint32_t));
+  }
+  if (!to_file)
+  {
+    Serial.flush();
+  }
+  return ok;
+}
+
+static void la_dump_serial(void)
+{
+  if (la_dump_count == 0)
+  {
+    Serial.printf("There is no Logic Analyzer capture to dump\n");
+    return;
+  }
+  la_dump_send(false);
+  Serial.printf("\n");
+}
+
+static void la_dump_save(void)
+{
+  bool      ok;
+
+  if (la_dump_count == 0)
+  {
+    Serial.printf("There is no Logic Analyzer capture to save\n");
+    return;
+  }
+  if (!(la_dump_file = SD.open(LA_DUMP_FILENAME, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Could not create %s\n", LA_DUMP_FILENAME);
+    return;
+  }
+  ok = la_dump_send(true);
+  la_dump_file.close();
+  Serial.printf("%s %s, %u samples\n", ok ? "Saved" : "Error writing", LA_DUMP_FILENAME, la_dump_count);
+}
+
+//
+//  Called by Logic_Analyzer_Poll() when an acquisition finishes. Remembers where the samples are for
+//  "la dump" and "la save". Returns true if the results have been dumped or saved, false if
+//  Logic_Analyzer_Poll() should print them as a table
+//
+
+bool Logic_Analyzer_Dump_Results(uint32_t start_index, uint32_t count)
+{
+  la_dump_start = start_index & Logic_Analyzer_Current_Index_Mask;
+  la_dump_count = count;
+
+  switch (la_output)
+  {
+    case LA_OUTPUT_DUMP:
+      la_dump_serial();
+      return true;
+    case LA_OUTPUT_SAVE:
+      la_dump_save();
+      return true;
+    default:
+      return false;
+  }
+}
+
+//
+//  "la dump", "la save", and "la output MODE". Parameters are parsed from serial_string
+//
+
+void Logic_Analyzer_Dump_Command(void)
+{
+  const char  *mode;
+
+  if (strcasecmp(serial_string, "la dump") == 0)
+  {
+    la_dump_serial();
+    return;
+  }
+  if (strcasecmp(serial_string, "la save") == 0)
+  {
+    la_dump_save();
+    return;
+  }
+
+  mode = serial_string + 9;                                 //  Skip "la output"
+  while (*mode == ' ') mode++;
+  if      (strcasecmp(mode, "text") == 0)   la_output = LA_OUTPUT_TEXT;
+  else if (strcasecmp(mode, "dump") == 0)   la_output = LA_OUTPUT_DUMP;
+  else if (strcasecmp(mode, "save") == 0)   la_output = LA_OUTPUT_SAVE;
+  else
+  {
+    Serial.printf("la output must be text, dump or save\n");
+    return;
+  }
+  Serial.printf("Logic Analyzer results will be %s\n", (la_output == LA_OUTPUT_TEXT) ? "shown as a table" :
+                                                       (la_output == LA_OUTPUT_DUMP) ? "sent as a binary dump" :
+                                                                                       "saved to " LA_DUMP_FILENAME);
+}
+
+#endif
@@ -0,0 +1,307 @@
+//
+//  Logic Analyzer streaming to SD Card
+//
+//  "la go" captures 1024 samples around a trigger. For intermittent faults that needs repeated re-arming,
+//  so "la stream" instead records every bus cycle until "la stop" (or the file is full), into a file on
+//  the SD Card. The ISR (and DMA) store samples into LA_Stream_Ring[], and Logic_Analyzer_Poll() calls
+//  Logic_Analyzer_Stream_Poll() from loop() to compress full chunks and write them out.
+//
+//  The bus runs at about 613K cycles per second, so the ring buffer (4096 samples) holds about 6.7 ms. If
+//  loop() is busy for longer than that (a long AUXROM keyword, for example), samples are lost. Lost samples
+//  are counted, and the next sample stored has LA_STREAM_GAP_BIT set, so the gap can be found in the file.
+//
+//  File format, all multi-byte values are little endian:
+//
+//    File header, 16 bytes
+//        8 bytes     "EBTKSLAS"
+//        uint16      Format version, currently 1
+//        uint16      LA_STREAM_CHUNK_SAMPLES
+//        uint32      0, reserved
+//
+//    Then any number of chunks. Each chunk starts with a 16 byte header
+//        uint32      LA_STREAM_CHUNK_MAGIC
+//        uint16      Number of samples in this chunk (only the last chunk can be short)
+//        uint16      Number of payload bytes that follow the header
+//        uint32      Sequence number of the first sample in this chunk (samples stored, not counting lost samples)
+//        uint32      Total samples lost since streaming started, as of the end of this chunk
+//
+//    The payload is one tag byte per sample, followed by the fields that can't be predicted from the
+//    previous sample in the chunk. Each chunk starts with a previous sample (and prior control value) of
+//    all zeros, so chunks can be decoded on their own.
+//        Tag bits 1..0   Address:  0 same as previous, 1 previous + 1, 2 int8 delta follows, 3 uint16 follows
+//        Tag bits 3..2   Control (main sample bits 31..24):
+//                                  0 same as previous, 1 same as the one before it changed, 2 byte follows
+//        Tag bit  4      aux sample bits 15..0 follow as uint16 (bits 31..16 are always 0)
+//        Tag bit  5      Data same as previous, otherwise the data byte follows
+//        Tag bits 7..6   0
+//    The fields follow the tag in this order: address, control, aux, data
+//
+//  Most samples are sequential fetches, so they need 2 bytes (tag and data) rather than 8.
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_LA_STREAM
+
+#define LA_STREAM_VERSION           (1)
+#define LA_STREAM_CHUNK_MAGIC       (0x4B4E4843U)                               //  "CHNK"
+#define LA_STREAM_MAX_CHUNK_BYTES   (16 + 7 * LA_STREAM_CHUNK_SAMPLES)           //  Header, and every field present in every sample
+
+#define LA_TAG_ADDR_SAME            (0x00)
+#define LA_TAG_ADDR_INC             (0x01)
+#define LA_TAG_ADDR_REL8            (0x02)
+#define LA_TAG_ADDR_ABS16           (0x03)
+#define LA_TAG_CTRL_SAME            (0x00)
+#define LA_TAG_CTRL_PRIOR           (0x04)
+#define LA_TAG_CTRL_BYTE            (0x08)
+#define LA_TAG_AUX                  (0x10)
+#define LA_TAG_DATA_SAME            (0x20)
+
+#define LA_STREAM_MAX_CHUNKS_PER_POLL   (4)                                     //  Limit how long one call of Logic_Analyzer_Stream_Poll() can take
+#define LA_STREAM_HEARTBEAT_MS          (10000)
+
+//
+//  The output buffer must not be in EXTMEM, as the SD Card driver can't write from there
+//
+
+static uint8_t    la_stream_out[LA_STREAM_SD_WRITE_SIZE + LA_STREAM_MAX_CHUNK_BYTES];
+static uint32_t   la_stream_out_length;
+
+static FsFile     la_stream_file;
+static uint64_t   la_stream_bytes_written;
+static uint32_t   la_stream_samples_written;
+static uint32_t   la_stream_start_time;
+static uint32_t   la_stream_heartbeat;
+
+static inline void la_put8(uint8_t val)
+{
+  la_stream_out[la_stream_out_length++] = val;
+}
+
+static inline void la_put16(uint16_t val)
+{
+  la_stream_out[la_stream_out_length++] = val;
+  la_stream_out[la_stream_out_length++] = val >> 8;
+}
+
+static inline void la_put32(uint32_t val)
+{
+  la_put16(val);
+  la_put16(val >> 16);
+}
+
+//
+//  Compress the next num_samples samples from the ring buffer into la_stream_out[], and release them
+//  back to the ISR
+//
+
+static void la_stream_compress_chunk(uint32_t num_samples)
+{
+  uint32_t    header_position;
+  uint32_t    payload_start;
+  uint32_t    main, aux;
+  uint32_t    prev_main = 0, prev_aux = 0;
+  uint8_t     prior_ctrl = 0;
+  uint16_t    addr, delta;
+  uint8_t     tag;
+  uint32_t    i;
+
+  header_position = la_stream_out_length;
+  la_put32(LA_STREAM_CHUNK_MAGIC);
+  la_put16(num_samples);
+  la_put16(0);                                                  //  Payload length, filled in below
+  la_put32(la_stream_samples_written);
+  la_put32(LA_Stream_Dropped);
+  payload_start = la_stream_out_length;
+
+  for (i = 0 ; i < num_samples ; i++)
+  {
+    main = LA_Stream_Ring[(LA_Stream_Tail + i) & (LA_STREAM_RING_SIZE - 1)].main;
+    aux  = LA_Stream_Ring[(LA_Stream_Tail + i) & (LA_STREAM_RING_SIZE - 1)].aux;
+
+    addr  = main >> 8;
+    delta = addr - (uint16_t)(prev_main >> 8);
+    if      (delta == 0)                                      tag = LA_TAG_ADDR_SAME;
+    else if (delta == 1)                                      tag = LA_TAG_ADDR_INC;
+    else if (((int16_t)delta >= -128) && ((int16_t)delta <= 127))  tag = LA_TAG_ADDR_REL8;
+    else                                                      tag = LA_TAG_ADDR_ABS16;
+
+    if ((main >> 24) != (prev_main >> 24))
+    {
+      tag |= ((main >> 24) == prior_ctrl) ? LA_TAG_CTRL_PRIOR : LA_TAG_CTRL_BYTE;
+    }
+    if (aux != prev_aux)
+    {
+      tag |= LA_TAG_AUX;
+    }
+    if ((uint8_t)main == (uint8_t)prev_main)
+    {
+      tag |= LA_TAG_DATA_SAME;
+    }
+
+    la_put8(tag);
+    if ((tag & 0x03) == LA_TAG_ADDR_REL8)  la_put8(delta);
+    if ((tag & 0x03) == LA_TAG_ADDR_ABS16) la_put16(addr);
+    if (tag & LA_TAG_CTRL_BYTE)            la_put8(main >> 24);
+    if (tag & LA_TAG_AUX)                  la_put16(aux);
+    if (!(tag & LA_TAG_DATA_SAME))         la_put8(main);
+
+    if ((main >> 24) != (prev_main >> 24))
+    {
+      prior_ctrl = prev_main >> 24;
+    }
+    prev_main = main;
+    prev_aux  = aux;
+  }
+
+  la_stream_out[header_position + 6] = (la_stream_out_length - payload_start);
+  la_stream_out[header_position + 7] = (la_stream_out_length - payload_start) >> 8;
+
+  la_stream_samples_written += num_samples;
+  LA_Stream_Tail += num_samples;                                //  Only now can the ISR re-use these ring buffer entries
+}
+
+//
+//  Write whole LA_STREAM_SD_WRITE_SIZE blocks of la_stream_out[] to the file. If all is true, also write the
+//  partial block at the end. Returns false if the SD Card write failed
+//
+
+static bool la_stream_write_out(bool all)
+{
+  uint32_t    length;
+
+  while ((la_stream_out_length >= LA_STREAM_SD_WRITE_SIZE) || (all && la_stream_out_length))
+  {
+    length = (la_stream_out_length >= LA_STREAM_SD_WRITE_SIZE) ? LA_STREAM_SD_WRITE_SIZE : la_stream_out_length;
+    if (la_stream_file.write(la_stream_out, length) != length)
+    {
+      return false;
+    }
+    la_stream_bytes_written += length;
+    la_stream_out_length    -= length;
+    memmove(la_stream_out, la_stream_out + length, la_stream_out_length);
+  }
+  return true;
+}
+
+static void la_stream_close(const char * reason)
+{
+  uint32_t    elapsed_ms;
+  bool        write_ok;
+
+  Logic_Analyzer_State = ANALYZER_IDLE;
+  select_pinChange_isr();                                       //  Back to the ISR variant without the Logic Analyzer
+
+  //
+  //  Write out whatever is left in the ring buffer, as a final short chunk
+  //
+
+  write_ok = true;
+  while (write_ok && (LA_Stream_Head != LA_Stream_Tail))
+  {
+    la_stream_compress_chunk(((LA_Stream_Head - LA_Stream_Tail) > LA_STREAM_CHUNK_SAMPLES) ?
+                              LA_STREAM_CHUNK_SAMPLES : (LA_Stream_Head - LA_Stream_Tail));
+    write_ok = la_stream_write_out(false);
+  }
+  write_ok = write_ok && la_stream_write_out(true);
+  la_stream_file.truncate();                                    //  Release the unused part of the preallocation
+  la_stream_file.close();
+
+  elapsed_ms = systick_millis_count - la_stream_start_time;
+  Serial.printf("\nLogic Analyzer streaming stopped: %s\n", reason);
+  if (!write_ok)
+  {
+    Serial.printf("SD Card write failed, the capture is incomplete\n");
+  }
+  Serial.printf("File %s\n", LA_STREAM_FILENAME);
+  Serial.printf("Samples written %10u in %u.%03u seconds\n", la_stream_samples_written, elapsed_ms / 1000, elapsed_ms % 1000);
+  Serial.printf("Samples lost    %10u\n", LA_Stream_Dropped);
+  Serial.printf("Bytes written   %10u  (%.2f bytes per sample)\n\n", (uint32_t)la_stream_bytes_written,
+                la_stream_samples_written ? (double)la_stream_bytes_written / la_stream_samples_written : 0.0);
+}
+
+void Logic_Analyzer_Stream_Start(void)
+{
+  if (Logic_Analyzer_State != ANALYZER_IDLE)
+  {
+    Serial.printf("The Logic Analyzer is already running\n");
+    return;
+  }
+
+  if (!(la_stream_file = SD.open(LA_STREAM_FILENAME, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Could not create %s\n", LA_STREAM_FILENAME);
+    return;
+  }
+  if (!la_stream_file.preAllocate(LA_STREAM_FILE_SIZE))
+  {
+    Serial.printf("Could not preallocate %u MB for %s, streaming anyway but samples are more likely to be lost\n",
+                  (uint32_t)(LA_STREAM_FILE_SIZE >> 20), LA_STREAM_FILENAME);
+  }
+
+  la_stream_out_length      = 0;
+  la_stream_bytes_written   = 0;
+  la_stream_samples_written = 0;
+  la_put8('E'); la_put8('B'); la_put8('T'); la_put8('K'); la_put8('S'); la_put8('L'); la_put8('A'); la_put8('S');
+  la_put16(LA_STREAM_VERSION);
+  la_put16(LA_STREAM_CHUNK_SAMPLES);
+  la_put32(0);
+
+  LA_Stream_Head      = 0;
+  LA_Stream_Tail      = 0;
+  LA_Stream_Dropped   = 0;
+  LA_Stream_Gap_Flag  = 0;
+  la_stream_start_time  = systick_millis_count;
+  la_stream_heartbeat   = systick_millis_count + LA_STREAM_HEARTBEAT_MS;
+
+  Logic_Analyzer_State = ANALYZER_STREAMING;                    //  Ring buffer must be ready before this
+  select_pinChange_isr();                                       //  Switch to the ISR variant that runs the Logic Analyzer
+  Serial.printf("Logic Analyzer streaming to %s. Type 'la stop' to finish\n", LA_STREAM_FILENAME);
+}
+
+void Logic_Analyzer_Stream_Stop(void)
+{
+  if (Logic_Analyzer_State != ANALYZER_STREAMING)
+  {
+    Serial.printf("The Logic Analyzer is not streaming\n");
+    return;
+  }
+  la_stream_close("la stop");
+}
+
+//
+//  Called from Logic_Analyzer_Poll() while streaming
+//
+
+void Logic_Analyzer_Stream_Poll(void)
+{
+  int     chunks = 0;
+
+  while (((LA_Stream_Head - LA_Stream_Tail) >= LA_STREAM_CHUNK_SAMPLES) && (chunks++ < LA_STREAM_MAX_CHUNKS_PER_POLL))
+  {
+    la_stream_compress_chunk(LA_STREAM_CHUNK_SAMPLES);
+    if (!la_stream_write_out(false))
+    {
+      la_stream_close("SD Card write error");
+      return;
+    }
+  }
+
+  if ((la_stream_bytes_written + sizeof(la_stream_out)) > LA_STREAM_FILE_SIZE)
+  {
+    la_stream_close("file is full");
+    return;
+  }
+
+  if ((int32_t)(systick_millis_count - la_stream_heartbeat) >= 0)
+  {
+    Serial.printf("LA stream: %u samples, %u KB, %u lost\n", la_stream_samples_written,
+                  (uint32_t)(la_stream_bytes_written >> 10), LA_Stream_Dropped);
+    la_stream_heartbeat = systick_millis_count + LA_STREAM_HEARTBEAT_MS;
+  }
+}
+
+#endif
@@ -0,0 +1,323 @@
+//
+//  Logic Analyzer trigger sequencer
+//
+//  "la setup" triggers on one mask and pattern, plus an event count. That can't express things like
+//  "this ROM entry point, followed by a write to this I/O register within 200 cycles". "la trig FILE"
+//  loads a trigger described as a state machine of up to LA_SEQUENCER_MAX_STATES states from a JSON
+//  file on the SD Card, and compiles it into Logic_Analyzer_Sequence[]. From then on, "la go" and
+//  "la deep" use it instead of the "la setup" trigger, until "la trig off".
+//
+//      la trig FILE        Load and compile a trigger sequence
+//      la trig             Show the compiled sequence
+//      la trig off         Go back to the "la setup" trigger
+//
+//  The sequencer starts in state 0. In each state, each bus cycle:
+//      If "match" matches ("count" times, default 1), go to "goto"
+//      Otherwise if "else" matches, go to "else_goto"
+//      Otherwise if more than "within" cycles have passed in this state, go to "timeout_goto"
+//  goto values are a state number, or "fire" to trigger the Logic Analyzer. "else_goto" and
+//  "timeout_goto" default to 0, "goto" defaults to the next state ("fire" for the last state).
+//
+//  A comparator ("match" or "else") can test any of these, all others are don't care. Strings are
+//  octal, as in "la setup", and numbers are decimal:
+//      "addr"      An address "060000", or an inclusive range ["060000", "077777"]
+//      "data"      Data byte
+//      "cycle"     Which of W (/WR), R (/RD) and L (/LMA) are asserted, the others are not. "" is an idle
+//                  cycle. Add F to require an instruction fetch, D to require DMA
+//      "rselec"    Selected ROM
+//      "drp"       DRP register
+//
+//  Example: trigger on a write to 177406 that happens within 500 cycles of entering ROM 0361 at 064000,
+//  but not if the ROM writes to 177400 first
+//
+//    { "states": [
+//        { "match": { "addr": "064000", "rselec": "0361", "cycle": "RF" } },
+//        { "match": { "addr": "177406", "cycle": "W" }, "goto": "fire",
+//          "else":  { "addr": "177400", "cycle": "W" }, "else_goto": 0,
+//          "within": 500, "timeout_goto": 0 }
+//    ] }
+//
+
+#include <Arduino.h>
+#define ARDUINOJSON_ENABLE_COMMENTS 1
+#include "ArduinoJson.h"
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_LA_SEQUENCER
+
+static char       la_trig_filename[SERIAL_STRING_MAX_LENGTH + 2];
+static uint32_t   la_trig_num_states;
+
+//
+//  Called before every acquisition, and for every "la deep" segment
+//
+
+void Logic_Analyzer_Sequencer_Reset(void)
+{
+  Logic_Analyzer_Sequencer_State  = 0;
+  Logic_Analyzer_Sequencer_Cycles = 0;
+  Logic_Analyzer_Sequencer_Count  = Logic_Analyzer_Sequence[0].count;
+}
+
+static bool la_trig_number(JsonVariant value, uint32_t *result)
+{
+  if (value.is<const char *>())
+  {
+    *result = strtoul(value.as<const char *>(), NULL, 8);
+    return true;
+  }
+  if (value.is<uint32_t>())
+  {
+    *result = value.as<uint32_t>();
+    return true;
+  }
+  return false;
+}
+
+static bool la_trig_goto(JsonVariant value, uint8_t default_state, uint8_t *result)
+{
+  uint32_t    state;
+
+  if (value.isNull())
+  {
+    *result = default_state;
+    return true;
+  }
+  if (value.is<const char *>() && (strcasecmp(value.as<const char *>(), "fire") == 0))
+  {
+    *result = LA_SEQUENCER_FIRE;
+    return true;
+  }
+  if (value.is<uint32_t>() && ((state = value.as<uint32_t>()) < la_trig_num_states))
+  {
+    *result = state;
+    return true;
+  }
+  Serial.printf("goto values must be \"fire\" or a state number less than %d\n", la_trig_num_states);
+  return false;
+}
+
+static bool la_trig_compile_comparator(JsonObject source, struct S_LA_Trigger_Comparator *cmp)
+{
+  uint32_t      low, high, value;
+  const char    *cycle;
+
+  memset(cmp, 0, sizeof(*cmp));
+  cmp->addr_span = 0xFFFF;
+
+  if (!source["addr"].isNull())
+  {
+    if (source["addr"].is<JsonArray>())
+    {
+      if (!la_trig_number(source["addr"][0], &low) || !la_trig_number(source["addr"][1], &high)) goto bad_value;
+    }
+    else
+    {
+      if (!la_trig_number(source["addr"], &low)) goto bad_value;
+      high = low;
+    }
+    if ((high < low) || (high > 0xFFFF)) goto bad_value;
+    cmp->addr_low  = low;
+    cmp->addr_span = high - low;
+  }
+
+  if (!source["data"].isNull())
+  {
+    if (!la_trig_number(source["data"], &value) || (value > 0xFF)) goto bad_value;
+    cmp->main_mask  |= 0x000000FF;
+    cmp->main_value |= value;
+  }
+
+  if (!source["cycle"].isNull())
+  {
+    if (!(cycle = source["cycle"].as<const char *>())) goto bad_value;
+    cmp->main_mask  |= BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA;
+    cmp->main_value |= BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA;            //  Active low, so none asserted
+    for ( ; *cycle ; cycle++)
+    {
+      switch (toupper(*cycle))
+      {
+        case 'W':   cmp->main_value &= ~BIT_MASK_WR;                          break;
+        case 'R':   cmp->main_value &= ~BIT_MASK_RD;                          break;
+        case 'L':   cmp->main_value &= ~BIT_MASK_LMA;                         break;
+        case 'F':   cmp->main_mask |= 0x40000000;  cmp->main_value |= 0x40000000;  break;
+        case 'D':   cmp->main_mask |= 0x80000000;  cmp->main_value |= 0x80000000;  break;
+        default:    goto bad_value;
+      }
+    }
+  }
+
+  if (!source["rselec"].isNull())
+  {
+    if (!la_trig_number(source["rselec"], &value) || (value > 0xFF)) goto bad_value;
+    cmp->aux_mask  |= 0x000000FF;
+    cmp->aux_value |= value;
+  }
+
+  if (!source["drp"].isNull())
+  {
+    if (!la_trig_number(source["drp"], &value) || (value > 0xFF)) goto bad_value;
+    cmp->aux_mask  |= 0x0000FF00;
+    cmp->aux_value |= value << 8;
+  }
+  return true;
+
+bad_value:
+  Serial.printf("Bad value in comparator\n");
+  return false;
+}
+
+//
+//  Compile the file into a local table, and only copy it to Logic_Analyzer_Sequence[] if it is all good
+//
+
+static bool la_trig_load(const char * filename)
+{
+  struct S_LA_Trigger_State   table[LA_SEQUENCER_MAX_STATES];
+  JsonDocument                doc;
+  JsonArray                   states;
+  uint32_t                    state;
+  int                         count;
+  FsFile                      file;
+
+  if (!(file = SD.open(filename, FILE_READ)))
+  {
+    Serial.printf("Couldn't open %s\n", filename);
+    return false;
+  }
+  DeserializationError error = deserializeJson(doc, file);
+  file.close();
+  if (error)
+  {
+    Serial.printf("JSON error in %s: %s\n", filename, error.c_str());
+    return false;
+  }
+
+  states = doc["states"].as<JsonArray>();
+  la_trig_num_states = states.size();
+  if ((la_trig_num_states == 0) || (la_trig_num_states > LA_SEQUENCER_MAX_STATES))
+  {
+    Serial.printf("%s must have 1 to %d states\n", filename, LA_SEQUENCER_MAX_STATES);
+    return false;
+  }
+
+  memset(table, 0, sizeof(table));
+  for (state = 0 ; state < la_trig_num_states ; state++)
+  {
+    JsonObject  source = states[state];
+
+    Serial.printf("State %d: ", state);
+    if (source["match"].isNull())
+    {
+      Serial.printf("needs a \"match\" comparator\n");
+      return false;
+    }
+    if (!la_trig_compile_comparator(source["match"], &table[state].cmp[0]))                               return false;
+    if (!la_trig_goto(source["goto"], (state + 1 < la_trig_num_states) ? state + 1 : LA_SEQUENCER_FIRE,
+                      &table[state].goto_state[0]))                                                       return false;
+    if (source["else"].isNull())
+    {
+      table[state].goto_state[1] = LA_SEQUENCER_UNUSED;
+    }
+    else
+    {
+      if (!la_trig_compile_comparator(source["else"], &table[state].cmp[1]))                              return false;
+      if (!la_trig_goto(source["else_goto"], 0, &table[state].goto_state[1]))                             return false;
+    }
+    if (!la_trig_goto(source["timeout_goto"], 0, &table[state].timeout_state))                            return false;
+    count               = source["count"]  | 1;
+    table[state].count  = (count < 1) ? 1 : count;
+    table[state].within = source["within"] | 0;
+    Serial.printf("OK\n");
+  }
+
+  memcpy(Logic_Analyzer_Sequence, table, sizeof(table));
+  strlcpy(la_trig_filename, filename, sizeof(la_trig_filename));
+  return true;
+}
+
+static void la_trig_print_goto(uint8_t next)
+{
+  if (next == LA_SEQUENCER_FIRE) Serial.printf("fire");
+  else                           Serial.printf("%d", next);
+}
+
+static void la_trig_print_comparator(const struct S_LA_Trigger_Comparator *cmp)
+{
+  Serial.printf("addr %06o..%06o  main %08X/%08X  aux %04X/%04X", cmp->addr_low, cmp->addr_low + cmp->addr_span,
+                cmp->main_value, cmp->main_mask, cmp->aux_value, cmp->aux_mask);
+}
+
+static void la_trig_show(void)
+{
+  uint32_t    state;
+
+  if (!Logic_Analyzer_Sequencer_Active)
+  {
+    Serial.printf("No trigger sequence is loaded, the 'la setup' trigger is used\n");
+    return;
+  }
+  Serial.printf("Trigger sequence from %s, value/mask in hex\n", la_trig_filename);
+  for (state = 0 ; state < la_trig_num_states ; state++)
+  {
+    const struct S_LA_Trigger_State   *st = &Logic_Analyzer_Sequence[state];
+
+    Serial.printf("%d  match ", state);
+    la_trig_print_comparator(&st->cmp[0]);
+    Serial.printf("  x%u -> ", st->count);
+    la_trig_print_goto(st->goto_state[0]);
+    Serial.printf("\n");
+    if (st->goto_state[1] != LA_SEQUENCER_UNUSED)
+    {
+      Serial.printf("   else  ");
+      la_trig_print_comparator(&st->cmp[1]);
+      Serial.printf("      -> ");
+      la_trig_print_goto(st->goto_state[1]);
+      Serial.printf("\n");
+    }
+    if (st->within)
+    {
+      Serial.printf("   after %u cycles -> ", st->within);
+      la_trig_print_goto(st->timeout_state);
+      Serial.printf("\n");
+    }
+  }
+  Serial.printf("\n");
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "la trig"
+//
+
+void Logic_Analyzer_Trigger_Command(void)
+{
+  const char  *args = serial_string + 7;
+
+  while (*args == ' ') args++;
+
+  if (*args == '\0')
+  {
+    la_trig_show();
+    return;
+  }
+  if (Logic_Analyzer_State != ANALYZER_IDLE)
+  {
+    Serial.printf("Can't change the trigger while the Logic Analyzer is running\n");
+    return;
+  }
+  if (strcasecmp(args, "off") == 0)
+  {
+    Logic_Analyzer_Sequencer_Active = false;
+    Serial.printf("Using the 'la setup' trigger\n");
+    return;
+  }
+  Logic_Analyzer_Sequencer_Active = false;                  //  A failed load leaves the 'la setup' trigger in use
+  if (la_trig_load(args))
+  {
+    Logic_Analyzer_Sequencer_Active = true;
+    la_trig_show();
+  }
+}
+
+#endif
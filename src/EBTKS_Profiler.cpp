@@ -0,0 +1,313 @@
+//
+//  Sampling profiler for HP-85 programs
+//
+//  onPhi_1_Rise() sees every bus cycle. While the profiler is running, every Profiler_Period'th
+//  instruction fetch is counted in a 64 byte bucket of the address space by Profiler_Record() (in
+//  EBTKS_Bus_Interface_ISR.cpp). Fetches from the bank switched ROM window are counted separately for
+//  each ROM, by RSELEC. Counting one fetch in 16 costs the ISR a decrement and a test on the others,
+//  and still gives a good picture of where a long BASIC workload spends its time.
+//
+//      prof start [N]          Clear the counters, and count every Nth instruction fetch (default PROFILER_DEFAULT_PERIOD)
+//      prof stop               Stop counting. The counters are kept
+//      prof clear              Clear the counters
+//      prof show [N]           Show the N busiest buckets (default 20, at most PROFILER_TOP_N)
+//      prof save [FILE]        Save all buckets with samples, in address order, as CSV (default PROFILER_FILENAME)
+//
+//  Only the HP85B, HP86 and HP87 have IFETCH on the backplane, so there is nothing to count on an HP85A.
+//
+//  Buckets are named from the symbols in EBTKS.h. There are only a few system ROM labels there, so most
+//  system ROM buckets just show the address range, but the RAM intercepts (RMIDLE, KYIDLE, IRQ20 ...),
+//  which is where option ROMs and binary programs hook in, are all named.
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_PROFILER
+
+#define PROFILER_TOTAL_BUCKETS      (PROFILER_BUCKETS + PROFILER_ROM_SLOTS * PROFILER_ROM_BUCKETS)
+#define PROFILER_BUCKET_SIZE        (1U << PROFILER_BUCKET_SHIFT)
+
+#define PROFILER_SYMBOL(name)       { name, #name }
+
+struct S_Profiler_Symbol
+{
+  uint16_t      address;
+  const char    *name;
+};
+
+static const struct S_Profiler_Symbol profiler_symbols[] =
+{
+  PROFILER_SYMBOL(INTRAD),
+  PROFILER_SYMBOL(FP5),
+  PROFILER_SYMBOL(D2HOOK),
+  PROFILER_SYMBOL(IOTRFC),
+  PROFILER_SYMBOL(IOSP),
+  PROFILER_SYMBOL(CHIDLE),
+  PROFILER_SYMBOL(KYIDLE),
+  PROFILER_SYMBOL(RMIDLE),
+  PROFILER_SYMBOL(STRANG),
+  PROFILER_SYMBOL(IMERR),
+  PROFILER_SYMBOL(PRSIDL),
+  PROFILER_SYMBOL(IRQ20),
+  PROFILER_SYMBOL(SPAR0),
+  PROFILER_SYMBOL(SPAR1)
+};
+
+struct S_Profiler_Entry
+{
+  uint32_t      count;
+  uint16_t      bucket;                                 //  < PROFILER_BUCKETS for the flat buckets, then ROM slot buckets
+};
+
+static struct S_Profiler_Entry profiler_ranked[PROFILER_TOP_N];      //  Busiest first
+static uint32_t   profiler_ranked_count;                              //  Entries in profiler_ranked[]
+static uint32_t   profiler_ranked_buckets;                            //  Buckets with samples
+static uint32_t   profiler_ranked_total;
+
+static void profiler_clear(void)
+{
+  memset(Profiler_Buckets, 0, sizeof(Profiler_Buckets));
+  memset(Profiler_ROM_Buckets, 0, sizeof(Profiler_ROM_Buckets));
+  memset(Profiler_ROM_Slot, 0, sizeof(Profiler_ROM_Slot));
+  Profiler_ROM_Slots_Used = 0;
+  Profiler_Samples        = 0;
+  Profiler_ROM_Overflow   = 0;
+}
+
+static uint32_t profiler_count(uint32_t bucket)
+{
+  if (bucket < PROFILER_BUCKETS)
+  {
+    return Profiler_Buckets[bucket];
+  }
+  bucket -= PROFILER_BUCKETS;
+  return Profiler_ROM_Buckets[bucket / PROFILER_ROM_BUCKETS][bucket % PROFILER_ROM_BUCKETS];
+}
+
+//
+//  Find the PROFILER_TOP_N busiest buckets, by insertion into profiler_ranked[]. The counters keep changing if
+//  the profiler is running, so each is read once
+//
+
+static void profiler_rank(void)
+{
+  uint32_t    i, count, position;
+
+  profiler_ranked_count   = 0;
+  profiler_ranked_buckets = 0;
+  profiler_ranked_total   = 0;
+  for (i = 0 ; i < PROFILER_TOTAL_BUCKETS ; i++)
+  {
+    if ((count = profiler_count(i)) == 0)
+    {
+      continue;
+    }
+    profiler_ranked_buckets++;
+    profiler_ranked_total += count;
+    if ((profiler_ranked_count == PROFILER_TOP_N) && (count <= profiler_ranked[PROFILER_TOP_N - 1].count))
+    {
+      continue;                                         //  Not busier than the last one, and ties keep the lower bucket
+    }
+    if (profiler_ranked_count < PROFILER_TOP_N)
+    {
+      profiler_ranked_count++;
+    }
+    for (position = profiler_ranked_count - 1 ; (position > 0) && (profiler_ranked[position - 1].count < count) ; position--)
+    {
+      profiler_ranked[position] = profiler_ranked[position - 1];
+    }
+    profiler_ranked[position].count  = count;
+    profiler_ranked[position].bucket = i;
+  }
+}
+
+//
+//  First address of a bucket, and the RSELEC of its ROM (-1 if not in the ROM window)
+//
+
+static uint32_t profiler_bucket_address(uint32_t bucket, int *rselec)
+{
+  if (bucket < PROFILER_BUCKETS)
+  {
+    *rselec = -1;
+    return bucket << PROFILER_BUCKET_SHIFT;
+  }
+  bucket -= PROFILER_BUCKETS;
+  *rselec = Profiler_ROM_Rselec[bucket / PROFILER_ROM_BUCKETS];
+  return 060000 + ((bucket % PROFILER_ROM_BUCKETS) << PROFILER_BUCKET_SHIFT);
+}
+
+static const char *profiler_region(uint32_t address)
+{
+  if (address < 060000)   return "System ROM";
+  if (address < 0100000)  return "Option ROM";
+  if (address < 0177400)  return "RAM";
+  return "I/O";
+}
+
+//
+//  The first symbol in the bucket, or "" if none
+//
+
+static const char *profiler_symbol(uint32_t address)
+{
+  uint32_t    i;
+
+  for (i = 0 ; i < sizeof(profiler_symbols) / sizeof(profiler_symbols[0]) ; i++)
+  {
+    if ((profiler_symbols[i].address >= address) && (profiler_symbols[i].address < address + PROFILER_BUCKET_SIZE))
+    {
+      return profiler_symbols[i].name;
+    }
+  }
+  return "";
+}
+
+static void profiler_status(void)
+{
+  Serial.printf("Profiler is %s, %lu samples, 1 in %lu instruction fetches\n", Profiler_Active ? "running" : "stopped",
+                Profiler_Samples, Profiler_Period);
+  if (Profiler_ROM_Overflow)
+  {
+    Serial.printf("%lu samples from more than %d ROMs were not counted\n", Profiler_ROM_Overflow, PROFILER_ROM_SLOTS);
+  }
+}
+
+static void profiler_start(uint32_t period)
+{
+  Profiler_Active = false;
+  profiler_clear();
+  Profiler_Period    = (period == 0) ? PROFILER_DEFAULT_PERIOD : period;
+  Profiler_Countdown = Profiler_Period;
+  Profiler_Active    = true;
+  select_pinChange_isr();
+  Serial.printf("Profiling 1 in %lu instruction fetches. 'prof show' for results, 'prof stop' to stop\n", Profiler_Period);
+}
+
+static void profiler_stop(void)
+{
+  Profiler_Active = false;
+  select_pinChange_isr();
+  profiler_status();
+}
+
+static void profiler_show(uint32_t lines)
+{
+  uint32_t    i, address;
+  int         rselec;
+
+  profiler_status();
+  profiler_rank();
+  if (profiler_ranked_total == 0)
+  {
+    Serial.printf("No instruction fetches have been counted. The HP85A does not have IFETCH on the backplane\n");
+    return;
+  }
+  if ((lines > PROFILER_TOP_N) && (profiler_ranked_buckets > PROFILER_TOP_N))
+  {
+    Serial.printf("%lu buckets have samples, only the busiest %d are ranked. 'prof save' has them all\n",
+                  profiler_ranked_buckets, PROFILER_TOP_N);
+  }
+  Serial.printf("\nRank  ROM  Address range     Samples      %%  Where\n");
+  for (i = 0 ; (i < profiler_ranked_count) && (i < lines) ; i++)
+  {
+    address = profiler_bucket_address(profiler_ranked[i].bucket, &rselec);
+    if (rselec >= 0)
+    {
+      Serial.printf("%4lu  %03o  ", i + 1, rselec);
+    }
+    else
+    {
+      Serial.printf("%4lu       ", i + 1);
+    }
+    Serial.printf("%06lo-%06lo  %9lu  %5.1f  %-10s %s\n", address, address + PROFILER_BUCKET_SIZE - 1, profiler_ranked[i].count,
+                  (100.0 * profiler_ranked[i].count) / profiler_ranked_total, profiler_region(address), profiler_symbol(address));
+  }
+}
+
+//
+//  Every bucket with samples, in address order, straight from the counters. Sort by the samples column to rank them.
+//  If the profiler is running, the percentages are of the total when the save started
+//
+
+static void profiler_save(const char *filename)
+{
+  FsFile      file;
+  char        line[120];
+  uint32_t    i, address, length, count, total = 0, buckets = 0;
+  int         rselec;
+  bool        ok;
+
+  for (i = 0 ; i < PROFILER_TOTAL_BUCKETS ; i++)
+  {
+    total += profiler_count(i);
+  }
+  if (!(file = SD.open(filename, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Could not create %s\n", filename);
+    return;
+  }
+  length = snprintf(line, sizeof(line), "rselec,start,end,samples,percent,region,symbol\n");
+  ok = file.write(line, length) == length;
+  for (i = 0 ; ok && (i < PROFILER_TOTAL_BUCKETS) ; i++)
+  {
+    if ((count = profiler_count(i)) == 0)
+    {
+      continue;
+    }
+    buckets++;
+    address = profiler_bucket_address(i, &rselec);
+    length  = (rselec >= 0) ? snprintf(line, sizeof(line), "%03o", rselec) : 0;
+    length += snprintf(line + length, sizeof(line) - length, ",%06lo,%06lo,%lu,%.2f,%s,%s\n", address, address + PROFILER_BUCKET_SIZE - 1,
+                       count, total ? (100.0 * count) / total : 0.0, profiler_region(address), profiler_symbol(address));
+    ok = file.write(line, length) == length;
+  }
+  file.close();
+  Serial.printf("%s %s, %lu buckets\n", ok ? "Saved" : "Error writing", filename, buckets);
+}
+
+//
+//  Parameters are parsed from serial_string, which starts with "prof"
+//
+
+void Profiler_Command(void)
+{
+  const char  *args = serial_string + 4;
+
+  while (*args == ' ') args++;
+
+  if (strncasecmp(args, "start", 5) == 0)
+  {
+    profiler_start(strtoul(args + 5, NULL, 10));
+  }
+  else if (strcasecmp(args, "stop") == 0)
+  {
+    profiler_stop();
+  }
+  else if (strcasecmp(args, "clear") == 0)
+  {
+    profiler_clear();
+    Serial.printf("Profiler counters cleared\n");
+  }
+  else if (strncasecmp(args, "show", 4) == 0)
+  {
+    uint32_t  lines = strtoul(args + 4, NULL, 10);
+
+    profiler_show(lines ? lines : 20);
+  }
+  else if (strncasecmp(args, "save", 4) == 0)
+  {
+    args += 4;
+    while (*args == ' ') args++;
+    profiler_save(*args ? args : PROFILER_FILENAME);
+  }
+  else
+  {
+    profiler_status();
+    Serial.printf("prof start [N], prof stop, prof clear, prof show [N], prof save [FILE]\n");
+  }
+}
+
+#endif
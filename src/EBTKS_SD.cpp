@@ -29,8 +29,6 @@ bool          CRTRemote;
 bool          AutoStartEn;
 bool          tapeEn;
 
-extern bool enRam16k;
-
 #if ENABLE_EMC_SUPPORT
 bool          EMC_Enable;
 int           EMC_NumBanks = 4;         //  Correct value is 8. If we see only 4 being supported, it either got it from CONFIG.TXT, or initialization failed
@@ -38,6 +36,8 @@ int           EMC_StartBank = 5;        //  Correct for systems with pre-install
 int           EMC_StartAddress;
 int           EMC_EndAddress;
 bool          EMC_Master = false;
+char          EMC_Restore[256];                         //  EMC snapshot to restore at power up, "" for none
+bool          EMC_PSRAM;                                //  Banks beyond EMC_CACHE_BANKS may be kept in PSRAM
 #endif
 
 
@@ -354,6 +354,16 @@ bool get_EMC_master(void)
   return EMC_Master;
 }
 
+const char * get_EMC_Restore(void)
+{
+  return EMC_Restore;
+}
+
+bool get_EMC_PSRAM(void)
+{
+  return EMC_PSRAM && PSRAM_Holds_EXTMEM();
+}
+
 #endif
 
 //
@@ -601,7 +611,7 @@ bool loadConfiguration(const char *filename)
   //
   //  Only allow 16k RAM option for systems that might need it
   //
-  enRam16k = false;
+  enHP85RamExp(false);                                //  Also rebuilds the bus page tables for this machine
   if (ONLY_HAS_16K_RAM)
   {
     enHP85RamExp(doc["ram16k"] | false);
@@ -750,6 +760,8 @@ bool loadConfiguration(const char *filename)
   EMC_Enable    = doc["EMC"]["enable"] | false;
   EMC_NumBanks  = doc["EMC"]["NumBanks"] | 0;
   EMC_StartBank = doc["EMC"]["StartBank"] | 4;      //  This would be right for a system with 128K DRAM pre-installed  #### need to check
+  strlcpy(EMC_Restore, doc["EMC"]["Restore"] | "", sizeof(EMC_Restore));
+  EMC_PSRAM     = doc["EMC"]["PSRAM"] | true;          //  Banks beyond the DMAMEM cache kept in PSRAM, see EBTKS_EMC_Cache.cpp
   #if TRACE_LOAD_CONFIG
   Serial.printf("\nCheckpoint 12 EMC\n"); Serial.flush();
   #endif
@@ -772,6 +784,13 @@ bool loadConfiguration(const char *filename)
       LOGPRINTF("%s", temp_char_ptr);
       EMC_NumBanks = EMC_MAX_BANKS;
     }
+    if (!get_EMC_PSRAM() && (EMC_NumBanks > EMC_CACHE_BANKS))
+    {   //  Banks beyond the cache are stored in PSRAM, see EBTKS_EMC_Cache.cpp
+      temp_char_ptr = log_to_CRT_ptr;
+      log_to_CRT_ptr += sprintf(log_to_CRT_ptr, "EMC PSRAM not enabled (or no PSRAM), so only %d EMC Banks. Setting EMC Banks to %d\n", EMC_CACHE_BANKS, EMC_CACHE_BANKS);
+      LOGPRINTF("%s", temp_char_ptr);
+      EMC_NumBanks = EMC_CACHE_BANKS;
+    }
 
     //
     //  Not sure about the following case for disabling, but it avoids possible bugs that might be lurking in having the number of banks == 0
@@ -811,6 +830,36 @@ bool loadConfiguration(const char *filename)
   //
 #endif
 
+  //
+  //  DMA burst length and refresh break, for this machine type. "dma bench" measures what is safe, and prints
+  //  the lines to put here. Machines that are not listed use MAX_DMA_BURST_LENGTH and DMA_BURST_BREAK_CYCLES
+  //  A burst longer than DMA_BURST_REFRESH_LIMIT can drop a DRAM refresh, so it is clamped. Only "dma bench long"
+  //  goes past it
+  //
+  DMA_Burst_Length       = doc["DMA"][machineType]["BurstLength"] | MAX_DMA_BURST_LENGTH;
+  DMA_Burst_Break_Cycles = doc["DMA"][machineType]["BreakCycles"] | DMA_BURST_BREAK_CYCLES;
+  if (DMA_Burst_Length < 1)
+  {
+    DMA_Burst_Length = MAX_DMA_BURST_LENGTH;
+  }
+  if (DMA_Burst_Length > DMA_BURST_REFRESH_LIMIT)
+  {
+    temp_char_ptr = log_to_CRT_ptr;
+    log_to_CRT_ptr += sprintf(log_to_CRT_ptr, "DMA burst %u too long, using %d\n", DMA_Burst_Length, DMA_BURST_REFRESH_LIMIT);
+    LOGPRINTF("%s", temp_char_ptr);
+    DMA_Burst_Length = DMA_BURST_REFRESH_LIMIT;
+  }
+  if ((DMA_Burst_Break_Cycles < 1) || (DMA_Burst_Break_Cycles > 16))
+  {
+    DMA_Burst_Break_Cycles = DMA_BURST_BREAK_CYCLES;
+  }
+  if ((DMA_Burst_Length != MAX_DMA_BURST_LENGTH) || (DMA_Burst_Break_Cycles != DMA_BURST_BREAK_CYCLES))
+  {
+    temp_char_ptr = log_to_CRT_ptr;
+    log_to_CRT_ptr += sprintf(log_to_CRT_ptr, "DMA burst %u, break %u cycles\n", DMA_Burst_Length, DMA_Burst_Break_Cycles);
+    LOGPRINTF("%s", temp_char_ptr);
+  }
+
   SCOPE_1_Pulser(1);         //  From beginning of function to here is 15 ms , measured 2/7/2021  ---  code has changed, need to retime ######
   EBTKS_delay_ns(10000); //  10 us
   SCOPE_1_Pulser(1);
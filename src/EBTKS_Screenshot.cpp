@@ -0,0 +1,118 @@
+//
+//  Screenshots
+//
+//  Saves what is on the CRT as a PBM image on the SD Card.
+//
+//      screenshot [FILE]               From the serial port (default SCREENSHOT_FILENAME)
+//      AUXCMD 0, 33, "FILE", ""        From BASIC
+//
+//  Screenshot_Start() works out the screen geometry from current_screen, which the CRT write handlers keep up
+//  to date, writes the file header, and returns. Screenshot_Poll(), called from loop(), renders
+//  SCREENSHOT_ROWS_PER_POLL rows straight from current_screen with CRT_Render_Rows() and writes them, until
+//  the image is done. So the HP-85 is never held, there is no copy of the screen, and tape and disk polling
+//  in loop() only wait for a few rows. The mode and size are fixed when the screenshot starts, but if the
+//  HP-85 writes to the CRT (or scrolls) while it is being saved, the rows not yet written show the change.
+//
+//  Alpha characters are drawn with the generic 5 x 7 font in EBTKS_CRT_Render.cpp, not the Series 80
+//  character ROM, so special characters and some glyph details differ from the real screen.
+//
+//  The image is the alpha screen, or the graphics screen, whichever is on display. File format is PBM (P4),
+//  which most image tools read, and is the same packing as graphics memory: 1 bit per pixel, leftmost pixel
+//  in the MSB. A lit pixel is black. An HP85 screen is 6 kB, and an HP86/87 alpha screen 19 kB.
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+
+#if ENABLE_SCREENSHOT
+
+static struct S_CRT_Geometry screenshot_geometry;
+static uint8_t              screenshot_buffer[SCREENSHOT_ROWS_PER_POLL * 80];     //  80 bytes is the widest row, HP86/87 alpha
+static FsFile               screenshot_file;
+static char                 screenshot_filename[258];       //  Resolved paths from the AUXROM are at most 256 characters
+static uint32_t             screenshot_width, screenshot_height;
+static uint32_t             screenshot_row;                 //  Next row to render
+static bool                 screenshot_active;
+
+bool Screenshot_Start(const char *filename)
+{
+  char        header[64];
+  int         length;
+
+  if (screenshot_active)
+  {
+    Serial.printf("Still writing %s\n", screenshot_filename);
+    return false;
+  }
+  CRT_Get_Geometry(&current_screen, &screenshot_geometry);
+  CRT_Render_Size(&screenshot_geometry, &screenshot_width, &screenshot_height);
+
+  if (!(screenshot_file = SD.open(filename, O_RDWR | O_TRUNC | O_CREAT)))
+  {
+    Serial.printf("Could not create %s\n", filename);
+    return false;
+  }
+  length = snprintf(header, sizeof(header), "P4\n# EBTKS %s %s\n%u %u\n", get_machineType(),
+                    screenshot_geometry.graphics ? "graphics" : "alpha", screenshot_width, screenshot_height);
+  if (screenshot_file.write(header, length) != (size_t)length)
+  {
+    Serial.printf("Error writing %s\n", filename);
+    screenshot_file.close();
+    return false;
+  }
+  strlcpy(screenshot_filename, filename, sizeof(screenshot_filename));
+  screenshot_row    = 0;
+  screenshot_active = true;
+  return true;
+}
+
+void Screenshot_Poll(void)
+{
+  uint32_t    rows, length;
+
+  if (!screenshot_active)
+  {
+    return;
+  }
+  rows = screenshot_height - screenshot_row;
+  if (rows > SCREENSHOT_ROWS_PER_POLL)
+  {
+    rows = SCREENSHOT_ROWS_PER_POLL;
+  }
+  CRT_Render_Rows(&current_screen, &screenshot_geometry, screenshot_row, rows, screenshot_buffer);
+  length = rows * (screenshot_width / 8);
+  if (screenshot_file.write(screenshot_buffer, length) != length)
+  {
+    Serial.printf("Error writing %s\n", screenshot_filename);
+    screenshot_file.close();
+    screenshot_active = false;
+    return;
+  }
+  screenshot_row += rows;
+  if (screenshot_row >= screenshot_height)
+  {
+    Serial.printf("Saved %s, %u x %u %s\n", screenshot_filename, screenshot_width, screenshot_height,
+                  screenshot_geometry.graphics ? "graphics" : "alpha");
+    screenshot_file.close();
+    screenshot_active = false;
+  }
+}
+
+//
+//  "screenshot [FILE]". Parameters are parsed from serial_string
+//
+
+void Screenshot_Command(void)
+{
+  const char  *filename = serial_string + 10;
+
+  while (*filename == ' ') filename++;
+  if (*filename == '\0')
+  {
+    filename = SCREENSHOT_FILENAME;
+  }
+  Screenshot_Start(filename);
+}
+
+#endif
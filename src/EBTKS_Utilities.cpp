@@ -240,13 +240,9 @@ void PSRAM_Test(void);
 void show(void);
 void dump_keys(bool hp85kbd , bool octal);
 void ESP_Programmer_Setup(void);
+void show_isr_stats(void);
+void clear_isr_stats(void);
 
-#if ENABLE_TRACE_EMC
-void EMC_Info(void);
-#endif
-#if ENABLE_TRACE_PTR2
-void EMC_Ptr2(void);
-#endif
 
 
 struct S_Command_Entry
@@ -283,9 +279,18 @@ struct S_Command_Entry Command_Table[] =
   {"crt 3",            CRT_Timing_Test_3},
   {"crt 4",            CRT_Timing_Test_4},
   {"crt 5",            CRT_Timing_Test_5},
+  {"crt bench",        CRT_Bench},
   {"sdreadtimer",      diag_sdread_1},
   {"la setup",         Setup_Logic_Analyzer},
   {"la go",            Logic_analyzer_go},
+#if ENABLE_LA_DUMP
+  {"la dump",          Logic_Analyzer_Dump_Command},
+  {"la save",          Logic_Analyzer_Dump_Command},
+#endif
+#if ENABLE_LA_STREAM
+  {"la stream",        Logic_Analyzer_Stream_Start},
+  {"la stop",          Logic_Analyzer_Stream_Stop},
+#endif
   {"addr",             proc_addr},
   {"clean log",        clean_logfile},
   {"Date",             show_RTC},
@@ -303,12 +308,10 @@ struct S_Command_Entry Command_Table[] =
   {"graphics test",    Simple_Graphics_Test},
   {"PSRAMTest",        PSRAM_Test},
   {"ESP32 Prog",       ESP_Programmer_Setup},
-#if ENABLE_TRACE_EMC
-  {"EMC",              EMC_Info},
-#endif
-#if ENABLE_TRACE_PTR2
-  {"EMC",              EMC_Ptr2},
+#if ENABLE_EMC_SUPPORT
+  {"emc cache",        EMC_Cache_Info},
 #endif
+  {"isrstats clear",   clear_isr_stats},
   {"jay pi",           jay_pi},
   {"auxint",           proc_auxint},
   {"jo",               just_once_func},
@@ -666,6 +669,105 @@ void Serial_Command_Poll(void)
     return;
   }
 
+#if ENABLE_LA_DUMP
+  if(strncasecmp(serial_string , "la output", 9) == 0)
+  {
+    Logic_Analyzer_Dump_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_LA_SEQUENCER
+  if(strncasecmp(serial_string , "la trig", 7) == 0)
+  {
+    Logic_Analyzer_Trigger_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_LA_DEEP
+  if(strncasecmp(serial_string , "la deep", 7) == 0)
+  {
+    Logic_Analyzer_Deep_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_EMC_SNAPSHOT
+  if((strncasecmp(serial_string , "emc save", 8) == 0) || (strncasecmp(serial_string , "emc load", 8) == 0))
+  {
+    EMC_Snapshot_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_EMC_TRACE
+  if(strncasecmp(serial_string , "emc trace", 9) == 0)
+  {
+    EMC_Trace_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_HP85_RAM_SHADOW
+  if(strncasecmp(serial_string , "shadow", 6) == 0)
+  {
+    HP85_Shadow_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_CRT_STREAM
+  if(strncasecmp(serial_string , "crt stream", 10) == 0)
+  {
+    CRT_Stream_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_CRT_RECORD
+  if(strncasecmp(serial_string , "crt record", 10) == 0)
+  {
+    CRT_Record_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_SCREENSHOT
+  if(strncasecmp(serial_string , "screenshot", 10) == 0)
+  {
+    Screenshot_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_DMA_BENCH
+  if(strncasecmp(serial_string , "dma bench", 9) == 0)
+  {
+    DMA_Bench_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
+#if ENABLE_PROFILER
+  if(strncasecmp(serial_string , "prof", 4) == 0)
+  {
+    Profiler_Command();
+    serial_string_used();
+    return;
+  }
+#endif
+
   //
   //  Special version (undocumented for end users) of setdate
   //
@@ -807,6 +909,12 @@ void show(void)
     return;
   }
 
+  if(strcasecmp(serial_string + 5, "isrstats") == 0)    //  Not strncasecmp() so nothing after isrstats
+  {
+    show_isr_stats();
+    return;
+  }
+
   if(strcasecmp(serial_string + 5, "key85_O") == 0)     //  Not strncasecmp() so nothing after key85_O
   {
     dump_keys(true, true);
@@ -980,6 +1088,7 @@ void help_1(void)
   Serial.printf("     mb       Display current mailboxes and related data\n");
   Serial.printf("     CRTVis   Show what is visible on the CRT\n");
   Serial.printf("     CRTAll   Show all of the CRT ALPHA memory\n");
+  Serial.printf("     isrstats Show ISR and I/O handler timing (if enabled at compile time)\n");
   Serial.printf("     key85_O  Display HP85 Special Keys in Octal\n");
   Serial.printf("     key85_D  Display HP85 Special Keys in Decimal\n");
   Serial.printf("     key87_O  Display HP87 Special Keys in Octal\n");
@@ -997,19 +1106,62 @@ void help_2(void)
   Serial.printf("Commands for Diagnostic\n");
   Serial.printf("la setup      Set up the logic analyzer\n");
   Serial.printf("la go         Start the logic analyzer\n");
+#if ENABLE_LA_DUMP
+  Serial.printf("la dump       Send the last capture over USB serial in binary, see tools/la_decode\n");
+  Serial.printf("la save       Save the last capture to %s\n", LA_DUMP_FILENAME);
+  Serial.printf("la output M   When 'la go' finishes: text (table), dump or save\n");
+#endif
+#if ENABLE_LA_STREAM
+  Serial.printf("la stream     Record every bus cycle to %s until 'la stop'\n", LA_STREAM_FILENAME);
+  Serial.printf("la stop       Stop 'la stream' and close the file\n");
+#endif
+#if ENABLE_LA_SEQUENCER
+  Serial.printf("la trig FILE  Load a multi-state trigger sequence from a JSON file. 'la trig' shows it, 'la trig off' reverts to 'la setup'\n");
+#endif
+#if ENABLE_LA_DEEP
+  Serial.printf("la deep N P Q Capture N segments of P samples before and Q from the 'la setup' trigger into PSRAM\n");
+  Serial.printf("la deep show S F C   Show C samples of segment S, from F samples relative to the trigger\n");
+  Serial.printf("la deep stop  Stop a deep capture, keeping the segments already captured\n");
+#endif
+#if ENABLE_PROFILER
+  Serial.printf("prof start N  Profile every Nth instruction fetch (HP85B/86/87). prof stop, prof clear\n");
+  Serial.printf("prof show N   Show the N busiest 64 byte buckets. prof save [FILE] saves them all as CSV (%s)\n", PROFILER_FILENAME);
+#endif
   Serial.printf("addr          Instantly show where HP85 is executing\n");
   Serial.printf("kbdcode       Show key codes for next 10 characters in the keyboard buffer\n");
   Serial.printf("clean log     Clean the Logfile on the SD Card\n");
   Serial.printf("sdreadtimer   Test Reading with different start positions\n");
   Serial.printf("SDCID         Display the CID information for the SD Card\n");
-  Serial.printf("PSRAMTest     Test the 8 MB PSRAM. You probably should do the PWO command when test has finished\n");
-  Serial.printf("ESP32 Prog    Activate a passthrough serial path to program the ESP32\n");
-#if ENABLE_TRACE_EMC
-  Serial.printf("EMC           display info about the EMC emulation\n");
+#if ENABLE_EMC_SUPPORT
+  Serial.printf("emc cache     Show which EMC banks are in the fast RAM cache, and the cache statistics\n");
+#endif
+#if ENABLE_EMC_SNAPSHOT
+  Serial.printf("emc save F    Save EMC memory and pointers to file F (default %s). emc load force F restores them\n", EMC_SNAPSHOT_FILENAME);
 #endif
-#if ENABLE_TRACE_PTR2
-  Serial.printf("EMC           display info tracing EMC Ptr2 over a limited range\n");
+#if ENABLE_EMC_TRACE
+  Serial.printf("emc trace on [LOW HIGH]  Trace EMC operations with pointers in the octal window. emc trace off\n");
+  Serial.printf("emc trace show N  Show the last N EMC trace events. emc trace dump/save [FILE] for tools/la_decode\n");
 #endif
+#if ENABLE_HP85_RAM_SHADOW
+  Serial.printf("shadow        HP-85 RAM shadow status. shadow check compares it with RAM, shadow dump ADDR [N] dumps memory\n");
+#endif
+#if ENABLE_CRT_STREAM
+  Serial.printf("crt stream    Remote display stream statistics. crt stream dump prints a keyframe for tools/crt_stream\n");
+#endif
+#if ENABLE_CRT_RECORD
+  Serial.printf("crt record    CRT recorder status. crt record start [F] records CRT writes to F (default %s), crt record stop\n", CRT_RECORD_FILENAME);
+#endif
+#if ENABLE_SCREENSHOT
+  Serial.printf("screenshot F  Save the screen as a PBM image in file F (default %s)\n", SCREENSHOT_FILENAME);
+  Serial.printf("              Alpha text uses a generic 5x7 font, not the Series 80 character ROM\n");
+#endif
+#if ENABLE_DMA_BENCH
+  Serial.printf("dma bench [ADDR]  Measure DMA rates and errors for each burst length, using free RAM (or octal ADDR)\n");
+  Serial.printf("dma bench long [ADDR]  Also try bursts that can starve DRAM refresh. Reset the HP-85 afterwards\n");
+#endif
+  Serial.printf("PSRAMTest     Test the 8 MB PSRAM. You probably should do the PWO command when test has finished\n");
+  Serial.printf("ESP32 Prog    Activate a passthrough serial path to program the ESP32\n");
+  Serial.printf("isrstats clear Clear the ISR timing statistics shown by show isrstats\n");
   Serial.printf("pwo           Pulse PWO, resetting HP85 and EBTKS\n");
 
 //Serial.printf("dump ram window Start(8) Len(8)   Dump RAM in ROM window\n");                          //  Currently broken because of parsing
@@ -1075,6 +1227,7 @@ void help_5(void)
   Serial.printf("crt 3         Normal CRT Write Experiments\n");
   Serial.printf("crt 4         Test screen Save and Restore\n");
   Serial.printf("crt 5         Test writing text to HP86/87 CRT\n");
+  Serial.printf("crt bench     Measure CRT write speed, rewriting the screen with its own contents\n");
   Serial.printf("\n");
 }
 
@@ -1298,6 +1451,7 @@ void proc_addr(void)
 //  }
 
   Logic_Analyzer_State = ANALYZER_IDLE;
+  select_pinChange_isr();                                 //  In case it was acquiring, back to the ISR variant without the Logic Analyzer
   Logic_Analyzer_Data_index = 0;
   Logic_Analyzer_Valid_Samples   = 0;
   Logic_Analyzer_Trigger_Value_1 = 0;   //  trigger on anything
@@ -1459,6 +1613,7 @@ void Setup_Boot_Time_Logic_Analyzer(void)
   //
 
   Logic_Analyzer_State = ANALYZER_IDLE;
+  select_pinChange_isr();                                 //  In case it was acquiring, back to the ISR variant without the Logic Analyzer
   Logic_Analyzer_Data_index             = 0;
   Logic_Analyzer_Valid_Samples          = 0;
   Logic_Analyzer_Index_of_Trigger       = -1;             //  A negative value means that if we display the buffer without a trigger event (time out) we won't display the Trigger message
@@ -1574,6 +1729,16 @@ void no_SD_card_message(void)
 {
 
   //Write_on_CRT_Alpha(2, 0, "                                ");
+#if ENABLE_DMA_QUEUE
+  DMA_Queue_CRT_Text(2, 0, "Hello,");
+  DMA_Queue_CRT_Text(3, 0, "You have installed an EBTKS, but");
+  DMA_Queue_CRT_Text(4, 0, "it seems to not have an SD card");
+  DMA_Queue_CRT_Text(5, 0, "installed. Without it, EBTKS");
+  DMA_Queue_CRT_Text(6, 0, "won't work. No ROMs, Tape,");
+  DMA_Queue_CRT_Text(7, 0, "Disk (or extra RAM, 85A only)");
+  DMA_Queue_CRT_Text(9, 0, "I suggest a class 10, 16 GB card");
+  DMA_Queue_CRT_Text(10,0, "with the standard EBTKS file set");
+#else
   Write_on_CRT_Alpha(2, 0, "Hello,");
   Write_on_CRT_Alpha(3, 0, "You have installed an EBTKS, but");
   Write_on_CRT_Alpha(4, 0, "it seems to not have an SD card");
@@ -1582,6 +1747,7 @@ void no_SD_card_message(void)
   Write_on_CRT_Alpha(7, 0, "Disk (or extra RAM, 85A only)");
   Write_on_CRT_Alpha(9, 0, "I suggest a class 10, 16 GB card");
   Write_on_CRT_Alpha(10,0, "with the standard EBTKS file set");
+#endif
   Serial.printf("\nMessage sent to CRT advising that there is no SD card\n");
 }
 
@@ -1630,6 +1796,12 @@ void Setup_Logic_Analyzer(void)
 
   serial_string_used();
 
+  if (Logic_Analyzer_State >= ANALYZER_STREAMING)
+  {
+    Serial.printf("The Logic Analyzer is busy, type 'la stop' or 'la deep stop' first\n");
+    return;
+  }
+
   //
   //  Not all of these initializations are needed, but this makes sure I've got all these
   //  values to something reasonable
@@ -1650,6 +1822,7 @@ void Setup_Logic_Analyzer(void)
   //  These are always initialized when this function is called
   //
   Logic_Analyzer_State = ANALYZER_IDLE;
+  select_pinChange_isr();                                 //  In case it was acquiring, back to the ISR variant without the Logic Analyzer
   Logic_Analyzer_Data_index             = 0;
   Logic_Analyzer_Valid_Samples          = 0;
   Logic_Analyzer_Index_of_Trigger       = -1;                             //  A negative value means that if we display the buffer without a trigger event (time out) we won't display the Trigger message
@@ -2042,6 +2215,11 @@ static  uint32_t    LA_Heartbeat_Timer;
 
 void Logic_analyzer_go(void)
 {
+  if (Logic_Analyzer_State >= ANALYZER_STREAMING)
+  {
+    Serial.printf("The Logic Analyzer is busy, type 'la stop' or 'la deep stop' first\n");
+    return;
+  }
 //
 //  This re-initialization allows re issuing la_go without re-entering parameters
 //
@@ -2055,7 +2233,11 @@ void Logic_analyzer_go(void)
   Logic_Analyzer_Samples_Till_Done  = Logic_Analyzer_Current_Buffer_Length - Logic_Analyzer_Pre_Trigger_Samples;
   LA_Heartbeat_Timer                = systick_millis_count + 1000;    //  Do heartbeat message every 1000 ms
   Logic_Analyzer_Valid_Samples_1_second_ago = -100000;
+#if ENABLE_LA_SEQUENCER
+  Logic_Analyzer_Sequencer_Reset();
+#endif
   Logic_Analyzer_State              = ANALYZER_ACQUIRING;
+  select_pinChange_isr();                                             //  Switch to the ISR variant that runs the Logic Analyzer
   Ctrl_C_seen = false;
 }
 
@@ -2066,13 +2248,27 @@ void Logic_Analyzer_Poll(void)
   int16_t       i, j;
   int16_t       Samples_to_display;
   int16_t       Display_starting_index;
-  float         sample_time;
 
   if (Logic_Analyzer_State == ANALYZER_IDLE)
   {
     return;
   }
 
+#if ENABLE_LA_STREAM
+  if (Logic_Analyzer_State == ANALYZER_STREAMING)
+  {
+    Logic_Analyzer_Stream_Poll();
+    return;
+  }
+#endif
+#if ENABLE_LA_DEEP
+  if (Logic_Analyzer_State == ANALYZER_DEEP_ACQUIRING)
+  {
+    Logic_Analyzer_Deep_Poll();
+    return;
+  }
+#endif
+
   if (LA_Heartbeat_Timer < systick_millis_count)
   {
     Serial.printf("Heartbeat Timer %10d    systick_millis_count %10d\n", LA_Heartbeat_Timer, systick_millis_count);
@@ -2132,6 +2328,13 @@ void Logic_Analyzer_Poll(void)
 la_display_results:
 
   Logic_Analyzer_State = ANALYZER_IDLE;
+  select_pinChange_isr();                                             //  Back to the ISR variant without the Logic Analyzer
+#if ENABLE_LA_DUMP
+  if (Logic_Analyzer_Dump_Results(Display_starting_index, Samples_to_display))
+  {
+    return;                                                           //  "la output" is dump or save, so no table
+  }
+#endif
   Serial.printf("Logic Analyzer results\n\n");
   Serial.printf("Buffer Length %d  Address Mask  %d\n" , Logic_Analyzer_Current_Buffer_Length, Logic_Analyzer_Current_Index_Mask);
   Serial.printf("Trigger Index %d  Pre Trigger Samples %d\n\n", Logic_Analyzer_Index_of_Trigger, Logic_Analyzer_Pre_Trigger_Samples);
@@ -2169,8 +2372,7 @@ la_display_results:
   // Serial.printf("PRIMASK Expect 1     = %08X\n", temp);           //  It will be a real surprise if this works. Expect LSB to be 1. Tested, It works and shows Global Interrupt enable
   Serial.printf("\n\n");
 
-  Serial.printf("    Time Sample   Address     Data   Cycle RSE  DRP DMA /IR /HAL          LA Data 1\n");
-  Serial.printf("     us                              WRLF  LEC           LX  TX\n");
+  Logic_Analyzer_Print_Heading();
   sample_number_relative_to_trigger = - Logic_Analyzer_Pre_Trigger_Samples;
 
   for (i = 0 ; i < Samples_to_display ; i++)
@@ -2198,46 +2400,63 @@ la_display_results:
     //   temp &= ~0x10000000;  // test HALTX flag
     // }
 
-    sample_time = (16.0/9.808) * sample_number_relative_to_trigger;
-
-    //Serial.printf("%08X ", temp);
-    if ((temp & (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR)) == (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR))
-    { //  All 3 control lines are high (not asserted, so data bus is junque)
-      Serial.printf("%9.3f %5d %06o/%04X  xxx/xx  ", sample_time, sample_number_relative_to_trigger++, (temp >> 8) & 0x0000FFFFU,
-                                                             (temp >> 8) & 0x0000FFFFU );
-    }
-    else
-    {
-      Serial.printf("%9.3f %5d %06o/%04X  %03o/%02X  ", sample_time, sample_number_relative_to_trigger++, (temp >> 8) & 0x0000FFFFU,
-                                                             (temp >> 8) & 0x0000FFFFU,
-                                                             temp & 0x000000FFU,
-                                                             temp & 0x000000FFU);
-    }
-    Serial.printf("%c", (temp & BIT_MASK_WR)  ? '-' : 'W');   //  Remember that these 3 signals are active low
-    Serial.printf("%c", (temp & BIT_MASK_RD)  ? '-' : 'R');
-    Serial.printf("%c", (temp & BIT_MASK_LMA) ? '-' : 'L');
-    Serial.printf("%c", (temp & 0x40000000)   ? 'F' : '-');
-    Serial.printf("  %03o", Logic_Analyzer_Data_2[j] & 0x000000FF );
-    Serial.printf("  %03o", (Logic_Analyzer_Data_2[j] & 0x0000FF00) >> 8 );
-    Serial.printf(" %s", (temp & 0x80000000)     ? " D "  : "   " );
-    Serial.printf(" %s",   (temp & 0x20000000)   ? "   "  : " I " );
-    Serial.printf(" %s",   (temp & 0x10000000)   ? "   "  : "  H");
-
-    if (j == Logic_Analyzer_Index_of_Trigger)
-    {
-      Serial.printf("  Trigger");
-    }
-    else
-    {
-      Serial.printf("         ");
-    }
-    Serial.printf("  %08X", temp);
-    Serial.printf("\n");
+    Logic_Analyzer_Print_Sample(sample_number_relative_to_trigger++, temp, Logic_Analyzer_Data_2[j], j == Logic_Analyzer_Index_of_Trigger);
     Serial.flush();
   }
   Serial.printf("\n\n");
 }
 
+//
+//  One line of the Logic Analyzer results table. Used by Logic_Analyzer_Poll() and the deep capture display
+//
+
+void Logic_Analyzer_Print_Heading(void)
+{
+  Serial.printf("    Time Sample   Address     Data   Cycle RSE  DRP DMA /IR /HAL          LA Data 1\n");
+  Serial.printf("     us                              WRLF  LEC           LX  TX\n");
+}
+
+void Logic_Analyzer_Print_Sample(int32_t sample_number_relative_to_trigger, uint32_t temp, uint32_t aux, bool is_trigger)
+{
+  float         sample_time;
+
+  sample_time = (16.0/9.808) * sample_number_relative_to_trigger;
+
+  //Serial.printf("%08X ", temp);
+  if ((temp & (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR)) == (BIT_MASK_LMA | BIT_MASK_RD | BIT_MASK_WR))
+  { //  All 3 control lines are high (not asserted, so data bus is junque)
+    Serial.printf("%9.3f %5d %06o/%04X  xxx/xx  ", sample_time, sample_number_relative_to_trigger, (temp >> 8) & 0x0000FFFFU,
+                                                           (temp >> 8) & 0x0000FFFFU );
+  }
+  else
+  {
+    Serial.printf("%9.3f %5d %06o/%04X  %03o/%02X  ", sample_time, sample_number_relative_to_trigger, (temp >> 8) & 0x0000FFFFU,
+                                                           (temp >> 8) & 0x0000FFFFU,
+                                                           temp & 0x000000FFU,
+                                                           temp & 0x000000FFU);
+  }
+  Serial.printf("%c", (temp & BIT_MASK_WR)  ? '-' : 'W');   //  Remember that these 3 signals are active low
+  Serial.printf("%c", (temp & BIT_MASK_RD)  ? '-' : 'R');
+  Serial.printf("%c", (temp & BIT_MASK_LMA) ? '-' : 'L');
+  Serial.printf("%c", (temp & 0x40000000)   ? 'F' : '-');
+  Serial.printf("  %03o", aux & 0x000000FF );
+  Serial.printf("  %03o", (aux & 0x0000FF00) >> 8 );
+  Serial.printf(" %s", (temp & 0x80000000)     ? " D "  : "   " );
+  Serial.printf(" %s",   (temp & 0x20000000)   ? "   "  : " I " );
+  Serial.printf(" %s",   (temp & 0x10000000)   ? "   "  : "  H");
+
+  if (is_trigger)
+  {
+    Serial.printf("  Trigger");
+  }
+  else
+  {
+    Serial.printf("         ");
+  }
+  Serial.printf("  %08X", temp);
+  Serial.printf("\n");
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 int int_power(int base, int exp)
@@ -2535,6 +2754,16 @@ extern "C" uint8_t external_psram_size;           //  startup.c does a simple te
 extern "C" uint32_t *	  _extram_start;
 extern "C" uint32_t *	  _extram_end;
 
+//
+//  True if everything that was linked into EXTMEM (the EMC store, the Logic Analyzer deep capture store, ...)
+//  is in PSRAM that is fitted
+//
+
+bool PSRAM_Holds_EXTMEM(void)
+{
+  return (external_psram_size != 0) && ((uint32_t)&_extram_end <= 0x70000000 + ((uint32_t)external_psram_size << 20));
+}
+
 bool memory_ok = false;
 
 uint32_t *memory_begin, *memory_end;
@@ -2751,154 +2980,113 @@ bool check_lfsr_pattern(uint32_t seed)
 	return true;
 }
 
-#if ENABLE_TRACE_EMC
-struct EMC_Trace_1_Struct {
-          uint32_t  ptr_1_contents;
-          uint32_t  ptr_2_contents;
-          uint32_t  Trace_mask;
-          uint32_t  Cycle_count;
-          uint8_t   Trace_val;
-          uint8_t   Trace_cycleNdx;
-};
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  ISR timing statistics
 
-extern struct EMC_Trace_1_Struct EMC_Trace_1[EMC_DIAG_BUF_SIZE];
+#if ENABLE_ISR_STATS
 
-extern uint32_t           m_emc_ptr1 , m_emc_ptr2;        //  EMC pointers
-extern uint32_t           diag_snap_PTR2;                 //  Looks like this is only needed when ENABLE_TRACE_EMC is enabled
-extern bool               diag_snap_lock;                 //  Looks like this is only needed when ENABLE_TRACE_EMC is enabled
-extern uint32_t           Trace_index;
+static const char * isr_phase_names[ISR_PHASE_COUNT] = {"Phi 1 Rise", "Phi 1 Fall", "Mid cycle", "Entry to Fall", "Total ISR"};
+static const char * isr_emc_names[ISR_EMC_COUNT]     = {"EMC cache read", "EMC cache write"};
 
+//
+//  Label the I/O registers that EBTKS (might) implement, so the report is readable without a register map
+//
 
-void EMC_Info(void)
+static const char * isr_stats_io_name(uint8_t reg)
 {
-  struct EMC_Trace_1_Struct *trace_ptr;
-#if !ENABLE_EMC_SUPPORT
-  Serial.printf("The EMC emulation is disabled by a compile time flag\n");
-  return;
-#endif
-  
-#if ENABLE_EMC_SUPPORT
-  Serial.printf("EMC Configurations base on CONFIG.TXT\n");
-  Serial.printf("EMC Support      %s\n",    get_EMC_Enable() ? "true":"false");
-  Serial.printf("EMC Num Banks    %d, 32 KB each\n", get_EMC_NumBanks());
-  Serial.printf("EMC Start Bank   %d\n", get_EMC_StartBank());
-  Serial.printf("EMC Start Addr   %08o Octal\n", get_EMC_StartAddress());
-  Serial.printf("EMC End Addr     %08o Octal\n", get_EMC_EndAddress());
-  Serial.printf("EMC PTR 1        %08o Octal\n", m_emc_ptr1);
-  Serial.printf("EMC PTR 2        %08o Octal\n", m_emc_ptr2);
-  Serial.printf("diag_snap_lock   %s\n",    diag_snap_lock ? "true":"false");
-  Serial.printf("diag_snap_PTR2   %08o Octal\n", diag_snap_PTR2);
-  Serial.printf("Trace_index      %d\n", Trace_index);
-
-  Serial.printf("\ni    val  Ndx    Mask   Ptr1      Ptr2      Cycle\n");
-  for (uint32_t i = 0 ; i < Trace_index ;)
-  {
-    trace_ptr = &EMC_Trace_1[i];
-    Serial.printf("%4d ", i);
-    Serial.printf("%02X   ",  trace_ptr->Trace_val);
-    Serial.printf("%3d ",     trace_ptr->Trace_cycleNdx);
-    Serial.printf("%08X ",    trace_ptr->Trace_mask);
-    Serial.printf("%08X ",    trace_ptr->ptr_1_contents);
-    Serial.printf("%08X  ",   trace_ptr->ptr_2_contents);
-    Serial.printf("%10d",     trace_ptr->Cycle_count);
-    Serial.printf("\n");
+  if (reg == (GINTEN & 0xFF))                                   return "GINTEN";
+  if (reg == (GINTDS & 0xFF))                                   return "GINTDS";
+  if ((reg >= (CRTSAD & 0xFF)) && (reg <= (CRTDAT & 0xFF)))     return "CRT 85";
+  if ((reg >= (TAPSTS & 0xFF)) && (reg <= (TAPDAT & 0xFF)))     return "Tape";
+  if (reg == (RSELEC & 0xFF))                                   return "RSELEC";
+  if ((reg >= 0x40) && (reg <= 0x4F))                           return "1MB5";
+  if ((reg >= (HP86_87_CRTSAD & 0xFF)) && (reg <= (HP86_87_CRTDAT & 0xFF)))   return "CRT 86/87";
+  if ((reg >= 0xC8) && (reg <= 0xCF))                           return "EMC";
+  if (reg == (HEYEBTKS & 0xFF))                                 return "AUXROM";
+  return "";
+}
 
-    i++;
-    if ((i % 3) == 0)
-    {
-      Serial.printf("\n");
-    }
-  }
-  diag_snap_lock = false;
-  diag_snap_PTR2 = 0xFFFFFFFF;
-  Trace_index = 0;
+static void show_one_isr_stat(const char * name, struct S_ISR_Timing * stat)
+{
+  uint32_t  cycles_per_us = F_CPU_ACTUAL / 1000000;
+  int       bin;
 
-#endif
+  Serial.printf("%-18s %10u %6u %8.1f %6u %6u ns  ", name, stat->count, stat->min,
+                (double)stat->total / stat->count, stat->max, (stat->max * 1000) / cycles_per_us);
+  for (bin = 0 ; bin < ISR_STATS_HISTOGRAM_BINS ; bin++)
+  {
+    Serial.printf(" %u", stat->histogram[bin]);
+  }
+  Serial.printf("\n");
 }
 
-#endif
+void show_isr_stats(void)
+{
+  struct S_ISR_Timing   snapshot;
+  char                  name[24];
+  int                   i;
 
-#if ENABLE_TRACE_PTR2
-struct EMC_Trace_2_struct {
-          uint32_t  ptr_2_contents_pre;
-          uint32_t  ptr_2_contents_post;
-          uint32_t  Cycle_count;
-          uint8_t   Trace_cycleNdx;
-          uint8_t   Trace_op;
-          uint8_t   Dec_disp;
-          uint8_t   EMC_DRP;
-          uint8_t   EMC_DRP_Loaded;
-};
+  Serial.printf("\nISR timing in CPU cycles at %u MHz. Histogram bin n is 2^n to 2^(n+1)-1 cycles\n", F_CPU_ACTUAL / 1000000);
+  Serial.printf("\n                        Count    Min     Mean    Max    Max     Histogram\n");
+  for (i = 0 ; i < ISR_PHASE_COUNT ; i++)
+  {
+    snapshot = ISR_Stats_Phase[i];          //  The ISR keeps updating, so work from a copy
+    if (snapshot.count)
+    {
+      show_one_isr_stat(isr_phase_names[i], &snapshot);
+    }
+  }
 
-extern struct EMC_Trace_2_struct EMC_Trace_2[EMC_PTR2_BUF_SIZE];
-extern uint32_t  Trace_index;
+  Serial.printf("\nEMC data accesses, all from the DMAMEM cache. Max is the worst case\n");
+  for (i = 0 ; i < ISR_EMC_COUNT ; i++)
+  {
+    snapshot = ISR_Stats_EMC[i];
+    if (snapshot.count)
+    {
+      show_one_isr_stat(isr_emc_names[i], &snapshot);
+    }
+  }
 
-void EMC_Ptr2(void)
-{
-  struct EMC_Trace_2_struct *trace_ptr;
-#if !ENABLE_EMC_SUPPORT
-  Serial.printf("The EMC emulation is disabled by a compile time flag\n");
-  return;
-#endif
-  
-#if ENABLE_EMC_SUPPORT
-  Serial.printf("EMC Configurations base on CONFIG.TXT\n");
-  Serial.printf("EMC Support      %s\n",    get_EMC_Enable() ? "true":"false");
-  Serial.printf("EMC Num Banks    %d, 32 KB each\n", get_EMC_NumBanks());
-  Serial.printf("EMC Start Bank   %d\n", get_EMC_StartBank());
-  Serial.printf("EMC Start Addr   %08o Octal\n", get_EMC_StartAddress());
-  Serial.printf("EMC End Addr     %08o Octal\n", get_EMC_EndAddress());
-  Serial.printf("Trace_index      %d\n", Trace_index);
-
-  Serial.printf("\n  i  Ptr2 Pre Ptr2 Post  Op   Ndx    Cycle   disp DRP   DRPLoad\n\n");
-  for (uint32_t i = 0 ; i < Trace_index ; i++)
-  {
-    trace_ptr = &EMC_Trace_2[i];
-    Serial.printf("%4d ", i);
-    Serial.printf("%8d ", trace_ptr->ptr_2_contents_pre);
-    Serial.printf(" %8d  ", trace_ptr->ptr_2_contents_post);
-    switch (trace_ptr->Trace_op)
+  Serial.printf("\nI/O handlers\n");
+  for (i = 0 ; i < 256 ; i++)
+  {
+    snapshot = ISR_Stats_IO_Read[i];
+    if (snapshot.count)
     {
-      case 1:
-        Serial.printf("DecM ");
-        break;
-      case 2:
-        Serial.printf("Dec1 ");
-        break;
-      case 3:
-        Serial.printf("Rd I ");
-        break;
-      case 4:
-        Serial.printf("Wr I ");
-        break;
-      default:
-        Serial.printf("ERR! ");
-        break;
+      sprintf(name, "R %06o %s", 0177400 + i, isr_stats_io_name(i));
+      show_one_isr_stat(name, &snapshot);
     }
-    Serial.printf("%3d ", trace_ptr->Trace_cycleNdx);
-    Serial.printf("%10d", trace_ptr->Cycle_count);
-    Serial.printf(" %2d   %03o", trace_ptr->Dec_disp, trace_ptr->EMC_DRP & 077);    //  Mask of the DRP instruction bits (top 2 bits), keep the lower 6
-    // if (Trace_op[i] < 2)
-    // {
-    //   Serial.printf(" %2d   %03o", Dec_disp[i], EMC_DRP[i] & 077);    //  Mask of the DRP instruction bits (top 2 bits), keep the lower 6
-    // }
-    // else
-    // {
-    //   Serial.printf("         ");
-    // }
-    if (trace_ptr->EMC_DRP_Loaded != 0xff)
+    snapshot = ISR_Stats_IO_Write[i];
+    if (snapshot.count)
     {
-      Serial.printf("   %03o", trace_ptr->EMC_DRP_Loaded);
+      sprintf(name, "W %06o %s", 0177400 + i, isr_stats_io_name(i));
+      show_one_isr_stat(name, &snapshot);
     }
-    Serial.printf("\n");
   }
-  Trace_index = 0;
+  Serial.printf("\n");
+}
 
-#endif
+void clear_isr_stats(void)
+{
+  memset(ISR_Stats_Phase,    0, sizeof(ISR_Stats_Phase));
+  memset(ISR_Stats_IO_Read,  0, sizeof(ISR_Stats_IO_Read));
+  memset(ISR_Stats_IO_Write, 0, sizeof(ISR_Stats_IO_Write));
+  memset(ISR_Stats_EMC,      0, sizeof(ISR_Stats_EMC));
+  Serial.printf("ISR timing statistics cleared\n");
 }
 
-#endif
+#else
+
+void show_isr_stats(void)
+{
+  Serial.printf("ISR timing statistics are disabled by a compile time flag (ENABLE_ISR_STATS)\n");
+}
+
+void clear_isr_stats(void)
+{
+  show_isr_stats();
+}
 
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  Time and Date functions
 //
@@ -3247,6 +3435,27 @@ void str_tolower(char *p)
   for (  ; *p ; ++p) *p = ((*p > 0x40) && (*p < 0x5b)) ? (*p | 0x60) : *p;
 }
 
+//
+//  CRC-32, as used by zip. Start with crc = 0, and pass the result of each call to the next for data in pieces
+//
+
+uint32_t crc32_update(uint32_t crc, const void *data, uint32_t length)
+{
+  const uint8_t   *p = (const uint8_t *)data;
+  int             bit;
+
+  crc = ~crc;
+  while (length--)
+  {
+    crc ^= *p++;
+    for (bit = 0 ; bit < 8 ; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320U & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
 
 
 //**********************************************************   From Everett, 9/22/2020 , with just formatting changes to conform with the rest of the source code
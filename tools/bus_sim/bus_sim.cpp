@@ -0,0 +1,628 @@
+//
+//      bus_sim       Host (Linux) bus cycle simulator for the EBTKS Phi 1 ISR
+//
+//      Compiles the real src/EBTKS_Bus_Interface_ISR.cpp and src/EBTKS_Bank_Switched_ROM.cpp
+//      against a simulated GPIO layer (see shim/Arduino.h), then replays a trace of Capricorn
+//      bus cycles through whatever ISR the firmware installs with attachInterruptVector().
+//      For every bus cycle it reports what EBTKS drove back onto the bus, and how long the
+//      ISR call took in host cycles and host instructions.
+//
+//      The host numbers are not Teensy nanoseconds, but they are repeatable enough to compare
+//      one build of the ISR against another, so timing regressions show up before the code
+//      gets to the bench and the oscilloscope (SET_SCOPE_1 / CLEAR_SCOPE_1).
+//
+//      Build and run (see Makefile in this directory):
+//
+//          make -C tools/bus_sim
+//          tools/bus_sim/bus_sim -m HP85A -x tools/bus_sim/traces/ram16k.trc
+//
+//      A bank switched ROM is loaded with -r FILE (repeat for more ROMs), and -s NNN selects it (RSELEC, octal)
+//      before the first cycle. Only traces/ram16k.trc ships with the tree, other traces are made with "la go"
+//
+//      Trace file formats (may be mixed, one bus cycle per line, # starts a comment):
+//
+//        1) Native:    <cycle> <data> [F]
+//                      cycle is any combination of the letters W R L for the asserted
+//                      /WR /RD /LMA signals (or - for none), data is the 8 bit value on the
+//                      bus during Phi 1, in octal. F (or an F in the cycle field) marks an
+//                      instruction fetch. For example
+//                          L   000         first byte of an address load
+//                          L   140         second byte, address is now 140000
+//                          R   361         read
+//                          W   045         write
+//                          RL  000         LMA read (EMC indirect)
+//
+//        2) Logic Analyzer: any line whose last field is an 8 hex digit Logic_Analyzer_main_sample,
+//                      so the output of "la go" can be replayed directly. The address field in
+//                      each sample is checked against the simulated address register.
+//
+//      Only the bus interface, bank switched ROMs, 16K RAM expansion and EMC are present. I/O
+//      handlers for the CRT, tape, 1MB5 and AUXROM mailboxes are not linked, so those I/O
+//      addresses behave as if nothing was registered.
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "Inc_Common_Headers.h"
+#include "sim_config.h"
+
+extern ioReadFuncPtr_t  ioReadFuncs[256];
+extern ioWriteFuncPtr_t ioWriteFuncs[256];
+
+#define MAX_TRACE_LINE          (256)
+#define MAX_WORST_CYCLES        (32)
+
+struct S_Bus_Cycle
+{
+  uint32_t  control;                    //  /WR /RD /LMA in bits 26..24, active low, same as GPIO6
+  uint8_t   data;
+  bool      ifetch;
+  bool      has_address;                //  true for Logic Analyzer samples
+  uint16_t  address;
+};
+
+struct S_Cycle_Cost
+{
+  uint32_t  cycle_number;
+  uint32_t  host_cycles;
+  int64_t   host_instructions;
+  uint16_t  address;
+  uint32_t  control;
+};
+
+static const char *sim_machine_names[] = {"HP83", "HP9915A", "HP85A", "HP85AEMC", "HP85B", "HP9915B", "HP86A", "HP86B", "HP87", "HP87XM"};
+
+static bool               quiet;
+static int                perf_fd = -1;
+static struct S_Cycle_Cost worst[MAX_WORST_CYCLES];
+static int                worst_count;
+static int                worst_wanted = 10;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  Measurement
+
+//
+//  Host instruction counter. If perf events are not available (containers often block them)
+//  only host cycles are reported
+//
+
+static void open_instruction_counter(void)
+{
+  struct perf_event_attr    pe;
+
+  memset(&pe, 0, sizeof(pe));
+  pe.type           = PERF_TYPE_HARDWARE;
+  pe.size           = sizeof(pe);
+  pe.config         = PERF_COUNT_HW_INSTRUCTIONS;
+  pe.disabled       = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv     = 1;
+  perf_fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+  if (perf_fd >= 0)
+  {
+    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static int64_t read_instruction_counter(void)
+{
+  int64_t   count;
+
+  if (perf_fd < 0)
+  {
+    return 0;
+  }
+  if (read(perf_fd, &count, sizeof(count)) != sizeof(count))
+  {
+    return 0;
+  }
+  return count;
+}
+
+static void remember_if_worst(struct S_Cycle_Cost *cost)
+{
+  int     i;
+
+  if (worst_count < worst_wanted)
+  {
+    worst[worst_count++] = *cost;
+  }
+  else if (cost->host_cycles > worst[worst_count - 1].host_cycles)
+  {
+    worst[worst_count - 1] = *cost;
+  }
+  else
+  {
+    return;
+  }
+  for (i = worst_count - 1 ; i > 0 && worst[i].host_cycles > worst[i - 1].host_cycles ; i--)
+  {
+    struct S_Cycle_Cost temp = worst[i];
+    worst[i] = worst[i - 1];
+    worst[i - 1] = temp;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  Trace parsing
+
+static void format_cycle_type(char *dest, uint32_t control, bool ifetch)
+{
+  dest[0] = (control & BIT_MASK_WR)  ? '-' : 'W';               //  Same layout as Logic_Analyzer_Poll()
+  dest[1] = (control & BIT_MASK_RD)  ? '-' : 'R';
+  dest[2] = (control & BIT_MASK_LMA) ? '-' : 'L';
+  dest[3] = ifetch ? 'F' : '-';
+  dest[4] = 0;
+}
+
+static bool is_la_sample(const char *token)
+{
+  int     i;
+
+  if (strlen(token) != 8)
+  {
+    return false;
+  }
+  for (i = 0 ; i < 8 ; i++)
+  {
+    if (!isxdigit((unsigned char)token[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//
+//  Returns true if the line held a bus cycle
+//
+
+static bool parse_trace_line(char *line, struct S_Bus_Cycle *cycle, int line_number)
+{
+  char          *tokens[16];
+  int           num_tokens = 0;
+  char          *p;
+  uint32_t      sample;
+  unsigned int  data;
+
+  if ((p = strchr(line, '#')) != NULL)
+  {
+    *p = 0;
+  }
+  for (p = strtok(line, " \t\r\n") ; p && num_tokens < 16 ; p = strtok(NULL, " \t\r\n"))
+  {
+    tokens[num_tokens++] = p;
+  }
+  if (num_tokens == 0)
+  {
+    return false;
+  }
+
+  memset(cycle, 0, sizeof(*cycle));
+
+  if (is_la_sample(tokens[num_tokens - 1]))
+  {
+    sample = strtoul(tokens[num_tokens - 1], NULL, 16);
+    cycle->control      = sample & (BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA);
+    cycle->data         = sample & 0xFF;
+    cycle->ifetch       = (sample & 0x40000000) != 0;
+    cycle->has_address  = true;
+    cycle->address      = (sample >> 8) & 0xFFFF;
+    return true;
+  }
+
+  if (num_tokens < 2)
+  {
+    fprintf(stderr, "Line %d: expected <cycle> <data>\n", line_number);
+    return false;
+  }
+
+  cycle->control = BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA;    //  All de-asserted
+  for (p = tokens[0] ; *p ; p++)
+  {
+    switch (toupper((unsigned char)*p))
+    {
+      case 'W': cycle->control &= ~BIT_MASK_WR;  break;
+      case 'R': cycle->control &= ~BIT_MASK_RD;  break;
+      case 'L': cycle->control &= ~BIT_MASK_LMA; break;
+      case 'F': cycle->ifetch = true;            break;
+      case 'I':
+      case '-': break;
+      default:
+        fprintf(stderr, "Line %d: unknown cycle type %s\n", line_number, tokens[0]);
+        return false;
+    }
+  }
+  if (sscanf(tokens[1], "%o", &data) != 1)
+  {
+    fprintf(stderr, "Line %d: data must be octal\n", line_number);
+    return false;
+  }
+  cycle->data = data & 0xFF;
+  if ((num_tokens > 2) && (toupper((unsigned char)tokens[2][0]) == 'F'))
+  {
+    cycle->ifetch = true;
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  Setup
+
+//
+//  Same ROM header rules as loadRom() in EBTKS_SD.cpp, without the ID checking
+//
+
+static bool sim_load_rom(const char *fname, int slot_num)
+{
+  FILE      *rfile;
+  uint8_t   *slot;
+  uint8_t   id;
+
+  if (slot_num >= MAX_ROMS)
+  {
+    fprintf(stderr, "Too many ROMs, maximum is %d\n", MAX_ROMS);
+    return false;
+  }
+  if ((rfile = fopen(fname, "rb")) == NULL)
+  {
+    fprintf(stderr, "Can't open ROM file %s\n", fname);
+    return false;
+  }
+  slot = getRomSlotPtr(slot_num);
+  if (fread(slot, 1, ROM_PAGE_SIZE, rfile) < 3)
+  {
+    fprintf(stderr, "Can't read ROM header %s\n", fname);
+    fclose(rfile);
+    return false;
+  }
+  fclose(rfile);
+  id = (slot[0] == 0377) ? slot[1] : slot[0];
+  setRomMap(id, slot_num);
+  if (!quiet)
+  {
+    printf("ROM %s loaded into slot %d as ID %03o\n", fname, slot_num, id);
+  }
+  return true;
+}
+
+static int lookup_machine(const char *name)
+{
+  int     i;
+
+  for (i = MACH_FIRST_ENTRY ; i < MACH_LAST_ENTRY ; i++)
+  {
+    if (strcasecmp(sim_machine_names[i], name) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//
+//  Pin state while nothing is happening: Phi 1 low (so WAIT_WHILE_PHI_1_HIGH falls straight
+//  through), all active low bus signals high, IPRIH high (no higher priority interrupt)
+//
+
+static void init_pins(void)
+{
+  memset(&sim_gpio6, 0, sizeof(sim_gpio6));
+  memset(&sim_gpio7, 0, sizeof(sim_gpio7));
+  memset(&sim_gpio8, 0, sizeof(sim_gpio8));
+  memset(&sim_gpio9, 0, sizeof(sim_gpio9));
+  GPIO_PAD_STATUS_REG_LMA       = BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA | DATA_BUS_MASK;
+  GPIO_PAD_STATUS_REG_IPRIH_IN  = BIT_MASK_IPRIH_IN | BIT_MASK_PWO_L;
+  GPIO_PAD_STATUS_REG_T04      |= BIT_MASK_T04 | BIT_MASK_T05;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+    "Usage: bus_sim [options] tracefile\n"
+    "  -m machine     HP83 HP9915A HP85A HP85AEMC HP85B HP9915B HP86A HP86B HP87 HP87XM (default HP85A)\n"
+    "  -x             Enable the HP85A 16K RAM expansion\n"
+    "  -e start:num   Enable EMC, start bank and number of banks\n"
+    "  -r romfile     Load a ROM image (repeat for more ROMs)\n"
+    "  -s rselec      Initial RSELEC value, octal\n"
+    "  -w count       Number of worst case cycles to list (default 10, max %d)\n"
+    "  -b budget      Exit with status 2 if any ISR call takes more than budget host instructions\n"
+    "  -q             Only print the summary\n"
+    "Exit status is 3 if EBTKS drove data that does not match the trace\n", MAX_WORST_CYCLES);
+  exit(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  Main
+
+int main(int argc, char **argv)
+{
+  int                 opt;
+  int                 rom_slot = 0;
+  const char          *rom_files[MAX_ROMS];
+  int                 num_rom_files = 0;
+  bool                ram_expansion = false;
+  int                 initial_rselec = -1;
+  int64_t             budget = 0;
+  FILE                *trace;
+  char                line[MAX_TRACE_LINE];
+  int                 line_number = 0;
+  struct S_Bus_Cycle  cycle;
+  struct S_Cycle_Cost cost;
+  uint8_t             previous_bus_data = 0xFF;
+  bool                first_cycle = true;
+  uint32_t            t0, t1;
+  int64_t             i0, i1;
+  uint32_t            overhead_cycles;
+  int64_t             overhead_instructions;
+  char                type[8];
+
+  uint32_t            cycle_count = 0, reads = 0, writes = 0, lmas = 0, driven = 0;
+  uint32_t            data_mismatch = 0, address_mismatch = 0, over_budget = 0;
+  uint64_t            total_host_cycles = 0;
+  int64_t             total_host_instructions = 0;
+  uint32_t            min_host_cycles = 0xFFFFFFFF, max_host_cycles = 0;
+  int64_t             min_host_instructions = INT64_MAX, max_host_instructions = 0;
+
+  sim_config.machine = MACH_HP85A;
+
+  while ((opt = getopt(argc, argv, "m:xe:r:s:w:b:q")) != -1)
+  {
+    switch (opt)
+    {
+      case 'm':
+        if ((sim_config.machine = lookup_machine(optarg)) < 0)
+        {
+          fprintf(stderr, "Unknown machine %s\n", optarg);
+          usage();
+        }
+        break;
+      case 'x': ram_expansion = true; break;
+      case 'e':
+        if (sscanf(optarg, "%d:%d", &sim_config.emc_start_bank, &sim_config.emc_num_banks) != 2)
+        {
+          usage();
+        }
+        if (sim_config.emc_num_banks > EMC_MAX_BANKS)
+        {
+          sim_config.emc_num_banks = EMC_MAX_BANKS;
+        }
+        break;
+      case 'r':
+        if (num_rom_files < MAX_ROMS)
+        {
+          rom_files[num_rom_files++] = optarg;
+        }
+        break;
+      case 's': initial_rselec = strtol(optarg, NULL, 8); break;
+      case 'w':
+        worst_wanted = atoi(optarg);
+        if (worst_wanted < 0) worst_wanted = 0;
+        if (worst_wanted > MAX_WORST_CYCLES) worst_wanted = MAX_WORST_CYCLES;
+        break;
+      case 'b': budget = atoll(optarg); break;
+      case 'q': quiet = true; break;
+      default:  usage();
+    }
+  }
+  if (optind != argc - 1)
+  {
+    usage();
+  }
+  if ((trace = fopen(argv[optind], "r")) == NULL)
+  {
+    fprintf(stderr, "Can't open trace file %s\n", argv[optind]);
+    return 1;
+  }
+
+  //
+  //  Same order as setup() in EBTKS.cpp
+  //
+
+  init_pins();
+  initIOfuncTable();
+  initRoms();
+  for (int i = 0 ; i < num_rom_files ; i++)
+  {
+    if (!sim_load_rom(rom_files[i], rom_slot++))
+    {
+      return 1;
+    }
+  }
+  enHP85RamExp(ram_expansion && ONLY_HAS_16K_RAM);
+#if ENABLE_EMC_SUPPORT
+  if (sim_config.emc_num_banks && SUPPORTS_EMC)
+  {
+    emc_init();
+  }
+#endif
+  if (initial_rselec >= 0)
+  {
+    (ioWriteFuncs[RSELEC & 0xFF])(initial_rselec);
+  }
+  setupPinChange();
+  if (sim_installed_isr == NULL)
+  {
+    fprintf(stderr, "setupPinChange() did not install an ISR\n");
+    return 1;
+  }
+
+  open_instruction_counter();
+  t0 = ARM_DWT_CYCCNT;  i0 = read_instruction_counter();
+  t1 = ARM_DWT_CYCCNT;  i1 = read_instruction_counter();
+  overhead_cycles       = t1 - t0;
+  overhead_instructions = i1 - i0;
+
+  if (!quiet)
+  {
+    const char  *isr_name = "pinChange_isr";
+
+    if (sim_installed_isr == &pinChange_isr_no_emc) isr_name = "pinChange_isr_no_emc";
+#if ENABLE_EMC_SUPPORT
+    if (sim_installed_isr == &pinChange_isr_emc)    isr_name = "pinChange_isr_emc";
+#endif
+    printf("Machine %s, RAM expansion %s, EMC banks %d, ISR %s, instruction counter %s\n\n",
+           sim_machine_names[sim_config.machine], getHP85RamExp() ? "on" : "off",
+           sim_config.emc_num_banks, isr_name, (perf_fd >= 0) ? "available" : "not available");
+    printf("  Cycle  Type  Address  Bus  EBTKS  Pins   ISR cycles  ISR instr\n");
+  }
+
+  while (fgets(line, sizeof(line), trace))
+  {
+    line_number++;
+    if (!parse_trace_line(line, &cycle, line_number))
+    {
+      continue;
+    }
+
+    if (first_cycle && cycle.has_address)
+    {
+      addReg = cycle.address;                                   //  Logic Analyzer trace, so we know where we are
+    }
+    first_cycle = false;
+
+    //
+    //  One ISR call finishes Phi 1 of the previous cycle (data from that cycle is still on
+    //  the bus) and then samples the control lines of this cycle at Phi 2
+    //
+
+    GPIO_PAD_STATUS_REG_LMA = (GPIO_PAD_STATUS_REG_LMA & ~(BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA | BIT_MASK_PHASE1 | DATA_BUS_MASK)) |
+                              cycle.control | ((uint32_t)previous_bus_data << BIT_POSITION_DB0);
+    if (cycle.ifetch)
+    {
+      GPIO_PAD_STATUS_REG_IFETCH |=  BIT_MASK_IFETCH;
+    }
+    else
+    {
+      GPIO_PAD_STATUS_REG_IFETCH &= ~BIT_MASK_IFETCH;
+    }
+
+    i0 = read_instruction_counter();
+    t0 = ARM_DWT_CYCCNT;
+    sim_installed_isr();
+    t1 = ARM_DWT_CYCCNT;
+    i1 = read_instruction_counter();
+
+    cost.cycle_number       = cycle_count;
+    cost.host_cycles        = ((t1 - t0) > overhead_cycles) ? (t1 - t0) - overhead_cycles : 0;   //  Timer noise can make very short calls look negative
+    cost.host_instructions  = ((i1 - i0) > overhead_instructions) ? (i1 - i0) - overhead_instructions : 0;
+    cost.address            = addReg;
+    cost.control            = cycle.control;
+
+    //
+    //  Look at the pins to see if EBTKS is driving the data bus (and /RC) for this cycle
+    //
+
+    bool ebtks_drives = ((GPIO_DIRECTION_DB0 & DATA_BUS_MASK) == DATA_BUS_MASK) && GET_BUS_DIR_TO_HP;
+    uint8_t ebtks_data = (GPIO_DR_DB0 & DATA_BUS_MASK) >> BIT_POSITION_DB0;
+
+    previous_bus_data = ebtks_drives ? ebtks_data : cycle.data;
+
+    if (!(cycle.control & BIT_MASK_LMA)) lmas++;
+    if (schedule_read)  reads++;
+    if (schedule_write) writes++;
+    if (ebtks_drives)
+    {
+      driven++;
+      if (ebtks_data != cycle.data)
+      {
+        data_mismatch++;
+      }
+    }
+    if (cycle.has_address && (cycle.address != addReg))
+    {
+      address_mismatch++;
+    }
+    if (budget && (cost.host_instructions > budget))
+    {
+      over_budget++;
+    }
+
+    total_host_cycles       += cost.host_cycles;
+    total_host_instructions += cost.host_instructions;
+    if (cost.host_cycles < min_host_cycles)             min_host_cycles = cost.host_cycles;
+    if (cost.host_cycles > max_host_cycles)             max_host_cycles = cost.host_cycles;
+    if (cost.host_instructions < min_host_instructions) min_host_instructions = cost.host_instructions;
+    if (cost.host_instructions > max_host_instructions) max_host_instructions = cost.host_instructions;
+    remember_if_worst(&cost);
+
+    if (!quiet)
+    {
+      format_cycle_type(type, cycle.control, cycle.ifetch);
+      printf("%7u  %s  %06o   %03o  ", cycle_count, type, addReg, cycle.data);
+      if (ebtks_drives)
+      {
+        printf("%03o%c  ", ebtks_data, (ebtks_data != cycle.data) ? '!' : ' ');
+      }
+      else
+      {
+        printf("---   ");
+      }
+      printf("%c%c%c%c  %10u  ",
+             GET_ASSERT_INT    ? 'I' : '-',
+             GET_ASSERT_INTPRI ? 'P' : '-',
+             GET_ASSERT_HALT   ? 'H' : '-',
+             (cycle.has_address && (cycle.address != addReg)) ? 'A' : ' ',
+             cost.host_cycles);
+      if (perf_fd >= 0)
+      {
+        printf("%9lld\n", (long long)cost.host_instructions);
+      }
+      else
+      {
+        printf("      n/a\n");
+      }
+    }
+    cycle_count++;
+  }
+  fclose(trace);
+
+  //
+  //  One more ISR call so that a write in the last traced cycle is completed
+  //
+
+  GPIO_PAD_STATUS_REG_LMA = (GPIO_PAD_STATUS_REG_LMA & ~(BIT_MASK_PHASE1 | DATA_BUS_MASK)) |
+                            BIT_MASK_WR | BIT_MASK_RD | BIT_MASK_LMA | ((uint32_t)previous_bus_data << BIT_POSITION_DB0);
+  sim_installed_isr();
+
+  printf("\nSummary\n");
+  printf("  Bus cycles              %10u\n", cycle_count);
+  printf("  LMA / Read / Write      %10u / %u / %u\n", lmas, reads, writes);
+  printf("  Reads EBTKS drove       %10u\n", driven);
+  printf("  EBTKS data != trace     %10u\n", data_mismatch);
+  printf("  Address != LA sample    %10u\n", address_mismatch);
+  printf("  EBTKS_delay_ns() total  %10lld ns (not simulated)\n", (long long)sim_config.delay_ns_requested);
+  if (cycle_count)
+  {
+    printf("  ISR host cycles         min %u  mean %.1f  max %u\n", min_host_cycles,
+           (double)total_host_cycles / cycle_count, max_host_cycles);
+    if (perf_fd >= 0)
+    {
+      printf("  ISR host instructions   min %lld  mean %.1f  max %lld\n", (long long)min_host_instructions,
+             (double)total_host_instructions / cycle_count, (long long)max_host_instructions);
+    }
+  }
+  if (worst_count)
+  {
+    printf("\n  Worst case ISR calls\n    Cycle  Type  Address   Host cycles  Host instr\n");
+    for (int i = 0 ; i < worst_count ; i++)
+    {
+      format_cycle_type(type, worst[i].control, false);
+      printf("  %7u  %s  %06o   %11u  %10lld\n", worst[i].cycle_number, type, worst[i].address,
+             worst[i].host_cycles, (long long)worst[i].host_instructions);
+    }
+  }
+  if (budget && (perf_fd < 0))
+  {
+    printf("\nInstruction budget not checked, no instruction counter available\n");
+  }
+  else if (over_budget)
+  {
+    printf("\n%u ISR calls exceeded the budget of %lld instructions\n", over_budget, (long long)budget);
+    return 2;
+  }
+  return data_mismatch ? 3 : 0;
+}
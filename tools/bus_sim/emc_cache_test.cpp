@@ -0,0 +1,258 @@
+//
+//      emc_cache_test     Host test of the EMC bank cache replacement policy
+//
+//      Runs src/EBTKS_EMC_Cache.cpp against simulated EMC traffic. The accesses are made the way
+//      emc_r() and emc_w() make them: through EMC_Bank_Ptr[], counting in EMC_Bank_Accesses[] and
+//      EMC_Bank_Generation[], and banks a pointer is about to reach are asked for in EMC_Bank_Wanted.
+//      Each case checks which banks end up in the cache after calls to emc_cache_rebalance(), that
+//      the ISR is never left a PSRAM address, and that no data is lost as banks move.
+//
+//          make -C tools/bus_sim check
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+#include "sim_config.h"
+
+extern "C" uint8_t external_psram_size;
+extern uint32_t   m_emc_ptr1, m_emc_ptr2;
+
+static uint8_t  *cache_slot[EMC_CACHE_BANKS];               //  The cache slots, found from the initial mapping
+static int      failures;
+
+static void check(bool ok, const char *what)
+{
+  printf("  %s  %s\n", ok ? "pass" : "FAIL", what);
+  if (!ok) failures++;
+}
+
+static void setup_emc(int num_banks, int psram_mb)
+{
+  int     slot;
+
+  sim_config.emc_start_bank = 4;
+  sim_config.emc_num_banks  = num_banks;
+  sim_config.emc_psram      = true;
+  external_psram_size       = psram_mb;
+  m_emc_ptr1                = 0;                            //  Below EMC, so no bank is near a pointer
+  m_emc_ptr2                = 0;
+  emc_cache_init();
+  for (slot = 0 ; slot < EMC_CACHE_BANKS ; slot++)
+  {
+    cache_slot[slot] = EMC_Bank_Ptr[slot];
+  }
+}
+
+static bool is_cached(int bank)
+{
+  int     slot;
+
+  for (slot = 0 ; slot < EMC_CACHE_BANKS ; slot++)
+  {
+    if (EMC_Bank_Ptr[bank] == cache_slot[slot]) return true;
+  }
+  return false;
+}
+
+//
+//  As emc_w() and emc_r() do it
+//
+
+static void isr_write(int bank, int offset, uint8_t val)
+{
+  EMC_Bank_Ptr[bank][offset] = val;
+  EMC_Bank_Generation[bank]++;
+  EMC_Bank_Accesses[bank]++;
+}
+
+static uint8_t isr_read(int bank, int offset)
+{
+  EMC_Bank_Accesses[bank]++;
+  return EMC_Bank_Ptr[bank][offset];
+}
+
+static void touch(int bank, int count)
+{
+  while (count--) isr_read(bank, count & (EMC_BANK_SIZE - 1));
+}
+
+static uint8_t pattern(int bank, int offset)
+{
+  return (uint8_t)(bank * 37 + offset * 11 + (offset >> 8));
+}
+
+static void want(int bank)
+{
+  EMC_Bank_Wanted |= 1U << bank;
+}
+
+static bool only_cache_mapped(void)
+{
+  int     bank;
+
+  for (bank = 0 ; bank < EMC_MAX_BANKS ; bank++)
+  {
+    if ((EMC_Bank_Ptr[bank] != NULL) && !is_cached(bank)) return false;
+  }
+  return true;
+}
+
+static void fill_all(int num_banks)
+{
+  int     bank, offset;
+
+  for (bank = 0 ; bank < num_banks ; bank++)
+  {
+    for (offset = 0 ; offset < EMC_BANK_SIZE ; offset++)
+    {
+      emc_cache_bank_data(bank)[offset] = pattern(bank, offset);
+      EMC_Bank_Generation[bank]++;
+    }
+  }
+}
+
+static bool verify_all(int num_banks)
+{
+  int     bank, offset;
+
+  for (bank = 0 ; bank < num_banks ; bank++)
+  {
+    for (offset = 0 ; offset < EMC_BANK_SIZE ; offset++)
+    {
+      if (emc_cache_bank_data(bank)[offset] != pattern(bank, offset)) return false;
+    }
+  }
+  return true;
+}
+
+static int cached_count(int num_banks)
+{
+  int     bank, count = 0;
+
+  for (bank = 0 ; bank < num_banks ; bank++)
+  {
+    if (is_cached(bank)) count++;
+  }
+  return count;
+}
+
+static void test_fits_in_cache(void)
+{
+  int     bank;
+
+  printf("Configuration that fits in the cache\n");
+  setup_emc(EMC_CACHE_BANKS, 8);
+  check(cached_count(EMC_CACHE_BANKS) == EMC_CACHE_BANKS, "all banks start out cached");
+  fill_all(EMC_CACHE_BANKS);
+  for (bank = 0 ; bank < EMC_CACHE_BANKS ; bank++) touch(bank, 1000);
+  emc_cache_rebalance();
+  check(cached_count(EMC_CACHE_BANKS) == EMC_CACHE_BANKS, "still all cached after a rebalance");
+  check(verify_all(EMC_CACHE_BANKS), "data intact");
+}
+
+static void test_fetch(void)
+{
+  int     bank;
+
+  printf("A wanted bank is fetched, the least recently used is evicted\n");
+  setup_emc(EMC_MAX_BANKS, 8);
+  check(cached_count(EMC_MAX_BANKS) == EMC_CACHE_BANKS, "first banks start out cached");
+  check(EMC_Bank_Ptr[20] == NULL, "bank 20 starts in PSRAM, not mapped for the ISR");
+  fill_all(EMC_MAX_BANKS);
+
+  for (bank = 0 ; bank < EMC_CACHE_BANKS ; bank++)
+  {
+    if (bank != 5) touch(bank, 10);
+  }
+  want(20);
+  emc_cache_rebalance();
+  check(is_cached(20), "bank 20 fetched");
+  check(EMC_Bank_Wanted == 0, "nothing still wanted, so HALT is released");
+  check(!is_cached(5), "bank 5, the only idle cached bank, evicted");
+  check(cached_count(EMC_MAX_BANKS) == EMC_CACHE_BANKS, "cache still full");
+  check(only_cache_mapped(), "the ISR only sees cache slots");
+  check(verify_all(EMC_MAX_BANKS), "data intact, bank 5 was written back");
+
+  isr_write(20, 1234, 0x5A);
+  emc_cache_rebalance();
+  for (bank = 0 ; bank < EMC_CACHE_BANKS ; bank++)
+  {
+    if (bank != 5) touch(bank, 10);
+  }
+  want(21);
+  emc_cache_rebalance();
+  check(is_cached(21) && !is_cached(20), "bank 21 replaced bank 20, which was used least recently");
+  check(emc_cache_bank_data(20)[1234] == 0x5A, "write to bank 20 while cached survived eviction");
+  emc_cache_bank_data(20)[1234] = pattern(20, 1234);
+  check(verify_all(EMC_MAX_BANKS), "all other data intact");
+}
+
+static void test_not_wanted(void)
+{
+  int     bank;
+
+  printf("Nothing moves unless a bank is wanted\n");
+  setup_emc(EMC_MAX_BANKS, 8);
+  for (bank = 0 ; bank < EMC_CACHE_BANKS ; bank++) touch(bank, (bank == 2) ? 0 : 1000);
+  emc_cache_rebalance();
+  emc_cache_rebalance();
+  check(cached_count(EMC_CACHE_BANKS) == EMC_CACHE_BANKS, "original banks all still cached");
+}
+
+static void test_pointer_banks_kept(void)
+{
+  int     bank;
+
+  printf("A bank near a pointer is not evicted\n");
+  setup_emc(EMC_MAX_BANKS, 8);
+  emc_cache_rebalance();
+  for (bank = 1 ; bank < EMC_CACHE_BANKS ; bank++) touch(bank, 10);
+  m_emc_ptr2 = get_EMC_StartAddress() + 100;                //  In bank 0, the least recently used
+  want(22);
+  emc_cache_rebalance();
+  check(is_cached(22), "bank 22 fetched");
+  check(is_cached(0), "bank 0, which PTR2 points into, kept");
+  check(cached_count(EMC_MAX_BANKS) == EMC_CACHE_BANKS, "cache still full");
+}
+
+static void test_several_wanted(void)
+{
+  printf("Several wanted banks in one poll\n");
+  setup_emc(EMC_MAX_BANKS, 8);
+  want(10);
+  want(11);
+  want(30);
+  emc_cache_rebalance();
+  check(is_cached(10) && is_cached(11) && is_cached(30), "banks 10, 11 and 30 fetched");
+  check(EMC_Bank_Wanted == 0, "nothing still wanted");
+  check(cached_count(EMC_MAX_BANKS) == EMC_CACHE_BANKS, "cache still full");
+}
+
+static void test_no_psram(void)
+{
+  int     bank;
+
+  printf("No PSRAM\n");
+  setup_emc(EMC_MAX_BANKS, 0);
+  check(cached_count(EMC_CACHE_BANKS) == EMC_CACHE_BANKS, "EMC_CACHE_BANKS banks, all cached");
+  check(EMC_Bank_Ptr[EMC_CACHE_BANKS] == NULL, "banks beyond the cache are not mapped");
+  fill_all(EMC_CACHE_BANKS);
+  for (bank = 0 ; bank < EMC_CACHE_BANKS ; bank++) touch(bank, (bank == 3) ? 0 : 1000);
+  emc_cache_rebalance();
+  check(cached_count(EMC_CACHE_BANKS) == EMC_CACHE_BANKS, "nothing moves");
+  check(verify_all(EMC_CACHE_BANKS), "data intact");
+}
+
+int main(void)
+{
+  test_fits_in_cache();
+  test_fetch();
+  test_not_wanted();
+  test_pointer_banks_kept();
+  test_several_wanted();
+  test_no_psram();
+  printf("\n%s, %d failures\n", failures ? "FAILED" : "PASSED", failures);
+  return failures ? 1 : 0;
+}
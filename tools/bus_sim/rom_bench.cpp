@@ -0,0 +1,163 @@
+//
+//      rom_bench     Host benchmark of bank switched ROM fetches
+//
+//      ROM fetches are the most frequent bus cycle that EBTKS serves while an option ROM is
+//      running, so this compares the host cost per fetch of two ways of finding the byte:
+//
+//        legacy       The original readBankRom(): test rselec against the AUXROM ID range, then
+//                     the RAM window bounds, then currRom. Copied here for reference
+//        page table   The busReadPages[] lookup that onReadData() does, with the pages that
+//                     mapRomPages() builds from the bank descriptor
+//
+//      Each is run with a normal ROM and with an AUXROM selected, over the same mix of fetches
+//      (mostly sequential code, with some AUXROM RAM window reads). Host cycles are not Teensy
+//      cycles, but the ratios are a useful guide.
+//
+//          make -C tools/bus_sim bench
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+
+#include "Inc_Common_Headers.h"
+
+extern ioWriteFuncPtr_t ioWriteFuncs[256];
+
+#define NUM_FETCHES         (1 << 16)           //  Length of the address pattern, a power of 2
+#define NUM_PASSES          (200)
+
+static uint16_t   fetch_addr[NUM_FETCHES];      //  Addresses relative to the ROM page, 000000..017777
+
+//
+//  Baseline implementation, for comparison. State is a copy of what ioWriteRSELEC() used to keep
+//
+
+static volatile uint8_t legacy_rselec;
+static uint8_t          *legacy_currRom;
+
+__attribute__((noinline)) static bool legacy_readBankRom(uint16_t addr)
+{
+  if ((legacy_rselec >= AUXROM_PRIMARY_ID) && (legacy_rselec <= AUXROM_SECONDARY_ID_END))
+  {
+    if ((addr >= AUXROM_RAM_WINDOW_START) && (addr <= AUXROM_RAM_WINDOW_LAST))
+    {
+      readData = AUXROM_RAM_Window.as_bytes[addr - AUXROM_RAM_WINDOW_START];
+      return true;
+    }
+  }
+  if (legacy_currRom)
+  {
+    readData = legacy_currRom[addr];
+    return true;
+  }
+  return false;
+}
+
+__attribute__((noinline)) static bool page_table_read(uint16_t addr)
+{
+  uint8_t   *page;
+
+  addr += ROM_PAGE;
+  if ((page = busReadPages[addr >> 8]) != NULL)
+  {
+    readData = page[addr & 0x00FFU];
+    return true;
+  }
+  return false;
+}
+
+static void make_fetch_pattern(void)
+{
+  uint32_t  seed = 12345;
+  uint16_t  pc = 0;
+  int       i;
+
+  for (i = 0 ; i < NUM_FETCHES ; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    if ((seed >> 24) < 16)                                            //  About 6% RAM window accesses
+    {
+      fetch_addr[i] = AUXROM_RAM_WINDOW_START + ((seed >> 8) % AUXROM_RAM_WINDOW_SIZE);
+      continue;
+    }
+    if ((seed >> 24) < 32)                                            //  and 6% jumps
+    {
+      pc = (seed >> 8) % AUXROM_RAM_WINDOW_START;
+    }
+    fetch_addr[i] = pc++ & (AUXROM_RAM_WINDOW_START - 1);             //  Code lives below the window
+  }
+}
+
+static double run(bool (*read_func)(uint16_t), uint32_t *checksum)
+{
+  uint32_t  t0, t1;
+  uint64_t  total = 0;
+  uint32_t  sum = 0;
+  int       pass, i;
+
+  for (pass = 0 ; pass < NUM_PASSES ; pass++)
+  {
+    t0 = ARM_DWT_CYCCNT;
+    for (i = 0 ; i < NUM_FETCHES ; i++)
+    {
+      if (read_func(fetch_addr[i]))
+      {
+        sum += readData;
+      }
+    }
+    t1 = ARM_DWT_CYCCNT;
+    total += (uint32_t)(t1 - t0);
+  }
+  *checksum = sum;
+  return (double)total / ((double)NUM_PASSES * NUM_FETCHES);
+}
+
+static void bench(uint8_t id, const char *description)
+{
+  uint32_t  sum_legacy, sum_pages;
+  double    legacy, pages;
+
+  (ioWriteFuncs[RSELEC & 0xFF])(id);
+  legacy_rselec  = id;
+  legacy_currRom = getROMEntry(id);
+
+  legacy     = run(legacy_readBankRom,     &sum_legacy);
+  pages      = run(page_table_read,        &sum_pages);
+
+  printf("%-12s %03o  %10.2f  %10.2f   %s\n", description, id, legacy, pages,
+         (sum_legacy == sum_pages) ? "same data" : "DATA MISMATCH");
+}
+
+int main(void)
+{
+  uint8_t   *slot;
+  int       i;
+
+  initIOfuncTable();
+  initRoms();
+
+  //
+  //  A normal ROM (ID 0320) and a primary AUXROM (ID 0361), filled with a pattern, and a RAM window
+  //  with different contents, so any mix up shows in the checksums
+  //
+
+  slot = getRomSlotPtr(0);
+  for (i = 0 ; i < ROM_PAGE_SIZE ; i++) slot[i] = i * 7;
+  slot[0] = 0320;
+  setRomMap(0320, 0);
+
+  slot = getRomSlotPtr(1);
+  for (i = 0 ; i < ROM_PAGE_SIZE ; i++) slot[i] = i * 13;
+  slot[0] = 0361;
+  setRomMap(0361, 1);
+
+  for (i = 0 ; i < AUXROM_RAM_WINDOW_SIZE ; i++) AUXROM_RAM_Window.as_bytes[i] = i ^ 0x55;
+
+  make_fetch_pattern();
+
+  printf("Host cycles per ROM fetch, %d fetches x %d passes\n\n", NUM_FETCHES, NUM_PASSES);
+  printf("Bank          ID      legacy  page table\n");
+  bench(0320, "Option ROM");
+  bench(0361, "AUXROM");
+  return 0;
+}
@@ -0,0 +1,157 @@
+//
+//      Host (Linux) stand-in for the Teensy 4.1 Arduino core, used only by the bus cycle simulator
+//      in tools/bus_sim. It provides just enough of the core for EBTKS_Bus_Interface_ISR.cpp and
+//      EBTKS_Bank_Switched_ROM.cpp to compile unmodified against a simulated GPIO layer.
+//
+//      The GPIO registers that the EBTKS.h macros reference (GPIOn_DR, _DR_SET, _DR_CLEAR,
+//      _DR_TOGGLE, _GDIR, _PSR, _ISR, _IMR) are mapped onto Sim_GPIO structs. The pad status
+//      registers (PSR) are written by the simulator to present a bus cycle, and the data
+//      registers (DR) are read back to see what EBTKS drove.
+//
+//      Nothing here is used by the firmware build.
+//
+
+#ifndef EBTKS_SIM_ARDUINO_H
+#define EBTKS_SIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+//
+//  Memory placement attributes have no meaning on the host
+//
+
+#define FASTRUN
+#define DMAMEM
+#define EXTMEM
+#define PROGMEM
+
+//
+//  The firmware declares pinChange_isr() with __attribute__ ((interrupt ("IRQ"))) which is an
+//  ARM attribute. On x86 the interrupt attribute means something else entirely, so remove it.
+//
+
+#define interrupt(x)
+
+//
+//  Simulated GPIO register block. Only the registers EBTKS.h uses are modelled
+//
+
+struct Sim_GPIO
+{
+  volatile uint32_t   DR;
+  volatile uint32_t   GDIR;
+  volatile uint32_t   PSR;
+  volatile uint32_t   ISR;
+  volatile uint32_t   IMR;
+};
+
+extern Sim_GPIO sim_gpio6, sim_gpio7, sim_gpio8, sim_gpio9;
+
+//
+//  The _SET, _CLEAR and _TOGGLE registers are write only aliases that modify DR. These little
+//  proxies make "GPIO6_DR_SET = mask" behave the same way it does on the i.MX RT1062
+//
+
+struct Sim_DR_Set     { Sim_GPIO &g; void operator=(uint32_t v) const { g.DR = g.DR |  v; } };
+struct Sim_DR_Clear   { Sim_GPIO &g; void operator=(uint32_t v) const { g.DR = g.DR & ~v; } };
+struct Sim_DR_Toggle  { Sim_GPIO &g; void operator=(uint32_t v) const { g.DR = g.DR ^  v; } };
+
+#define GPIO6_DR              (sim_gpio6.DR)
+#define GPIO7_DR              (sim_gpio7.DR)
+#define GPIO8_DR              (sim_gpio8.DR)
+#define GPIO9_DR              (sim_gpio9.DR)
+#define GPIO6_DR_SET          (Sim_DR_Set{sim_gpio6})
+#define GPIO7_DR_SET          (Sim_DR_Set{sim_gpio7})
+#define GPIO8_DR_SET          (Sim_DR_Set{sim_gpio8})
+#define GPIO9_DR_SET          (Sim_DR_Set{sim_gpio9})
+#define GPIO6_DR_CLEAR        (Sim_DR_Clear{sim_gpio6})
+#define GPIO7_DR_CLEAR        (Sim_DR_Clear{sim_gpio7})
+#define GPIO8_DR_CLEAR        (Sim_DR_Clear{sim_gpio8})
+#define GPIO9_DR_CLEAR        (Sim_DR_Clear{sim_gpio9})
+#define GPIO6_DR_TOGGLE       (Sim_DR_Toggle{sim_gpio6})
+#define GPIO7_DR_TOGGLE       (Sim_DR_Toggle{sim_gpio7})
+#define GPIO8_DR_TOGGLE       (Sim_DR_Toggle{sim_gpio8})
+#define GPIO9_DR_TOGGLE       (Sim_DR_Toggle{sim_gpio9})
+#define GPIO6_GDIR            (sim_gpio6.GDIR)
+#define GPIO7_GDIR            (sim_gpio7.GDIR)
+#define GPIO8_GDIR            (sim_gpio8.GDIR)
+#define GPIO9_GDIR            (sim_gpio9.GDIR)
+#define GPIO6_PSR             (sim_gpio6.PSR)
+#define GPIO7_PSR             (sim_gpio7.PSR)
+#define GPIO8_PSR             (sim_gpio8.PSR)
+#define GPIO9_PSR             (sim_gpio9.PSR)
+#define GPIO6_ISR             (sim_gpio6.ISR)
+#define GPIO6_IMR             (sim_gpio6.IMR)
+
+//
+//  Cortex-M7 core registers and NVIC. The cycle counter is backed by the host time stamp counter
+//
+
+uint32_t sim_read_cycle_counter(void);
+#define ARM_DWT_CYCCNT        (sim_read_cycle_counter())
+
+extern uint32_t sim_SCB_AIRCR, sim_SCB_ICSR;
+#define SCB_AIRCR             (sim_SCB_AIRCR)
+#define SCB_ICSR              (sim_SCB_ICSR)
+
+#define IRQ_GPIO6789          (157)
+#define NVIC_ENABLE_IRQ(n)    ((void)(n))
+#define NVIC_DISABLE_IRQ(n)   ((void)(n))
+#define NVIC_CLEAR_PENDING(n) ((void)(n))
+#define NVIC_SET_PRIORITY(n, p)   ((void)(n), (void)(p))
+
+#define __disable_irq()       do {} while(0)
+#define __enable_irq()        do {} while(0)
+#define noInterrupts()        do {} while(0)
+#define interrupts()          do {} while(0)
+
+#define RISING                (3)
+#define FALLING               (2)
+#define CHANGE                (4)
+#define INPUT                 (0)
+#define OUTPUT                (1)
+#define HIGH                  (1)
+#define LOW                   (0)
+
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode);
+void attachInterruptVector(int irq, void (*function)(void));
+void pinMode(uint8_t pin, uint8_t mode);
+void delayNanoseconds(uint32_t nsec);
+void delayMicroseconds(uint32_t usec);
+void delay(uint32_t msec);
+uint32_t millis(void);
+uint32_t micros(void);
+
+//
+//  The simulator records whichever vector the firmware installs with attachInterruptVector()
+//  and calls it once per simulated bus cycle
+//
+
+extern void (*sim_installed_isr)(void);
+
+//
+//  Minimal Serial, so that diagnostic Serial.printf() calls in the compiled modules still work
+//
+
+class Sim_Serial
+{
+  public:
+    int  printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    void flush(void);
+    void begin(uint32_t baud);
+    int  available(void);
+    int  read(void);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buf, size_t n);
+    operator bool() const { return true; }
+};
+
+extern Sim_Serial Serial;
+
+#endif
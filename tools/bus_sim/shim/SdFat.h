@@ -0,0 +1,49 @@
+//
+//      Host stand-in for the SdFat library, used only by tools/bus_sim. The bus interface code does
+//      not touch the SD Card, but EBTKS_Global_Data.h and EBTKS_Tape_Drive.h declare objects of
+//      these types, so empty shells are enough.
+//
+
+#ifndef EBTKS_SIM_SDFAT_H
+#define EBTKS_SIM_SDFAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILE_READ     (0)
+#define FILE_WRITE    (1)
+#define O_RDONLY      (0)
+#define O_RDWR        (2)
+#define O_CREAT       (0x40)
+#define O_TRUNC       (0x200)
+#define O_APPEND      (0x400)
+
+class FsFile
+{
+  public:
+    bool     open(const char *, int = 0)          { return false; }
+    bool     close(void)                          { return true; }
+    int      read(void)                           { return -1; }
+    int      read(void *, size_t)                 { return -1; }
+    size_t   write(const void *, size_t)          { return 0; }
+    size_t   write(uint8_t)                       { return 0; }
+    bool     seek(uint64_t)                       { return false; }
+    bool     seekSet(uint64_t)                    { return false; }
+    uint64_t size(void)                           { return 0; }
+    uint64_t curPosition(void)                    { return 0; }
+    bool     preAllocate(uint64_t)                { return false; }
+    void     flush(void)                          { }
+    bool     sync(void)                           { return true; }
+    bool     isOpen(void)                         { return false; }
+    operator bool() const                         { return false; }
+};
+
+class SdFs
+{
+  public:
+    FsFile   open(const char *, int = 0)          { return FsFile(); }
+    bool     exists(const char *)                 { return false; }
+    bool     remove(const char *)                 { return false; }
+};
+
+#endif
@@ -0,0 +1,9 @@
+//
+//  Host stand-in for the Teensy pgmspace.h, for Base64.h. PROGMEM comes from shim/Arduino.h
+//
+
+#pragma once
+
+#include <stdint.h>
+
+#define pgm_read_byte(addr)   (*(const uint8_t *)(addr))
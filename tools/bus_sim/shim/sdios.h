@@ -0,0 +1,3 @@
+//
+//      Host stand-in for the SdFat sdios.h header. Nothing from it is needed by the bus simulator.
+//
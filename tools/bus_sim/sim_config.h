@@ -0,0 +1,20 @@
+//
+//      Simulated configuration for tools/bus_sim. This replaces the parameters that the firmware
+//      reads from CONFIG.TXT (see EBTKS_SD.cpp)
+//
+
+#ifndef EBTKS_SIM_CONFIG_H
+#define EBTKS_SIM_CONFIG_H
+
+struct Sim_Config
+{
+  int       machine;                    //  One of enum machine_numbers in EBTKS.h
+  int       emc_start_bank;
+  int       emc_num_banks;              //  0 disables EMC
+  bool      emc_psram;                  //  "PSRAM" in the EMC section
+  int64_t   delay_ns_requested;         //  Sum of all EBTKS_delay_ns() calls
+};
+
+extern struct Sim_Config sim_config;
+
+#endif
@@ -0,0 +1,162 @@
+//
+//      Host stand-ins for everything the bus interface code links against that is not part of
+//      the bus interface itself: the Teensy core functions declared in shim/Arduino.h, the
+//      configuration getters normally provided by EBTKS_SD.cpp, EBTKS_delay_ns() from
+//      EBTKS_Utilities.cpp, and allocation of the shared globals.
+//
+//      The machine and EMC configuration that would normally come from CONFIG.TXT lives in
+//      sim_config, and is set from the bus_sim command line.
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//  As in EBTKS.cpp, this file is the one compilation unit that allocates the globals
+#define ALLOCATE  1
+
+#include "Inc_Common_Headers.h"
+#include "sim_config.h"
+
+struct Sim_Config sim_config;
+
+Sim_GPIO sim_gpio6, sim_gpio7, sim_gpio8, sim_gpio9;
+uint32_t sim_SCB_AIRCR, sim_SCB_ICSR;
+void (*sim_installed_isr)(void);
+Sim_Serial Serial;
+
+extern "C"
+{
+  volatile uint32_t systick_millis_count;
+  volatile uint32_t systick_cycle_count;
+  uint8_t external_psram_size = 8;              //  MB, as on an EBTKS with one PSRAM chip
+}
+
+//
+//  The rest of the firmware defines these, the bus interface only needs them to exist
+//
+
+volatile bool writeCRTflag;
+bool badFlag;
+uint16_t badAddr;
+bool sadFlag;
+uint16_t sadAddr;
+
+Tape::Tape() {}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  Teensy core stand-ins
+
+uint32_t sim_read_cycle_counter(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return (uint32_t)__rdtsc();
+#else
+  struct timespec   ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+void attachInterrupt(uint8_t pin, void (*function)(void), int mode)
+{
+  (void)pin; (void)function; (void)mode;
+}
+
+void attachInterruptVector(int irq, void (*function)(void))
+{
+  if (irq == IRQ_GPIO6789)
+  {
+    sim_installed_isr = function;
+  }
+}
+
+void pinMode(uint8_t pin, uint8_t mode)       { (void)pin; (void)mode; }
+void delayNanoseconds(uint32_t nsec)          { (void)nsec; }
+void delayMicroseconds(uint32_t usec)         { (void)usec; }
+void delay(uint32_t msec)                     { (void)msec; }
+uint32_t millis(void)                         { return systick_millis_count; }
+uint32_t micros(void)                         { return systick_millis_count * 1000; }
+
+int Sim_Serial::printf(const char *format, ...)
+{
+  va_list   args;
+  int       result;
+
+  va_start(args, format);
+  result = vprintf(format, args);
+  va_end(args);
+  return result;
+}
+
+void   Sim_Serial::flush(void)                          { fflush(stdout); }
+void   Sim_Serial::begin(uint32_t baud)                 { (void)baud; }
+int    Sim_Serial::available(void)                      { return 0; }
+int    Sim_Serial::read(void)                           { return -1; }
+size_t Sim_Serial::write(uint8_t c)                     { return fwrite(&c, 1, 1, stdout); }
+size_t Sim_Serial::write(const uint8_t *buf, size_t n)  { return fwrite(buf, 1, n, stdout); }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////  EBTKS stand-ins
+
+//
+//  The ISR busy waits 222 ns between onPhi_1_Fall() and mid_cycle_processing(). On the host
+//  that is just noise in the measurement, so it is not reproduced. The requested time is
+//  accumulated so the report can show how much of the ISR is deliberate delay.
+//
+
+void EBTKS_delay_ns(int32_t count)
+{
+  sim_config.delay_ns_requested += count;
+}
+
+int get_machineNum(void)
+{
+  return sim_config.machine;
+}
+
+//
+//  The host has no EXTMEM section, so any PSRAM size holds it
+//
+
+bool PSRAM_Holds_EXTMEM(void)
+{
+  return external_psram_size != 0;
+}
+
+#if ENABLE_EMC_SUPPORT
+bool get_EMC_Enable(void)
+{
+  return sim_config.emc_num_banks != 0;
+}
+
+int get_EMC_NumBanks(void)
+{
+  return sim_config.emc_num_banks;
+}
+
+int get_EMC_StartBank(void)
+{
+  return sim_config.emc_start_bank;
+}
+
+bool get_EMC_PSRAM(void)
+{
+  return sim_config.emc_psram && PSRAM_Holds_EXTMEM();
+}
+
+int get_EMC_StartAddress(void)
+{
+  return sim_config.emc_start_bank << 15;
+}
+
+int get_EMC_EndAddress(void)
+{
+  return (sim_config.emc_start_bank << 15) + (sim_config.emc_num_banks << 15) - 1;
+}
+
+bool get_EMC_master(void)
+{
+  return sim_config.machine == MACH_HP85AEMC;
+}
+#endif
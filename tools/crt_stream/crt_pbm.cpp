@@ -0,0 +1,40 @@
+//
+//      Renders a rebuilt screen to a PBM (P4) file, with the firmware's renderer (../../src/EBTKS_CRT_Render.cpp,
+//      built against the ../bus_sim shim), so the image is what "screenshot" on the EBTKS would have written
+//
+
+#include <Arduino.h>
+
+#include "Inc_Common_Headers.h"
+#include "crt_stream.h"
+
+bool            Is8687;                                     //  Normally in EBTKS_CRT.cpp. CRT_Get_Geometry() reads it
+
+bool stream_write_pbm(const Stream_Screen *screen, const char *name)
+{
+  static video_capt_t     capture;
+  struct S_CRT_Geometry   geometry;
+  static uint8_t          row[80];
+  uint32_t                width, height, y;
+  FILE                    *out;
+
+  memset(&capture, 0, sizeof(capture));
+  memcpy(capture.vram, screen->vram, screen->vram_size);
+  capture.sadAddr = screen->sad;
+  capture.ctrl    = screen->ctrl;
+  Is8687 = (screen->flags & CRT_STREAM_8687) != 0;
+  CRT_Get_Geometry(&capture, &geometry);
+  CRT_Render_Size(&geometry, &width, &height);
+
+  if (!(out = fopen(name, "wb")))
+  {
+    return false;
+  }
+  fprintf(out, "P4\n# EBTKS %s %s\n%u %u\n", Is8687 ? "HP87" : "HP85", geometry.graphics ? "graphics" : "alpha", width, height);
+  for (y = 0 ; y < height ; y++)
+  {
+    CRT_Render_Rows(&capture, &geometry, y, 1, row);
+    fwrite(row, 1, width / 8, out);
+  }
+  return (fclose(out) == 0);
+}
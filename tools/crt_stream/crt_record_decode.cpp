@@ -0,0 +1,191 @@
+//
+//      Playback of CRT recordings, see crt_stream.h and ../../src/EBTKS_CRT_Record.cpp
+//
+
+#include <string.h>
+
+#include "crt_stream.h"
+
+static uint32_t get16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool get_leb128(Record_Replay *replay, uint32_t *value)
+{
+  uint32_t    shift = 0;
+  uint8_t     byte;
+
+  *value = 0;
+  do
+  {
+    if (replay->pos >= replay->length || shift > 28)
+    {
+      return false;
+    }
+    byte = replay->data[replay->pos++];
+    *value |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return true;
+}
+
+const char *record_begin(Record_Replay *replay, const uint8_t *data, size_t length)
+{
+  uint32_t    vram_size;
+  uint8_t     flags;
+
+  memset(replay, 0, sizeof(*replay));
+  if (length < CRT_RECORD_HEADER_LENGTH || memcmp(data, "EBTKSCRT", 8) != 0)
+  {
+    return "not a CRT recording";
+  }
+  if (get16(&data[8]) != 1 || get16(&data[10]) != CRT_RECORD_HEADER_LENGTH)
+  {
+    return "unknown format version";
+  }
+  vram_size = get16(&data[20]);
+  flags     = data[29];
+  if ((vram_size != 8192 && vram_size != 16384) || length < CRT_RECORD_HEADER_LENGTH + vram_size)
+  {
+    return "bad vram size, or the file is truncated";
+  }
+  replay->rate     = get32(&data[12]);
+  replay->sad      = get16(&data[22]);
+  replay->bad      = get16(&data[24]);
+  replay->sad_high = (flags & CRT_RECORD_SAD_HIGH) != 0;
+  replay->bad_high = (flags & CRT_RECORD_BAD_HIGH) != 0;
+  replay->screen.vram_size = vram_size;
+  replay->screen.sad       = get16(&data[26]);
+  replay->screen.ctrl      = data[28];
+  replay->screen.flags     = (flags & CRT_RECORD_8687) ? CRT_STREAM_8687 : 0;
+  replay->screen.complete  = true;
+  memcpy(replay->screen.vram, &data[CRT_RECORD_HEADER_LENGTH], vram_size);
+  if (replay->rate == 0)
+  {
+    return "cycle counter rate is 0";
+  }
+  replay->data   = data;
+  replay->length = length;
+  replay->pos    = CRT_RECORD_HEADER_LENGTH + vram_size;
+  return NULL;
+}
+
+int record_next(Record_Replay *replay, Record_Event *event, const char **error)
+{
+  uint32_t    delta;
+
+  *error = "recording is truncated";
+  if (replay->pos >= replay->length)
+  {
+    return 0;                                               //  No end code, as when the EBTKS was switched off
+  }
+  memset(event, 0, sizeof(*event));
+  event->code = replay->data[replay->pos++];
+  switch (event->code)
+  {
+    case RECORD_SAD:
+    case RECORD_BAD:
+    case RECORD_CTRL:
+    case RECORD_DAT:
+      if (replay->pos >= replay->length)
+      {
+        return -1;
+      }
+      event->val = replay->data[replay->pos++];
+      if (!get_leb128(replay, &delta))
+      {
+        return -1;
+      }
+      replay->cycles += delta;
+      replay->events++;
+      return 1;
+    case CRT_RECORD_LOST:
+      if (!get_leb128(replay, &event->count))
+      {
+        return -1;
+      }
+      replay->lost += event->count;
+      return 1;
+    case CRT_RECORD_GAP:
+      if (!get_leb128(replay, &event->count))
+      {
+        return -1;
+      }
+      replay->cycles += (uint64_t)event->count * replay->rate / 1000;
+      replay->gaps++;
+      return 1;
+    case CRT_RECORD_END:
+      return 0;
+    default:
+      *error = "unknown event code";
+      return -1;
+  }
+}
+
+//
+//  As ioWriteCrt*() (HP83/85/9915) and ioWrite8687Crt*() in EBTKS_CRT.cpp
+//
+
+void record_apply(Record_Replay *replay, const Record_Event *event)
+{
+  Stream_Screen   *screen = &replay->screen;
+  uint32_t        index;
+
+  switch (event->code)
+  {
+    case RECORD_SAD:
+      if (replay->sad_high)
+      {
+        replay->sad = (replay->sad | (event->val << 8)) & 037777;
+        screen->sad = replay->sad;
+      }
+      else
+      {
+        replay->sad = event->val;
+      }
+      replay->sad_high = !replay->sad_high;
+      break;
+    case RECORD_BAD:
+      if (replay->bad_high)
+      {
+        replay->bad = (replay->bad | (event->val << 8)) & 037777;
+      }
+      else
+      {
+        replay->bad = event->val;
+      }
+      replay->bad_high = !replay->bad_high;
+      break;
+    case RECORD_CTRL:
+      screen->ctrl = event->val;
+      break;
+    case RECORD_DAT:
+      if (screen->flags & CRT_STREAM_8687)
+      {
+        screen->vram[replay->bad] = event->val;
+        replay->bad = (replay->bad + 1) & 037777;
+        break;
+      }
+      index = replay->bad >> 1;
+      if (replay->bad & 1)                                  //  Odd nibble address, the byte is split
+      {
+        screen->vram[index] = (screen->vram[index] & 0xF0) | (event->val >> 4);
+        if (index + 1 < sizeof(screen->vram))
+        {
+          screen->vram[index + 1] = (screen->vram[index + 1] & 0x0F) | (event->val << 4);
+        }
+      }
+      else
+      {
+        screen->vram[index] = event->val;
+      }
+      replay->bad = (replay->bad + 2) & 037777;
+      break;
+  }
+}
@@ -0,0 +1,186 @@
+//
+//      crt_replay    Host (Linux) playback of an EBTKS CRT recording
+//
+//      Plays back a file made by "crt record start" (see src/EBTKS_CRT_Record.cpp), and shows the screen as it
+//      was at regular times, or just at the end. Frames are only made when the screen changed since the last one.
+//
+//      Build and run (see Makefile in this directory):
+//
+//          make -C tools/crt_stream
+//          tools/crt_stream/crt_replay CRT_Record.bin                      final screen, and a summary
+//          tools/crt_stream/crt_replay -v CRT_Record.bin                   every register write, with its time
+//          tools/crt_stream/crt_replay -i 500 -a CRT_Record.bin            the alpha screen every 500 ms
+//          tools/crt_stream/crt_replay -i 100 -p frame CRT_Record.bin      frame_00001.pbm ... every 100 ms
+//
+//      The images are rendered as the EBTKS "screenshot" command does. To make an animation of them, with
+//      ImageMagick for example:
+//
+//          convert -delay 10 frame_*.pbm replay.gif
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "crt_stream.h"
+
+static const char *reg_names[] = { "SAD", "BAD", "CTRL", "DAT" };
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: crt_replay [-v] [-i ms] [-a] [-p prefix] [-o vram.bin] file\n"
+                  "    -v    print every event\n"
+                  "    -i    make a frame every ms milliseconds of recording, if the screen changed\n"
+                  "    -a    print the alpha screen for each frame\n"
+                  "    -p    write each frame as a PBM image, prefix_NNNNN.pbm\n"
+                  "    -o    write the final vram to a file\n");
+  exit(2);
+}
+
+static Record_Replay  replay;
+static Stream_Screen  last_frame;
+static uint32_t       frames;
+static bool           print_frames;
+static const char     *prefix;
+
+static double replay_ms(uint64_t cycles)
+{
+  return (double)cycles * 1000.0 / replay.rate;
+}
+
+//
+//  Print and/or write the screen, if it changed since the last frame. Returns false if the image can't be written
+//
+
+static bool frame(uint64_t cycles)
+{
+  char        name[1024];
+
+  if (frames && memcmp(&last_frame, &replay.screen, sizeof(last_frame)) == 0)
+  {
+    return true;
+  }
+  frames++;
+  last_frame = replay.screen;
+  if (print_frames)
+  {
+    printf("\nFrame %u at %.1f ms\n", frames, replay_ms(cycles));
+    stream_print_alpha(&replay.screen, stdout);
+  }
+  if (prefix)
+  {
+    snprintf(name, sizeof(name), "%s_%05u.pbm", prefix, frames);
+    if (!stream_write_pbm(&replay.screen, name))
+    {
+      perror(name);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t>  data;
+  Record_Event          event;
+  const char            *error, *output_name = NULL;
+  bool                  verbose = false;
+  uint64_t              next_frame = 0, interval = 0;
+  FILE                  *in, *out;
+  int                   opt, c, result;
+
+  while ((opt = getopt(argc, argv, "vi:ap:o:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'v': verbose = true;                               break;
+      case 'i': interval = strtoul(optarg, NULL, 10);         break;
+      case 'a': print_frames = true;                          break;
+      case 'p': prefix = optarg;                              break;
+      case 'o': output_name = optarg;                         break;
+      default:  usage();
+    }
+  }
+  if (optind != argc - 1)
+  {
+    usage();
+  }
+  if (!(in = fopen(argv[optind], "rb")))
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  while ((c = fgetc(in)) != EOF)
+  {
+    data.push_back(c);
+  }
+  fclose(in);
+
+  if ((error = record_begin(&replay, data.data(), data.size())))
+  {
+    fprintf(stderr, "%s: %s\n", argv[optind], error);
+    return 1;
+  }
+  printf("%s recording, cycle counter at %u MHz\n", (replay.screen.flags & CRT_STREAM_8687) ? "HP86/87" : "HP83/85",
+         replay.rate / 1000000);
+  interval = interval * replay.rate / 1000;                 //  ms to cycles
+
+  while ((result = record_next(&replay, &event, &error)) == 1)
+  {
+    //
+    //  A frame shows every write up to its time, so make the frames that are due before this event
+    //
+    while (interval && replay.cycles > next_frame)
+    {
+      if (!frame(next_frame))
+      {
+        return 1;
+      }
+      next_frame += interval;
+    }
+    if (verbose)
+    {
+      if (event.code == CRT_RECORD_LOST)
+      {
+        printf("%12.3f ms  %u events lost\n", replay_ms(replay.cycles), event.count);
+      }
+      else if (event.code == CRT_RECORD_GAP)
+      {
+        printf("%12.3f ms  gap of %u ms\n", replay_ms(replay.cycles), event.count);
+      }
+      else
+      {
+        printf("%12.3f ms  %-4s  %03o  %c\n", replay_ms(replay.cycles), reg_names[event.code], event.val,
+               (event.code == RECORD_DAT && (event.val & 0x7F) >= 0x20 && (event.val & 0x7F) < 0x7F) ? event.val & 0x7F : ' ');
+      }
+    }
+    record_apply(&replay, &event);
+  }
+  if (result < 0)
+  {
+    fprintf(stderr, "%s: %s, at offset %zu\n", argv[optind], error, replay.pos);
+  }
+  if ((interval || prefix) && !frame(replay.cycles))        //  The final screen
+  {
+    return 1;
+  }
+
+  printf("%u events over %.3f s, %u lost, %u gaps, %u frames\n", replay.events, replay_ms(replay.cycles) / 1000.0,
+         replay.lost, replay.gaps, frames);
+  if (!print_frames)
+  {
+    stream_print_alpha(&replay.screen, stdout);
+  }
+  if (output_name)
+  {
+    if (!(out = fopen(output_name, "wb")) || fwrite(replay.screen.vram, 1, replay.screen.vram_size, out) != replay.screen.vram_size)
+    {
+      perror(output_name);
+      return 1;
+    }
+    fclose(out);
+  }
+  return result < 0;
+}
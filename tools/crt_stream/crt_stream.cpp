@@ -0,0 +1,174 @@
+//
+//      crt_stream    Host (Linux) decoder for the EBTKS incremental screen stream
+//
+//      Reads frames from CRT_Stream_Frame() (see src/EBTKS_CRT_Stream.cpp), one per line, applies them in
+//      order, and prints the alpha screen they rebuild. Each line can be
+//
+//        {"hpDelta":{"seq":...,"frame":"..."}},CRC     A reply to "get_delta", as sent to the ESP32
+//        Base64                                        A line printed by "crt stream dump"
+//
+//      Anything else (other replies, terminal noise) is skipped. A frame that doesn't follow the last one
+//      applied, and isn't a keyframe, is reported and skipped, as the ESP32 would ask for a keyframe.
+//
+//      Build and run (see Makefile in this directory):
+//
+//          make -C tools/crt_stream
+//          tools/crt_stream/crt_stream capture.txt                 final screen
+//          tools/crt_stream/crt_stream -v -s capture.txt           every frame, and the screen after each
+//          tools/crt_stream/crt_stream -o vram.bin capture.txt     also write the rebuilt vram
+//          tools/crt_stream/crt_stream -p screen.pbm capture.txt   also write the final screen as an image
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "crt_stream.h"
+
+#define MAX_FRAME     (8192)
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: crt_stream [-v] [-s] [-o vram.bin] [-p screen.pbm] [file]\n"
+                  "    -v    print a line for each frame\n"
+                  "    -s    print the screen after each frame, not just at the end\n"
+                  "    -o    write the rebuilt vram to a file\n"
+                  "    -p    write the final screen, alpha or graphics, as a PBM image\n");
+  exit(2);
+}
+
+//
+//  The Base64 frame in a line, or an empty string
+//
+
+static std::string find_frame(const char *line)
+{
+  const char  *start, *end;
+
+  if ((start = strstr(line, "\"frame\":\"")))
+  {
+    start += 9;
+    if (!(end = strchr(start, '"')))
+    {
+      return "";
+    }
+    return std::string(start, end - start);
+  }
+  for (end = line ; *end && *end != '\r' && *end != '\n' ; end++)
+  {
+    if (!strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=", *end))
+    {
+      return "";
+    }
+  }
+  if (end - line < 20)                                      //  Shorter than any frame
+  {
+    return "";
+  }
+  return std::string(line, end - line);
+}
+
+int main(int argc, char **argv)
+{
+  static Stream_Screen  screen;
+  uint8_t               frame[MAX_FRAME];
+  char                  line[16384];
+  const char            *output_name = NULL, *image_name = NULL, *error;
+  bool                  verbose = false, every = false;
+  uint32_t              frames = 0, rejected = 0, frame_bytes = 0;
+  std::string           text;
+  long                  length;
+  FILE                  *in, *out;
+  int                   opt;
+
+  while ((opt = getopt(argc, argv, "vso:p:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'v': verbose = true;           break;
+      case 's': every = true;             break;
+      case 'o': output_name = optarg;     break;
+      case 'p': image_name = optarg;      break;
+      default:  usage();
+    }
+  }
+  if (optind < argc - 1)
+  {
+    usage();
+  }
+  in = stdin;
+  if (optind == argc - 1 && !(in = fopen(argv[optind], "r")))
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), in))
+  {
+    text = find_frame(line);
+    if (text.empty())
+    {
+      continue;
+    }
+    if ((length = base64_decode(text.c_str(), frame, sizeof(frame))) < 0)
+    {
+      fprintf(stderr, "Bad Base64, line skipped\n");
+      continue;
+    }
+    if ((error = stream_apply(&screen, frame, length)))
+    {
+      fprintf(stderr, "Frame skipped: %s\n", error);
+      rejected++;
+      continue;
+    }
+    frames++;
+    frame_bytes += length;
+    if (verbose)
+    {
+      printf("Frame %u%s%s, %ld bytes, %u runs, %u bytes of vram. SAD %06o CTRL %03o\n", screen.seq,
+             (screen.flags & CRT_STREAM_KEY) ? " key" : "", (screen.flags & CRT_STREAM_MORE) ? " more" : "",
+             length, screen.runs, screen.bytes, screen.sad, screen.ctrl);
+    }
+    if (every && screen.complete)
+    {
+      stream_print_alpha(&screen, stdout);
+      printf("\n");
+    }
+  }
+  if (in != stdin)
+  {
+    fclose(in);
+  }
+
+  if (frames == 0)
+  {
+    fprintf(stderr, "No frames found\n");
+    return 1;
+  }
+  printf("%u frames, %u bytes, average %u. %u skipped\n", frames, frame_bytes, frame_bytes / frames, rejected);
+  if (!screen.complete)
+  {
+    printf("The last keyframe is not complete\n");
+  }
+  if (!every)
+  {
+    stream_print_alpha(&screen, stdout);
+  }
+  if (output_name)
+  {
+    if (!(out = fopen(output_name, "wb")) || fwrite(screen.vram, 1, screen.vram_size, out) != screen.vram_size)
+    {
+      perror(output_name);
+      return 1;
+    }
+    fclose(out);
+  }
+  if (image_name && !stream_write_pbm(&screen, image_name))
+  {
+    perror(image_name);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+//
+//      Decoder for the incremental screen stream sent by CRT_Stream_Frame() in ../../src/EBTKS_CRT_Stream.cpp.
+//      The frame format is described there.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define CRT_STREAM_VERSION        (1)
+#define CRT_STREAM_HEADER_LENGTH  (14)
+#define CRT_STREAM_RUN_HEADER     (4)
+#define CRT_STREAM_RAW            (0x8000U)
+
+#define CRT_STREAM_KEY            (0x01)
+#define CRT_STREAM_8687           (0x02)
+#define CRT_STREAM_MORE           (0x04)
+
+//
+//  The peer's copy of the screen, as rebuilt from frames
+//
+
+struct Stream_Screen
+{
+  uint8_t     vram[16384];
+  uint32_t    vram_size;
+  uint32_t    sad;
+  uint8_t     ctrl;
+  uint8_t     flags;                      //  Of the last frame applied
+  uint32_t    seq;                        //  Last frame applied, 0 if none
+  bool        complete;                   //  A keyframe and everything after it, up to a frame without MORE
+  uint32_t    runs, bytes;                //  Of the last frame applied
+};
+
+//
+//  Returns the number of bytes written to out, or -1 if the data is bad or doesn't fit
+//
+
+long lzs_decode(const uint8_t *in, size_t length, uint8_t *out, size_t out_size);
+long base64_decode(const char *in, uint8_t *out, size_t out_size);
+
+//
+//  Apply one frame. Returns NULL, or what is wrong with the frame. A frame that isn't a keyframe
+//  and doesn't follow the last one applied is rejected, and the screen is left as it is
+//
+
+const char *stream_apply(Stream_Screen *screen, const uint8_t *frame, size_t length);
+
+void stream_print_alpha(const Stream_Screen *screen, FILE *out);
+
+//
+//  Write the screen as a PBM image, rendered as the firmware's "screenshot" would (crt_pbm.cpp). Returns false
+//  if the file can't be written
+//
+
+bool stream_write_pbm(const Stream_Screen *screen, const char *name);
+
+//
+//  Playback of a recording made by "crt record" (../../src/EBTKS_CRT_Record.cpp, which describes the format),
+//  in crt_record_decode.cpp. The register writes are applied as the write handlers in EBTKS_CRT.cpp do
+//
+
+#define CRT_RECORD_HEADER_LENGTH  (32)
+#define CRT_RECORD_8687           (0x01)
+#define CRT_RECORD_SAD_HIGH       (0x02)
+#define CRT_RECORD_BAD_HIGH       (0x04)
+#define CRT_RECORD_LOST           (0x10)
+#define CRT_RECORD_GAP            (0x11)
+#define CRT_RECORD_END            (0x12)
+
+enum { RECORD_SAD = 0, RECORD_BAD, RECORD_CTRL, RECORD_DAT };  //  As enum crt_record_regs in EBTKS_Global_Data.h
+
+struct Record_Event
+{
+  uint8_t     code;                       //  RECORD_SAD .. RECORD_DAT, CRT_RECORD_LOST or CRT_RECORD_GAP
+  uint8_t     val;                        //  The byte written
+  uint32_t    count;                      //  Events lost, or the gap in ms
+};
+
+struct Record_Replay
+{
+  Stream_Screen   screen;                 //  As the CRT shows it. flags has CRT_STREAM_8687 for an HP86/87
+  uint16_t        sad, bad;               //  As the write handlers hold them
+  bool            sad_high, bad_high;     //  The next write to SAD or BAD is the high byte
+  uint32_t        rate;                   //  Of the cycle counter, in Hz
+  uint64_t        cycles;                 //  Since the start, up to the last event read
+  uint32_t        events, lost, gaps;
+  const uint8_t   *data;
+  size_t          length, pos;
+};
+
+//
+//  record_begin() returns NULL, or what is wrong with the header. record_next() reads the next event, and moves
+//  replay->cycles to its time. It returns 1, 0 at the end of the recording, or -1 with *error set.
+//  record_apply() applies a register write to the screen
+//
+
+const char *record_begin(Record_Replay *replay, const uint8_t *data, size_t length);
+int record_next(Record_Replay *replay, Record_Event *event, const char **error);
+void record_apply(Record_Replay *replay, const Record_Event *event);
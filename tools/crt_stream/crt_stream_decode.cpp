@@ -0,0 +1,299 @@
+//
+//      LZS and Base64 decoding, and rebuilding the screen from stream frames
+//
+//      The repo only has the LZS compressor (../../src/lzs-simple-compression.c), so the decompressor is
+//      here. Bits are taken MS bit first:
+//
+//          0 + 8 bits                  Literal byte
+//          1 1 + 7 bit offset          Match, offset 1..127. Offset 0 is the end marker
+//          1 0 + 11 bit offset         Match, offset 1..2047
+//
+//      followed, for a match, by the length: 00 = 2, 01 = 3, 10 = 4, 1100 = 5, 1101 = 6, 1110 = 7, 1111 = 8
+//      and then 4 bit groups that are added to it, for as long as the group is 15
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "crt_stream.h"
+
+struct Bit_Reader
+{
+  const uint8_t   *data;
+  size_t          length;
+  size_t          bit;
+};
+
+static long get_bits(Bit_Reader *reader, int count)
+{
+  long    val = 0;
+
+  while (count--)
+  {
+    if (reader->bit >= reader->length * 8)
+    {
+      return -1;
+    }
+    val = (val << 1) | ((reader->data[reader->bit >> 3] >> (7 - (reader->bit & 7))) & 1);
+    reader->bit++;
+  }
+  return val;
+}
+
+long lzs_decode(const uint8_t *in, size_t length, uint8_t *out, size_t out_size)
+{
+  Bit_Reader  reader = {in, length, 0};
+  long        bit, offset, code, extra;
+  size_t      pos = 0, count;
+
+  for (;;)
+  {
+    if ((bit = get_bits(&reader, 1)) < 0)
+    {
+      return -1;                                            //  No end marker
+    }
+    if (bit == 0)
+    {
+      if ((code = get_bits(&reader, 8)) < 0 || pos >= out_size)
+      {
+        return -1;
+      }
+      out[pos++] = code;
+      continue;
+    }
+    if ((bit = get_bits(&reader, 1)) < 0)
+    {
+      return -1;
+    }
+    offset = get_bits(&reader, bit ? 7 : 11);
+    if (offset == 0 && bit)
+    {
+      return pos;                                           //  End marker
+    }
+    if (offset <= 0 || (size_t)offset > pos)
+    {
+      return -1;
+    }
+    if ((code = get_bits(&reader, 2)) < 0)
+    {
+      return -1;
+    }
+    if (code < 3)
+    {
+      count = code + 2;
+    }
+    else
+    {
+      if ((code = get_bits(&reader, 2)) < 0)
+      {
+        return -1;
+      }
+      count = code + 5;
+      if (count == 8)
+      {
+        do
+        {
+          if ((extra = get_bits(&reader, 4)) < 0)
+          {
+            return -1;
+          }
+          count += extra;
+        } while (extra == 15);
+      }
+    }
+    if (pos + count > out_size)
+    {
+      return -1;
+    }
+    while (count--)
+    {
+      out[pos] = out[pos - offset];                         //  Byte at a time, as the match may overlap
+      pos++;
+    }
+  }
+}
+
+static int base64_value(char c)
+{
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+long base64_decode(const char *in, uint8_t *out, size_t out_size)
+{
+  uint32_t    bits = 0;
+  int         nbits = 0, val;
+  size_t      pos = 0;
+
+  for ( ; *in && *in != '=' ; in++)
+  {
+    if ((val = base64_value(*in)) < 0)
+    {
+      return -1;
+    }
+    bits = (bits << 6) | val;
+    nbits += 6;
+    if (nbits >= 8)
+    {
+      nbits -= 8;
+      if (pos >= out_size)
+      {
+        return -1;
+      }
+      out[pos++] = bits >> nbits;
+    }
+  }
+  return pos;
+}
+
+static uint32_t get16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+const char *stream_apply(Stream_Screen *screen, const uint8_t *frame, size_t length)
+{
+  uint32_t    seq, vram_size, block_size, runs, first, blocks, run_length, start, bytes, i;
+  size_t      pos;
+  long        decoded;
+  uint8_t     flags;
+
+  if (length < CRT_STREAM_HEADER_LENGTH)
+  {
+    return "frame is too short";
+  }
+  if (frame[0] != CRT_STREAM_VERSION)
+  {
+    return "unknown format version";
+  }
+  flags      = frame[1];
+  seq        = frame[2] | (frame[3] << 8) | (frame[4] << 16) | ((uint32_t)frame[5] << 24);
+  vram_size  = get16(&frame[6]);
+  block_size = frame[11];
+  runs       = frame[12];
+  if ((vram_size != 8192 && vram_size != 16384) || block_size == 0)
+  {
+    return "bad vram or block size";
+  }
+  if (!(flags & CRT_STREAM_KEY) && (screen->seq == 0 || seq != screen->seq + 1 || vram_size != screen->vram_size))
+  {
+    return "delta frame does not follow the last frame applied";
+  }
+
+  //
+  //  Check every run before changing the screen
+  //
+  pos = CRT_STREAM_HEADER_LENGTH;
+  for (i = 0 ; i < runs ; i++)
+  {
+    if (pos + CRT_STREAM_RUN_HEADER > length)
+    {
+      return "run header is past the end of the frame";
+    }
+    run_length = get16(&frame[pos + 2]) & ~CRT_STREAM_RAW;
+    if (frame[pos] * block_size >= vram_size)
+    {
+      return "run starts past the end of vram";
+    }
+    pos += CRT_STREAM_RUN_HEADER + run_length;
+    if (pos > length)
+    {
+      return "run data is past the end of the frame";
+    }
+  }
+
+  if (flags & CRT_STREAM_KEY)
+  {
+    memset(screen->vram, 0, sizeof(screen->vram));
+    screen->complete = false;
+  }
+  screen->vram_size = vram_size;
+  screen->sad       = get16(&frame[8]);
+  screen->ctrl      = frame[10];
+  screen->flags     = flags;
+  screen->seq       = seq;
+  screen->runs      = runs;
+  screen->bytes     = 0;
+
+  pos = CRT_STREAM_HEADER_LENGTH;
+  for (i = 0 ; i < runs ; i++)
+  {
+    first      = frame[pos];
+    blocks     = frame[pos + 1];
+    run_length = get16(&frame[pos + 2]);
+    start      = first * block_size;
+    bytes      = blocks * block_size;
+    if (start + bytes > vram_size)
+    {
+      bytes = vram_size - start;
+    }
+    pos += CRT_STREAM_RUN_HEADER;
+    if (run_length & CRT_STREAM_RAW)
+    {
+      run_length &= ~CRT_STREAM_RAW;
+      if (run_length != bytes)
+      {
+        return "stored run has the wrong length";
+      }
+      memcpy(&screen->vram[start], &frame[pos], bytes);
+    }
+    else
+    {
+      decoded = lzs_decode(&frame[pos], run_length, &screen->vram[start], bytes);
+      if (decoded != (long)bytes)
+      {
+        return "bad compressed run";
+      }
+    }
+    pos += run_length;
+    screen->bytes += bytes;
+  }
+  if (!(flags & CRT_STREAM_MORE))
+  {
+    screen->complete = true;
+  }
+  return NULL;
+}
+
+//
+//  The visible alpha screen. HP83/85/9915: 16 lines of 32 from sadAddr / 2, wrapping at 2048.
+//  HP86/87: 16 or 24 lines of 80 from sadAddr, wrapping at 4320, or at 16320 in ALPHALL
+//
+
+void stream_print_alpha(const Stream_Screen *screen, FILE *out)
+{
+  uint32_t    addr, wrap, lines, columns, line, column;
+  char        c;
+
+  if (screen->flags & CRT_STREAM_8687)
+  {
+    columns = 80;
+    lines   = (screen->ctrl & 0x08) ? 24 : 16;
+    wrap    = (screen->ctrl & 0x40) ? 16320 : 4320;
+    addr    = screen->sad % wrap;
+  }
+  else
+  {
+    columns = 32;
+    lines   = 16;
+    wrap    = 2048;
+    addr    = (screen->sad / 2) % wrap;
+  }
+  for (line = 0 ; line < lines ; line++)
+  {
+    for (column = 0 ; column < columns ; column++)
+    {
+      c = screen->vram[addr] & 0x7F;                        //  Bit 7 is underline
+      fputc((c < 0x20 || c == 0x7F) ? ' ' : c, out);
+      if (++addr >= wrap)
+      {
+        addr = 0;
+      }
+    }
+    fputc('\n', out);
+  }
+}
@@ -0,0 +1,391 @@
+//
+//      Round trip test of the incremental screen stream: frames from the firmware's CRT_Stream_Frame()
+//      (../../src/EBTKS_CRT_Stream.cpp, built against the ../bus_sim shim), applied by this directory's decoder.
+//
+//      current_screen and the dirty block tracking normally live in EBTKS_CRT.cpp, which needs the whole
+//      firmware, so simple stand-ins are here. Each test changes the screen, builds frames until nothing
+//      is left to send, and checks that the rebuilt vram matches.
+//
+//      The screen renderer (../../src/EBTKS_CRT_Render.cpp, used by "screenshot" and crt_stream -p) is checked
+//      on a few known characters and modes.
+//
+//      The CRT recorder (../../src/EBTKS_CRT_Record.cpp) is fed register writes as the write handlers would,
+//      at known times, and its encoding is played back with crt_record_decode.cpp.
+//
+
+#include <Arduino.h>
+#include <setjmp.h>
+#include <stdarg.h>
+
+#include "Inc_Common_Headers.h"
+#include "Base64.h"
+#include "crt_stream.h"
+
+video_capt_t    current_screen;
+video_capt_t    captured_screen;
+char            serial_string[SERIAL_STRING_MAX_LENGTH + 2];
+Sim_Serial      Serial;
+Base64Class     Base64;
+SdFs            SD;
+
+extern "C" volatile uint32_t systick_millis_count;
+volatile uint32_t systick_millis_count;
+bool            badFlag, sadFlag;                       //  As EBTKS_CRT.cpp holds them
+uint16_t        badAddr, sadAddr;
+static uint32_t test_cycles;
+
+uint32_t sim_read_cycle_counter(void)
+{
+  return test_cycles;
+}
+
+static uint32_t test_dirty[CRT_DIRTY_WORDS];
+static bool     test_view;
+static int      failures;
+
+bool PSRAM_Holds_EXTMEM(void)                           //  EBTKS_Utilities.cpp, for "crt record start"
+{
+  return true;
+}
+
+//
+//  Stand-ins for EBTKS_CRT.cpp
+//
+
+bool CRT_Dirty_Take(uint8_t consumer, struct S_CRT_Dirty *dirty)
+{
+  (void)consumer;
+  memcpy(dirty->blocks, test_dirty, sizeof(test_dirty));
+  dirty->block_size = Is8687 ? CRT_DIRTY_BLOCK_8687 : CRT_DIRTY_BLOCK_85;
+  dirty->view = test_view;
+  memset(test_dirty, 0, sizeof(test_dirty));
+  test_view = false;
+  return true;
+}
+
+void CRT_Dirty_Mark_Range(uint32_t first, uint32_t length)
+{
+  uint32_t    block_size = Is8687 ? CRT_DIRTY_BLOCK_8687 : CRT_DIRTY_BLOCK_85;
+  uint32_t    block;
+
+  for (block = first / block_size ; block <= (first + length - 1) / block_size ; block++)
+  {
+    test_dirty[block >> 5] |= 1U << (block & 31);
+  }
+}
+
+int Sim_Serial::printf(const char *format, ...)
+{
+  va_list     args;
+  int         n;
+
+  va_start(args, format);
+  n = vprintf(format, args);
+  va_end(args);
+  return n;
+}
+
+//
+//  Send frames until nothing is left, as the ESP32 would. Returns the total frame bytes
+//
+
+static uint32_t sync(Stream_Screen *peer, uint32_t *frames, bool lose_first)
+{
+  uint8_t     frame[CRT_STREAM_FRAME_MAX];
+  uint32_t    length, total = 0;
+  const char  *error;
+
+  *frames = 0;
+  do
+  {
+    length = CRT_Stream_Frame(peer->seq, frame, sizeof(frame));
+    if (length > CRT_STREAM_FRAME_MAX)
+    {
+      printf("  frame of %u bytes is too long\n", length);
+      failures++;
+      return total;
+    }
+    total += length;
+    (*frames)++;
+    if (lose_first)
+    {
+      lose_first = false;                                   //  The peer never sees it, and asks with its old ack
+      continue;
+    }
+    if ((error = stream_apply(peer, frame, length)))
+    {
+      printf("  frame %u rejected: %s\n", CRT_Stream_Seq(), error);
+      failures++;
+      return total;
+    }
+  } while (CRT_Stream_More() || (peer->seq != CRT_Stream_Seq()));
+  return total;
+}
+
+static void check(const char *name, Stream_Screen *peer, bool lose_first = false)
+{
+  uint32_t    frames, bytes, size = Is8687 ? 16384 : 8192;
+  bool        ok;
+
+  bytes = sync(peer, &frames, lose_first);
+  ok = peer->complete && (peer->vram_size == size) && (memcmp(peer->vram, current_screen.vram, size) == 0) &&
+       (peer->sad == current_screen.sadAddr) && (peer->ctrl == current_screen.ctrl);
+  printf("%-44s %2u frames %6u bytes  %s\n", name, frames, bytes, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    failures++;
+  }
+}
+
+static void put_text(uint32_t offset, const char *text)
+{
+  memcpy(&current_screen.vram[offset], text, strlen(text));
+  CRT_Dirty_Mark_Range(offset, strlen(text));
+}
+
+static void fill_noise(uint32_t first, uint32_t length, uint32_t seed)
+{
+  uint32_t    i;
+
+  for (i = 0 ; i < length ; i++)
+  {
+    seed = seed * 1103515245 + 12345;
+    current_screen.vram[first + i] = seed >> 16;
+  }
+  CRT_Dirty_Mark_Range(first, length);
+}
+
+static void test_machine(bool is_8687)
+{
+  static Stream_Screen  peer;
+  uint32_t              row, columns = is_8687 ? 80 : 32;
+  char                  text[96];
+
+  Is8687 = is_8687;
+  memset(&current_screen, 0, sizeof(current_screen));
+  memset(&peer, 0, sizeof(peer));
+  printf("%s\n", is_8687 ? "HP86/87" : "HP85");
+
+  for (row = 0 ; row < 16 ; row++)
+  {
+    snprintf(text, sizeof(text), "%2u READY  10 DISP \"LINE %u\"", row, row);
+    put_text(row * columns, text);
+  }
+  check("keyframe, 16 lines of text", &peer);
+
+  put_text(3 * columns + 5, "CHANGED");
+  check("one changed line", &peer);
+
+  current_screen.sadAddr = is_8687 ? 2 * columns : 4 * columns;
+  test_view = true;
+  check("scroll, no vram change", &peer);
+
+  fill_noise(is_8687 ? 4320 : 2048, is_8687 ? 8000 : 6144, 1);
+  current_screen.ctrl = 0x80;
+  test_view = true;
+  check("graphics noise, more than one frame", &peer);
+
+  put_text(columns * 10, "AFTER NOISE");
+  check("change after a lost frame, resent as keyframe", &peer, true);
+
+  current_screen.vram[(is_8687 ? 16384 : 8192) - 1] = 0xA5;
+  CRT_Dirty_Mark_Range((is_8687 ? 16384 : 8192) - 1, 1);
+  check("last byte of vram", &peer);
+
+  check("nothing changed", &peer);
+}
+
+//
+//  Render one image row and compare it with what is expected, pixel columns from first for the length of expect
+//
+
+static void check_row(const char *name, uint32_t y, uint32_t first, const char *expect)
+{
+  struct S_CRT_Geometry   geometry;
+  uint8_t                 row[80];
+  char                    got[96];
+  uint32_t                x, length = strlen(expect);
+
+  CRT_Get_Geometry(&current_screen, &geometry);
+  CRT_Render_Rows(&current_screen, &geometry, y, 1, row);
+  for (x = 0 ; x < length ; x++)
+  {
+    got[x] = (row[(first + x) / 8] & (0x80 >> ((first + x) & 7))) ? '#' : '.';
+  }
+  got[length] = 0;
+  printf("%-44s %s  %s\n", name, got, strcmp(got, expect) ? "FAILED" : "ok");
+  if (strcmp(got, expect))
+  {
+    printf("%-44s %s  expected\n", "", expect);
+    failures++;
+  }
+}
+
+static void check_size(const char *name, uint32_t width, uint32_t height)
+{
+  struct S_CRT_Geometry   geometry;
+  uint32_t                w, h;
+
+  CRT_Get_Geometry(&current_screen, &geometry);
+  CRT_Render_Size(&geometry, &w, &h);
+  printf("%-44s %3u x %3u  %s\n", name, w, h, (w == width && h == height) ? "ok" : "FAILED");
+  if (w != width || h != height)
+  {
+    failures++;
+  }
+}
+
+static void test_render(void)
+{
+  printf("Renderer\n");
+  Is8687 = false;
+  memset(&current_screen, 0, sizeof(current_screen));
+  current_screen.vram[0] = 'A';
+  current_screen.vram[1] = 'H' | 0x80;
+  check_size("HP85 alpha", 256, 192);
+  check_row("HP85 'A', top row of the glyph", 2, 0, "..###...");
+  check_row("HP85 'A', crossbar", 6, 0, ".#####..");
+  check_row("HP85 underlined 'H', underline row", 10, 8, "########");
+  check_row("HP85 'A' is not underlined", 10, 0, "........");
+
+  current_screen.sadAddr = 2 * (2048 - 32);                 //  Top line is the last line of alpha memory
+  check_row("HP85 alpha wraps to vram[0] on line 2", 12 + 6, 0, ".#####..");
+  current_screen.sadAddr = 0;
+
+  current_screen.ctrl = 0x80;
+  current_screen.vram[0x800 + 32 * 3 + 1] = 0xA5;
+  check_size("HP85 graphics", 256, 192);
+  check_row("HP85 graphics row 3", 3, 8, "#.#..#.#");
+
+  Is8687 = true;
+  memset(&current_screen, 0, sizeof(current_screen));
+  current_screen.vram[79] = 'A';
+  check_size("HP86/87 alpha, 16 lines", 640, 240);
+  check_row("HP86/87 'A' in column 79", 3 + 4, 79 * 8, ".#####..");
+  current_screen.ctrl = 0x08;
+  check_size("HP86/87 alpha, 24 lines", 640, 240);
+  check_row("HP86/87 'A', 24 lines", 1 + 4, 79 * 8, ".#####..");
+  current_screen.ctrl = 0x08 | 0x20;
+  check_row("HP86/87 inverse", 1 + 4, 79 * 8, "#.....##");
+  current_screen.ctrl = 0x80 | 0x40;
+  current_screen.sadAddr = 4320;                            //  Graphics start at CRTSAD
+  current_screen.vram[(4320 + 68 * 239 + 67) & 037777] = 0x01;     //  GRAPHALL wraps at the end of vram
+  check_size("HP86/87 GRAPHALL", 544, 240);
+  check_row("HP86/87 GRAPHALL, last pixel, wrapped", 239, 536, ".......#");
+  current_screen.ctrl = 0x80;
+  check_size("HP86/87 normal graphics", 400, 240);
+}
+
+//
+//  Record writes at known times, encode them, and play them back
+//
+
+static void check(const char *name, bool ok)
+{
+  printf("%-44s %s\n", name, ok ? "ok" : "FAILED");
+  if (!ok)
+  {
+    failures++;
+  }
+}
+
+static void record(uint8_t reg, uint8_t val, uint32_t cycles)
+{
+  test_cycles += cycles;
+  CRT_Record_Write(reg, val);
+}
+
+static void record_text(const char *text, uint16_t address)
+{
+  record(CRT_RECORD_BAD, address & 0xFF, 1000);
+  record(CRT_RECORD_BAD, address >> 8, 1000);
+  while (*text)
+  {
+    record(CRT_RECORD_DAT, *text++, 600);
+  }
+}
+
+static void test_record(bool is_8687)
+{
+  static uint8_t          data[CRT_RECORD_HEADER_LENGTH + 16384 + 65536];
+  uint32_t                length, vram_size = is_8687 ? 16384 : 8192, count, dat_cycles = 0;
+  Record_Replay           replay;
+  Record_Event            event;
+  const char              *error;
+  int                     result;
+  char                    text[6];
+
+  printf("Recorder, %s\n", is_8687 ? "HP86/87" : "HP85");
+  Is8687 = is_8687;
+  memset(&current_screen, 0, sizeof(current_screen));
+  memcpy(current_screen.vram, "OLD", 3);
+  sadFlag = badFlag = false;
+  sadAddr = badAddr = 0;
+  systick_millis_count = 1000;
+  test_cycles = 0xFFFFF000;                                 //  Wraps during the recording
+
+  length = CRT_Record_Begin(data);
+  memcpy(data + length, current_screen.vram, vram_size);
+  length += vram_size;
+
+  record_text("HELLO", is_8687 ? 80 : 64);                  //  Line 2, HP85 addresses are in nibbles
+  record(CRT_RECORD_CTRL, 0x08, 500);
+  systick_millis_count += 5000;                             //  A pause, longer than the cycle counter could time
+  record(CRT_RECORD_SAD, is_8687 ? 80 : 64, 700);
+  record(CRT_RECORD_SAD, 0, 700);
+  for (count = 0; count < CRT_RECORD_ISR_RING_SIZE; count++)  //  10 events are already in the ISR's ring, so 10 are lost
+  {
+    record(CRT_RECORD_DAT, ' ', 600);
+  }
+  length += CRT_Record_Encode(data + length, sizeof(data) - length);
+  for (count = 0; count < CRT_RECORD_ISR_RING_SIZE; count++)  //  The ISR's ring was emptied, so none are lost
+  {
+    record(CRT_RECORD_DAT, ' ', 600);
+  }
+  length += CRT_Record_Encode(data + length, sizeof(data) - length);
+  length += CRT_Record_Encode(data + length, sizeof(data) - length);
+  CRT_Record_Active = false;
+  data[length++] = CRT_RECORD_END;
+
+  error = record_begin(&replay, data, length);
+  check("Header", error == NULL && replay.rate == 600000000 && replay.screen.vram_size == vram_size &&
+                  ((replay.screen.flags & CRT_STREAM_8687) != 0) == is_8687);
+  if (error)
+  {
+    return;
+  }
+  while ((result = record_next(&replay, &event, &error)) == 1)
+  {
+    if (replay.events == 7 && event.code == CRT_RECORD_DAT)
+    {
+      dat_cycles = (uint32_t)replay.cycles;                 //  The 'O' of HELLO
+    }
+    record_apply(&replay, &event);
+  }
+  check("Decodes to the end", result == 0);
+  if (is_8687)
+  {
+    memcpy(text, &replay.screen.vram[80], 5);
+  }
+  else
+  {
+    memcpy(text, &replay.screen.vram[32], 5);
+  }
+  text[5] = '\0';
+  check("Text written", strcmp(text, "HELLO") == 0 && memcmp(replay.screen.vram, "OLD", 3) == 0);
+  check("Start address and control", replay.screen.sad == (is_8687 ? 80 : 64) && replay.screen.ctrl == 0x08);
+  check("Time of a write, across counter wrap", dat_cycles == 1000 + 1000 + 5 * 600);
+  check("Gap", replay.gaps == 1 && replay.cycles >= 5000ULL * 600000);
+  check("Lost events", replay.lost == 10 && replay.events == 2 * CRT_RECORD_ISR_RING_SIZE);
+}
+
+int main(void)
+{
+  test_machine(false);
+  test_machine(true);
+  test_render();
+  test_record(false);
+  test_record(true);
+  printf("%s, %d failures\n", failures ? "FAILED" : "PASSED", failures);
+  return failures != 0;
+}
@@ -0,0 +1,576 @@
+//
+//      capricorn     Rebuild the instruction stream from a Logic Analyzer capture, and disassemble it
+//
+//      The Capricorn CPU asserts IFETCH while it reads the first byte of each instruction (HP85B, 86 and 87,
+//      the HP85A does not have IFETCH on the backplane). Operand bytes are the reads that follow, from the
+//      next addresses. Everything else the instruction does is a data access, and is listed with it, with
+//      addresses named from the symbol table in include/EBTKS.h. DMA cycles (bit 31, including the ones
+//      that DMA_Logic_Analyzer_Support() records for EBTKS's own DMA) are listed as such.
+//
+//      The Capricorn has 64 bytes of registers, R0 to R77 (octal). ARP and DRP instructions select the
+//      address and data registers for the instructions that follow, so they are tracked as the capture is
+//      decoded. Multi-byte instructions work from DR up to the end of its register: 2 bytes for R0..R37,
+//      8 bytes for R40..R77 (the same rule as emc_ptr12_decrement() in EBTKS_Bus_Interface_ISR.cpp).
+//      Until the capture has shown a DRP instruction, DR is taken from the DRP field of the aux sample.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "la_decode.h"
+
+#define REG_UNKNOWN             (-1)
+#define MAX_INSTRUCTION_BYTES   (10)                    //  Opcode + 8 literal bytes, with room to spare
+#define MAX_LISTED_ACCESSES     (4)                     //  More than this, and the rest are counted
+
+static std::map<uint32_t, std::string>  symbols;
+
+//
+//  Symbols are "#define NAME (0nnnnnn)  // comment" lines, as in include/EBTKS.h. Only octal values
+//  are used, so pin numbers and other defines are skipped. The first name for an address is kept
+//
+
+bool load_symbols(const char *filename)
+{
+  FILE      *in;
+  char      line[256], name[64];
+  char      *p, *end;
+  uint32_t  value;
+
+  if (!(in = fopen(filename, "r")))
+  {
+    return false;
+  }
+  while (fgets(line, sizeof(line), in))
+  {
+    if (sscanf(line, " #define %63s", name) != 1)
+    {
+      continue;
+    }
+    p = strstr(line, name) + strlen(name);
+    while (isspace(*p)) p++;
+    if (*p++ != '(') continue;
+    while (*p == ' ') p++;
+    if (*p != '0') continue;
+    value = strtoul(p, &end, 8);
+    while (*end == ' ') end++;
+    if ((*end != ')') || (value == 0) || (value > 0177777)) continue;
+    symbols.insert(std::make_pair(value, std::string(name)));
+  }
+  fclose(in);
+  return true;
+}
+
+//
+//  I/O registers (177400 and up) must match exactly. Elsewhere, NAME+n is used for up to 8 bytes past a
+//  symbol, as many RAM symbols are the start of a buffer. Returns NULL if there is no symbol
+//
+
+const char *symbol_name(uint32_t address, char *buffer, size_t length)
+{
+  std::map<uint32_t, std::string>::const_iterator   it;
+
+  it = symbols.upper_bound(address);
+  if (it == symbols.begin())
+  {
+    return NULL;
+  }
+  --it;
+  if (it->first == address)
+  {
+    snprintf(buffer, length, "%s", it->second.c_str());
+    return buffer;
+  }
+  if ((address < 0177400) && (address - it->first < 8))
+  {
+    snprintf(buffer, length, "%s+%u", it->second.c_str(), address - it->first);
+    return buffer;
+  }
+  return NULL;
+}
+
+//
+//  Instruction set
+//
+
+enum operand_mode
+{
+  MODE_NONE,                  //  BIN
+  MODE_ARP,                   //  ARP R40
+  MODE_DRP,                   //  DRP R40
+  MODE_DR,                    //  CLM R40
+  MODE_DR_AR,                 //  LDM R40,R50
+  MODE_DR_LIT,                //  LDM R40,=001,002...
+  MODE_DR_ADDR,               //  LDMD R40,=CRTSAD
+  MODE_DR_INDEX,              //  LDMD R40,X36,CRTSAD
+  MODE_STACK,                 //  PUMD R40,+R6
+  MODE_JSB_ADDR,              //  JSB =ADDR
+  MODE_JSB_INDEX,             //  JSB X36,ADDR
+  MODE_JUMP,                  //  JNZ ADDR
+  MODE_UNKNOWN
+};
+
+struct Opcode
+{
+  char              name[8];
+  enum operand_mode mode;
+  bool              multi;                            //  Multi-byte, length from DR
+};
+
+static const char *jumps[16] =
+  { "JMP", "JNO", "JOD", "JEV", "JNG", "JPS", "JNZ", "JZR", "JEN", "JEZ", "JNC", "JCY", "JLZ", "JRZ", "JLN", "JRN" };
+
+static const char *singles[32] =
+  { "ELB", "ELM", "ERB", "ERM", "LLB", "LLM", "LRB", "LRM", "ICB", "ICM", "DCB", "DCM", "TCB", "TCM", "NCB", "NCM",
+    "TSB", "TSM", "CLB", "CLM", "ORB", "ORM", "XRB", "XRM", "BIN", "BCD", "SAD", "DCE", "ICE", "CLE", "RTN", "PAD" };
+
+static const char *arithmetic[8] = { "CMB", "CMM", "ADB", "ADM", "SBB", "SBM", "JSB", "ANM" };
+
+static struct Opcode decode_opcode(uint8_t op)
+{
+  struct Opcode   result;
+  int             group;
+
+  memset(&result, 0, sizeof(result));
+  result.multi = op & 1;
+  if (op < 0100)
+  {
+    strcpy(result.name, "ARP");
+    result.mode = MODE_ARP;
+  }
+  else if (op < 0200)
+  {
+    strcpy(result.name, "DRP");
+    result.mode = MODE_DRP;
+  }
+  else if (op < 0240)
+  {
+    strcpy(result.name, singles[op - 0200]);
+    result.mode = (op < 0224) ? MODE_DR : (op < 0230) ? MODE_DR_AR : MODE_NONE;
+  }
+  else if (op < 0300)
+  {
+    //  Bit 0 byte/multi, bit 1 load/store, bits 4..2 addressing mode
+    static const enum operand_mode  modes[8]    = { MODE_DR_AR, MODE_DR_LIT, MODE_DR_AR, MODE_DR_ADDR,
+                                                    MODE_DR_AR, MODE_DR_ADDR, MODE_DR_INDEX, MODE_DR_INDEX };
+    static const char               suffix[8]   = { 0, 0, 'D', 'D', 'I', 'I', 'D', 'I' };
+
+    group = (op >> 2) & 7;
+    snprintf(result.name, sizeof(result.name), "%s%c%c", (op & 2) ? "ST" : "LD", (op & 1) ? 'M' : 'B', suffix[group]);
+    result.mode = modes[group];
+  }
+  else if (op < 0340)
+  {
+    //  Bits 2..0 operation, bits 4..3 addressing mode. JSB takes the place of ANB
+    static const enum operand_mode  modes[4]    = { MODE_DR_AR, MODE_DR_LIT, MODE_DR_AR, MODE_DR_ADDR };
+
+    group = (op >> 3) & 3;
+    snprintf(result.name, sizeof(result.name), "%s%s", arithmetic[op & 7], (group >= 2) ? "D" : "");
+    result.mode  = modes[group];
+    result.multi = (op & 1);
+    if ((op & 7) == 6)
+    {
+      strcpy(result.name, "JSB");
+      result.multi = false;
+      result.mode  = (group == 0) ? MODE_JSB_INDEX : (group == 1) ? MODE_JSB_ADDR : MODE_UNKNOWN;
+    }
+  }
+  else if (op < 0360)
+  {
+    //  Bit 0 byte/multi, bit 1 pop/push, bit 2 increment/decrement, bit 3 direct/indirect
+    snprintf(result.name, sizeof(result.name), "%s%c%c", (op & 2) ? "PU" : "PO", (op & 1) ? 'M' : 'B', (op & 8) ? 'I' : 'D');
+    result.mode = MODE_STACK;
+  }
+  else
+  {
+    strcpy(result.name, jumps[op & 0x0F]);
+    result.mode  = MODE_JUMP;
+    result.multi = false;
+  }
+  if (result.mode == MODE_UNKNOWN)
+  {
+    strcpy(result.name, "???");
+  }
+  return result;
+}
+
+//
+//  Bytes transferred by a multi-byte instruction, REG_UNKNOWN if DR is not known
+//
+
+static int multi_length(int dr)
+{
+  if (dr < 0)
+  {
+    return REG_UNKNOWN;
+  }
+  return (dr < 040) ? 2 - (dr & 1) : 8 - (dr & 7);
+}
+
+//
+//  Instruction length in bytes, REG_UNKNOWN if it depends on an unknown DR
+//
+
+static int instruction_length(const struct Opcode &op, int dr)
+{
+  switch (op.mode)
+  {
+    case MODE_DR_LIT:
+      if (!op.multi) return 2;
+      return (multi_length(dr) < 0) ? REG_UNKNOWN : 1 + multi_length(dr);
+    case MODE_DR_ADDR:
+    case MODE_DR_INDEX:
+    case MODE_JSB_ADDR:
+    case MODE_JSB_INDEX:
+      return 3;
+    case MODE_JUMP:
+      return 2;
+    case MODE_UNKNOWN:
+      return REG_UNKNOWN;
+    default:
+      return 1;
+  }
+}
+
+static const char *reg_name(int reg, char *buffer, size_t length)
+{
+  if (reg < 0)        snprintf(buffer, length, "R?");
+  else if (reg == 1)  snprintf(buffer, length, "R*");       //  Register number is taken from R0
+  else                snprintf(buffer, length, "R%02o", reg & 077);
+  return buffer;
+}
+
+static const char *address_text(uint32_t address, char *buffer, size_t length)
+{
+  char      name[64];
+
+  if (symbol_name(address, name, sizeof(name)) && !strchr(name, '+'))
+  {
+    snprintf(buffer, length, "%s", name);
+  }
+  else
+  {
+    snprintf(buffer, length, "%06o", address);
+  }
+  return buffer;
+}
+
+//
+//  Decoding state, carried from one instruction to the next
+//
+
+struct Instruction
+{
+  bool          open;
+  int64_t       number;                               //  Sample number of the opcode fetch
+  uint32_t      pc;
+  uint8_t       rselec;
+  uint8_t       bytes[MAX_INSTRUCTION_BYTES];
+  int           length;                               //  Bytes fetched so far
+  int           expected;                             //  REG_UNKNOWN if not known
+  bool          data_seen;                            //  Operand bytes can't follow a data access
+  int           accesses;
+  std::string   bus;
+};
+
+static struct Instruction   current;
+static int                  arp = REG_UNKNOWN;
+static int                  drp = REG_UNKNOWN;
+static bool                 drp_from_capture;         //  Have seen a DRP instruction
+static std::map<std::string, uint64_t>  mnemonic_count;
+static std::map<uint32_t, uint64_t>     address_count;        //  rselec << 16 | pc
+
+static void format_instruction(const struct Instruction &in, char *text, size_t length)
+{
+  struct Opcode   op = decode_opcode(in.bytes[0]);
+  char            dr[16], ar[16], target[64];
+  uint32_t        address = (in.length >= 3) ? (in.bytes[1] | (in.bytes[2] << 8)) : 0;
+  int             used, i;
+
+  reg_name(drp, dr, sizeof(dr));
+  reg_name(arp, ar, sizeof(ar));
+  switch (op.mode)
+  {
+    case MODE_NONE:       snprintf(text, length, "%s", op.name);                                          break;
+    case MODE_ARP:
+    case MODE_DRP:        snprintf(text, length, "%-5s %s", op.name, reg_name(in.bytes[0] & 077, dr, sizeof(dr)));  break;
+    case MODE_DR:         snprintf(text, length, "%-5s %s", op.name, dr);                                 break;
+    case MODE_DR_AR:      snprintf(text, length, "%-5s %s,%s", op.name, dr, ar);                          break;
+    case MODE_STACK:      snprintf(text, length, "%-5s %s,%c%s", op.name, dr, (in.bytes[0] & 4) ? '-' : '+', ar);  break;
+    case MODE_DR_LIT:
+      used = snprintf(text, length, "%-5s %s,=", op.name, dr);
+      for (i = 1 ; (i < in.length) && (used < (int)length) ; i++)
+      {
+        used += snprintf(text + used, length - used, "%s%03o", (i > 1) ? "," : "", in.bytes[i]);
+      }
+      break;
+    case MODE_DR_ADDR:    snprintf(text, length, "%-5s %s,=%s", op.name, dr, address_text(address, target, sizeof(target)));  break;
+    case MODE_DR_INDEX:   snprintf(text, length, "%-5s %s,X%s,%s", op.name, dr, ar + 1, address_text(address, target, sizeof(target)));  break;
+    case MODE_JSB_ADDR:   snprintf(text, length, "%-5s =%s", op.name, address_text(address, target, sizeof(target)));  break;
+    case MODE_JSB_INDEX:  snprintf(text, length, "%-5s X%s,%s", op.name, ar + 1, address_text(address, target, sizeof(target)));  break;
+    case MODE_JUMP:
+      if (in.length < 2) snprintf(text, length, "%-5s ?", op.name);
+      else snprintf(text, length, "%-5s %s", op.name,
+                    address_text((in.pc + 2 + (int8_t)in.bytes[1]) & 0xFFFF, target, sizeof(target)));
+      break;
+    default:              snprintf(text, length, "%s", op.name);                                        break;
+  }
+}
+
+//
+//  The ARP and DRP instructions change the registers for the instructions that follow. SAD and PAD
+//  save and restore them on the R6 stack, and after PAD they are not known
+//
+
+static void track_registers(uint8_t op)
+{
+  if (op < 0100)
+  {
+    arp = (op == 1) ? REG_UNKNOWN : op;
+  }
+  else if (op < 0200)
+  {
+    drp = (op == 0101) ? REG_UNKNOWN : (op & 077);
+    drp_from_capture = true;
+  }
+  else if (op == 0237)
+  {
+    arp = drp = REG_UNKNOWN;
+  }
+}
+
+static void flush_instruction(FILE *out)
+{
+  char      bytes[48], text[96];
+  int       used = 0, i;
+
+  if (!current.open)
+  {
+    return;
+  }
+  for (i = 0 ; (i < current.length) && (i < 6) ; i++)
+  {
+    used += snprintf(bytes + used, sizeof(bytes) - used, "%03o ", current.bytes[i]);
+  }
+  if (current.length > 6)
+  {
+    snprintf(bytes + used, sizeof(bytes) - used, "...");
+  }
+  format_instruction(current, text, sizeof(text));
+  if (out)
+  {
+    if ((current.pc >= 060000) && (current.pc < 0100000))
+    {
+      fprintf(out, "%8lld  %03o  %06o  %-24s  %-*s", (long long)current.number, current.rselec, current.pc, bytes, current.bus.empty() ? 0 : 28, text);
+    }
+    else
+    {
+      fprintf(out, "%8lld       %06o  %-24s  %-*s", (long long)current.number, current.pc, bytes, current.bus.empty() ? 0 : 28, text);
+    }
+    fprintf(out, "%s%s\n", current.bus.empty() ? "" : "  ; ", current.bus.c_str());
+  }
+
+  mnemonic_count[std::string(decode_opcode(current.bytes[0]).name)]++;
+  address_count[(((current.pc >= 060000) && (current.pc < 0100000)) ? (uint32_t)current.rselec << 16 : 0) | current.pc]++;
+  track_registers(current.bytes[0]);
+  current.open = false;
+}
+
+static void start_instruction(const Sample &s)
+{
+  current.open      = true;
+  current.number    = s.number;
+  current.pc        = (s.main >> 8) & 0xFFFF;
+  current.rselec    = s.aux & 0xFF;
+  current.bytes[0]  = s.main & 0xFF;
+  current.length    = 1;
+  current.expected  = instruction_length(decode_opcode(current.bytes[0]), drp);
+  current.data_seen = false;
+  current.accesses  = 0;
+  current.bus.clear();
+}
+
+static void add_access(std::string &bus, int *count, const char *kind, uint32_t main)
+{
+  char      text[96], name[64];
+  uint32_t  address = (main >> 8) & 0xFFFF;
+
+  if (++*count > MAX_LISTED_ACCESSES)
+  {
+    if (*count == MAX_LISTED_ACCESSES + 1) bus += "  ...";
+    return;
+  }
+  if (symbol_name(address, name, sizeof(name)))
+  {
+    snprintf(text, sizeof(text), "%s%s %06o %s=%03o", bus.empty() ? "" : "  ", kind, address, name, main & 0xFF);
+  }
+  else
+  {
+    snprintf(text, sizeof(text), "%s%s %06o=%03o", bus.empty() ? "" : "  ", kind, address, main & 0xFF);
+  }
+  bus += text;
+}
+
+//
+//  Walk the samples, and call flush_instruction() for each instruction. If out is NULL, just count
+//
+
+static void decode(FILE *out, const std::vector<Sample> &samples)
+{
+  std::string   dma_bus;
+  int           dma_count = 0;
+  int64_t       dma_number = 0;
+  bool          rd, wr, lma;
+
+  current.open = false;
+  arp = drp = REG_UNKNOWN;
+  drp_from_capture = false;
+
+  for (const Sample &s : samples)
+  {
+    rd  = !(s.main & MAIN_RD);
+    wr  = !(s.main & MAIN_WR);
+    lma = !(s.main & MAIN_LMA);
+
+    if (s.main & MAIN_GAP)
+    {
+      flush_instruction(out);
+      if (out) fprintf(out, "          --------  samples were lost here\n");
+    }
+    if (s.trigger)
+    {
+      flush_instruction(out);
+      if (out) fprintf(out, "          --------  trigger\n");
+    }
+    if (!drp_from_capture && (s.aux & 0xFF00))
+    {
+      drp = (s.aux >> 8) & 077;                       //  DRP from the EMC tracking in the ISR
+    }
+
+    if (s.main & MAIN_DMA)
+    {
+      if (rd != wr)
+      {
+        if (dma_count == 0) dma_number = s.number;
+        add_access(dma_bus, &dma_count, rd ? "R" : "W", s.main);
+      }
+      continue;
+    }
+    if (dma_count)
+    {
+      flush_instruction(out);
+      if (out) fprintf(out, "%8lld       DMA     %d cycles  ; %s\n", (long long)dma_number, dma_count, dma_bus.c_str());
+      dma_bus.clear();
+      dma_count = 0;
+    }
+
+    if (lma || (rd == wr))
+    {
+      if (rd && wr && lma && current.open)
+      {
+        current.bus += current.bus.empty() ? "INTACK" : "  INTACK";
+      }
+      continue;                                       //  Address loads, idle cycles, and acknowledge cycles
+    }
+
+    if (rd && (s.main & MAIN_IF))
+    {
+      flush_instruction(out);
+      start_instruction(s);
+      continue;
+    }
+    if (!current.open)
+    {
+      continue;                                       //  Before the first instruction fetch in the capture
+    }
+    if (rd && !current.data_seen && (current.length < MAX_INSTRUCTION_BYTES) &&
+        ((current.expected < 0) || (current.length < current.expected)) &&
+        (((s.main >> 8) & 0xFFFF) == ((current.pc + current.length) & 0xFFFF)))
+    {
+      current.bytes[current.length++] = s.main & 0xFF;
+      continue;
+    }
+    current.data_seen = true;
+    add_access(current.bus, &current.accesses, rd ? "R" : "W", s.main);
+  }
+  flush_instruction(out);
+}
+
+static bool has_instruction_fetch(const std::vector<Sample> &samples)
+{
+  for (const Sample &s : samples)
+  {
+    if (s.main & MAIN_IF) return true;
+  }
+  return false;
+}
+
+void disassemble(FILE *out, const std::vector<Sample> &samples)
+{
+  if (!has_instruction_fetch(samples))
+  {
+    fprintf(stderr, "There are no instruction fetches in the capture. The HP85A does not have IFETCH on the backplane\n");
+    return;
+  }
+  fprintf(out, "  Sample  ROM  Address  Bytes                     Instruction                   Bus\n");
+  decode(out, samples);
+}
+
+//
+//  Where the time went: instructions by mnemonic, and the most executed addresses
+//
+
+void profile(FILE *out, const std::vector<Sample> &samples)
+{
+  std::vector<std::pair<uint64_t, std::string>>   mnemonics;
+  std::vector<std::pair<uint64_t, uint32_t>>      addresses;
+  uint64_t      total = 0;
+  char          name[64];
+  size_t        i;
+
+  if (!has_instruction_fetch(samples))
+  {
+    fprintf(stderr, "There are no instruction fetches in the capture. The HP85A does not have IFETCH on the backplane\n");
+    return;
+  }
+  mnemonic_count.clear();
+  address_count.clear();
+  decode(NULL, samples);
+
+  for (const auto &m : mnemonic_count)
+  {
+    mnemonics.push_back(std::make_pair(m.second, m.first));
+    total += m.second;
+  }
+  for (const auto &a : address_count)
+  {
+    addresses.push_back(std::make_pair(a.second, a.first));
+  }
+  std::sort(mnemonics.rbegin(), mnemonics.rend());
+  std::sort(addresses.rbegin(), addresses.rend());
+
+  fprintf(out, "%llu instructions in %zu bus cycles\n\n", (unsigned long long)total, samples.size());
+  fprintf(out, "Mnemonic      Count      %%\n");
+  for (i = 0 ; i < mnemonics.size() ; i++)
+  {
+    fprintf(out, "%-8s %10llu  %5.1f\n", mnemonics[i].second.c_str(), (unsigned long long)mnemonics[i].first,
+            100.0 * mnemonics[i].first / total);
+  }
+  fprintf(out, "\nROM  Address       Count      %%  Symbol\n");
+  for (i = 0 ; (i < addresses.size()) && (i < 20) ; i++)
+  {
+    uint32_t  pc = addresses[i].second & 0xFFFF;
+
+    if ((pc >= 060000) && (pc < 0100000)) fprintf(out, "%03o  ", addresses[i].second >> 16);
+    else                                  fprintf(out, "     ");
+    fprintf(out, "%06o  %10llu  %5.1f  %s\n", pc, (unsigned long long)addresses[i].first, 100.0 * addresses[i].first / total,
+            symbol_name(pc, name, sizeof(name)) ? name : "");
+  }
+}
@@ -0,0 +1,535 @@
+//
+//      la_decode     Host (Linux) decoder for EBTKS Logic Analyzer captures
+//
+//      Reads either of the binary formats the firmware writes, and prints the samples as the
+//      same table that "la go" prints, or as a VCD file for GTKWave, PulseView (sigrok) and
+//      other waveform viewers. It can also disassemble the Capricorn instructions in a capture,
+//      and profile them. See capricorn.cpp
+//
+//        "EBTKSLAD"    A "la dump" or "la save" of the Logic Analyzer buffer. See src/EBTKS_LA_Dump.cpp.
+//                      For "la dump", just save everything received on the USB serial port to a file,
+//                      any text before the dump is skipped.
+//        "EBTKSLAS"    A "la stream" recording. See src/EBTKS_LA_Stream.cpp
+//        "EBTKSEMT"    An "emc trace dump" or "emc trace save" of the EMC trace ring. See src/EBTKS_EMC_Trace.cpp.
+//                      This is always printed as a table, the -v, -d and -p options do not apply
+//        Text          The table printed by "la go", copied from a terminal
+//
+//      Build and run (see Makefile in this directory):
+//
+//          make -C tools/la_decode
+//          tools/la_decode/la_decode LA_Dump.bin                   table
+//          tools/la_decode/la_decode -v -o capture.vcd LA_Dump.bin VCD
+//          tools/la_decode/la_decode -d LA_Stream.bin                 disassembly
+//
+//      The table can be replayed by tools/bus_sim, as each line ends with the raw main sample.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "la_decode.h"
+
+#define DUMP_HEADER_MIN         (48)
+#define EMC_TRACE_HEADER_MIN    (32)
+#define EMC_TRACE_EVENT_LENGTH  (16)
+#define STREAM_HEADER_LENGTH    (16)
+#define CHUNK_HEADER_LENGTH     (16)
+#define CHUNK_MAGIC             (0x4B4E4843U)           //  "CHNK"
+#define DEFAULT_CYCLE_PS        (1631321)               //  16 / 9.808 MHz
+
+static std::vector<Sample>  samples;
+static uint32_t             cycle_ps = DEFAULT_CYCLE_PS;
+static int64_t              first_number_for_time;      //  Sample number that is time 0 in the VCD
+
+static uint32_t get16(const uint8_t *p)  { return p[0] | (p[1] << 8); }
+static uint32_t get32(const uint8_t *p)  { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+  crc = ~crc;
+  while (length--)
+  {
+    crc ^= *data++;
+    for (int bit = 0 ; bit < 8 ; bit++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320U & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static const uint8_t *find_magic(const std::vector<uint8_t> &file, const char *magic)
+{
+  size_t    i;
+
+  for (i = 0 ; i + 8 <= file.size() ; i++)
+  {
+    if (memcmp(&file[i], magic, 8) == 0)
+    {
+      return &file[i];
+    }
+  }
+  return NULL;
+}
+
+static bool decode_dump(const uint8_t *p, const uint8_t *end)
+{
+  uint32_t    header_length, count, i;
+  int32_t     trigger;
+
+  if ((end - p) < DUMP_HEADER_MIN)
+  {
+    fprintf(stderr, "Dump header is truncated\n");
+    return false;
+  }
+  if (get16(p + 8) != 1)
+  {
+    fprintf(stderr, "Unknown dump version %u\n", get16(p + 8));
+    return false;
+  }
+  header_length = get16(p + 10);
+  count         = get32(p + 12);
+  trigger       = (int32_t)get32(p + 16);
+  cycle_ps      = get32(p + 24);
+  if ((uint64_t)(end - p) < (uint64_t)header_length + 8ULL * count + 4)
+  {
+    fprintf(stderr, "Dump is truncated, expected %u samples\n", count);
+    return false;
+  }
+  if (crc32(0, p, header_length + 8 * count) != get32(p + header_length + 8 * count))
+  {
+    fprintf(stderr, "Dump CRC does not match, the data is corrupted\n");
+    return false;
+  }
+
+  fprintf(stderr, "Logic Analyzer dump, %u samples, %s, trigger mask %08X-%08X pattern %08X-%08X%s\n", count,
+          (trigger >= 0) ? "triggered" : "not triggered",
+          get32(p + 28), get32(p + 32), get32(p + 36), get32(p + 40),
+          (get32(p + 44) & 1) ? " (la trig sequence)" : "");
+
+  for (i = 0 ; i < count ; i++)
+  {
+    Sample    s;
+
+    s.main    = get32(p + header_length + 8 * i);
+    s.aux     = get32(p + header_length + 8 * i + 4);
+    s.number  = (trigger >= 0) ? (int64_t)i - trigger : (int64_t)i - (int32_t)get32(p + 20);
+    s.trigger = ((int32_t)i == trigger);
+    samples.push_back(s);
+  }
+  first_number_for_time = samples.empty() ? 0 : samples[0].number;
+  return true;
+}
+
+//
+//  See the format description in src/EBTKS_EMC_Trace.cpp
+//
+
+static bool decode_emc_trace(const uint8_t *p, const uint8_t *end, FILE *out)
+{
+  static const char *op_names[] = { "?", "read", "write", "dec", "ptr rd", "ptr wr" };
+  uint32_t          header_length, count, recorded, i;
+  const uint8_t     *e;
+
+  if ((end - p) < EMC_TRACE_HEADER_MIN)
+  {
+    fprintf(stderr, "EMC trace header is truncated\n");
+    return false;
+  }
+  if (get16(p + 8) != 1)
+  {
+    fprintf(stderr, "Unknown EMC trace version %u\n", get16(p + 8));
+    return false;
+  }
+  header_length = get16(p + 10);
+  count         = get32(p + 12);
+  recorded      = get32(p + 16);
+  if ((uint64_t)(end - p) < (uint64_t)header_length + (uint64_t)EMC_TRACE_EVENT_LENGTH * count + 4)
+  {
+    fprintf(stderr, "EMC trace is truncated, expected %u events\n", count);
+    return false;
+  }
+  if (crc32(0, p, header_length + EMC_TRACE_EVENT_LENGTH * count) != get32(p + header_length + EMC_TRACE_EVENT_LENGTH * count))
+  {
+    fprintf(stderr, "EMC trace CRC does not match, the data is corrupted\n");
+    return false;
+  }
+
+  fprintf(stderr, "EMC trace, %u events, %u recorded, window %08o to %08o\n", count, recorded, get32(p + 20), get32(p + 24));
+  fprintf(out, "     Cycle  Delta  Op      Pointer   Data  DRP  Ndx  PTR\n");
+  for (i = 0 ; i < count ; i++)
+  {
+    e = p + header_length + EMC_TRACE_EVENT_LENGTH * i;
+    fprintf(out, "%10u  %5u  %-6s  %08o  %03o   %03o  %3u  %u\n", get32(e + 4),
+            i ? get32(e + 4) - get32(e + 4 - EMC_TRACE_EVENT_LENGTH) : 0,
+            op_names[(e[8] < sizeof(op_names) / sizeof(op_names[0])) ? e[8] : 0],
+            get32(e), e[9], e[10], e[11], (e[12] & 0x04) ? 2 : 1);
+  }
+  return true;
+}
+
+//
+//  See the format description in src/EBTKS_LA_Stream.cpp
+//
+
+static bool decode_stream(const uint8_t *p, const uint8_t *end)
+{
+  uint32_t    count, payload_length, sequence, lost = 0, i;
+  uint32_t    prev_main, prev_aux, main, aux;
+  uint8_t     prior_ctrl, ctrl, tag;
+  uint16_t    addr;
+  const uint8_t *q, *payload_end;
+  uint32_t    chunks = 0;
+
+  if ((end - p) < STREAM_HEADER_LENGTH)
+  {
+    fprintf(stderr, "Stream header is truncated\n");
+    return false;
+  }
+  if (get16(p + 8) != 1)
+  {
+    fprintf(stderr, "Unknown stream version %u\n", get16(p + 8));
+    return false;
+  }
+  p += STREAM_HEADER_LENGTH;
+
+  while ((end - p) >= CHUNK_HEADER_LENGTH)
+  {
+    if (get32(p) != CHUNK_MAGIC)
+    {
+      fprintf(stderr, "Bad chunk header at chunk %u, stopping\n", chunks);
+      break;
+    }
+    count          = get16(p + 4);
+    payload_length = get16(p + 6);
+    sequence       = get32(p + 8);
+    lost           = get32(p + 12);
+    q              = p + CHUNK_HEADER_LENGTH;
+    payload_end    = q + payload_length;
+    if (payload_end > end)
+    {
+      fprintf(stderr, "Chunk %u is truncated, stopping\n", chunks);
+      break;
+    }
+
+    prev_main = prev_aux = 0;
+    prior_ctrl = 0;
+    for (i = 0 ; i < count ; i++)
+    {
+      if (q >= payload_end) goto bad_payload;
+      tag  = *q++;
+      addr = prev_main >> 8;
+      switch (tag & 0x03)
+      {
+        case 0:   break;
+        case 1:   addr++;                             break;
+        case 2:   addr += (int8_t)*q++;               break;
+        case 3:   addr = get16(q);  q += 2;           break;
+      }
+      ctrl = prev_main >> 24;
+      switch (tag & 0x0C)
+      {
+        case 0x00:  break;
+        case 0x04:  ctrl = prior_ctrl;                break;
+        case 0x08:  ctrl = *q++;                      break;
+        default:    goto bad_payload;
+      }
+      if (ctrl != (uint8_t)(prev_main >> 24))
+      {
+        prior_ctrl = prev_main >> 24;
+      }
+      aux = prev_aux;
+      if (tag & 0x10)
+      {
+        aux = get16(q);  q += 2;
+      }
+      main = ((uint32_t)ctrl << 24) | ((uint32_t)addr << 8) | ((tag & 0x20) ? (prev_main & 0xFF) : *q++);
+      if (q > payload_end) goto bad_payload;
+
+      Sample    s;
+      s.main    = main;
+      s.aux     = aux;
+      s.number  = (int64_t)sequence + i;
+      s.trigger = false;
+      samples.push_back(s);
+
+      prev_main = main;
+      prev_aux  = aux;
+    }
+    p = payload_end;
+    chunks++;
+  }
+
+  fprintf(stderr, "Logic Analyzer stream, %u chunks, %zu samples, %u samples lost\n", chunks, samples.size(), lost);
+  first_number_for_time = 0;
+  return true;
+
+bad_payload:
+  fprintf(stderr, "Chunk %u payload does not match its header, stopping\n", chunks);
+  first_number_for_time = 0;
+  return !samples.empty();
+}
+
+//
+//  The table printed by "la go" (or by this program), copied from a terminal. Each line has the sample
+//  number, RSELEC and DRP in octal, and ends with the raw main sample in hex. Other lines are skipped
+//
+
+static bool decode_text(const std::vector<uint8_t> &file)
+{
+  std::string   line;
+  size_t        i;
+
+  for (i = 0 ; i <= file.size() ; i++)
+  {
+    if ((i < file.size()) && (file[i] != '\n'))
+    {
+      line += (char)file[i];
+      continue;
+    }
+
+    Sample      s;
+    char        time[24], address[24], data[24], cycle[24];
+    unsigned    rselec, drp;
+    long long   number;
+    const char  *last = strrchr(line.c_str(), ' ');
+    char        *end;
+
+    if (last && (sscanf(line.c_str(), "%23s %lld %23s %23s %23s %o %o", time, &number, address, data, cycle, &rselec, &drp) == 7) &&
+        (strlen(cycle) == 4) && (strlen(last + 1) >= 8))
+    {
+      s.main    = strtoul(last + 1, &end, 16);
+      s.aux     = (rselec & 0xFF) | ((drp & 0xFF) << 8);
+      s.number  = number;
+      s.trigger = (strstr(line.c_str(), "Trigger") != NULL);
+      if ((end - (last + 1)) == 8)
+      {
+        samples.push_back(s);
+      }
+    }
+    line.clear();
+  }
+  if (samples.empty())
+  {
+    return false;
+  }
+  fprintf(stderr, "Logic Analyzer table, %zu samples\n", samples.size());
+  first_number_for_time = samples[0].number;
+  return true;
+}
+
+//
+//  Same layout as Logic_Analyzer_Print_Sample() in src/EBTKS_Utilities.cpp
+//
+
+static void print_table(FILE *out)
+{
+  fprintf(out, "    Time Sample   Address     Data   Cycle RSE  DRP DMA /IR /HAL          LA Data 1\n");
+  fprintf(out, "     us                              WRLF  LEC           LX  TX\n");
+  for (const Sample &s : samples)
+  {
+    uint32_t  temp = s.main;
+
+    if ((temp & (MAIN_LMA | MAIN_RD | MAIN_WR)) == (MAIN_LMA | MAIN_RD | MAIN_WR))
+    {
+      fprintf(out, "%9.3f %5lld %06o/%04X  xxx/xx  ", (cycle_ps / 1.0e6) * s.number, (long long)s.number,
+              (temp >> 8) & 0xFFFF, (temp >> 8) & 0xFFFF);
+    }
+    else
+    {
+      fprintf(out, "%9.3f %5lld %06o/%04X  %03o/%02X  ", (cycle_ps / 1.0e6) * s.number, (long long)s.number,
+              (temp >> 8) & 0xFFFF, (temp >> 8) & 0xFFFF, temp & 0xFF, temp & 0xFF);
+    }
+    fprintf(out, "%c%c%c%c", (temp & MAIN_WR) ? '-' : 'W', (temp & MAIN_RD) ? '-' : 'R',
+                             (temp & MAIN_LMA) ? '-' : 'L', (temp & MAIN_IF) ? 'F' : '-');
+    fprintf(out, "  %03o  %03o", s.aux & 0xFF, (s.aux >> 8) & 0xFF);
+    fprintf(out, " %s %s %s", (temp & MAIN_DMA) ? " D " : "   ", (temp & MAIN_IRLX) ? "   " : " I ",
+                                 (temp & MAIN_HALTX) ? "   " : "  H");
+    fprintf(out, "%s", s.trigger ? "  Trigger" : (temp & MAIN_GAP) ? "  Gap    " : "         ");
+    fprintf(out, "  %08X\n", temp);
+  }
+}
+
+static void vcd_bits(FILE *out, uint32_t value, int width, char id)
+{
+  fputc('b', out);
+  for (int bit = width - 1 ; bit >= 0 ; bit--)
+  {
+    fputc((value >> bit) & 1 ? '1' : '0', out);
+  }
+  fprintf(out, " %c\n", id);
+}
+
+static void print_vcd(FILE *out)
+{
+  uint32_t  prev_main = 0, prev_aux = 0;
+  bool      prev_trigger = false;
+  bool      first = true;
+
+  fprintf(out, "$version EBTKS la_decode $end\n");
+  fprintf(out, "$timescale 1ps $end\n");
+  fprintf(out, "$scope module hp85 $end\n");
+  fprintf(out, "$var wire 16 a addr $end\n");
+  fprintf(out, "$var wire 8 d data $end\n");
+  fprintf(out, "$var wire 1 w WR_n $end\n");
+  fprintf(out, "$var wire 1 r RD_n $end\n");
+  fprintf(out, "$var wire 1 l LMA_n $end\n");
+  fprintf(out, "$var wire 1 f IFETCH $end\n");
+  fprintf(out, "$var wire 1 m DMA $end\n");
+  fprintf(out, "$var wire 1 i IRLX_n $end\n");
+  fprintf(out, "$var wire 1 h HALTX_n $end\n");
+  fprintf(out, "$var wire 8 s RSELEC $end\n");
+  fprintf(out, "$var wire 8 p DRP $end\n");
+  fprintf(out, "$var wire 1 t trigger $end\n");
+  fprintf(out, "$var wire 1 g gap $end\n");
+  fprintf(out, "$upscope $end\n");
+  fprintf(out, "$enddefinitions $end\n");
+
+  for (const Sample &s : samples)
+  {
+    uint32_t  changed = first ? 0xFFFFFFFF : (s.main ^ prev_main);
+    uint32_t  aux_changed = first ? 0xFFFFFFFF : (s.aux ^ prev_aux);
+
+    fprintf(out, "#%lld\n", (long long)(s.number - first_number_for_time) * cycle_ps);
+    if (changed & 0x00FFFF00) vcd_bits(out, (s.main >> 8) & 0xFFFF, 16, 'a');
+    if (changed & 0x000000FF) vcd_bits(out, s.main & 0xFF, 8, 'd');
+    if (changed & MAIN_WR)    fprintf(out, "%c%c\n", (s.main & MAIN_WR)    ? '1' : '0', 'w');
+    if (changed & MAIN_RD)    fprintf(out, "%c%c\n", (s.main & MAIN_RD)    ? '1' : '0', 'r');
+    if (changed & MAIN_LMA)   fprintf(out, "%c%c\n", (s.main & MAIN_LMA)   ? '1' : '0', 'l');
+    if (changed & MAIN_IF)    fprintf(out, "%c%c\n", (s.main & MAIN_IF)    ? '1' : '0', 'f');
+    if (changed & MAIN_DMA)   fprintf(out, "%c%c\n", (s.main & MAIN_DMA)   ? '1' : '0', 'm');
+    if (changed & MAIN_IRLX)  fprintf(out, "%c%c\n", (s.main & MAIN_IRLX)  ? '1' : '0', 'i');
+    if (changed & MAIN_HALTX) fprintf(out, "%c%c\n", (s.main & MAIN_HALTX) ? '1' : '0', 'h');
+    if (changed & MAIN_GAP)   fprintf(out, "%c%c\n", (s.main & MAIN_GAP)   ? '1' : '0', 'g');
+    if (aux_changed & 0x00FF) vcd_bits(out, s.aux & 0xFF, 8, 's');
+    if (aux_changed & 0xFF00) vcd_bits(out, (s.aux >> 8) & 0xFF, 8, 'p');
+    if (first || (s.trigger != prev_trigger)) fprintf(out, "%c%c\n", s.trigger ? '1' : '0', 't');
+
+    prev_main    = s.main;
+    prev_aux     = s.aux;
+    prev_trigger = s.trigger;
+    first        = false;
+  }
+  if (!samples.empty())
+  {
+    fprintf(out, "#%lld\n", (long long)(samples.back().number + 1 - first_number_for_time) * cycle_ps);
+  }
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: la_decode [-t | -v | -d | -p] [-s symbols] [-o output] capture_file\n");
+  fprintf(stderr, "  -t          print the samples as a table, like 'la go' (default)\n");
+  fprintf(stderr, "  -v          write a VCD file\n");
+  fprintf(stderr, "  -d          disassemble the instructions in the capture\n");
+  fprintf(stderr, "  -p          profile the instructions in the capture\n");
+  fprintf(stderr, "  -s symbols  more symbols for -d and -p, as '#define NAME (0nnnnnn)' lines. Can be repeated.\n");
+  fprintf(stderr, "              The symbols in %s are always loaded\n", EBTKS_H);
+  fprintf(stderr, "  -o output   write to output rather than stdout\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<uint8_t>  file;
+  const uint8_t         *start;
+  const char            *output_name = NULL;
+  char                  mode = 't';
+  bool                  ok;
+  FILE                  *in, *out;
+  int                   opt, c;
+
+  if (!load_symbols(EBTKS_H))
+  {
+    fprintf(stderr, "Could not read symbols from %s\n", EBTKS_H);
+  }
+  while ((opt = getopt(argc, argv, "tvdps:o:")) != -1)
+  {
+    switch (opt)
+    {
+      case 't':
+      case 'v':
+      case 'd':
+      case 'p': mode = opt;               break;
+      case 's':
+        if (!load_symbols(optarg))
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'o': output_name = optarg;     break;
+      default:  usage();
+    }
+  }
+  if (optind != argc - 1)
+  {
+    usage();
+  }
+
+  if (!(in = fopen(argv[optind], "rb")))
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  while ((c = getc(in)) != EOF)
+  {
+    file.push_back(c);
+  }
+  fclose(in);
+
+  out = stdout;
+  if (output_name && !(out = fopen(output_name, "w")))
+  {
+    perror(output_name);
+    return 1;
+  }
+  if ((start = find_magic(file, "EBTKSEMT")))
+  {
+    ok = decode_emc_trace(start, file.data() + file.size(), out);
+    if (out != stdout)
+    {
+      fclose(out);
+    }
+    return ok ? 0 : 1;
+  }
+  else if ((start = find_magic(file, "EBTKSLAD")))
+  {
+    ok = decode_dump(start, file.data() + file.size());
+  }
+  else if ((start = find_magic(file, "EBTKSLAS")))
+  {
+    ok = decode_stream(start, file.data() + file.size());
+  }
+  else if (!decode_text(file))
+  {
+    fprintf(stderr, "%s is not a Logic Analyzer dump, stream or table\n", argv[optind]);
+    return 1;
+  }
+  else
+  {
+    ok = true;
+  }
+  if (!ok)
+  {
+    return 1;
+  }
+
+  switch (mode)
+  {
+    case 'v': print_vcd(out);               break;
+    case 'd': disassemble(out, samples);    break;
+    case 'p': profile(out, samples);        break;
+    default:  print_table(out);             break;
+  }
+  if (out != stdout)
+  {
+    fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+//
+//      la_decode     Shared definitions for the Logic Analyzer decoder and the Capricorn disassembler
+//
+
+#ifndef LA_DECODE_H
+#define LA_DECODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+
+//
+//  Sample layout, from src/EBTKS_Bus_Interface_ISR.cpp
+//
+
+#define MAIN_DMA                (0x80000000U)
+#define MAIN_IF                 (0x40000000U)
+#define MAIN_IRLX               (0x20000000U)           //  Active low
+#define MAIN_HALTX              (0x10000000U)           //  Active low
+#define MAIN_GAP                (0x08000000U)           //  LA_STREAM_GAP_BIT, samples were lost before this one
+#define MAIN_WR                 (0x04000000U)           //  Active low
+#define MAIN_RD                 (0x02000000U)           //  Active low
+#define MAIN_LMA                (0x01000000U)           //  Active low
+
+struct Sample
+{
+  uint32_t  main;
+  uint32_t  aux;
+  int64_t   number;                                     //  Relative to the trigger for dumps, sequence number for streams
+  bool      trigger;
+};
+
+//
+//  capricorn.cpp
+//
+
+bool        load_symbols(const char *filename);
+const char *symbol_name(uint32_t address, char *buffer, size_t length);
+void        disassemble(FILE *out, const std::vector<Sample> &samples);
+void        profile(FILE *out, const std::vector<Sample> &samples);
+
+#endif